@@ -0,0 +1,146 @@
+#include "../flexception.h"
+#include "../image.h"
+#include "../parallel.h"
+#include "../parsers/parse_scene.h"
+#include "../render.h"
+#include "../stats.h"
+#include <embree4/rtcore.h>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Render a fixed list of the bundled scenes at a fixed number of samples per pixel, and report
+// the parse, BVH build and render times, the ray throughput, and the RMSE against stored references,
+// so that regressions in speed or convergence show up in one command.
+// The samplers only depend on the pixel sample, so the images (and the RMSEs) do not depend on the number of threads.
+// [Usage] ./lajolla_bench [-t num_threads] [-o report.json] [--spp spp] [--references dir]
+//                         [--make-references] [--reference-spp spp] [scene names...]
+// Run from the repository root. With --make-references, the scenes are rendered at --reference-spp
+// (default 256) and written to the references directory (default bench_references) instead.
+
+struct BenchScene {
+    std::string name;
+    std::string filename;
+    int spp;
+};
+
+static const std::vector<BenchScene> bench_scenes = { { "cbox", "scenes/cbox/cbox.xml", 4 },
+                                                      { "veach_mi", "scenes/veach_mi/mi.xml", 4 },
+                                                      { "matpreview", "scenes/matpreview/matpreview.xml", 4 },
+                                                      { "vol_cbox", "scenes/volpath_test/vol_cbox.xml", 4 },
+                                                      { "sponza", "scenes/sponza/sponza.xml", 4 } };
+
+static Real rmse(const Image3& a, const Image3& b) {
+    if (a.width != b.width || a.height != b.height) { Error("The reference has a different resolution"); }
+    double sum = 0;
+    for (int i = 0; i < (int)a.data.size(); i++) {
+        Vector3 d = a.data[i] - b.data[i];
+        sum += d.x * d.x + d.y * d.y + d.z * d.z;
+    }
+    return Real(sqrt(sum / (3 * double(a.data.size()))));
+}
+
+int main(int argc, char* argv[]) {
+    int num_threads           = std::thread::hardware_concurrency();
+    std::string report_file   = "bench.json";
+    std::string reference_dir = "bench_references";
+    int spp                   = 0;
+    bool make_references      = false;
+    int reference_spp         = 256;
+    std::vector<std::string> names;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-t") {
+            num_threads = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "-o") {
+            report_file = std::string(argv[++i]);
+        } else if (std::string(argv[i]) == "--spp") {
+            spp = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "--references") {
+            reference_dir = std::string(argv[++i]);
+        } else if (std::string(argv[i]) == "--make-references") {
+            make_references = true;
+        } else if (std::string(argv[i]) == "--reference-spp") {
+            reference_spp = std::stoi(std::string(argv[++i]));
+        } else {
+            names.push_back(std::string(argv[i]));
+        }
+    }
+    std::vector<BenchScene> scenes;
+    for (const BenchScene& scene : bench_scenes) {
+        if (names.empty() || std::find(names.begin(), names.end(), scene.name) != names.end()) {
+            scenes.push_back(scene);
+        }
+    }
+    if (scenes.empty()) { Error("None of the given scenes is in the benchmark"); }
+
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+    parallel_init(num_threads);
+    if (make_references) { std::filesystem::create_directories(reference_dir); }
+
+    std::ofstream os;
+    if (!make_references) {
+        os.open(report_file);
+        if (!os) { Error(std::string("Cannot write the report to ") + report_file); }
+        os << "{\n  \"threads\": " << num_parallel_threads() << ",\n  \"scenes\": [\n";
+    }
+    std::vector<std::string> summary;
+    for (int i = 0; i < (int)scenes.size(); i++) {
+        const BenchScene& bench = scenes[i];
+        std::string reference   = (std::filesystem::path(reference_dir) / (bench.name + ".exr")).string();
+        int scene_spp           = make_references ? reference_spp : (spp > 0 ? spp : bench.spp);
+
+        StatsReport begin            = collect_stats();
+        std::unique_ptr<Scene> scene = parse_scene(bench.filename, embree_device);
+        // (the sampler type of the scene file is kept, only the spp is overridden)
+        scene->options.samples_per_pixel = scene_spp;
+        Image3 img                       = render(*scene);
+        StatsReport report               = collect_stats() - begin;
+        if (make_references) {
+            imwrite(reference, img);
+            printf("Reference written to %s\n", reference.c_str());
+            continue;
+        }
+
+        double render_seconds = report.phase_seconds[int(StatPhase::Render)];
+        uint64_t num_rays =
+            report.counters[int(StatCounter::IntersectRays)] + report.counters[int(StatCounter::ShadowRays)];
+        double mrays_per_second = render_seconds > 0 ? num_rays / render_seconds / 1e6 : 0;
+        char error[32]          = "null";
+        if (std::filesystem::exists(reference)) {
+            snprintf(error, sizeof(error), "%g", rmse(img, imread3(reference)));
+        }
+
+        os << "    {\n";
+        os << "      \"scene\": \"" << bench.name << "\",\n";
+        os << "      \"spp\": " << scene_spp << ",\n";
+        os << "      \"parse_seconds\": " << report.phase_seconds[int(StatPhase::Parse)] << ",\n";
+        os << "      \"bvh_build_seconds\": " << report.phase_seconds[int(StatPhase::BvhBuild)] << ",\n";
+        os << "      \"render_seconds\": " << render_seconds << ",\n";
+        os << "      \"mrays_per_second\": " << mrays_per_second << ",\n";
+        os << "      \"rmse\": " << error << ",\n";
+        os << "      \"stats\":\n";
+        write_stats_json(os, bench.filename, report, 6);
+        os << "\n    }" << (i + 1 < (int)scenes.size() ? ",\n" : "\n");
+
+        char line[256];
+        snprintf(line, sizeof(line), "%s, %d, %.3f, %.3f, %.3f, %.3f, %s", bench.name.c_str(), scene_spp,
+                 report.phase_seconds[int(StatPhase::Parse)], report.phase_seconds[int(StatPhase::BvhBuild)],
+                 render_seconds, mrays_per_second, error);
+        summary.push_back(line);
+    }
+    if (!make_references) {
+        os << "  ]\n}\n";
+        printf("\nscene, spp, parse (s), bvh build (s), render (s), Mrays/s, rmse\n");
+        for (const std::string& line : summary) { printf("%s\n", line.c_str()); }
+        printf("Report written to %s\n", report_file.c_str());
+    }
+
+    parallel_cleanup();
+    rtcReleaseDevice(embree_device);
+    return 0;
+}
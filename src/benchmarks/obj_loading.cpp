@@ -0,0 +1,220 @@
+#include "../flexception.h"
+#include "../parallel.h"
+#include "../parsers/parse_obj.h"
+#include "../timer.h"
+#include "../transform.h"
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <string>
+#include <thread>
+
+// Compare parse_obj against the previous std::getline/std::regex/std::map parser on a generated mesh:
+// a (resolution x resolution) grid of quads with positions, uvs, and normals.
+// [Usage] ./bench_obj_loading [-t num_threads] [-n resolution] [--skip-reference]
+
+// The previous parser, kept here as the reference.
+namespace reference {
+
+static inline std::string& ltrim(std::string& s) {
+    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) { return !std::isspace(ch); }));
+    return s;
+}
+static inline std::string& rtrim(std::string& s) {
+    s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) { return !std::isspace(ch); }).base(), s.end());
+    return s;
+}
+static inline std::string& trim(std::string& s) { return ltrim(rtrim(s)); }
+
+static std::vector<int> split_face_str(const std::string& s) {
+    std::regex rgx("/");
+    std::sregex_token_iterator first{ begin(s), end(s), rgx, -1 }, last;
+    std::vector<std::string> list{ first, last };
+    std::vector<int> result;
+    for (auto& i : list) {
+        if (i != "") result.push_back(std::stoi(i));
+        else result.push_back(0);
+    }
+    while (result.size() < 3) result.push_back(0);
+    return result;
+}
+
+struct ObjVertex {
+    ObjVertex(const std::vector<int>& id) : v(id[0] - 1), vt(id[1] - 1), vn(id[2] - 1) {}
+
+    bool operator<(const ObjVertex& vertex) const {
+        if (v != vertex.v) { return v < vertex.v; }
+        if (vt != vertex.vt) { return vt < vertex.vt; }
+        if (vn != vertex.vn) { return vn < vertex.vn; }
+        return false;
+    }
+
+    int v, vt, vn;
+};
+
+size_t get_vertex_id(const ObjVertex& vertex, const std::vector<Vector3>& pos_pool, const std::vector<Vector2>& st_pool,
+                     const std::vector<Vector3>& nor_pool, const Matrix4x4& to_world, std::vector<MeshPosition>& pos,
+                     std::vector<Vector2>& st, std::vector<Vector3>& nor, std::map<ObjVertex, size_t>& vertex_map) {
+    auto it = vertex_map.find(vertex);
+    if (it != vertex_map.end()) { return it->second; }
+    size_t id = pos.size();
+    pos.push_back(xform_point(to_world, pos_pool[vertex.v]));
+    if (vertex.vt != -1) st.push_back(st_pool[vertex.vt]);
+    if (vertex.vn != -1) { nor.push_back(xform_normal(inverse(to_world), nor_pool[vertex.vn])); }
+    vertex_map[vertex] = id;
+    return id;
+}
+
+TriangleMesh parse_obj(const fs::path& filename, const Matrix4x4& to_world) {
+    std::vector<Vector3> pos_pool;
+    std::vector<Vector3> nor_pool;
+    std::vector<Vector2> st_pool;
+    std::map<ObjVertex, size_t> vertex_map;
+    TriangleMesh mesh;
+
+    std::ifstream ifs(filename.c_str(), std::ifstream::in);
+    if (!ifs.is_open()) { Error("Unable to open the obj file"); }
+    while (ifs.good()) {
+        std::string line;
+        std::getline(ifs, line);
+        line = trim(line);
+        if (line.size() == 0 || line[0] == '#') { continue; }
+
+        std::stringstream ss(line);
+        std::string token;
+        ss >> token;
+        if (token == "v") {
+            Real x, y, z, w = 1;
+            ss >> x >> y >> z >> w;
+            pos_pool.push_back(Vector3{ x, y, z } / w);
+        } else if (token == "vt") {
+            Real s, t, w;
+            ss >> s >> t >> w;
+            st_pool.push_back(Vector2{ s, 1 - t });
+        } else if (token == "vn") {
+            Real x, y, z;
+            ss >> x >> y >> z;
+            nor_pool.push_back(normalize(Vector3{ x, y, z }));
+        } else if (token == "f") {
+            std::string i0, i1, i2;
+            ss >> i0 >> i1 >> i2;
+            ObjVertex v0(split_face_str(i0)), v1(split_face_str(i1)), v2(split_face_str(i2));
+            size_t v0id = get_vertex_id(v0, pos_pool, st_pool, nor_pool, to_world, mesh.positions, mesh.uvs,
+                                        mesh.normals, vertex_map);
+            size_t v1id = get_vertex_id(v1, pos_pool, st_pool, nor_pool, to_world, mesh.positions, mesh.uvs,
+                                        mesh.normals, vertex_map);
+            size_t v2id = get_vertex_id(v2, pos_pool, st_pool, nor_pool, to_world, mesh.positions, mesh.uvs,
+                                        mesh.normals, vertex_map);
+            mesh.indices.push_back(Vector3i{ v0id, v1id, v2id });
+            std::string i3;
+            if (ss >> i3) {
+                ObjVertex v3(split_face_str(i3));
+                size_t v3id = get_vertex_id(v3, pos_pool, st_pool, nor_pool, to_world, mesh.positions, mesh.uvs,
+                                            mesh.normals, vertex_map);
+                mesh.indices.push_back(Vector3i{ v0id, v2id, v3id });
+            }
+        }
+    }
+    return mesh;
+}
+
+} // namespace reference
+
+/// Write a wavy grid with resolution^2 quads.
+void write_grid_obj(const fs::path& filename, int resolution) {
+    FILE* fp = fopen(filename.c_str(), "w");
+    if (fp == nullptr) { Error("Unable to write " + filename.string()); }
+    fprintf(fp, "# generated by bench_obj_loading\n");
+    for (int y = 0; y <= resolution; y++) {
+        for (int x = 0; x <= resolution; x++) {
+            Real u = Real(x) / resolution, v = Real(y) / resolution;
+            fprintf(fp, "v %.6f %.6f %.6f\n", u, v, Real(0.05) * sin(20 * u) * cos(20 * v));
+        }
+    }
+    for (int y = 0; y <= resolution; y++) {
+        for (int x = 0; x <= resolution; x++) {
+            fprintf(fp, "vt %.6f %.6f\n", Real(x) / resolution, Real(y) / resolution);
+        }
+    }
+    for (int y = 0; y <= resolution; y++) {
+        for (int x = 0; x <= resolution; x++) {
+            Real u = Real(x) / resolution, v = Real(y) / resolution;
+            fprintf(fp, "vn %.6f %.6f 1\n", -cos(20 * u) * cos(20 * v), sin(20 * u) * sin(20 * v));
+        }
+    }
+    for (int y = 0; y < resolution; y++) {
+        for (int x = 0; x < resolution; x++) {
+            int i0 = y * (resolution + 1) + x + 1, i1 = i0 + 1, i2 = i1 + resolution + 1, i3 = i0 + resolution + 1;
+            fprintf(fp, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", i0, i0, i0, i1, i1, i1, i2, i2, i2, i3, i3, i3);
+        }
+    }
+    fclose(fp);
+}
+
+/// Whether two meshes have the same topology and (up to the precision of the text) the same vertices.
+bool same_mesh(const TriangleMesh& a, const TriangleMesh& b) {
+    if (a.positions.size() != b.positions.size() || a.indices.size() != b.indices.size() ||
+        a.uvs.size() != b.uvs.size() || a.normals.size() != b.normals.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.indices.size(); i++) {
+        if (a.indices[i].x != b.indices[i].x || a.indices[i].y != b.indices[i].y || a.indices[i].z != b.indices[i].z) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < a.positions.size(); i++) {
+        if (distance(Vector3(a.positions[i]), Vector3(b.positions[i])) > Real(1e-4)) { return false; }
+    }
+    for (size_t i = 0; i < a.normals.size(); i++) {
+        if (distance(a.normals[i], b.normals[i]) > Real(1e-4)) { return false; }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    int num_threads     = std::max((int)std::thread::hardware_concurrency(), 1);
+    int resolution      = 1000;
+    bool skip_reference = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-t") {
+            num_threads = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "-n") {
+            resolution = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "--skip-reference") {
+            skip_reference = true;
+        }
+    }
+
+    fs::path filename = fs::temp_directory_path() / "lajolla_bench_obj_loading.obj";
+    write_grid_obj(filename, resolution);
+    Matrix4x4 to_world = translate(Vector3{ 1, 2, 3 }) * scale(Vector3{ 2, 2, 2 });
+
+    Timer timer;
+    parallel_init(1);
+    tick(timer);
+    TriangleMesh mesh = parse_obj(filename, to_world);
+    double time_1     = tick(timer);
+    parallel_cleanup();
+
+    parallel_init(num_threads);
+    tick(timer);
+    TriangleMesh mesh_n = parse_obj(filename, to_world);
+    double time_n       = tick(timer);
+    parallel_cleanup();
+
+    double reference_time = 0;
+    bool same             = same_mesh(mesh, mesh_n);
+    if (!skip_reference) {
+        tick(timer);
+        TriangleMesh reference_mesh = reference::parse_obj(filename, to_world);
+        reference_time              = tick(timer);
+        same                        = same && same_mesh(mesh, reference_mesh);
+    }
+
+    printf("triangles, file (MB), reference (s), 1 thread (s), %d threads (s), speedup, same mesh\n", num_threads);
+    printf("%d, %.1f, %.3f, %.3f, %.3f, %.1f, %s\n", (int)mesh.indices.size(), fs::file_size(filename) / 1e6,
+           reference_time, time_1, time_n, reference_time / time_n, same ? "yes" : "NO");
+    fs::remove(filename);
+    return same ? 0 : 1;
+}
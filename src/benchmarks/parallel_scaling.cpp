@@ -0,0 +1,44 @@
+#include "../parallel.h"
+#include "../parsers/parse_scene.h"
+#include "../render.h"
+#include "../timer.h"
+#include <embree4/rtcore.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Measure how rendering scales with the number of threads.
+// [Usage] ./bench_parallel_scaling [-n max_threads] [scene.xml]
+// The scene defaults to scenes/sponza/sponza.xml (run from the repository root).
+int main(int argc, char* argv[]) {
+    int max_threads      = std::max((int)std::thread::hardware_concurrency(), 1);
+    std::string filename  = "scenes/sponza/sponza.xml";
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-n") {
+            max_threads = std::stoi(std::string(argv[++i]));
+        } else {
+            filename = std::string(argv[i]);
+        }
+    }
+
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+    double base_time        = 0;
+    printf("threads, parse (s), render (s), speedup\n");
+    for (int num_threads = 1; num_threads <= max_threads; num_threads++) {
+        parallel_init(num_threads);
+        Timer timer;
+        tick(timer);
+        std::unique_ptr<Scene> scene = parse_scene(filename, embree_device);
+        double parse_time            = tick(timer);
+        Image3 img                   = render(*scene);
+        double render_time           = tick(timer);
+        parallel_cleanup();
+
+        if (num_threads == 1) { base_time = render_time; }
+        printf("%d, %.3f, %.3f, %.2f\n", num_threads, parse_time, render_time, base_time / render_time);
+        fflush(stdout);
+    }
+    rtcReleaseDevice(embree_device);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "../parallel.h"
+#include "../parsers/parse_scene.h"
+#include "../render.h"
+#include "../timer.h"
+#include <embree4/rtcore.h>
+#include <sys/resource.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Measure the throughput and memory of the current Real type.
+// Build once as usual and once with -DLAJOLLA_SINGLE_PRECISION=ON, then compare the two outputs.
+// [Usage] ./bench_precision [-t num_threads] [--spp spp] [scene1.xml scene2.xml ...]
+// The scenes default to the Cornell box and the volumetric Cornell box (run from the repository root).
+
+template <typename T>
+size_t vector_bytes(const std::vector<T>& v) {
+    return v.size() * sizeof(T);
+}
+
+/// Bytes taken by the mesh vertex data of the scene.
+size_t geometry_bytes(const Scene& scene) {
+    size_t bytes = 0;
+    for (const Shape& shape : scene.shapes) {
+        if (auto* mesh = std::get_if<TriangleMesh>(&shape)) {
+            bytes += vector_bytes(mesh->positions) + vector_bytes(mesh->indices) + vector_bytes(mesh->normals) +
+                     vector_bytes(mesh->uvs);
+        }
+    }
+    return bytes;
+}
+
+/// Bytes taken by all mipmap levels of all textures.
+size_t texture_bytes(const Scene& scene) {
+    size_t bytes = 0;
+    for (const Mipmap1& mipmap : scene.texture_pool.image1s) {
+        for (const TexelImage& img : mipmap.images) { bytes += vector_bytes(img.data); }
+    }
+    for (const Mipmap3& mipmap : scene.texture_pool.image3s) {
+        for (const TexelImage& img : mipmap.images) { bytes += vector_bytes(img.data); }
+    }
+    return bytes;
+}
+
+/// Bytes taken by the voxel grids of the heterogeneous media.
+size_t volume_bytes(const Scene& scene) {
+    size_t bytes    = 0;
+    auto grid_bytes = [](const VolumeSpectrum& v) {
+        auto* grid = std::get_if<GridVolume<Spectrum>>(&v);
+        return grid == nullptr ? size_t(0) : vector_bytes(grid->data);
+    };
+    for (const Medium& medium : scene.media) {
+        if (auto* m = std::get_if<HeterogeneousMedium>(&medium)) {
+            bytes += grid_bytes(m->albedo) + grid_bytes(m->density);
+        }
+    }
+    return bytes;
+}
+
+/// Peak resident set size of the process in MB.
+double peak_rss_mb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // kilobytes on Linux
+}
+
+int main(int argc, char* argv[]) {
+    int num_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+    int spp         = 4;
+    std::vector<std::string> filenames;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-t") {
+            num_threads = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "--spp") {
+            spp = std::stoi(std::string(argv[++i]));
+        } else {
+            filenames.push_back(std::string(argv[i]));
+        }
+    }
+    if (filenames.empty()) { filenames = { "scenes/cbox/cbox.xml", "scenes/volpath_test/vol_cbox.xml" }; }
+
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+    parallel_init(num_threads);
+    printf("# Real = %s (%d bytes), sizeof(Vector3) = %d, sizeof(Spectrum) = %d\n",
+           sizeof(Real) == sizeof(float) ? "float" : "double", int(sizeof(Real)), int(sizeof(Vector3)),
+           int(sizeof(Spectrum)));
+    printf("scene, parse (s), render (s), Msamples/s, geometry (MB), textures (MB), volumes (MB), peak RSS (MB)\n");
+    for (const std::string& filename : filenames) {
+        Timer timer;
+        tick(timer);
+        std::unique_ptr<Scene> scene     = parse_scene(filename, embree_device);
+        double parse_time                = tick(timer);
+        scene->options.samples_per_pixel = spp;
+        Image3 img                       = render(*scene);
+        double render_time               = tick(timer);
+        double num_samples               = double(img.width) * double(img.height) * double(spp);
+        printf("%s, %.3f, %.3f, %.3f, %.2f, %.2f, %.2f, %.1f\n", filename.c_str(), parse_time, render_time,
+               num_samples / render_time / 1e6, geometry_bytes(*scene) / 1e6, texture_bytes(*scene) / 1e6,
+               volume_bytes(*scene) / 1e6, peak_rss_mb());
+        fflush(stdout);
+    }
+    parallel_cleanup();
+    rtcReleaseDevice(embree_device);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "../pcg.h"
+#include "../spectrum.h"
+#include "../timer.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// The spectrum functions on plain Vector3s, as they were before Spectrum got its own SIMD type.
+Vector3 spectrum_sqrt(const Vector3& s) {
+    return Vector3{ sqrt(max(s[0], Real(0))), sqrt(max(s[1], Real(0))), sqrt(max(s[2], Real(0))) };
+}
+Vector3 spectrum_exp(const Vector3& s) { return Vector3{ exp(s[0]), exp(s[1]), exp(s[2]) }; }
+Real spectrum_luminance(const Vector3& s) {
+    return s.x * Real(0.212671) + s.y * Real(0.715160) + s.z * Real(0.072169);
+}
+
+Spectrum spectrum_sqrt(const Spectrum& s) { return sqrt(s); }
+Spectrum spectrum_exp(const Spectrum& s) { return exp(s); }
+Real spectrum_luminance(const Spectrum& s) { return luminance(s); }
+
+template <typename S>
+struct Data {
+    std::vector<S> throughputs, bsdf_values, emissions, sigma_ts, radiances;
+    std::vector<S> initial_throughputs, initial_bsdf_values;
+    std::vector<Real> weights, distances;
+};
+
+template <typename S>
+Data<S> make_data(int n) {
+    pcg32_state rng = init_pcg32();
+    auto next_s     = [&]() {
+        Real r = next_pcg32_real<Real>(rng), g = next_pcg32_real<Real>(rng), b = next_pcg32_real<Real>(rng);
+        return S{ r, g, b };
+    };
+    Data<S> data;
+    for (int i = 0; i < n; i++) {
+        data.throughputs.push_back(next_s());
+        data.bsdf_values.push_back(next_s());
+        data.emissions.push_back(next_s());
+        data.sigma_ts.push_back(next_s());
+        data.radiances.push_back(S{ 0, 0, 0 });
+        data.weights.push_back(next_pcg32_real<Real>(rng) + Real(0.5));
+        data.distances.push_back(next_pcg32_real<Real>(rng));
+    }
+    data.initial_throughputs = data.throughputs;
+    data.initial_bsdf_values = data.bsdf_values;
+    return data;
+}
+
+// The color math of one path tracing bounce, each kernel run over all the entries.
+// Returns the time of each kernel in nanoseconds per entry.
+template <typename S>
+std::vector<double> run_kernels(Data<S>& data, int num_rounds, Real& checksum) {
+    int n = (int)data.throughputs.size();
+    std::vector<double> times(5, 0);
+    Timer timer;
+    for (int round = 0; round < num_rounds; round++) {
+        tick(timer);
+        // current_path_throughput *= (f * cos) / pdf
+        for (int i = 0; i < n; i++) {
+            data.throughputs[i] = data.throughputs[i] * data.bsdf_values[i] * data.weights[i];
+        }
+        times[0] += tick(timer);
+        // radiance += current_path_throughput * Le
+        for (int i = 0; i < n; i++) { data.radiances[i] += data.throughputs[i] * data.emissions[i]; }
+        times[1] += tick(timer);
+        // transmittance = exp(-sigma_t * t)
+        for (int i = 0; i < n; i++) {
+            data.throughputs[i] = data.throughputs[i] * spectrum_exp(-data.sigma_ts[i] * data.distances[i]);
+        }
+        times[2] += tick(timer);
+        // the sqrt of the base color in the Disney BSDFs
+        for (int i = 0; i < n; i++) { data.bsdf_values[i] = spectrum_sqrt(data.bsdf_values[i]) + Real(0.25); }
+        times[3] += tick(timer);
+        // Russian roulette
+        for (int i = 0; i < n; i++) { checksum += spectrum_luminance(data.throughputs[i]); }
+        times[4] += tick(timer);
+        // Start the next round from the same values
+        data.throughputs = data.initial_throughputs;
+        data.bsdf_values = data.initial_bsdf_values;
+        tick(timer);
+    }
+    for (double& t : times) { t = t / (double(n) * num_rounds) * 1e9; }
+    return times;
+}
+
+// Compare the spectrum kernels of the path tracers on Vector3 (scalar code)
+// and on the SIMD Spectrum type.
+// [Usage] ./bench_spectrum [-n num_entries] [-r num_rounds]
+int main(int argc, char* argv[]) {
+    int num_entries = 1 << 16;
+    int num_rounds  = 200;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-n") {
+            num_entries = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "-r") {
+            num_rounds = std::stoi(std::string(argv[++i]));
+        }
+    }
+
+    printf("# Real = %s, sizeof(Vector3) = %d, sizeof(Spectrum) = %d, %d chunk(s) of %d bytes\n",
+           sizeof(Real) == sizeof(float) ? "float" : "double", int(sizeof(Vector3)), int(sizeof(Spectrum)),
+           c_spectrum_chunks, c_spectrum_chunk_bytes);
+    Data<Vector3> vector3_data   = make_data<Vector3>(num_entries);
+    Data<Spectrum> spectrum_data = make_data<Spectrum>(num_entries);
+    Real vector3_checksum = 0, spectrum_checksum = 0;
+    std::vector<double> vector3_times  = run_kernels(vector3_data, num_rounds, vector3_checksum);
+    std::vector<double> spectrum_times = run_kernels(spectrum_data, num_rounds, spectrum_checksum);
+
+    const char* names[] = { "throughput", "multiply-add", "transmittance", "sqrt", "luminance" };
+    printf("kernel, Vector3 (ns/entry), Spectrum (ns/entry), speedup\n");
+    for (int k = 0; k < 5; k++) {
+        printf("%s, %.3f, %.3f, %.2f\n", names[k], vector3_times[k], spectrum_times[k],
+               vector3_times[k] / spectrum_times[k]);
+    }
+    // Both compute the same values
+    fprintf(stderr, "# checksums %g %g\n", double(vector3_checksum), double(spectrum_checksum));
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include "../pcg.h"
+#include "../table_dist.h"
+#include "../timer.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Compare the alias method (sample) against the CDF binary search (sample_cdf)
+// on tables of 10^2 to 10^max_exponent entries with random weights.
+// [Usage] ./bench_table_dist [-n num_samples] [-e max_exponent]
+int main(int argc, char* argv[]) {
+    int num_samples  = 10000000;
+    int max_exponent = 7;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-n") {
+            num_samples = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "-e") {
+            max_exponent = std::stoi(std::string(argv[++i]));
+        }
+    }
+
+    printf("entries, build (ms), alias (ns/sample), cdf (ns/sample), speedup\n");
+    int size = 100;
+    for (int e = 2; e <= max_exponent; e++, size *= 10) {
+        pcg32_state rng = init_pcg32(e);
+        std::vector<Real> f(size);
+        for (Real& w : f) { w = next_pcg32_real<Real>(rng); }
+
+        Timer timer;
+        tick(timer);
+        TableDist1D table = make_table_dist_1d(f);
+        double build_time = tick(timer);
+
+        // Both use the same random numbers. The sum of the sampled ids keeps the loops from being optimized away.
+        std::vector<Real> us(num_samples);
+        for (Real& u : us) { u = next_pcg32_real<Real>(rng); }
+        int64_t alias_sum = 0, cdf_sum = 0;
+        tick(timer);
+        for (Real u : us) { alias_sum += sample(table, u); }
+        double alias_time = tick(timer);
+        for (Real u : us) { cdf_sum += sample_cdf(table, u); }
+        double cdf_time = tick(timer);
+
+        printf("%d, %.3f, %.2f, %.2f, %.2f\n", size, build_time * 1e3, alias_time / num_samples * 1e9,
+               cdf_time / num_samples * 1e9, cdf_time / alias_time);
+        // Print the sums where they do not get in the way of the table
+        fprintf(stderr, "# checksums %lld %lld\n", (long long)alias_sum, (long long)cdf_sum);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "../parallel.h"
+#include "../parsers/parse_scene.h"
+#include "../render.h"
+#include "../stats.h"
+#include "../timer.h"
+#include <embree4/rtcore.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Render a scene with every tile order and a few tile sizes, and compare the throughput
+// (rays per second) and the cache misses, from the statistics of the renderer (stats.h).
+// [Usage] ./bench_tile_order [-t num_threads] [--spp spp] [-r num_rounds] [scene.xml]
+// The scene defaults to scenes/sponza/sponza.xml (run from the repository root).
+int main(int argc, char* argv[]) {
+    int num_threads      = std::max((int)std::thread::hardware_concurrency(), 1);
+    int spp              = 4;
+    int num_rounds       = 1;
+    std::string filename = "scenes/sponza/sponza.xml";
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-t") {
+            num_threads = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "--spp") {
+            spp = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "-r") {
+            num_rounds = std::stoi(std::string(argv[++i]));
+        } else {
+            filename = std::string(argv[i]);
+        }
+    }
+
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+    // The counters are opened before the worker threads are created, so that they follow the threads.
+    if (!open_hardware_counters()) {
+        fprintf(stderr, "# perf events are not available, the hardware counters are 0\n");
+    }
+    parallel_init(num_threads);
+    std::unique_ptr<Scene> scene     = parse_scene(filename, embree_device);
+    scene->options.samples_per_pixel = spp;
+
+    const TileOrder orders[]  = { TileOrder::Scanline, TileOrder::Morton, TileOrder::Hilbert, TileOrder::Spiral };
+    const char* order_names[] = { "scanline", "morton", "hilbert", "spiral" };
+    const int tile_sizes[]    = { 8, 16, 32, 64 };
+    printf("order, tile size, render (s), Mrays/s, cache misses (M), cache miss rate, instructions (G)\n");
+    for (int o = 0; o < 4; o++) {
+        for (int tile_size : tile_sizes) {
+            scene->options.tile_order = orders[o];
+            scene->options.tile_size  = tile_size;
+
+            double render_time      = 0;
+            StatsReport stats_begin = collect_stats();
+            for (int round = 0; round < num_rounds; round++) {
+                Timer timer;
+                tick(timer);
+                render(*scene);
+                render_time += tick(timer);
+            }
+            StatsReport report  = collect_stats() - stats_begin;
+            auto hardware       = [&](StatHardwareCounter c) { return double(report.hardware_counters[int(c)]); };
+            double num_rays     = double(report.counters[int(StatCounter::IntersectRays)] +
+                                         report.counters[int(StatCounter::ShadowRays)]);
+            double misses       = hardware(StatHardwareCounter::CacheMisses);
+            double references   = hardware(StatHardwareCounter::CacheReferences);
+            double instructions = hardware(StatHardwareCounter::Instructions);
+            printf("%s, %d, %.3f, %.3f, %.3f, %.4f, %.3f\n", order_names[o], tile_size, render_time / num_rounds,
+                   num_rays / render_time / 1e6, misses / num_rounds / 1e6, references > 0 ? misses / references : 0,
+                   instructions / num_rounds / 1e9);
+            fflush(stdout);
+        }
+    }
+    scene.reset();
+    parallel_cleanup();
+    rtcReleaseDevice(embree_device);
+    return 0;
+}
@@ -1,12 +1,13 @@
 #include "camera.h"
 #include "lajolla.h"
+#include "stats.h"
 #include "transform.h"
 
 #include <cmath>
 
 Camera::Camera(const Matrix4x4& cam_to_world, Real fov, int width, int height, const Filter& filter, int medium_id)
-    : cam_to_world(cam_to_world), world_to_cam(inverse(cam_to_world)), width(width), height(height), filter(filter),
-      medium_id(medium_id) {
+    : cam_to_world(cam_to_world), world_to_cam(inverse(cam_to_world)), fov(fov), width(width), height(height),
+      filter(filter), medium_id(medium_id) {
     Real aspect   = (Real)width / (Real)height;
     cam_to_sample = scale(Vector3(-Real(0.5), -Real(0.5) * aspect, Real(1.0))) *
                     translate(Vector3(-Real(1.0), -Real(1.0) / aspect, Real(0.0))) * perspective(fov);
@@ -14,6 +15,7 @@ Camera::Camera(const Matrix4x4& cam_to_world, Real fov, int width, int height, c
 }
 
 Ray sample_primary(const Camera& camera, const Vector2& screen_pos) {
+    add_stat(StatCounter::PrimaryRays);
     // screen_pos' domain is [0, 1]^2
     Vector2 pixel_pos{ screen_pos.x * camera.width, screen_pos.y * camera.height };
 
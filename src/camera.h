@@ -15,6 +15,7 @@ struct Camera {
 
     Matrix4x4 sample_to_cam, cam_to_sample;
     Matrix4x4 cam_to_world, world_to_cam;
+    Real fov; // horizontal, in degree
     int width, height;
     Filter filter;
 
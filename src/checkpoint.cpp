@@ -0,0 +1,156 @@
+#include "checkpoint.h"
+#include "flexception.h"
+#include "scene.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+/// Bump whenever the layout below (or Film) changes.
+constexpr uint32_t c_checkpoint_version = 3;
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t real_size;
+    int32_t width, height;
+    int32_t integrator, vol_path_version;
+    int32_t sampler;
+    uint64_t sampler_seed;
+    int32_t shard_index, num_shards;
+    int32_t samples_per_pixel;
+    double elapsed;
+};
+
+static CheckpointHeader make_header(const Scene& scene) {
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "LJCKPT\0\0", 8);
+    header.version           = c_checkpoint_version;
+    header.real_size         = sizeof(Real);
+    header.width             = scene.camera.width;
+    header.height            = scene.camera.height;
+    header.integrator        = int32_t(scene.options.integrator);
+    header.vol_path_version  = scene.options.vol_path_version;
+    header.sampler           = int32_t(scene.options.sampler);
+    header.sampler_seed      = scene.options.sampler_seed;
+    header.shard_index       = scene.options.shard_index;
+    header.num_shards        = scene.options.num_shards;
+    header.samples_per_pixel = scene.options.samples_per_pixel;
+    return header;
+}
+
+template <typename T>
+static void write_array(std::ofstream& ofs, const std::vector<T>& v) {
+    ofs.write((const char*)v.data(), v.size() * sizeof(T));
+}
+
+template <typename T>
+static void read_array(std::ifstream& ifs, std::vector<T>& v) {
+    ifs.read((char*)v.data(), v.size() * sizeof(T));
+}
+
+/// Whether two checkpoints are from the same render (up to the shard, and up to the samples per pixel
+/// without sharding). The shards split the samples per pixel into their ranges, so they need the same count.
+static bool same_render(const CheckpointHeader& a, const CheckpointHeader& b) {
+    return a.width == b.width && a.height == b.height && a.integrator == b.integrator &&
+           a.vol_path_version == b.vol_path_version && a.sampler == b.sampler && a.sampler_seed == b.sampler_seed &&
+           a.num_shards == b.num_shards && (a.num_shards <= 1 || a.samples_per_pixel == b.samples_per_pixel);
+}
+
+/// Read the header and the film of a checkpoint file.
+static void read_checkpoint_file(const fs::path& filename, CheckpointHeader& header, Film& film) {
+    std::ifstream ifs(filename, std::ios::binary);
+    ifs.read((char*)&header, sizeof(header));
+    if (!ifs || memcmp(header.magic, "LJCKPT", 6) != 0 || header.version != c_checkpoint_version ||
+        header.real_size != sizeof(Real) || header.width <= 0 || header.height <= 0) {
+        Error(std::string("Not a checkpoint of this version of lajolla: ") + filename.string());
+    }
+    film = Film(header.width, header.height);
+    read_array(ifs, film.radiance.data);
+    read_array(ifs, film.luminance_sq.data);
+    read_array(ifs, film.counts.data);
+    if (!ifs) { Error(std::string("Truncated checkpoint: ") + filename.string()); }
+}
+
+fs::path checkpoint_filename(const Scene& scene) {
+    std::string filename = scene.output_filename;
+    if (scene.options.num_shards > 1) {
+        filename += ".shard-" + std::to_string(scene.options.shard_index) + "-of-" +
+                    std::to_string(scene.options.num_shards);
+    }
+    return fs::path(filename + ".checkpoint");
+}
+
+void write_checkpoint(const fs::path& filename, const Scene& scene, const Film& film, Real elapsed) {
+    CheckpointHeader header = make_header(scene);
+    header.elapsed          = elapsed;
+
+    fs::path tmp_filename = filename;
+    tmp_filename += ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream ofs(tmp_filename, std::ios::binary);
+        ofs.write((const char*)&header, sizeof(header));
+        write_array(ofs, film.radiance.data);
+        write_array(ofs, film.luminance_sq.data);
+        write_array(ofs, film.counts.data);
+        if (!ofs) {
+            ofs.close();
+            std::error_code ec;
+            fs::remove(tmp_filename, ec);
+            Error(std::string("Failed to write the checkpoint ") + tmp_filename.string());
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp_filename, filename, ec);
+    if (ec) { Error(std::string("Failed to write the checkpoint ") + filename.string()); }
+}
+
+bool read_checkpoint(const fs::path& filename, const Scene& scene, RenderCheckpoint& checkpoint) {
+    std::error_code ec;
+    if (!fs::exists(filename, ec)) { return false; }
+    CheckpointHeader header;
+    read_checkpoint_file(filename, header, checkpoint.film);
+    CheckpointHeader expected = make_header(scene);
+    if (!same_render(header, expected) || header.shard_index != expected.shard_index) {
+        Error(std::string("The checkpoint ") + filename.string() +
+              " is from a render with another image size, integrator, sampler, or shard (or samples per pixel).");
+    }
+    checkpoint.elapsed = Real(header.elapsed);
+    return true;
+}
+
+Film merge_checkpoints(const std::vector<fs::path>& filenames) {
+    if (filenames.empty()) { Error("No checkpoint to merge."); }
+    CheckpointHeader first{};
+    Film merged;
+    std::vector<bool> has_shard;
+    for (const fs::path& filename : filenames) {
+        CheckpointHeader header;
+        Film film;
+        read_checkpoint_file(filename, header, film);
+        if (has_shard.empty()) {
+            first  = header;
+            merged = Film(header.width, header.height);
+            has_shard.resize(max(header.num_shards, 1), false);
+        } else if (!same_render(header, first)) {
+            Error(std::string("The checkpoint ") + filename.string() + " is from another render than " +
+                  filenames[0].string());
+        }
+        if (header.shard_index < 0 || header.shard_index >= (int)has_shard.size() || has_shard[header.shard_index]) {
+            Error(std::string("Duplicate or invalid shard in ") + filename.string());
+        }
+        has_shard[header.shard_index] = true;
+        for (int i = 0; i < (int)merged.counts.data.size(); i++) {
+            merged.radiance(i) += film.radiance(i);
+            merged.luminance_sq(i) += film.luminance_sq(i);
+            merged.counts(i) += film.counts(i);
+        }
+    }
+    for (int i = 0; i < (int)has_shard.size(); i++) {
+        if (!has_shard[i]) {
+            std::cerr << "Warning: shard " << i << " of " << has_shard.size() << " is missing." << std::endl;
+        }
+    }
+    return merged;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "film.h"
+#include "lajolla.h"
+
+struct Scene;
+
+/// Checkpoints of a progressive render (see progressive_render in render.cpp), so that a render that gets
+/// killed, e.g., on a preemptible machine, can continue where it stopped with --resume.
+///
+/// A checkpoint holds the accumulation buffers of the film (the radiance and squared luminance sums,
+/// and the sample count of each pixel) and the rendering time so far. That is the whole state of the render:
+/// the samplers derive their random numbers from the pixel, the sample index, and the seed alone
+/// (see sampler.h), and the next sample index of a pixel is its count. So a resumed render takes exactly
+/// the samples the interrupted one would have taken, and adds them up in the same order.
+/// The checkpoint also records the image size, the integrator, the sampler, and the seed,
+/// and refuses to resume a render with different ones. (The samples per pixel can change, except for a shard.)
+/// The file is written to a temporary file first and renamed, so that a kill never leaves a partial checkpoint.
+///
+/// A shard of a render (see RenderOptions::num_shards) writes its film to its checkpoint file at the end.
+/// The shards take disjoint ranges of samples, so the sums and counts of their films simply add up
+/// to the film of the whole render (merge_checkpoints).
+struct RenderCheckpoint {
+    Film film;
+    Real elapsed = 0; // seconds of rendering so far
+};
+
+/// The checkpoint file of the render of a scene: the output file name with ".checkpoint" appended,
+/// or ".shard-<i>-of-<N>.checkpoint" for the shard i of N.
+fs::path checkpoint_filename(const Scene& scene);
+
+/// Write the checkpoint of the render of scene. Throws an exception (Error) if the file cannot be written.
+void write_checkpoint(const fs::path& filename, const Scene& scene, const Film& film, Real elapsed);
+
+/// Read the checkpoint of the render of scene. Returns false if there is no such file;
+/// throws an exception (Error) if the file is not a checkpoint of this render.
+bool read_checkpoint(const fs::path& filename, const Scene& scene, RenderCheckpoint& checkpoint);
+
+/// Add up the films of the checkpoints of the shards of a render. Throws an exception (Error) if the checkpoints
+/// are not from the same render, or if a shard appears twice; a missing shard only gives a warning
+/// (the image then has fewer samples per pixel).
+Film merge_checkpoints(const std::vector<fs::path>& filenames);
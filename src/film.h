@@ -0,0 +1,64 @@
+#pragma once
+
+#include "image.h"
+#include "lajolla.h"
+#include "spectrum.h"
+
+/// Accumulation buffers for progressive rendering:
+/// the sum of the radiance samples and the number of samples taken at each pixel.
+/// We also keep the sum of the squared luminance of the samples, so that we can
+/// estimate the variance of each pixel for adaptive sampling.
+/// (Plain sums, unlike Welford's update, can be merged by adding them up.)
+struct Film {
+    Film() {}
+    Film(int w, int h) : radiance(w, h), luminance_sq(w, h), counts(w, h) {}
+
+    Image3 radiance;
+    Image1 luminance_sq;
+    Image<int> counts;
+};
+
+/// Add one sample to the pixel (x, y).
+inline void add_sample(Film& film, int x, int y, const Spectrum& L) {
+    Real lum = luminance(L);
+    film.radiance(x, y) += toRGB(L);
+    film.luminance_sq(x, y) += lum * lum;
+    film.counts(x, y) += 1;
+}
+
+/// Running mean of the luminance of the pixel (x, y).
+inline Real pixel_mean(const Film& film, int x, int y) {
+    int n = film.counts(x, y);
+    return n > 0 ? luminance(film.radiance(x, y)) / n : Real(0);
+}
+
+/// Unbiased sample variance of the luminance of the pixel (x, y).
+inline Real pixel_variance(const Film& film, int x, int y) {
+    int n = film.counts(x, y);
+    if (n < 2) { return infinity<Real>(); }
+    Real mean = pixel_mean(film, x, y);
+    return max(film.luminance_sq(x, y) / n - mean * mean, Real(0)) * n / (n - 1);
+}
+
+/// Relative standard error of the pixel (x, y), i.e., the standard deviation of the
+/// mean estimate over the mean. Dark pixels are measured against a small floor instead,
+/// so that we do not waste samples on tiny absolute errors.
+/// A pixel whose samples are all zero has no variance, but may just not have found its light yet
+/// (caustics, paths through media). Until it has a quarter of max_samples, we count it as if one of its
+/// n samples were n times the floor, i.e., a mean at the floor and an error of 1.
+inline Real pixel_error(const Film& film, int x, int y, int max_samples) {
+    int n = film.counts(x, y);
+    if (n < 2) { return infinity<Real>(); }
+    if (film.luminance_sq(x, y) == 0 && n < max_samples / 4) { return Real(1); }
+    return sqrt(pixel_variance(film, x, y) / n) / max(pixel_mean(film, x, y), Real(1e-2));
+}
+
+/// The current estimate of the image: the mean of the samples of each pixel
+/// (black where there is no sample yet).
+inline Image3 resolve(const Film& film) {
+    Image3 img(film.radiance.width, film.radiance.height);
+    for (int i = 0; i < (int)img.data.size(); i++) {
+        if (film.counts(i) > 0) { img(i) = film.radiance(i) / Real(film.counts(i)); }
+    }
+    return img;
+}
@@ -2,8 +2,77 @@
 #include "material.h"
 #include "ray.h"
 #include "scene.h"
+#include "stats.h"
+#include "transform.h"
 #include <embree4/rtcore.h>
 
+/// The shapes of a group compute their shading information in the local space of the group.
+/// Bring it to the world space of the instance.
+static ShadingInfo xform_shading_info(const ShapeInstance& instance, const Shape& shape, const ShadingInfo& info) {
+    Vector3 n = xform_normal(instance.to_local, info.shading_frame.n);
+    Vector3 x = xform_vector(instance.to_world, info.shading_frame.x);
+    // The tangent is stretched by the transformation, and is no longer orthogonal to n if it shears.
+    Real stretch = length(x);
+    x            = normalize(x - n * dot(n, x));
+
+    ShadingInfo world_info   = info;
+    world_info.shading_frame = Frame(x, normalize(cross(n, x)), n);
+    // Exact for uniform scalings, a reasonable approximation for the others.
+    world_info.inv_uv_size = info.inv_uv_size * stretch;
+    // The curvature of a triangle mesh is per unit of uv (see compute_shading_info), which the transformation
+    // does not change, but the one of a sphere is per unit of length.
+    if (std::holds_alternative<Sphere>(shape)) { world_info.mean_curvature = info.mean_curvature / stretch; }
+    return world_info;
+}
+
+/// Fill in a PathVertex from the hit information Embree gives us.
+/// If we hit a shape through an instance, instID is the geomID of the instance, and Ng is in its local space.
+PathVertex make_path_vertex(const Scene& scene, const Ray& ray, const RayDifferential& ray_diff, float tfar,
+                            const Vector3& Ng, const Vector2& st, unsigned int primID, unsigned int geomID,
+                            unsigned int instID) {
+    assert(geomID < scene.shapes.size());
+
+    PathVertex vertex;
+    vertex.position =
+        Vector3{ ray.org.x, ray.org.y, ray.org.z } + Vector3{ ray.dir.x, ray.dir.y, ray.dir.z } * Real(tfar);
+    vertex.geometric_normal   = normalize(Ng);
+    vertex.shape_id           = geomID;
+    vertex.primitive_id       = primID;
+    const Shape& shape        = scene.shapes[vertex.shape_id];
+    vertex.material_id        = get_material_id(shape);
+    vertex.interior_medium_id = get_interior_medium_id(shape);
+    vertex.exterior_medium_id = get_exterior_medium_id(shape);
+    vertex.st                 = st;
+
+    ShadingInfo shading_info;
+    if (instID == RTC_INVALID_GEOMETRY_ID) {
+        shading_info = compute_shading_info(shape, vertex);
+    } else {
+        assert(instID >= scene.shapes.size() && instID - scene.shapes.size() < scene.instances.size());
+        vertex.instance_id            = instID - scene.shapes.size();
+        const ShapeInstance& instance = scene.instances[vertex.instance_id];
+        // The shape only knows its local space
+        PathVertex local_vertex = vertex;
+        local_vertex.position   = xform_point(instance.to_local, vertex.position);
+        shading_info            = xform_shading_info(instance, shape, compute_shading_info(shape, local_vertex));
+        vertex.geometric_normal = xform_normal(instance.to_local, vertex.geometric_normal);
+    }
+    vertex.shading_frame     = shading_info.shading_frame;
+    vertex.uv                = shading_info.uv;
+    vertex.mean_curvature    = shading_info.mean_curvature;
+    vertex.ray_radius        = transfer(ray_diff, distance(ray.org, vertex.position));
+    // vertex.ray_radius stores approximatedly dp/dx,
+    // we get uv_screen_size (du/dx) using (dp/dx)/(dp/du)
+    vertex.uv_screen_size = vertex.ray_radius / shading_info.inv_uv_size;
+
+    // Flip the geometry normal to the same direction as the shading normal
+    if (dot(vertex.geometric_normal, vertex.shading_frame.n) < 0) {
+        vertex.geometric_normal = -vertex.geometric_normal;
+    }
+
+    return vertex;
+}
+
 std::optional<PathVertex> intersect(const Scene& scene, const Ray& ray, const RayDifferential& ray_diff) {
     RTCIntersectArguments rtc_args;
     rtcInitIntersectArguments(&rtc_args);
@@ -35,36 +104,79 @@ std::optional<PathVertex> intersect(const Scene& scene, const Ray& ray, const Ra
         { RTC_INVALID_GEOMETRY_ID } // instance IDs
     };
     rtcIntersect1(scene.embree_scene, &rtc_rayhit, &rtc_args);
+    add_stat(StatCounter::IntersectRays);
     if (rtc_hit.geomID == RTC_INVALID_GEOMETRY_ID) { return {}; };
-    assert(rtc_hit.geomID < scene.shapes.size());
-
-    PathVertex vertex;
-    vertex.position =
-        Vector3{ ray.org.x, ray.org.y, ray.org.z } + Vector3{ ray.dir.x, ray.dir.y, ray.dir.z } * Real(rtc_ray.tfar);
-    vertex.geometric_normal   = normalize(Vector3{ rtc_hit.Ng_x, rtc_hit.Ng_y, rtc_hit.Ng_z });
-    vertex.shape_id           = rtc_hit.geomID;
-    vertex.primitive_id       = rtc_hit.primID;
-    const Shape& shape        = scene.shapes[vertex.shape_id];
-    vertex.material_id        = get_material_id(shape);
-    vertex.interior_medium_id = get_interior_medium_id(shape);
-    vertex.exterior_medium_id = get_exterior_medium_id(shape);
-    vertex.st                 = Vector2{ rtc_hit.u, rtc_hit.v };
-
-    ShadingInfo shading_info = compute_shading_info(scene.shapes[vertex.shape_id], vertex);
-    vertex.shading_frame     = shading_info.shading_frame;
-    vertex.uv                = shading_info.uv;
-    vertex.mean_curvature    = shading_info.mean_curvature;
-    vertex.ray_radius        = transfer(ray_diff, distance(ray.org, vertex.position));
-    // vertex.ray_radius stores approximatedly dp/dx,
-    // we get uv_screen_size (du/dx) using (dp/dx)/(dp/du)
-    vertex.uv_screen_size = vertex.ray_radius / shading_info.inv_uv_size;
+    return make_path_vertex(scene, ray, ray_diff, rtc_ray.tfar, Vector3{ rtc_hit.Ng_x, rtc_hit.Ng_y, rtc_hit.Ng_z },
+                            Vector2{ rtc_hit.u, rtc_hit.v }, rtc_hit.primID, rtc_hit.geomID, rtc_hit.instID[0]);
+}
 
-    // Flip the geometry normal to the same direction as the shading normal
-    if (dot(vertex.geometric_normal, vertex.shading_frame.n) < 0) {
-        vertex.geometric_normal = -vertex.geometric_normal;
+/// Trace the rays [0, count) as one packet of size N (count <= N).
+template <int N, typename RTCRayHitPacket, typename IntersectFunc>
+void intersect_packet(const Scene& scene, const Ray* rays, const RayDifferential* ray_diffs, int count,
+                      std::optional<PathVertex>* vertices, IntersectFunc rtc_intersect) {
+    RTCIntersectArguments rtc_args;
+    rtcInitIntersectArguments(&rtc_args);
+    RTCRayHitPacket packet;
+    int valid[N];
+    for (int i = 0; i < N; i++) {
+        // Unused lanes are masked out with valid = 0, but we still give them sane values.
+        const Ray& ray          = rays[min(i, count - 1)];
+        valid[i]                = i < count ? -1 : 0;
+        packet.ray.org_x[i]     = (float)ray.org[0];
+        packet.ray.org_y[i]     = (float)ray.org[1];
+        packet.ray.org_z[i]     = (float)ray.org[2];
+        packet.ray.dir_x[i]     = (float)ray.dir[0];
+        packet.ray.dir_y[i]     = (float)ray.dir[1];
+        packet.ray.dir_z[i]     = (float)ray.dir[2];
+        packet.ray.tnear[i]     = (float)ray.tnear;
+        packet.ray.tfar[i]      = (float)ray.tfar;
+        packet.ray.mask[i]      = (unsigned int)(-1);
+        packet.ray.time[i]      = 0.f;
+        packet.ray.id[i]        = (unsigned int)i;
+        packet.ray.flags[i]     = 0;
+        packet.hit.geomID[i]    = RTC_INVALID_GEOMETRY_ID;
+        packet.hit.primID[i]    = RTC_INVALID_GEOMETRY_ID;
+        packet.hit.instID[0][i] = RTC_INVALID_GEOMETRY_ID;
     }
+    rtc_intersect(valid, scene.embree_scene, &packet, &rtc_args);
+    add_stat(StatCounter::IntersectRays, count);
+    for (int i = 0; i < count; i++) {
+        if (packet.hit.geomID[i] == RTC_INVALID_GEOMETRY_ID) {
+            vertices[i] = {};
+        } else {
+            vertices[i] = make_path_vertex(
+                scene, rays[i], ray_diffs[i], packet.ray.tfar[i],
+                Vector3{ packet.hit.Ng_x[i], packet.hit.Ng_y[i], packet.hit.Ng_z[i] },
+                Vector2{ packet.hit.u[i], packet.hit.v[i] }, packet.hit.primID[i], packet.hit.geomID[i],
+                packet.hit.instID[0][i]);
+        }
+    }
+}
 
-    return vertex;
+void intersect(const Scene& scene, const Ray* rays, const RayDifferential* ray_diffs, int count,
+               std::optional<PathVertex>* vertices) {
+    for (int start = 0; start < count;) {
+        // Use the smallest packet that fits the remaining rays, up to 16.
+        int remaining = count - start;
+        int n;
+        if (remaining == 1) {
+            n               = 1;
+            vertices[start] = intersect(scene, rays[start], ray_diffs[start]);
+        } else if (remaining <= 4) {
+            n = remaining;
+            intersect_packet<4, RTCRayHit4>(scene, rays + start, ray_diffs + start, n, vertices + start,
+                                            rtcIntersect4);
+        } else if (remaining <= 8) {
+            n = remaining;
+            intersect_packet<8, RTCRayHit8>(scene, rays + start, ray_diffs + start, n, vertices + start,
+                                            rtcIntersect8);
+        } else {
+            n = min(remaining, 16);
+            intersect_packet<16, RTCRayHit16>(scene, rays + start, ray_diffs + start, n, vertices + start,
+                                              rtcIntersect16);
+        }
+        start += n;
+    }
 }
 
 bool occluded(const Scene& scene, const Ray& ray) {
@@ -82,11 +194,87 @@ bool occluded(const Scene& scene, const Ray& ray) {
     rtc_ray.mask  = (unsigned int)(-1);
     rtc_ray.time  = 0.f;
     rtc_ray.flags = 0;
-    // TODO: switch to rtcOccluded16
     rtcOccluded1(scene.embree_scene, &rtc_ray, &rtc_args);
+    add_stat(StatCounter::ShadowRays);
     return rtc_ray.tfar < 0;
 }
 
+/// Trace the rays [0, count) as one packet of size N (count <= N).
+template <int N, typename RTCRayPacket, typename OccludedFunc>
+uint64_t occluded_packet(const Scene& scene, const Ray* rays, int count, OccludedFunc rtc_occluded) {
+    RTCOccludedArguments rtc_args;
+    rtcInitOccludedArguments(&rtc_args);
+    RTCRayPacket packet;
+    int valid[N];
+    for (int i = 0; i < N; i++) {
+        // Unused lanes are masked out with valid = 0, but we still give them sane values.
+        const Ray& ray  = rays[min(i, count - 1)];
+        valid[i]        = i < count ? -1 : 0;
+        packet.org_x[i] = (float)ray.org[0];
+        packet.org_y[i] = (float)ray.org[1];
+        packet.org_z[i] = (float)ray.org[2];
+        packet.dir_x[i] = (float)ray.dir[0];
+        packet.dir_y[i] = (float)ray.dir[1];
+        packet.dir_z[i] = (float)ray.dir[2];
+        packet.tnear[i] = (float)ray.tnear;
+        packet.tfar[i]  = (float)ray.tfar;
+        packet.mask[i]  = (unsigned int)(-1);
+        packet.time[i]  = 0.f;
+        packet.id[i]    = (unsigned int)i;
+        packet.flags[i] = 0;
+    }
+    rtc_occluded(valid, scene.embree_scene, &packet, &rtc_args);
+    add_stat(StatCounter::ShadowRays, count);
+    uint64_t mask = 0;
+    for (int i = 0; i < count; i++) {
+        if (packet.tfar[i] < 0) { mask |= uint64_t(1) << i; }
+    }
+    return mask;
+}
+
+uint64_t occluded(const Scene& scene, const Ray* rays, int count) {
+    assert(count <= 64);
+    uint64_t mask = 0;
+    for (int start = 0; start < count;) {
+        // Use the smallest packet that fits the remaining rays, up to 16.
+        int remaining = count - start;
+        int n;
+        uint64_t packet_mask;
+        if (remaining == 1) {
+            n           = 1;
+            packet_mask = occluded(scene, rays[start]) ? 1 : 0;
+        } else if (remaining <= 4) {
+            n           = remaining;
+            packet_mask = occluded_packet<4, RTCRay4>(scene, rays + start, n, rtcOccluded4);
+        } else if (remaining <= 8) {
+            n           = remaining;
+            packet_mask = occluded_packet<8, RTCRay8>(scene, rays + start, n, rtcOccluded8);
+        } else {
+            n           = min(remaining, 16);
+            packet_mask = occluded_packet<16, RTCRay16>(scene, rays + start, n, rtcOccluded16);
+        }
+        mask |= packet_mask << start;
+        start += n;
+    }
+    return mask;
+}
+
+void trace_shadow_rays(const Scene& scene, ShadowRayQueue& queue, Spectrum* sample_radiance) {
+    int num_rays = (int)queue.rays.size();
+    for (int start = 0; start < num_rays; start += 64) {
+        int count     = min(num_rays - start, 64);
+        uint64_t mask = occluded(scene, queue.rays.data() + start, count);
+        for (int i = 0; i < count; i++) {
+            if (!(mask & (uint64_t(1) << i))) {
+                sample_radiance[queue.sample_ids[start + i]] += queue.contributions[start + i];
+            }
+        }
+    }
+    queue.rays.clear();
+    queue.contributions.clear();
+    queue.sample_ids.clear();
+}
+
 Spectrum emission(const PathVertex& v, const Vector3& view_dir, const Scene& scene) {
     int light_id = get_area_light_id(scene.shapes[v.shape_id]);
     assert(light_id >= 0);
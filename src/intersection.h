@@ -7,6 +7,7 @@
 #include "vector.h"
 
 #include <optional>
+#include <vector>
 
 struct Scene;
 
@@ -27,6 +28,7 @@ struct PathVertex {
     int shape_id     = -1;
     int primitive_id = -1; // For triangle meshes. This indicates which triangle it hits.
     int material_id  = -1;
+    int instance_id  = -1; // If the shape is in a shape group, the instance of the group we hit.
 
     // If the path vertex is inside a medium, these two IDs
     // are the same.
@@ -39,9 +41,39 @@ struct PathVertex {
 std::optional<PathVertex> intersect(const Scene& scene, const Ray& ray,
                                     const RayDifferential& ray_diff = RayDifferential{});
 
+/// Intersect a batch of rays with a scene. vertices[i] receives the hit of rays[i]
+/// (or an invalid optional output). The rays are traced as packets with rtcIntersect16/8/4.
+void intersect(const Scene& scene, const Ray* rays, const RayDifferential* ray_diffs, int count,
+               std::optional<PathVertex>* vertices);
+
 /// Test is a ray segment intersect with anything in a scene.
 bool occluded(const Scene& scene, const Ray& ray);
 
+/// Test a batch of (at most 64) ray segments for occlusion.
+/// Bit i of the returned mask is set if rays[i] is occluded.
+/// The rays are traced as packets with rtcOccluded16/8/4, so Embree can use SIMD traversal.
+uint64_t occluded(const Scene& scene, const Ray* rays, int count);
+
+/// Shadow rays gathered for a batched occlusion test, instead of testing them one by one.
+/// Each ray carries the radiance it contributes to the sample sample_ids[i] if it is not occluded.
+struct ShadowRayQueue {
+    std::vector<Ray> rays;
+    std::vector<Spectrum> contributions;
+    std::vector<int> sample_ids;
+    // The sample that the rays pushed next belong to.
+    int sample_id = 0;
+};
+
+inline void push_shadow_ray(ShadowRayQueue& queue, const Ray& ray, const Spectrum& contribution) {
+    queue.rays.push_back(ray);
+    queue.contributions.push_back(contribution);
+    queue.sample_ids.push_back(queue.sample_id);
+}
+
+/// Trace all the shadow rays in the queue (in batches), add the contributions of the
+/// unoccluded ones to sample_radiance[sample_id], and empty the queue.
+void trace_shadow_rays(const Scene& scene, ShadowRayQueue& queue, Spectrum* sample_radiance);
+
 /// Computes the emission at a path vertex v, with the viewing direction
 /// pointing outwards of the intersection.
 Spectrum emission(const PathVertex& v, const Vector3& view_dir, const Scene& scene);
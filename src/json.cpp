@@ -0,0 +1,225 @@
+#include "json.h"
+#include "flexception.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+struct JsonParser {
+    const std::string& str;
+    size_t pos = 0;
+
+    void skip_whitespace() {
+        while (pos < str.size() && (str[pos] == ' ' || str[pos] == '\t' || str[pos] == '\n' || str[pos] == '\r')) {
+            pos++;
+        }
+    }
+
+    [[noreturn]] void fail(const std::string& message) {
+        throw fl_exception("JSON: " + message + " at offset " + std::to_string(pos), __FILE__, __LINE__);
+    }
+
+    void expect(char c) {
+        skip_whitespace();
+        if (pos >= str.size() || str[pos] != c) { fail(std::string("expected '") + c + "'"); }
+        pos++;
+    }
+
+    bool consume(const char* word) {
+        size_t len = std::char_traits<char>::length(word);
+        if (str.compare(pos, len, word) != 0) { return false; }
+        pos += len;
+        return true;
+    }
+
+    std::string parse_string() {
+        expect('"');
+        std::string ret;
+        while (true) {
+            if (pos >= str.size()) { fail("unterminated string"); }
+            char c = str[pos++];
+            if (c == '"') { break; }
+            if (c != '\\') {
+                ret += c;
+                continue;
+            }
+            if (pos >= str.size()) { fail("unterminated string"); }
+            char e = str[pos++];
+            if (e == 'n') {
+                ret += '\n';
+            } else if (e == 't') {
+                ret += '\t';
+            } else if (e == 'r') {
+                ret += '\r';
+            } else if (e == 'b') {
+                ret += '\b';
+            } else if (e == 'f') {
+                ret += '\f';
+            } else if (e == 'u') {
+                // Exactly four hex digits
+                unsigned int code = 0;
+                for (int i = 0; i < 4; i++) {
+                    if (pos >= str.size() || !isxdigit((unsigned char)str[pos])) { fail("invalid escape"); }
+                    char h = str[pos++];
+                    code   = code * 16 + (isdigit((unsigned char)h) ? h - '0' : tolower((unsigned char)h) - 'a' + 10);
+                }
+                // Encode the code point as UTF-8 (surrogate pairs are not combined).
+                if (code < 0x80) {
+                    ret += char(code);
+                } else if (code < 0x800) {
+                    ret += char(0xc0 | (code >> 6));
+                    ret += char(0x80 | (code & 0x3f));
+                } else {
+                    ret += char(0xe0 | (code >> 12));
+                    ret += char(0x80 | ((code >> 6) & 0x3f));
+                    ret += char(0x80 | (code & 0x3f));
+                }
+            } else if (e == '"' || e == '\\' || e == '/') {
+                ret += e;
+            } else {
+                fail("invalid escape");
+            }
+        }
+        return ret;
+    }
+
+    /// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? and nothing else: strtod alone also takes
+    /// "nan", "inf", hex floats and a leading '+', which we could not write back as JSON.
+    double parse_number() {
+        size_t begin = pos;
+        auto digits  = [&]() {
+            size_t first = pos;
+            while (pos < str.size() && isdigit((unsigned char)str[pos])) { pos++; }
+            return pos > first;
+        };
+        if (pos < str.size() && str[pos] == '-') { pos++; }
+        if (pos < str.size() && str[pos] == '0') {
+            pos++;
+        } else if (!digits()) {
+            pos = begin;
+            fail("unexpected character");
+        }
+        if (pos < str.size() && str[pos] == '.') {
+            pos++;
+            if (!digits()) { fail("invalid number"); }
+        }
+        if (pos < str.size() && (str[pos] == 'e' || str[pos] == 'E')) {
+            pos++;
+            if (pos < str.size() && (str[pos] == '+' || str[pos] == '-')) { pos++; }
+            if (!digits()) { fail("invalid number"); }
+        }
+        double number = strtod(str.substr(begin, pos - begin).c_str(), nullptr);
+        if (!std::isfinite(number)) {
+            pos = begin;
+            fail("number out of range");
+        }
+        return number;
+    }
+
+    JsonValue parse_value() {
+        skip_whitespace();
+        if (pos >= str.size()) { fail("unexpected end"); }
+        JsonValue value;
+        char c = str[pos];
+        if (c == '{') {
+            value.type = JsonValue::Type::Object;
+            pos++;
+            skip_whitespace();
+            if (pos < str.size() && str[pos] == '}') {
+                pos++;
+                return value;
+            }
+            while (true) {
+                skip_whitespace();
+                std::string key = parse_string();
+                expect(':');
+                value.object[key] = parse_value();
+                skip_whitespace();
+                if (pos < str.size() && str[pos] == ',') {
+                    pos++;
+                    continue;
+                }
+                expect('}');
+                return value;
+            }
+        } else if (c == '[') {
+            value.type = JsonValue::Type::Array;
+            pos++;
+            skip_whitespace();
+            if (pos < str.size() && str[pos] == ']') {
+                pos++;
+                return value;
+            }
+            while (true) {
+                value.array.push_back(parse_value());
+                skip_whitespace();
+                if (pos < str.size() && str[pos] == ',') {
+                    pos++;
+                    continue;
+                }
+                expect(']');
+                return value;
+            }
+        } else if (c == '"') {
+            value.type   = JsonValue::Type::String;
+            value.string = parse_string();
+        } else if (consume("true")) {
+            value.type    = JsonValue::Type::Boolean;
+            value.boolean = true;
+        } else if (consume("false")) {
+            value.type = JsonValue::Type::Boolean;
+        } else if (consume("null")) {
+            value.type = JsonValue::Type::Null;
+        } else {
+            value.type   = JsonValue::Type::Number;
+            value.number = parse_number();
+        }
+        return value;
+    }
+};
+
+JsonValue parse_json(const std::string& str) {
+    JsonParser parser{ str };
+    JsonValue value = parser.parse_value();
+    parser.skip_whitespace();
+    if (parser.pos != str.size()) { parser.fail("trailing characters"); }
+    return value;
+}
+
+const JsonValue* find_member(const JsonValue& value, const std::string& key) {
+    if (value.type != JsonValue::Type::Object) { return nullptr; }
+    auto it = value.object.find(key);
+    return it == value.object.end() ? nullptr : &it->second;
+}
+
+std::string json_string(const std::string& str) {
+    std::string ret = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            ret += '\\';
+            ret += c;
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            ret += buf;
+        } else {
+            ret += c;
+        }
+    }
+    return ret + "\"";
+}
+
+std::string json_number(double number) {
+    // (JSON has no NaN or infinity)
+    if (!std::isfinite(number)) { return "null"; }
+    char buf[32];
+    // Every integer up to 2^53 is exactly a double.
+    if (number == std::floor(number) && std::fabs(number) <= 9007199254740992.0) {
+        snprintf(buf, sizeof(buf), "%lld", (long long)number);
+    } else {
+        snprintf(buf, sizeof(buf), "%.*g", std::numeric_limits<double>::max_digits10, number);
+    }
+    return buf;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "lajolla.h"
+#include <map>
+#include <string>
+#include <vector>
+
+/// A minimal JSON document model, enough for the commands of the render server (server.h)
+/// and the statistics reports (stats.h). Numbers are stored as doubles.
+struct JsonValue {
+    enum class Type { Null, Boolean, Number, String, Array, Object };
+
+    Type type     = Type::Null;
+    bool boolean  = false;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::map<std::string, JsonValue> object;
+};
+
+/// Parse a JSON document. Throws an exception (Error) on a syntax error.
+JsonValue parse_json(const std::string& str);
+
+/// The member "key" of an object, or nullptr if the value is not an object or has no such member.
+const JsonValue* find_member(const JsonValue& value, const std::string& key);
+
+/// Quote and escape a string for JSON.
+std::string json_string(const std::string& str);
+
+/// Format a number for JSON so that it parses back to the same double:
+/// integers as integers (without an exponent), and the others with max_digits10 significant digits.
+/// NaN and the infinities, which JSON has no numbers for, become null.
+std::string json_number(double number);
@@ -18,9 +18,13 @@
 // put emphasis on the absolute performance.
 // We choose double so that we do not need to worry about
 // numerical accuracy as much when we render.
-// Switching to floating point computation is easy --
-// just set Real = float.
+// Switching to single precision is done by configuring with
+// -DLAJOLLA_SINGLE_PRECISION=ON, which sets Real = float.
+#ifdef LAJOLLA_SINGLE_PRECISION
+using Real = float;
+#else
 using Real = double;
+#endif
 
 // Lots of PIs!
 const Real c_PI         = Real(3.14159265358979323846);
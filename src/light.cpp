@@ -39,6 +39,13 @@ struct emission_op {
     const Scene& scene;
 };
 
+struct light_bounds_op {
+    std::optional<LightBounds> operator()(const DiffuseAreaLight& light) const;
+    std::optional<LightBounds> operator()(const Envmap& light) const;
+
+    const Scene& scene;
+};
+
 struct init_sampling_dist_op {
     void operator()(DiffuseAreaLight& light) const;
     void operator()(Envmap& light) const;
@@ -66,4 +73,8 @@ Spectrum emission(const Light& light, const Vector3& view_dir, Real view_footpri
     return std::visit(emission_op{ view_dir, point_on_light, view_footprint, scene }, light);
 }
 
+std::optional<LightBounds> light_bounds(const Light& light, const Scene& scene) {
+    return std::visit(light_bounds_op{ scene }, light);
+}
+
 void init_sampling_dist(Light& light, const Scene& scene) { return std::visit(init_sampling_dist_op{ scene }, light); }
@@ -7,6 +7,7 @@
 #include "spectrum.h"
 #include "texture.h"
 #include "vector.h"
+#include <optional>
 #include <variant>
 
 struct Scene;
@@ -29,6 +30,17 @@ struct Envmap {
     TableDist2D sampling_dist;
 };
 
+/// Bounds of a light for the light BVH (light_bvh.h): the light is inside the box [p_min, p_max],
+/// its surface normals are inside the cone around w with half angle theta_o,
+/// and it emits into directions at most theta_e away from its normals.
+struct LightBounds {
+    Vector3 p_min, p_max;
+    Real phi = 0; // power
+    Vector3 w{ Real(0), Real(0), Real(1) };
+    Real cos_theta_o = 1;
+    Real cos_theta_e = 1;
+};
+
 // To add more lights, first create a struct for the light, add it to the variant type below,
 // then implement all the relevant function below with the Light type.
 using Light = std::variant<DiffuseAreaLight, Envmap>;
@@ -58,6 +70,9 @@ Real pdf_point_on_light(const Light& light, const PointAndNormal& point_on_light
 Spectrum emission(const Light& light, const Vector3& view_dir, Real view_footprint,
                   const PointAndNormal& point_on_light, const Scene& scene);
 
+/// Bounds of the light (see LightBounds), or nullopt for the lights at infinity (e.g., envmaps).
+std::optional<LightBounds> light_bounds(const Light& light, const Scene& scene);
+
 /// Some lights require storing sampling data structures inside. This function initialize them.
 void init_sampling_dist(Light& light, const Scene& scene);
 
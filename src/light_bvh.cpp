@@ -0,0 +1,259 @@
+#include "light_bvh.h"
+#include "low_discrepancy.h"
+#include "scene.h"
+#include <algorithm>
+
+static Vector3 centroid(const LightBounds& b) { return (b.p_min + b.p_max) / Real(2); }
+
+static Real safe_sqrt(Real x) { return sqrt(max(x, Real(0))); }
+
+static Real safe_acos(Real x) { return acos(std::clamp(x, Real(-1), Real(1))); }
+
+/// The smallest cone that contains the cones (wa, cos_a) and (wb, cos_b).
+static void union_cones(const Vector3& wa, Real cos_a, const Vector3& wb, Real cos_b, Vector3& w, Real& cos_theta) {
+    Real theta_a = safe_acos(cos_a);
+    Real theta_b = safe_acos(cos_b);
+    Real theta_d = safe_acos(dot(wa, wb));
+    if (min(theta_d + theta_b, c_PI) <= theta_a) {
+        w         = wa;
+        cos_theta = cos_a;
+        return;
+    }
+    if (min(theta_d + theta_a, c_PI) <= theta_b) {
+        w         = wb;
+        cos_theta = cos_b;
+        return;
+    }
+    Real theta_o = (theta_a + theta_d + theta_b) / 2;
+    Vector3 axis = cross(wa, wb);
+    if (theta_o >= c_PI || length_squared(axis) <= 0) {
+        // The whole sphere
+        w         = wa;
+        cos_theta = -1;
+        return;
+    }
+    // Rotate wa towards wb by theta_o - theta_a (Rodrigues' rotation formula).
+    axis         = normalize(axis);
+    Real theta_r = theta_o - theta_a;
+    w            = wa * cos(theta_r) + cross(axis, wa) * sin(theta_r) + axis * (dot(axis, wa) * (1 - cos(theta_r)));
+    cos_theta    = cos(theta_o);
+}
+
+static LightBounds union_bounds(const LightBounds& a, const LightBounds& b) {
+    if (a.phi == 0) { return b; }
+    if (b.phi == 0) { return a; }
+    LightBounds ret;
+    for (int i = 0; i < 3; i++) {
+        ret.p_min[i] = min(a.p_min[i], b.p_min[i]);
+        ret.p_max[i] = max(a.p_max[i], b.p_max[i]);
+    }
+    ret.phi = a.phi + b.phi;
+    union_cones(a.w, a.cos_theta_o, b.w, b.cos_theta_o, ret.w, ret.cos_theta_o);
+    ret.cos_theta_e = min(a.cos_theta_e, b.cos_theta_e);
+    return ret;
+}
+
+/// The cost of a node for the surface area orientation heuristic (SAOH) of Conty and Kulla:
+/// power times the solid angle measure of the emitted directions times the surface area of the box.
+/// Splits across the thin dimensions of the parent box are penalized by kr.
+static Real split_cost(const LightBounds& b, const LightBounds& parent, int dim) {
+    Real theta_o     = safe_acos(b.cos_theta_o);
+    Real theta_e     = safe_acos(b.cos_theta_e);
+    Real theta_w     = min(theta_o + theta_e, c_PI);
+    Real sin_theta_o = safe_sqrt(1 - b.cos_theta_o * b.cos_theta_o);
+    Real m_omega     = c_TWOPI * (1 - b.cos_theta_o) + c_PIOVERTWO * (2 * theta_w * sin_theta_o -
+                                                                   cos(theta_o - 2 * theta_w) -
+                                                                   2 * theta_o * sin_theta_o + b.cos_theta_o);
+    Vector3 d        = b.p_max - b.p_min;
+    Vector3 parent_d = parent.p_max - parent.p_min;
+    Real kr          = max(parent_d) / parent_d[dim];
+    Real area        = 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    return b.phi * m_omega * kr * area;
+}
+
+struct LightBVHPrimitive {
+    int light_id;
+    LightBounds bounds;
+};
+
+/// Builds the subtree of primitives [start, end) and returns the index of its root.
+static int build_light_bvh(std::vector<LightBVHPrimitive>& primitives, int start, int end, uint64_t bit_trail,
+                           int depth, LightBVH& bvh) {
+    int node_id = (int)bvh.nodes.size();
+    if (end - start == 1) {
+        int light_id = primitives[start].light_id;
+        bvh.nodes.push_back(LightBVHNode{ primitives[start].bounds, light_id, true });
+        bvh.light_bit_trails[light_id] = bit_trail;
+        bvh.in_tree[light_id]          = true;
+        return node_id;
+    }
+    LightBounds bounds;
+    Vector3 c_min{ infinity<Real>(), infinity<Real>(), infinity<Real>() };
+    Vector3 c_max = -c_min;
+    for (int i = start; i < end; i++) {
+        bounds    = union_bounds(bounds, primitives[i].bounds);
+        Vector3 c = centroid(primitives[i].bounds);
+        for (int j = 0; j < 3; j++) {
+            c_min[j] = min(c_min[j], c[j]);
+            c_max[j] = max(c_max[j], c[j]);
+        }
+    }
+
+    // Find the best split into buckets along the centroids.
+    constexpr int num_buckets = 12;
+    Real min_cost             = infinity<Real>();
+    int min_bucket = -1, min_dim = -1;
+    auto bucket = [&](const LightBVHPrimitive& primitive, int dim) {
+        Real offset = (centroid(primitive.bounds)[dim] - c_min[dim]) / (c_max[dim] - c_min[dim]);
+        return std::clamp(int(offset * num_buckets), 0, num_buckets - 1);
+    };
+    // (beyond depth 32, we split by count so that the bit trails fit in 64 bits)
+    for (int dim = 0; dim < 3 && depth < 32; dim++) {
+        if (c_max[dim] == c_min[dim]) { continue; }
+        LightBounds buckets[num_buckets];
+        for (int i = start; i < end; i++) {
+            int b      = bucket(primitives[i], dim);
+            buckets[b] = union_bounds(buckets[b], primitives[i].bounds);
+        }
+        for (int split = 1; split < num_buckets; split++) {
+            LightBounds b0, b1;
+            for (int i = 0; i < split; i++) { b0 = union_bounds(b0, buckets[i]); }
+            for (int i = split; i < num_buckets; i++) { b1 = union_bounds(b1, buckets[i]); }
+            Real cost = split_cost(b0, bounds, dim) + split_cost(b1, bounds, dim);
+            if (cost > 0 && cost < min_cost) {
+                min_cost   = cost;
+                min_bucket = split;
+                min_dim    = dim;
+            }
+        }
+    }
+    int mid = (start + end) / 2;
+    if (min_dim != -1) {
+        auto it = std::partition(primitives.begin() + start, primitives.begin() + end,
+                                 [&](const LightBVHPrimitive& p) { return bucket(p, min_dim) < min_bucket; });
+        mid     = int(it - primitives.begin());
+        if (mid == start || mid == end) { mid = (start + end) / 2; }
+    }
+
+    bvh.nodes.push_back(LightBVHNode{ bounds, -1, false });
+    build_light_bvh(primitives, start, mid, bit_trail, depth + 1, bvh);
+    uint64_t second_bit_trail = bit_trail | (uint64_t(1) << depth);
+    bvh.nodes[node_id].index  = build_light_bvh(primitives, mid, end, second_bit_trail, depth + 1, bvh);
+    return node_id;
+}
+
+LightBVH make_light_bvh(const std::vector<Light>& lights, const Scene& scene) {
+    LightBVH bvh;
+    bvh.light_bit_trails.resize(lights.size(), 0);
+    bvh.in_tree.resize(lights.size(), false);
+    std::vector<LightBVHPrimitive> primitives;
+    for (int i = 0; i < (int)lights.size(); i++) {
+        std::optional<LightBounds> bounds = light_bounds(lights[i], scene);
+        if (!bounds) {
+            bvh.infinite_lights.push_back(i);
+        } else if (bounds->phi > 0) {
+            primitives.push_back(LightBVHPrimitive{ i, *bounds });
+        }
+    }
+    if (!primitives.empty()) { build_light_bvh(primitives, 0, (int)primitives.size(), 0, 0, bvh); }
+    return bvh;
+}
+
+/// cos(max(0, theta_a - theta_b)) and sin(max(0, theta_a - theta_b))
+static Real cos_sub_clamped(Real sin_a, Real cos_a, Real sin_b, Real cos_b) {
+    return cos_a > cos_b ? 1 : cos_a * cos_b + sin_a * sin_b;
+}
+
+static Real sin_sub_clamped(Real sin_a, Real cos_a, Real sin_b, Real cos_b) {
+    return cos_a > cos_b ? 0 : sin_a * cos_b - cos_a * sin_b;
+}
+
+Real importance(const LightBounds& bounds, const Vector3& p, const Vector3& n) {
+    if (bounds.phi == 0) { return 0; }
+    // The distance to the center, clamped to avoid a singularity inside the box
+    Vector3 pc  = centroid(bounds);
+    Real radius = distance(bounds.p_max, pc);
+    Real d2     = max(distance_squared(p, pc), radius);
+    // The angle between the cone axis and the direction from the box to p,
+    // minus the cone angle and the angle the box subtends from p:
+    // the smallest angle between a light normal and a direction towards p.
+    Vector3 wi         = length_squared(p - pc) > 0 ? normalize(p - pc) : Vector3{ Real(0), Real(0), Real(1) };
+    Real cos_theta_w   = dot(wi, bounds.w);
+    Real sin_theta_w   = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+    Real cos_theta_b   = distance_squared(p, pc) < radius * radius
+                             ? Real(-1)
+                             : safe_sqrt(1 - radius * radius / distance_squared(p, pc));
+    Real sin_theta_b   = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+    Real sin_theta_o   = safe_sqrt(1 - bounds.cos_theta_o * bounds.cos_theta_o);
+    Real cos_theta_x   = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, bounds.cos_theta_o);
+    Real sin_theta_x   = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, bounds.cos_theta_o);
+    Real cos_theta_min = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta_min <= bounds.cos_theta_e) { return 0; }
+    Real ret = bounds.phi * cos_theta_min / d2;
+    // The smallest angle between n and a direction towards the box
+    if (n.x != 0 || n.y != 0 || n.z != 0) {
+        Real cos_theta_i = fabs(dot(wi, n));
+        Real sin_theta_i = safe_sqrt(1 - cos_theta_i * cos_theta_i);
+        ret *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    }
+    return max(ret, Real(0));
+}
+
+static Real infinite_light_probability(const LightBVH& bvh) {
+    if (bvh.infinite_lights.empty()) { return 0; }
+    Real num_infinite = Real(bvh.infinite_lights.size());
+    return num_infinite / (num_infinite + (bvh.nodes.empty() ? 0 : 1));
+}
+
+int sample(const LightBVH& bvh, const Vector3& p, const Vector3& n, Real u) {
+    Real p_infinite = infinite_light_probability(bvh);
+    if (u < p_infinite) {
+        u = min(u / p_infinite, c_one_minus_epsilon);
+        return bvh.infinite_lights[min(int(u * bvh.infinite_lights.size()), (int)bvh.infinite_lights.size() - 1)];
+    }
+    if (bvh.nodes.empty()) { return -1; }
+    u           = min((u - p_infinite) / (1 - p_infinite), c_one_minus_epsilon);
+    int node_id = 0;
+    while (!bvh.nodes[node_id].is_leaf) {
+        // Choose a child proportionally to the importance and remap u to [0, 1).
+        int children[2] = { node_id + 1, bvh.nodes[node_id].index };
+        Real i0         = importance(bvh.nodes[children[0]].bounds, p, n);
+        Real i1         = importance(bvh.nodes[children[1]].bounds, p, n);
+        if (i0 == 0 && i1 == 0) { return -1; }
+        Real p0 = i0 / (i0 + i1);
+        if (u < p0) {
+            node_id = children[0];
+            u       = min(u / p0, c_one_minus_epsilon);
+        } else {
+            node_id = children[1];
+            u       = min((u - p0) / (1 - p0), c_one_minus_epsilon);
+        }
+    }
+    if (node_id == 0 && importance(bvh.nodes[0].bounds, p, n) == 0) { return -1; }
+    return bvh.nodes[node_id].index;
+}
+
+Real pmf(const LightBVH& bvh, const Vector3& p, const Vector3& n, int light_id) {
+    Real p_infinite = infinite_light_probability(bvh);
+    if (!bvh.in_tree[light_id]) {
+        bool infinite = std::find(bvh.infinite_lights.begin(), bvh.infinite_lights.end(), light_id) !=
+                        bvh.infinite_lights.end();
+        return infinite ? p_infinite / bvh.infinite_lights.size() : 0;
+    }
+    // Follow the bit trail down to the leaf of the light.
+    uint64_t bit_trail = bvh.light_bit_trails[light_id];
+    Real ret           = 1 - p_infinite;
+    int node_id        = 0;
+    while (!bvh.nodes[node_id].is_leaf) {
+        int children[2] = { node_id + 1, bvh.nodes[node_id].index };
+        Real i0         = importance(bvh.nodes[children[0]].bounds, p, n);
+        Real i1         = importance(bvh.nodes[children[1]].bounds, p, n);
+        if (i0 == 0 && i1 == 0) { return 0; }
+        int child = bit_trail & 1;
+        ret *= (child == 0 ? i0 : i1) / (i0 + i1);
+        node_id = children[child];
+        bit_trail >>= 1;
+    }
+    if (node_id == 0 && importance(bvh.nodes[0].bounds, p, n) == 0) { return 0; }
+    return ret;
+}
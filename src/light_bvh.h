@@ -0,0 +1,46 @@
+#pragma once
+
+#include "lajolla.h"
+#include "light.h"
+#include "vector.h"
+#include <vector>
+
+/// A bounding hierarchy over the lights for importance sampling many lights, from
+/// Alejandro Conty Estevez and Christopher Kulla, "Importance Sampling of Many Lights
+/// with Adaptive Tree Splitting", 2018, following pbrt-v4's BVHLightSampler.
+/// Every node bounds the positions, the power, and the emitted directions of the lights below it.
+/// From a shading point, we walk down the tree and choose each child with a probability proportional
+/// to a conservative estimate of its contribution (power, distance, and orientation), so that
+/// close lights that face the point are sampled more often than the lights far away or behind it.
+/// The lights at infinity (envmaps) are not in the tree, they are chosen uniformly with probability
+/// (number of infinite lights) / (number of infinite lights + 1).
+
+struct LightBVHNode {
+    LightBounds bounds;
+    // For a leaf, the light ID; otherwise the second child (the first child follows the node).
+    int index;
+    bool is_leaf;
+};
+
+struct LightBVH {
+    std::vector<LightBVHNode> nodes;
+    std::vector<int> infinite_lights;
+    /// For each light in the tree, the path from the root to its leaf:
+    /// bit i is 1 if we go to the second child at depth i. 0 for the lights not in the tree.
+    std::vector<uint64_t> light_bit_trails;
+    std::vector<bool> in_tree;
+};
+
+/// Build the hierarchy from the bounds of the lights. Lights with zero power are never sampled.
+LightBVH make_light_bvh(const std::vector<Light>& lights, const Scene& scene);
+
+/// The contribution estimate of the lights in "bounds" to the point p with normal n
+/// (n is zero for points in a medium).
+Real importance(const LightBounds& bounds, const Vector3& p, const Vector3& n);
+
+/// Sample a light for the point p with normal n given a random number u \in [0, 1].
+/// Returns -1 if no light can contribute.
+int sample(const LightBVH& bvh, const Vector3& p, const Vector3& n, Real u);
+
+/// The probability mass function of the sampling procedure above.
+Real pmf(const LightBVH& bvh, const Vector3& p, const Vector3& n, int light_id);
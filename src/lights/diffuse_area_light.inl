@@ -16,4 +16,62 @@ Spectrum emission_op::operator()(const DiffuseAreaLight& light) const {
     return light.intensity;
 }
 
+std::optional<LightBounds> light_bounds_op::operator()(const DiffuseAreaLight& light) const {
+    const Shape& shape = scene.shapes[light.shape_id];
+    LightBounds bounds;
+    bounds.phi = light_power_op{ scene }(light);
+    // We only emit on the side of the normal, into the whole hemisphere.
+    bounds.cos_theta_e = 0;
+    if (const Sphere* sphere = std::get_if<Sphere>(&shape)) {
+        Vector3 r          = Vector3{ sphere->radius, sphere->radius, sphere->radius };
+        bounds.p_min       = sphere->position - r;
+        bounds.p_max       = sphere->position + r;
+        bounds.cos_theta_o = -1;
+    } else if (const TriangleMesh* mesh = std::get_if<TriangleMesh>(&shape)) {
+        bounds.p_min = Vector3{ infinity<Real>(), infinity<Real>(), infinity<Real>() };
+        bounds.p_max = -bounds.p_min;
+        for (const MeshPosition& position : mesh->positions) {
+            Vector3 p = position;
+            for (int i = 0; i < 3; i++) {
+                bounds.p_min[i] = min(bounds.p_min[i], p[i]);
+                bounds.p_max[i] = max(bounds.p_max[i], p[i]);
+            }
+        }
+        // The emitting sides of the triangles. sample_point_on_shape flips the geometric normal
+        // to the side of the interpolated shading normal, which can differ within a triangle:
+        // then the triangle emits on both sides.
+        std::vector<Vector3> normals;
+        Vector3 sum{ Real(0), Real(0), Real(0) };
+        for (const Vector3i& index : mesh->indices) {
+            Vector3 p0 = mesh->positions[index[0]];
+            Vector3 n  = cross(Vector3(mesh->positions[index[1]]) - p0, Vector3(mesh->positions[index[2]]) - p0);
+            Real area  = length(n);
+            if (area <= 0) { continue; }
+            n               = n / area;
+            bool front_face = mesh->normals.empty(), back_face = false;
+            for (int i = 0; i < 3 && !mesh->normals.empty(); i++) {
+                Real d = dot(n, mesh->normals[index[i]]);
+                front_face |= d >= 0;
+                back_face |= d <= 0;
+            }
+            if (front_face) {
+                normals.push_back(n);
+                sum += area * n;
+            }
+            if (back_face) {
+                normals.push_back(-n);
+                sum += -area * n;
+            }
+        }
+        // A cone around the average normal that contains all of them.
+        bounds.cos_theta_o = -1;
+        if (length_squared(sum) > 0) {
+            bounds.w           = normalize(sum);
+            bounds.cos_theta_o = 1;
+            for (const Vector3& n : normals) { bounds.cos_theta_o = min(bounds.cos_theta_o, dot(bounds.w, n)); }
+        }
+    }
+    return bounds;
+}
+
 void init_sampling_dist_op::operator()(DiffuseAreaLight& light) const {}
@@ -65,6 +65,8 @@ Spectrum emission_op::operator()(const Envmap& light) const {
     return eval(light.values, uv, footprint, scene.texture_pool) * light.scale;
 }
 
+std::optional<LightBounds> light_bounds_op::operator()(const Envmap& light) const { return {}; }
+
 void init_sampling_dist_op::operator()(Envmap& light) const {
     if (auto* t = std::get_if<ImageTexture<Spectrum>>(&light.values)) {
         // Only need to initialize sampling distribution
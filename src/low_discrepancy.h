@@ -0,0 +1,111 @@
+#pragma once
+
+#include "lajolla.h"
+
+#include <limits>
+
+// Building blocks of the low-discrepancy samplers (see sampler.h):
+// hashing, Owen scrambling, and the first two dimensions of the Sobol sequence,
+// which form a (0,2)-sequence: every prefix of 2^m points has exactly one point
+// in each of the 2^m elementary intervals of any shape (1 x 2^m, 2 x 2^(m-1), ...).
+
+/// The largest Real below 1.
+constexpr Real c_one_minus_epsilon = Real(1) - std::numeric_limits<Real>::epsilon() / 2;
+
+/// Map 32 random bits to [0, 1).
+inline Real bits_to_real(uint32_t bits) { return min(Real(bits) * Real(0x1p-32), c_one_minus_epsilon); }
+
+inline uint32_t reverse_bits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+/// A 64-bit finalizer with good avalanche (from MurmurHash3/SplitMix, as in pbrt-v4's MixBits).
+inline uint64_t mix_bits(uint64_t v) {
+    v ^= v >> 31;
+    v *= 0x7fb5d329728ea185ULL;
+    v ^= v >> 27;
+    v *= 0x81dadef4bc2dd44dULL;
+    v ^= v >> 33;
+    return v;
+}
+
+inline uint64_t hash_combine(uint64_t a, uint64_t b) { return mix_bits(a ^ mix_bits(b + 0x9e3779b97f4a7c15ULL)); }
+
+/// Owen scrambling of the bits of v with a hash-based nested uniform permutation.
+/// From Brent Burley, "Practical Hash-based Owen Scrambling", JCGT 2020.
+/// Applied to a sample index, it shuffles the index within every aligned block of 2^m indices,
+/// so the prefixes of a (0,2)-sequence stay stratified.
+inline uint32_t owen_scramble(uint32_t v, uint32_t seed) {
+    v = reverse_bits(v);
+    // Laine-Karras permutation: the high bits of v are randomized by the low bits only.
+    v += seed;
+    v ^= v * 0x6c50b47cu;
+    v ^= v * 0xb82f1e52u;
+    v ^= v * 0xc7afe638u;
+    v ^= v * 0x8d22f6e6u;
+    return reverse_bits(v);
+}
+
+/// The first dimension of the Sobol sequence (the van der Corput sequence), as 32 bits.
+/// (the index bits above 32 only change the bits below the precision)
+inline uint32_t sobol_sample_0(uint64_t index) { return reverse_bits(uint32_t(index)); }
+
+/// The second dimension of the Sobol sequence, as 32 bits.
+/// Its generator matrix is the Pascal matrix mod 2, with the direction numbers v_{i+1} = v_i ^ (v_i >> 1).
+inline uint32_t sobol_sample_1(uint64_t index) {
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1) { result ^= v; }
+    }
+    return result;
+}
+
+/// Element i of a random permutation of [0, l) chosen by p.
+/// From Andrew Kensler, "Correlated Multi-Jittered Sampling", 2013.
+inline uint32_t permutation_element(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    // Every step is a bijection on the bits of w; we repeat until we land in [0, l).
+    do {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+/// Interleave the bits of x and y (x in the even bits).
+inline uint64_t encode_morton_2(uint32_t x, uint32_t y) {
+    auto spread = [](uint64_t v) {
+        v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        v = (v | (v << 2)) & 0x3333333333333333ULL;
+        v = (v | (v << 1)) & 0x5555555555555555ULL;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
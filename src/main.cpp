@@ -1,53 +1,273 @@
+#include "checkpoint.h"
+#include "flexception.h"
 #include "image.h"
 #include "parallel.h"
 #include "parsers/parse_scene.h"
 #include "render.h"
+#include "server.h"
+#include "stats.h"
 #include "timer.h"
 #include <embree4/rtcore.h>
 #include <filesystem>
+#include <fstream>
+#include <limits>
 #include <memory>
 #include <thread>
 #include <vector>
 
+/// Parse a duration like "30s", "5m", "1.5h" or "90" (seconds) into seconds.
+Real parse_duration(const std::string& str) {
+    size_t pos       = 0;
+    Real value       = std::stod(str, &pos);
+    std::string unit = str.substr(pos);
+    if (unit == "" || unit == "s") {
+        return value;
+    } else if (unit == "m" || unit == "min") {
+        return value * 60;
+    } else if (unit == "h") {
+        return value * 3600;
+    }
+    Error(std::string("Unrecognized duration: ") + str);
+    return 0;
+}
+
+/// Parse a size like "512M", "2G", "64k" or "1000000" (bytes) into bytes.
+size_t parse_bytes(const std::string& str) {
+    size_t pos       = 0;
+    Real value       = std::stod(str, &pos);
+    std::string unit = to_lowercase(str.substr(pos));
+    if (unit == "" || unit == "b") {
+        return size_t(value);
+    } else if (unit == "k" || unit == "kb") {
+        return size_t(value * 1024);
+    } else if (unit == "m" || unit == "mb") {
+        return size_t(value * 1024 * 1024);
+    } else if (unit == "g" || unit == "gb") {
+        return size_t(value * 1024 * 1024 * 1024);
+    }
+    Error(std::string("Unrecognized size: ") + str);
+    return 0;
+}
+
+/// "lajolla merge [-o output_file_name] shard files...": add up the films of the shards of a render
+/// (see checkpoint.h) and write the image. The output defaults to the output of the shards.
+int merge(int argc, char* argv[]) {
+    std::string outputfile = "";
+    std::vector<fs::path> filenames;
+    for (int i = 2; i < argc; ++i) {
+        if (std::string(argv[i]) == "-o") {
+            outputfile = std::string(argv[++i]);
+        } else {
+            filenames.push_back(fs::path(argv[i]));
+        }
+    }
+    if (filenames.empty()) {
+        std::cerr << "ERROR: No shard specified." << std::endl;
+        return 1;
+    }
+    if (outputfile == "") {
+        // out.exr.shard-3-of-8.checkpoint -> out.exr
+        std::string filename = filenames[0].string();
+        outputfile           = filename.substr(0, filename.rfind(".shard-"));
+    }
+    Film film             = merge_checkpoints(filenames);
+    int64_t total_samples = 0;
+    for (int c : film.counts.data) { total_samples += c; }
+    imwrite(outputfile, resolve(film));
+    std::cout << "Merged " << filenames.size() << " shards, "
+              << Real(total_samples) / (Real(film.counts.width) * Real(film.counts.height))
+              << " samples per pixel on average." << std::endl;
+    std::cout << "Image written to " << outputfile << std::endl;
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "merge") { return merge(argc, argv); }
     if (argc <= 1 || std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
         std::cout << "This is Wuqiong Zhao's version of jalolla." << std::endl;
-        std::cout << "[Usage] ./lajolla [-t num_threads] [-o output_file_name] filename.xml" << std::endl;
+        std::cout << "[Usage] ./lajolla [-t num_threads] [-o output_file_name] [--progressive] [--spp target_spp]"
+                     " [--time budget] [--checkpoint interval] [--resume] [--adaptive threshold] [--texture-cache size]"
+                     " [--mesh-cache dir] [--tile-size size] [--tile-order order] [--stats file.json] filename.xml"
+                  << std::endl;
+        std::cout << "        ./lajolla [-t num_threads] [--texture-cache size] [--mesh-cache dir] --server"
+                     " [--socket path]"
+                  << std::endl;
+        std::cout << "        ./lajolla merge [-o output_file_name] shard_files" << std::endl;
+        std::cout << "  --progressive          render in passes of one sample per pixel" << std::endl;
+        std::cout << "  --spp target_spp       override the number of samples per pixel" << std::endl;
+        std::cout << "  --time budget          progressive, stop after the time budget, e.g., 30s, 5m, 1h" << std::endl;
+        std::cout << "  --checkpoint interval  progressive, write the intermediate image and a checkpoint of the render"
+                     " (output_file.checkpoint) every interval"
+                  << std::endl;
+        std::cout << "  --resume               continue the render from its checkpoint, if there is one" << std::endl;
+        std::cout << "  --shard i/N            render only the shard i (from 0) of N, a range of the samples of every"
+                     " pixel, into output_file.shard-i-of-N.checkpoint; combine the shards with lajolla merge"
+                  << std::endl;
+        std::cout << "  --adaptive threshold   adaptive sampling, stop sampling a pixel once its relative error is"
+                     " below threshold (--spp is then the maximum per pixel)"
+                  << std::endl;
+        std::cout << "  --texture-cache size   load image textures lazily and keep at most size of them in memory,"
+                     " e.g., 512M, 2G"
+                  << std::endl;
+        std::cout << "  --mesh-cache dir       cache the meshes loaded from files in dir, so that the next parse of"
+                     " the scene is faster"
+                  << std::endl;
+        std::cout << "  --tile-size size       render in tiles of size x size pixels (16 by default)" << std::endl;
+        std::cout << "  --tile-order order     the order the tiles are handed to the threads in: scanline, morton,"
+                     " hilbert (default), or spiral (from the center outwards)"
+                  << std::endl;
+        std::cout << "  --stats file.json      count the rays, samples, and texture lookups (and the cache misses"
+                     " where perf events are permitted), time the phases of each scene, and write them to file.json"
+                     " at exit"
+                  << std::endl;
+        std::cout << "  --server               keep the scenes in memory and render the JSON commands read from stdin,"
+                     " one per line (see server.h)"
+                  << std::endl;
+        std::cout << "  --socket path          with --server, read the commands from the Unix domain socket path"
+                  << std::endl;
         return 0;
     }
 
     int num_threads        = std::thread::hardware_concurrency();
     std::string outputfile = "";
+    bool progressive       = false;
+    int spp                = 0;
+    Real time_budget       = 0;
+    Real checkpoint        = 0;
+    bool resume            = false;
+    int shard_index        = 0;
+    int num_shards         = 1;
+    Real adaptive          = 0;
+    size_t texture_cache   = 0;
+    std::string mesh_cache = "";
+    std::string stats_file = "";
+    int tile_size          = 0;
+    std::string tile_order = "";
+    bool server            = false;
+    std::string socket     = "";
     std::vector<std::string> filenames;
     for (int i = 1; i < argc; ++i) {
         if (std::string(argv[i]) == "-t") {
             num_threads = std::stoi(std::string(argv[++i]));
         } else if (std::string(argv[i]) == "-o") {
             outputfile = std::string(argv[++i]);
+        } else if (std::string(argv[i]) == "--progressive") {
+            progressive = true;
+        } else if (std::string(argv[i]) == "--spp") {
+            spp = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "--time") {
+            time_budget = parse_duration(std::string(argv[++i]));
+            progressive = true;
+        } else if (std::string(argv[i]) == "--adaptive") {
+            adaptive = std::stod(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "--texture-cache") {
+            texture_cache = parse_bytes(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "--mesh-cache") {
+            mesh_cache = std::string(argv[++i]);
+        } else if (std::string(argv[i]) == "--tile-size") {
+            tile_size = std::stoi(std::string(argv[++i]));
+        } else if (std::string(argv[i]) == "--tile-order") {
+            tile_order = std::string(argv[++i]);
+        } else if (std::string(argv[i]) == "--stats") {
+            stats_file = std::string(argv[++i]);
+        } else if (std::string(argv[i]) == "--server") {
+            server = true;
+        } else if (std::string(argv[i]) == "--socket") {
+            socket = std::string(argv[++i]);
+            server = true;
+        } else if (std::string(argv[i]) == "--shard") {
+            std::string shard = std::string(argv[++i]);
+            size_t slash      = shard.find('/');
+            if (slash == std::string::npos) { Error(std::string("Unrecognized shard: ") + shard); }
+            shard_index = std::stoi(shard.substr(0, slash));
+            num_shards  = std::stoi(shard.substr(slash + 1));
+            if (num_shards < 1 || shard_index < 0 || shard_index >= num_shards) {
+                Error(std::string("Invalid shard: ") + shard);
+            }
+        } else if (std::string(argv[i]) == "--resume") {
+            resume = true;
+        } else if (std::string(argv[i]) == "--checkpoint") {
+            checkpoint  = parse_duration(std::string(argv[++i]));
+            progressive = true;
         } else {
             filenames.push_back(std::string(argv[i]));
         }
     }
+    if (server) {
+        RTCDevice embree_device = rtcNewDevice(nullptr);
+        parallel_init(num_threads);
+        run_server(embree_device, socket, texture_cache, mesh_cache);
+        parallel_cleanup();
+        rtcReleaseDevice(embree_device);
+        return 0;
+    }
     if (filenames.empty()) {
         std::cerr << "ERROR: No input file specified." << std::endl;
         return 1;
     }
 
     RTCDevice embree_device = rtcNewDevice(nullptr);
+    // The hardware counters follow the threads created after them.
+    if (stats_file != "") { open_hardware_counters(); }
     parallel_init(num_threads);
 
+    std::vector<std::pair<std::string, StatsReport>> stats;
     for (const std::string& filename : filenames) {
+        StatsReport stats_begin = collect_stats();
         Timer timer;
         tick(timer);
         std::cout << "Parsing and constructing scene " << filename << "." << std::endl;
-        std::unique_ptr<Scene> scene = parse_scene(filename, embree_device);
+        std::unique_ptr<Scene> scene = parse_scene(filename, embree_device, texture_cache, mesh_cache);
         std::cout << "Done. Took " << tick(timer) << " seconds." << std::endl;
+        if (outputfile.compare("") == 0) { outputfile = scene->output_filename; }
+        scene->output_filename = outputfile;
+        if (spp > 0) {
+            scene->options.samples_per_pixel = spp;
+        } else if (time_budget > 0) {
+            // Only the time budget is given: keep on going until it runs out.
+            scene->options.samples_per_pixel = std::numeric_limits<int>::max();
+        }
+        scene->options.progressive         = progressive;
+        scene->options.time_budget         = time_budget;
+        scene->options.checkpoint_interval = checkpoint;
+        scene->options.resume              = resume;
+        scene->options.shard_index         = shard_index;
+        scene->options.num_shards          = num_shards;
+        if (adaptive > 0) { scene->options.adaptive_threshold = adaptive; }
+        if (tile_size > 0) { scene->options.tile_size = tile_size; }
+        if (tile_order != "") { scene->options.tile_order = parse_tile_order(tile_order); }
         std::cout << "Rendering..." << std::endl;
         Image3 img = render(*scene);
-        if (outputfile.compare("") == 0) { outputfile = scene->output_filename; }
         std::cout << "Done. Took " << tick(timer) << " seconds." << std::endl;
-        imwrite(outputfile, img);
-        std::cout << "Image written to " << outputfile << std::endl;
+        if (num_shards > 1) {
+            // The shards would overwrite each other's image: lajolla merge writes it.
+            std::cout << "Shard written to " << checkpoint_filename(*scene).string() << std::endl;
+        } else {
+            StatPhaseTimer phase_timer(StatPhase::Write);
+            imwrite(outputfile, img);
+            std::cout << "Image written to " << outputfile << std::endl;
+        }
+        if (stats_file != "") {
+            StatsReport report = collect_stats() - stats_begin;
+            uint64_t num_rays  = report.counters[int(StatCounter::IntersectRays)] +
+                                report.counters[int(StatCounter::ShadowRays)];
+            Real render_time   = report.phase_seconds[int(StatPhase::Render)];
+            std::cout << "Traced " << num_rays << " rays (" << (render_time > 0 ? num_rays / render_time / 1e6 : 0)
+                      << " Mrays/s)." << std::endl;
+            stats.push_back({ filename, report });
+        }
+    }
+
+    if (stats_file != "") {
+        std::ofstream os(stats_file);
+        if (!os) { Error(std::string("Cannot write the statistics to ") + stats_file); }
+        os << "[\n";
+        for (int i = 0; i < (int)stats.size(); i++) {
+            write_stats_json(os, stats[i].first, stats[i].second, 2);
+            os << (i + 1 < (int)stats.size() ? ",\n" : "\n");
+        }
+        os << "]\n";
+        std::cout << "Statistics written to " << stats_file << std::endl;
     }
 
     parallel_cleanup();
@@ -0,0 +1,33 @@
+#include "mapped_file.h"
+#include "flexception.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const fs::path& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) { Error(std::string("Unable to open ") + filename.string()); }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        Error(std::string("Unable to stat ") + filename.string());
+    }
+    size = size_t(st.st_size);
+    if (size > 0) {
+        void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            close(fd);
+            Error(std::string("Unable to map ") + filename.string());
+        }
+        // We mostly read front to back
+        madvise(ptr, size, MADV_SEQUENTIAL);
+        data = (const char*)ptr;
+    }
+    // The mapping stays valid after the file is closed.
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data != nullptr) { munmap((void*)data, size); }
+}
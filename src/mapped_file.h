@@ -0,0 +1,17 @@
+#pragma once
+
+#include "lajolla.h"
+
+/// A read-only memory mapping of a whole file.
+/// The pages are loaded by the OS as they are touched, so reading through the mapping
+/// avoids both the copies and the small reads of stream-based IO.
+struct MappedFile {
+    MappedFile(const fs::path& filename);
+    ~MappedFile();
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /// nullptr for an empty file
+    const char* data = nullptr;
+    size_t size      = 0;
+};
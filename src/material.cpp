@@ -1,5 +1,6 @@
 #include "material.h"
 #include "intersection.h"
+#include "stats.h"
 
 inline Vector3 sample_cos_hemisphere(const Vector2& rnd_param) {
     Real phi = c_TWOPI * rnd_param[0];
@@ -18,6 +19,7 @@ struct eval_op {
     Spectrum operator()(const DisneyClearcoat& bsdf) const;
     Spectrum operator()(const DisneySheen& bsdf) const;
     Spectrum operator()(const DisneyBSDF& bsdf) const;
+    Spectrum operator()(const PreparedDisneyBSDF& bsdf) const;
 
     const Vector3& dir_in;
     const Vector3& dir_out;
@@ -37,6 +39,7 @@ struct pdf_sample_bsdf_op {
     Real operator()(const DisneyClearcoat& bsdf) const;
     Real operator()(const DisneySheen& bsdf) const;
     Real operator()(const DisneyBSDF& bsdf) const;
+    Real operator()(const PreparedDisneyBSDF& bsdf) const;
 
     const Vector3& dir_in;
     const Vector3& dir_out;
@@ -56,6 +59,7 @@ struct sample_bsdf_op {
     std::optional<BSDFSampleRecord> operator()(const DisneyClearcoat& bsdf) const;
     std::optional<BSDFSampleRecord> operator()(const DisneySheen& bsdf) const;
     std::optional<BSDFSampleRecord> operator()(const DisneyBSDF& bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const PreparedDisneyBSDF& bsdf) const;
 
     const Vector3& dir_in;
     const PathVertex& vertex;
@@ -76,9 +80,9 @@ struct get_texture_op {
     TextureSpectrum operator()(const DisneyClearcoat& bsdf) const;
     TextureSpectrum operator()(const DisneySheen& bsdf) const;
     TextureSpectrum operator()(const DisneyBSDF& bsdf) const;
+    TextureSpectrum operator()(const PreparedDisneyBSDF& bsdf) const;
 };
 
-#include "materials/disney_bsdf.inl"
 #include "materials/disney_clearcoat.inl"
 #include "materials/disney_diffuse.inl"
 #include "materials/disney_glass.inl"
@@ -88,6 +92,15 @@ struct get_texture_op {
 #include "materials/lambertian.inl"
 #include "materials/roughdielectric.inl"
 #include "materials/roughplastic.inl"
+// The DisneyBSDF combines the lobes above
+#include "materials/disney_bsdf.inl"
+
+Material prepare_material(const Material& material, const PathVertex& vertex, const TexturePool& texture_pool) {
+    if (const DisneyBSDF* bsdf = std::get_if<DisneyBSDF>(&material)) {
+        return prepare_disney_bsdf(*bsdf, vertex, texture_pool);
+    }
+    return material;
+}
 
 Spectrum eval(const Material& material, const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex,
               const TexturePool& texture_pool, TransportDirection dir) {
@@ -97,6 +110,7 @@ Spectrum eval(const Material& material, const Vector3& dir_in, const Vector3& di
 std::optional<BSDFSampleRecord> sample_bsdf(const Material& material, const Vector3& dir_in, const PathVertex& vertex,
                                             const TexturePool& texture_pool, const Vector2& rnd_param_uv,
                                             const Real& rnd_param_w, TransportDirection dir) {
+    add_stat(StatCounter::BsdfSamples);
     return std::visit(sample_bsdf_op{ dir_in, vertex, texture_pool, rnd_param_uv, rnd_param_w, dir }, material);
 }
 
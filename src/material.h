@@ -110,15 +110,40 @@ struct DisneyBSDF {
     Real eta;
 };
 
+/// A DisneyBSDF with its textures evaluated at a surface point: a flat closure that eval,
+/// sample_bsdf, and pdf_sample_bsdf use without fetching any texture (see prepare_material).
+/// It is not a material of the scene files.
+struct PreparedDisneyBSDF {
+    Spectrum base_color;
+    Real specular_transmission;
+    Real metallic;
+    Real specular;
+    Real roughness;
+    Real specular_tint;
+    Real anisotropic;
+    Real sheen;
+    Real sheen_tint;
+    Real clearcoat;
+    Real clearcoat_gloss;
+
+    Real eta;
+};
+
 // To add more materials, first create a struct for the material, then overload the () operators for all the
 // functors below.
 using Material = std::variant<Lambertian, RoughPlastic, RoughDielectric, DisneyDiffuse, DisneyMetal, DisneyGlass,
-                              DisneyClearcoat, DisneySheen, DisneyBSDF>;
+                              DisneyClearcoat, DisneySheen, DisneyBSDF, PreparedDisneyBSDF>;
 
 /// We allow non-reciprocal BRDFs, so it's important
 /// to distinguish which direction we are tracing the rays.
 enum class TransportDirection { TO_LIGHT, TO_VIEW };
 
+/// Evaluate the textures of a material at a surface point once for all the BSDF queries
+/// (eval, sample_bsdf, pdf_sample_bsdf) at that point. A DisneyBSDF evaluates its textures
+/// again for each of its lobes and each query, so it becomes a PreparedDisneyBSDF.
+/// The other materials only look up each texture once per query, and are returned as they are.
+Material prepare_material(const Material& material, const PathVertex& vertex, const TexturePool& texture_pool);
+
 /// Given incoming direction and outgoing direction of lights,
 /// both pointing outwards of the surface point,
 /// outputs the BSDF times the cosine between outgoing direction
@@ -1,224 +1,134 @@
 #include "../microfacet.h"
 
+inline PreparedDisneyBSDF prepare_disney_bsdf(const DisneyBSDF& bsdf, const PathVertex& vertex,
+                                              const TexturePool& texture_pool) {
+    auto eval_texture = [&](const auto& texture) {
+        return eval(texture, vertex.uv, vertex.uv_screen_size, texture_pool);
+    };
+    PreparedDisneyBSDF prepared;
+    prepared.base_color            = eval_texture(bsdf.base_color);
+    prepared.specular_transmission = eval_texture(bsdf.specular_transmission);
+    prepared.metallic              = eval_texture(bsdf.metallic);
+    prepared.specular              = eval_texture(bsdf.specular);
+    prepared.roughness             = eval_texture(bsdf.roughness);
+    prepared.specular_tint         = eval_texture(bsdf.specular_tint);
+    prepared.anisotropic           = eval_texture(bsdf.anisotropic);
+    prepared.sheen                 = eval_texture(bsdf.sheen);
+    prepared.sheen_tint            = eval_texture(bsdf.sheen_tint);
+    prepared.clearcoat             = eval_texture(bsdf.clearcoat);
+    prepared.clearcoat_gloss       = eval_texture(bsdf.clearcoat_gloss);
+    prepared.eta                   = bsdf.eta;
+    return prepared;
+}
+
+// Without prepare_material, the DisneyBSDF evaluates all its textures for every query.
 Spectrum eval_op::operator()(const DisneyBSDF& bsdf) const {
-    // bool reflect = dot(vertex.geometric_normal, dir_in) *
-    //                dot(vertex.geometric_normal, dir_out) > 0;
-    // Flip the shading frame if it is inconsistent with the geometry normal
-    Frame frame = vertex.shading_frame;
-    if (dot(frame.n, dir_in) * dot(vertex.geometric_normal, dir_in) < 0) { frame = -frame; }
+    return (*this)(prepare_disney_bsdf(bsdf, vertex, texture_pool));
+}
+
+Real pdf_sample_bsdf_op::operator()(const DisneyBSDF& bsdf) const {
+    return (*this)(prepare_disney_bsdf(bsdf, vertex, texture_pool));
+}
+
+std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyBSDF& bsdf) const {
+    return (*this)(prepare_disney_bsdf(bsdf, vertex, texture_pool));
+}
+
+Spectrum eval_op::operator()(const PreparedDisneyBSDF& bsdf) const {
     // Homework 1: Wuqiong Zhao's implementation.
     // Check inside vs outside
     bool inside = (dot(vertex.geometric_normal, dir_in) < 0.0);
-
-    Real metallic  = eval(bsdf.metallic, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real specTrans = eval(bsdf.specular_transmission, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real sheen     = eval(bsdf.sheen, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real clearcoat = eval(bsdf.clearcoat, vertex.uv, vertex.uv_screen_size, texture_pool);
-
     if (inside) {
-        DisneyGlass glassBSDF;
-        // fill in all fields
-        glassBSDF.base_color  = bsdf.base_color;
-        glassBSDF.roughness   = bsdf.roughness;
-        glassBSDF.anisotropic = bsdf.anisotropic;
-        glassBSDF.eta         = bsdf.eta;
-
-        return eval_op{ dir_in, dir_out, vertex, texture_pool, dir }(glassBSDF);
+        return eval_disney_glass(dir_in, dir_out, vertex, bsdf.base_color, bsdf.roughness, bsdf.anisotropic, bsdf.eta);
     }
 
-    // Diffuse
-    DisneyDiffuse diffBSDF;
-    diffBSDF.base_color = bsdf.base_color;
-    diffBSDF.roughness  = bsdf.roughness;
-    Spectrum f_diffuse  = eval_op{ dir_in, dir_out, vertex, texture_pool, dir }(diffBSDF);
-
-    // Sheen
-    DisneySheen sheenBSDF;
-    sheenBSDF.base_color = bsdf.base_color;
-    sheenBSDF.sheen_tint = bsdf.sheen_tint;
-    Spectrum f_sheen     = eval_op{ dir_in, dir_out, vertex, texture_pool, dir }(sheenBSDF);
-
-    // Modified Metal
-    DisneyMetalModified metalBSDF;
-    metalBSDF.base_color    = bsdf.base_color;
-    metalBSDF.roughness     = bsdf.roughness;
-    metalBSDF.anisotropic   = bsdf.anisotropic;
-    metalBSDF.metallic      = bsdf.metallic;
-    metalBSDF.specular      = bsdf.specular;
-    metalBSDF.specular_tint = bsdf.specular_tint;
-    metalBSDF.eta           = bsdf.eta;
-
-    Spectrum f_metal = eval_op{ dir_in, dir_out, vertex, texture_pool, dir }(metalBSDF);
-
-    // -- Clearcoat
-    DisneyClearcoat coatBSDF;
-    coatBSDF.clearcoat_gloss = bsdf.clearcoat_gloss;
-    Spectrum f_clearcoat     = eval_op{ dir_in, dir_out, vertex, texture_pool, dir }(coatBSDF);
-
-    // -- Glass
-    DisneyGlass glassBSDF;
-    glassBSDF.base_color  = bsdf.base_color;
-    glassBSDF.roughness   = bsdf.roughness;
-    glassBSDF.anisotropic = bsdf.anisotropic;
-    glassBSDF.eta         = bsdf.eta;
-    Spectrum f_glass      = eval_op{ dir_in, dir_out, vertex, texture_pool, dir }(glassBSDF);
-
+    // The diffuse lobe has no subsurface term in the DisneyBSDF.
+    Spectrum f_diffuse   = eval_disney_diffuse(dir_in, dir_out, vertex, bsdf.base_color, bsdf.roughness, Real(0));
+    Spectrum f_sheen     = eval_disney_sheen(dir_in, dir_out, vertex, bsdf.base_color, bsdf.sheen_tint);
+    Spectrum f_metal     = eval_disney_metal_modified(dir_in, dir_out, vertex, bsdf.base_color, bsdf.roughness,
+                                                      bsdf.anisotropic, bsdf.specular, bsdf.metallic,
+                                                      bsdf.specular_tint, bsdf.eta);
+    Spectrum f_clearcoat = eval_disney_clearcoat(dir_in, dir_out, vertex, bsdf.clearcoat_gloss);
+    Spectrum f_glass     = eval_disney_glass(dir_in, dir_out, vertex, bsdf.base_color, bsdf.roughness,
+                                             bsdf.anisotropic, bsdf.eta);
+
+    Real metallic   = bsdf.metallic;
+    Real specTrans  = bsdf.specular_transmission;
     Real wDiffuse   = (1 - specTrans) * (1 - metallic);
-    Real wSheen     = (1 - metallic) * sheen;
+    Real wSheen     = (1 - metallic) * bsdf.sheen;
     Real wMetal     = (1 - specTrans * (1 - metallic));
-    Real wClearcoat = 0.25 * clearcoat;
+    Real wClearcoat = 0.25 * bsdf.clearcoat;
     Real wGlass     = (1 - metallic) * specTrans;
 
     return wDiffuse * f_diffuse + wSheen * f_sheen + wMetal * f_metal + wClearcoat * f_clearcoat + wGlass * f_glass;
 }
 
-Real pdf_sample_bsdf_op::operator()(const DisneyBSDF& bsdf) const {
-    // bool reflect = dot(vertex.geometric_normal, dir_in) *
-    //                dot(vertex.geometric_normal, dir_out) > 0;
-    // Flip the shading frame if it is inconsistent with the geometry normal
-    Frame frame = vertex.shading_frame;
-    if (dot(frame.n, dir_in) * dot(vertex.geometric_normal, dir_in) < 0) { frame = -frame; }
+Real pdf_sample_bsdf_op::operator()(const PreparedDisneyBSDF& bsdf) const {
     // Homework 1: Wuqiong Zhao's implementation.
     bool inside = (dot(vertex.geometric_normal, dir_in) < 0.0);
-
-    Real metallic  = eval(bsdf.metallic, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real specTrans = eval(bsdf.specular_transmission, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real clearcoat = eval(bsdf.clearcoat, vertex.uv, vertex.uv_screen_size, texture_pool);
-
     if (inside) {
         // Only Glass
-        DisneyGlass glassBSDF;
-        glassBSDF.base_color  = bsdf.base_color;
-        glassBSDF.roughness   = bsdf.roughness;
-        glassBSDF.anisotropic = bsdf.anisotropic;
-        glassBSDF.eta         = bsdf.eta;
-
-        return pdf_sample_bsdf_op{ dir_in, dir_out, vertex, texture_pool, dir }(glassBSDF);
+        return pdf_disney_glass(dir_in, dir_out, vertex, bsdf.roughness, bsdf.anisotropic, bsdf.eta);
     }
 
-    Real wD   = (1 - specTrans) * (1 - metallic);
-    Real wM   = (1 - specTrans * (1 - metallic));
-    Real wC   = 0.25 * clearcoat;
-    Real wG   = (1 - metallic) * specTrans;
-    Real sumW = (wD + wM + wC + wG);
+    Real metallic  = bsdf.metallic;
+    Real specTrans = bsdf.specular_transmission;
+    Real wD        = (1 - specTrans) * (1 - metallic);
+    Real wM        = (1 - specTrans * (1 - metallic));
+    Real wC        = 0.25 * bsdf.clearcoat;
+    Real wG        = (1 - metallic) * specTrans;
+    Real sumW      = (wD + wM + wC + wG);
 
     if (sumW < Real(0.05)) { return 0.0; }
 
-    // Diffuse
-    DisneyDiffuse diffBSDF;
-    diffBSDF.base_color = bsdf.base_color;
-    diffBSDF.roughness  = bsdf.roughness;
-    Real pdfD           = pdf_sample_bsdf_op{ dir_in, dir_out, vertex, texture_pool, dir }(diffBSDF);
-
-    // Metal
-    DisneyMetalModified metalBSDF;
-    metalBSDF.base_color    = bsdf.base_color;
-    metalBSDF.roughness     = bsdf.roughness;
-    metalBSDF.anisotropic   = bsdf.anisotropic;
-    metalBSDF.metallic      = bsdf.metallic;
-    metalBSDF.specular      = bsdf.specular;
-    metalBSDF.specular_tint = bsdf.specular_tint;
-    metalBSDF.eta           = bsdf.eta;
-    Real pdfM               = pdf_sample_bsdf_op{ dir_in, dir_out, vertex, texture_pool, dir }(metalBSDF);
-
-    // Clearcoat
-    DisneyClearcoat coatBSDF;
-    coatBSDF.clearcoat_gloss = bsdf.clearcoat_gloss;
-    Real pdfC                = pdf_sample_bsdf_op{ dir_in, dir_out, vertex, texture_pool, dir }(coatBSDF);
-
-    // Glass
-    DisneyGlass glassBSDF;
-    glassBSDF.base_color  = bsdf.base_color;
-    glassBSDF.roughness   = bsdf.roughness;
-    glassBSDF.anisotropic = bsdf.anisotropic;
-    glassBSDF.eta         = bsdf.eta;
-    Real pdfG             = pdf_sample_bsdf_op{ dir_in, dir_out, vertex, texture_pool, dir }(glassBSDF);
+    Real pdfD = pdf_disney_diffuse(dir_in, dir_out, vertex);
+    Real pdfM = pdf_disney_metal_modified(dir_in, dir_out, vertex, bsdf.roughness, bsdf.anisotropic);
+    Real pdfC = pdf_disney_clearcoat(dir_in, dir_out, vertex, bsdf.clearcoat_gloss);
+    Real pdfG = pdf_disney_glass(dir_in, dir_out, vertex, bsdf.roughness, bsdf.anisotropic, bsdf.eta);
 
     return (wD * pdfD + wM * pdfM + wC * pdfC + wG * pdfG) / sumW;
 }
 
-std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyBSDF& bsdf) const {
-    // Flip the shading frame if it is inconsistent with the geometry normal
-    Frame frame = vertex.shading_frame;
-    if (dot(frame.n, dir_in) * dot(vertex.geometric_normal, dir_in) < 0) { frame = -frame; }
+std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const PreparedDisneyBSDF& bsdf) const {
     // Homework 1: Wuqiong Zhao's implementation.
-    // Check inside
-    bool inside = (dot(vertex.geometric_normal, dir_in) < 0.0);
-
-    Real metallic  = eval(bsdf.metallic, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real specTrans = eval(bsdf.specular_transmission, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real clearcoat = eval(bsdf.clearcoat, vertex.uv, vertex.uv_screen_size, texture_pool);
-
     // If inside => sample only glass
+    bool inside = (dot(vertex.geometric_normal, dir_in) < 0.0);
     if (inside) {
-        DisneyGlass glassBSDF;
-        glassBSDF.base_color  = bsdf.base_color;
-        glassBSDF.roughness   = bsdf.roughness;
-        glassBSDF.anisotropic = bsdf.anisotropic;
-        glassBSDF.eta         = bsdf.eta;
-
-        return sample_bsdf_op{ dir_in, vertex, texture_pool, rnd_param_uv, rnd_param_w, dir }(glassBSDF);
+        return sample_disney_glass(dir_in, vertex, bsdf.roughness, bsdf.anisotropic, bsdf.eta, rnd_param_uv,
+                                   rnd_param_w);
     }
 
     // Weights
-    Real wD   = (1 - specTrans) * (1 - metallic);
-    Real wM   = (1 - specTrans * (1 - metallic));
-    Real wC   = 0.25 * clearcoat;
-    Real wG   = (1 - metallic) * specTrans;
-    Real sumW = wD + wM + wC + wG;
+    Real metallic  = bsdf.metallic;
+    Real specTrans = bsdf.specular_transmission;
+    Real wD        = (1 - specTrans) * (1 - metallic);
+    Real wM        = (1 - specTrans * (1 - metallic));
+    Real wC        = 0.25 * bsdf.clearcoat;
+    Real wG        = (1 - metallic) * specTrans;
+    Real sumW      = wD + wM + wC + wG;
     if (sumW < Real(0.05)) { return {}; }
 
+    // Pick a lobe, and reuse the random number for the lobe
     Real Xi = rnd_param_uv.x * sumW;
-
     if (Xi < wD) {
-        DisneyDiffuse diffBSDF;
-        diffBSDF.base_color = bsdf.base_color;
-        diffBSDF.roughness  = bsdf.roughness;
-        Real newX           = Xi / wD;
-        return sample_bsdf_op{ dir_in, vertex, texture_pool, Vector2(newX, rnd_param_uv.y), rnd_param_w, dir }(
-            diffBSDF);
+        return sample_disney_diffuse(dir_in, vertex, bsdf.roughness, Vector2(Xi / wD, rnd_param_uv.y));
     }
     Xi -= wD;
-
-    // Metal
     if (Xi < wM) {
-        DisneyMetalModified metalBSDF;
-        metalBSDF.base_color    = bsdf.base_color;
-        metalBSDF.roughness     = bsdf.roughness;
-        metalBSDF.anisotropic   = bsdf.anisotropic;
-        metalBSDF.metallic      = bsdf.metallic;
-        metalBSDF.specular      = bsdf.specular;
-        metalBSDF.specular_tint = bsdf.specular_tint;
-        metalBSDF.eta           = bsdf.eta;
-
-        Real newX = Xi / wM;
-        return sample_bsdf_op{ dir_in, vertex, texture_pool, Vector2(newX, rnd_param_uv.y), rnd_param_w, dir }(
-            metalBSDF);
+        return sample_disney_metal_modified(dir_in, vertex, bsdf.roughness, bsdf.anisotropic,
+                                            Vector2(Xi / wM, rnd_param_uv.y));
     }
     Xi -= wM;
-
-    // Clearcoat
     if (Xi < wC) {
-        DisneyClearcoat coatBSDF;
-        coatBSDF.clearcoat_gloss = bsdf.clearcoat_gloss;
-        Real newX                = Xi / wC;
-        return sample_bsdf_op{ dir_in, vertex, texture_pool, Vector2(newX, rnd_param_uv.y), rnd_param_w, dir }(
-            coatBSDF);
+        return sample_disney_clearcoat(dir_in, vertex, bsdf.clearcoat_gloss, Vector2(Xi / wC, rnd_param_uv.y));
     }
     Xi -= wC;
-
-    // Glass
-    {
-        DisneyGlass glassBSDF;
-        glassBSDF.base_color  = bsdf.base_color;
-        glassBSDF.roughness   = bsdf.roughness;
-        glassBSDF.anisotropic = bsdf.anisotropic;
-        glassBSDF.eta         = bsdf.eta;
-
-        Real newX = Xi / wG;
-        return sample_bsdf_op{ dir_in, vertex, texture_pool, Vector2(newX, rnd_param_uv.y), rnd_param_w, dir }(
-            glassBSDF);
-    }
+    return sample_disney_glass(dir_in, vertex, bsdf.roughness, bsdf.anisotropic, bsdf.eta,
+                               Vector2(Xi / wG, rnd_param_uv.y), rnd_param_w);
 }
 
 TextureSpectrum get_texture_op::operator()(const DisneyBSDF& bsdf) const { return bsdf.base_color; }
+
+TextureSpectrum get_texture_op::operator()(const PreparedDisneyBSDF& bsdf) const {
+    return make_constant_spectrum_texture(bsdf.base_color);
+}
@@ -1,6 +1,8 @@
 #include "../microfacet.h"
 
-Spectrum eval_op::operator()(const DisneyClearcoat& bsdf) const {
+/// The clearcoat lobe, given the evaluated clearcoat_gloss.
+inline Spectrum eval_disney_clearcoat(const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex,
+                                      Real gloss) {
     if (dot(vertex.geometric_normal, dir_in) < 0 || dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
         return make_zero_spectrum();
@@ -10,7 +12,6 @@ Spectrum eval_op::operator()(const DisneyClearcoat& bsdf) const {
     if (dot(frame.n, dir_in) < 0) { frame = -frame; }
 
     // Homework 1: Wuqiong Zhao's implementation.
-    Real gloss   = eval(bsdf.clearcoat_gloss, vertex.uv, vertex.uv_screen_size, texture_pool);
     Real alpha_g = (Real(1) - gloss) * Real(0.1) + gloss * Real(0.001);
 
     Vector3 lwi = to_local(frame, dir_in);
@@ -37,7 +38,7 @@ Spectrum eval_op::operator()(const DisneyClearcoat& bsdf) const {
     return Spectrum(f, f, f);
 }
 
-Real pdf_sample_bsdf_op::operator()(const DisneyClearcoat& bsdf) const {
+inline Real pdf_disney_clearcoat(const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex, Real gloss) {
     if (dot(vertex.geometric_normal, dir_in) < 0 || dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
         return 0;
@@ -47,7 +48,6 @@ Real pdf_sample_bsdf_op::operator()(const DisneyClearcoat& bsdf) const {
     if (dot(frame.n, dir_in) < 0) { frame = -frame; }
 
     // Homework 1: Wuqiong Zhao's implementation.
-    Real gloss   = eval(bsdf.clearcoat_gloss, vertex.uv, vertex.uv_screen_size, texture_pool);
     Real alpha_g = (Real(1) - gloss) * Real(0.1) + gloss * Real(0.001);
 
     Vector3 lwi = to_local(frame, dir_in);
@@ -75,7 +75,8 @@ inline Vector3 sample_clearcoat_half_vector(Real alpha, const Vector2& u) {
     return Vector3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
 }
 
-std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyClearcoat& bsdf) const {
+inline std::optional<BSDFSampleRecord> sample_disney_clearcoat(const Vector3& dir_in, const PathVertex& vertex,
+                                                               Real gloss, const Vector2& rnd_param_uv) {
     if (dot(vertex.geometric_normal, dir_in) < 0) {
         // No light below the surface
         return {};
@@ -85,9 +86,8 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyClearcoat
     if (dot(frame.n, dir_in) < 0) { frame = -frame; }
 
     // Homework 1: Wuqiong Zhao's implementation.
-    auto reflect_vector = [](const Vector3& i, const Vector3& m) { return i - 2.0 * dot(i, m) * m; };
+    auto reflect_vector = [](const Vector3& i, const Vector3& m) { return i - Real(2) * dot(i, m) * m; };
 
-    Real gloss   = eval(bsdf.clearcoat_gloss, vertex.uv, vertex.uv_screen_size, texture_pool);
     Real alpha_g = (Real(1) - gloss) * Real(0.1) + gloss * Real(0.001);
 
     Vector3 lwi = to_local(frame, dir_in);
@@ -99,6 +99,22 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyClearcoat
     return BSDFSampleRecord{ to_world(frame, lwo), Real(1.0), alpha_g };
 }
 
+Spectrum eval_op::operator()(const DisneyClearcoat& bsdf) const {
+    return eval_disney_clearcoat(dir_in, dir_out, vertex,
+                                 eval(bsdf.clearcoat_gloss, vertex.uv, vertex.uv_screen_size, texture_pool));
+}
+
+Real pdf_sample_bsdf_op::operator()(const DisneyClearcoat& bsdf) const {
+    return pdf_disney_clearcoat(dir_in, dir_out, vertex,
+                                eval(bsdf.clearcoat_gloss, vertex.uv, vertex.uv_screen_size, texture_pool));
+}
+
+std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyClearcoat& bsdf) const {
+    return sample_disney_clearcoat(dir_in, vertex,
+                                   eval(bsdf.clearcoat_gloss, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                   rnd_param_uv);
+}
+
 TextureSpectrum get_texture_op::operator()(const DisneyClearcoat& bsdf) const {
     return make_constant_spectrum_texture(make_zero_spectrum());
 }
@@ -1,4 +1,7 @@
-Spectrum eval_op::operator()(const DisneyDiffuse& bsdf) const {
+/// The Disney lobes take their textures already evaluated, so that the DisneyBSDF can share
+/// one evaluation between all its lobes (see PreparedDisneyBSDF).
+inline Spectrum eval_disney_diffuse(const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex,
+                                    const Spectrum& base_color, Real roughness, Real subsurface) {
     if (dot(vertex.geometric_normal, dir_in) < 0 || dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
         return make_zero_spectrum();
@@ -9,9 +12,6 @@ Spectrum eval_op::operator()(const DisneyDiffuse& bsdf) const {
 
     // Homework 1: Wuqiong Zhao's implementation.
     Vector3 half_vector = normalize(dir_in + dir_out);
-    Spectrum base_color = eval(bsdf.base_color, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real subsurface     = eval(bsdf.subsurface, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real roughness      = eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
     Real n_dot_in       = dot(frame.n, dir_in);
     Real n_dot_out      = dot(frame.n, dir_out);
     Real h_dot_out      = dot(half_vector, dir_out);
@@ -20,11 +20,11 @@ Spectrum eval_op::operator()(const DisneyDiffuse& bsdf) const {
     roughness = std::clamp(roughness, Real(0.01), Real(1));
 
     Real F_D90                    = Real(0.5) + Real(2) * roughness * (h_dot_out * h_dot_out);
-    auto F_D                      = [&](Real omega) { return 1 + (F_D90 - 1) * pow(1 - fabs(omega), 5); };
+    auto F_D                      = [&](Real omega) { return 1 + (F_D90 - 1) * pow(1 - fabs(omega), Real(5)); };
     Spectrum base_diffuse_contrib = (base_color / c_PI) * F_D(n_dot_in) * F_D(n_dot_out);
 
     Real F_SS90 = roughness * (h_dot_out * h_dot_out);
-    auto F_SS   = [&](Real omega) { return 1 + (F_SS90 - 1) * pow(1 - fabs(omega), 5); };
+    auto F_SS   = [&](Real omega) { return 1 + (F_SS90 - 1) * pow(1 - fabs(omega), Real(5)); };
     Spectrum subsurface_contrib =
         (Real(1.25) * base_color / c_PI) *
         (F_SS(n_dot_in) * F_SS(n_dot_out) * (Real(1.0) / (fabs(n_dot_in) + fabs(n_dot_out)) - Real(0.5)) + Real(0.5));
@@ -32,7 +32,7 @@ Spectrum eval_op::operator()(const DisneyDiffuse& bsdf) const {
     return ((Real(1.0) - subsurface) * base_diffuse_contrib + subsurface * subsurface_contrib) * fabs(n_dot_out);
 }
 
-Real pdf_sample_bsdf_op::operator()(const DisneyDiffuse& bsdf) const {
+inline Real pdf_disney_diffuse(const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex) {
     if (dot(vertex.geometric_normal, dir_in) < 0 || dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
         return Real(0);
@@ -45,7 +45,8 @@ Real pdf_sample_bsdf_op::operator()(const DisneyDiffuse& bsdf) const {
     return fmax(dot(frame.n, dir_out), Real(0)) / c_PI;
 }
 
-std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyDiffuse& bsdf) const {
+inline std::optional<BSDFSampleRecord> sample_disney_diffuse(const Vector3& dir_in, const PathVertex& vertex,
+                                                             Real roughness, const Vector2& rnd_param_uv) {
     if (dot(vertex.geometric_normal, dir_in) < 0) {
         // No light below the surface
         return {};
@@ -55,8 +56,23 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyDiffuse&
     if (dot(frame.n, dir_in) < 0) { frame = -frame; }
 
     // Homework 1: Wuqiong Zhao's implementation.
-    Real roughness = eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
     return BSDFSampleRecord{ to_world(frame, sample_cos_hemisphere(rnd_param_uv)), Real(0) /* eta */, roughness };
 }
 
+Spectrum eval_op::operator()(const DisneyDiffuse& bsdf) const {
+    return eval_disney_diffuse(dir_in, dir_out, vertex,
+                               eval(bsdf.base_color, vertex.uv, vertex.uv_screen_size, texture_pool),
+                               eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+                               eval(bsdf.subsurface, vertex.uv, vertex.uv_screen_size, texture_pool));
+}
+
+Real pdf_sample_bsdf_op::operator()(const DisneyDiffuse& bsdf) const {
+    return pdf_disney_diffuse(dir_in, dir_out, vertex);
+}
+
+std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyDiffuse& bsdf) const {
+    return sample_disney_diffuse(dir_in, vertex, eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                 rnd_param_uv);
+}
+
 TextureSpectrum get_texture_op::operator()(const DisneyDiffuse& bsdf) const { return bsdf.base_color; }
@@ -1,16 +1,15 @@
 #include "../microfacet.h"
 
-Spectrum eval_op::operator()(const DisneyGlass& bsdf) const {
+/// The glass lobe on its evaluated textures. bsdf_eta is the internal IOR / external IOR.
+inline Spectrum eval_disney_glass(const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex,
+                                  const Spectrum& base_color, Real roughness, Real anisotropic, Real bsdf_eta) {
     bool reflect = dot(vertex.geometric_normal, dir_in) * dot(vertex.geometric_normal, dir_out) > 0;
     // Flip the shading frame if it is inconsistent with the geometry normal
     Frame frame = vertex.shading_frame;
     if (dot(frame.n, dir_in) * dot(vertex.geometric_normal, dir_in) < 0) { frame = -frame; }
 
     // Homework 1: Wuqiong Zhao's implementation.
-    Spectrum base_color = eval(bsdf.base_color, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real roughness      = eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real anisotropic    = eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real eta            = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf.eta : 1 / bsdf.eta;
+    Real eta = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf_eta : 1 / bsdf_eta;
 
     Vector3 half_vector, lwh;
 
@@ -43,12 +42,13 @@ Spectrum eval_op::operator()(const DisneyGlass& bsdf) const {
     } else {
         Real h_dot_out  = dot(half_vector, dir_out);
         Real sqrt_denom = h_dot_in + eta * h_dot_out;
-        return base_color.sqrt() * ((1 - F) * D * G * fabs(h_dot_out * h_dot_in)) /
+        return sqrt(base_color) * ((1 - F) * D * G * fabs(h_dot_out * h_dot_in)) /
                (fabs(dot(frame.n, dir_in)) * sqrt_denom * sqrt_denom);
     }
 }
 
-Real pdf_sample_bsdf_op::operator()(const DisneyGlass& bsdf) const {
+inline Real pdf_disney_glass(const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex, Real roughness,
+                             Real anisotropic, Real bsdf_eta) {
     bool reflect = dot(vertex.geometric_normal, dir_in) * dot(vertex.geometric_normal, dir_out) > 0;
     // Flip the shading frame if it is inconsistent with the geometry normal
     Frame frame = vertex.shading_frame;
@@ -57,7 +57,7 @@ Real pdf_sample_bsdf_op::operator()(const DisneyGlass& bsdf) const {
     // Homework 1: Wuqiong Zhao's implementation.
     // If we are going into the surface, then we use normal eta
     // (internal/external), otherwise we use external/internal.
-    Real eta = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf.eta : 1 / bsdf.eta;
+    Real eta = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf_eta : 1 / bsdf_eta;
     assert(eta > 0);
 
     Vector3 half_vector, lwh;
@@ -79,8 +79,6 @@ Real pdf_sample_bsdf_op::operator()(const DisneyGlass& bsdf) const {
     // Flip half-vector if it's below surface
     if (dot(half_vector, frame.n) < 0) { half_vector = -half_vector; }
 
-    Real roughness   = eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real anisotropic = eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool);
     // Clamp roughness to avoid numerical issues.
     roughness = std::clamp(roughness, Real(0.01), Real(1));
 
@@ -98,7 +96,9 @@ Real pdf_sample_bsdf_op::operator()(const DisneyGlass& bsdf) const {
     }
 }
 
-std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyGlass& bsdf) const {
+inline std::optional<BSDFSampleRecord> sample_disney_glass(const Vector3& dir_in, const PathVertex& vertex,
+                                                           Real roughness, Real anisotropic, Real bsdf_eta,
+                                                           const Vector2& rnd_param_uv, Real rnd_param_w) {
     // Flip the shading frame if it is inconsistent with the geometry normal
     Frame frame = vertex.shading_frame;
     if (dot(frame.n, dir_in) * dot(vertex.geometric_normal, dir_in) < 0) { frame = -frame; }
@@ -106,9 +106,7 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyGlass& bs
     // Homework 1: Wuqiong Zhao's implementation.
     // If we are going into the surface, then we use normal eta
     // (internal/external), otherwise we use external/internal.
-    Real eta         = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf.eta : 1 / bsdf.eta;
-    Real roughness   = eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real anisotropic = eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool);
+    Real eta = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf_eta : 1 / bsdf_eta;
     // Clamp roughness to avoid numerical issues.
     roughness = std::clamp(roughness, Real(0.01), Real(1));
 
@@ -151,4 +149,23 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyGlass& bs
     }
 }
 
+Spectrum eval_op::operator()(const DisneyGlass& bsdf) const {
+    return eval_disney_glass(dir_in, dir_out, vertex,
+                             eval(bsdf.base_color, vertex.uv, vertex.uv_screen_size, texture_pool),
+                             eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+                             eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool), bsdf.eta);
+}
+
+Real pdf_sample_bsdf_op::operator()(const DisneyGlass& bsdf) const {
+    return pdf_disney_glass(dir_in, dir_out, vertex,
+                            eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+                            eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool), bsdf.eta);
+}
+
+std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyGlass& bsdf) const {
+    return sample_disney_glass(dir_in, vertex, eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+                               eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool), bsdf.eta,
+                               rnd_param_uv, rnd_param_w);
+}
+
 TextureSpectrum get_texture_op::operator()(const DisneyGlass& bsdf) const { return bsdf.base_color; }
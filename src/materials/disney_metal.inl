@@ -23,7 +23,7 @@ Spectrum eval_op::operator()(const DisneyMetal& bsdf) const {
     // Clamp roughness to avoid numerical issues.
     roughness = std::clamp(roughness, Real(0.01), Real(1));
 
-    Spectrum F_m = base_color + (1.0 - base_color) * pow(Real(1.0) - fabs(h_dot_out), 5.0);
+    Spectrum F_m = base_color + (Real(1) - base_color) * pow(Real(1.0) - fabs(h_dot_out), Real(5));
     Real D_m     = GGX(lwh, roughness, anisotropic);
     Real G_in    = smith_masking_gtr2(lwi, roughness, anisotropic);
     Real G_out   = smith_masking_gtr2(lwo, roughness, anisotropic);
@@ -76,7 +76,7 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyMetal& bs
     Real alpha_x     = std::max(Real(0.0001), (roughness * roughness) / aspect);
     Real alpha_y     = std::max(Real(0.0001), (roughness * roughness) * aspect);
 
-    auto reflect_vector = [](const Vector3& i, const Vector3& m) { return i - 2.0 * dot(i, m) * m; };
+    auto reflect_vector = [](const Vector3& i, const Vector3& m) { return i - Real(2) * dot(i, m) * m; };
 
     Vector3 v_local = to_local(frame, dir_in);
     // Vector3 h_local = sample_visible_normals(v_local, roughness * roughness, rnd_param_uv);
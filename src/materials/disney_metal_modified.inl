@@ -1,7 +1,10 @@
 #include "../microfacet.h"
 #include "material.h"
 
-Spectrum eval_op::operator()(const DisneyMetalModified& bsdf) const {
+/// The metal lobe of the DisneyBSDF, on its evaluated textures.
+inline Spectrum eval_disney_metal_modified(const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex,
+                                           const Spectrum& base_color, Real roughness, Real anisotropic,
+                                           Real specular, Real metallic, Real spec_tint, Real eta) {
     if (dot(vertex.geometric_normal, dir_in) < 0 || dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
         return make_zero_spectrum();
@@ -11,14 +14,7 @@ Spectrum eval_op::operator()(const DisneyMetalModified& bsdf) const {
     if (dot(frame.n, dir_in) < 0) { frame = -frame; }
 
     // Homework 1: Wuqiong Zhao's implementation.
-    Spectrum base_color = eval(bsdf.base_color, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real anisotropic    = eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real roughness      = eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real n_dot_in       = dot(frame.n, dir_in);
-    Real specular       = eval(bsdf.specular, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real metallic       = eval(bsdf.metallic, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real spec_tint      = eval(bsdf.specular_tint, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real eta            = bsdf.eta;
+    Real n_dot_in = dot(frame.n, dir_in);
 
     Vector3 lwi    = to_local(frame, dir_in);
     Vector3 lwo    = to_local(frame, dir_out);
@@ -35,12 +31,12 @@ Spectrum eval_op::operator()(const DisneyMetalModified& bsdf) const {
     Real r0 = r0_of_eta(eta);
 
     auto lum           = luminance(base_color);
-    Spectrum tintColor = make_const_spectrum(1.0);
+    Spectrum tintColor = make_const_spectrum(Real(1));
     if (lum > 0.0) { tintColor = base_color * (Real(1.0) / lum); }
 
-    Spectrum Ks = (Real(1) - spec_tint) * make_const_spectrum(1.0) + spec_tint * tintColor;
+    Spectrum Ks = (Real(1) - spec_tint) * make_const_spectrum(Real(1)) + spec_tint * tintColor;
     Spectrum c0 = specular * r0 * (Real(1) - metallic) * Ks + metallic * base_color;
-    Spectrum Fm = c0 + (make_const_spectrum(1.0) - c0) * std::pow(Real(1.0) - std::fabs(h_dot_out), Real(5.0));
+    Spectrum Fm = c0 + (make_const_spectrum(Real(1)) - c0) * std::pow(Real(1.0) - std::fabs(h_dot_out), Real(5.0));
 
     // 7) distribution & masking
     Real D_m   = GGX(lwh, roughness, anisotropic);
@@ -51,7 +47,8 @@ Spectrum eval_op::operator()(const DisneyMetalModified& bsdf) const {
     return (Fm * D_m * G_m) / (Real(4.0) * std::fabs(n_dot_in));
 }
 
-Real pdf_sample_bsdf_op::operator()(const DisneyMetalModified& bsdf) const {
+inline Real pdf_disney_metal_modified(const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex,
+                                      Real roughness, Real anisotropic) {
     if (dot(vertex.geometric_normal, dir_in) < 0 || dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
         return 0;
@@ -61,8 +58,6 @@ Real pdf_sample_bsdf_op::operator()(const DisneyMetalModified& bsdf) const {
     if (dot(frame.n, dir_in) < 0) { frame = -frame; }
 
     // Homework 1: Wuqiong Zhao's implementation.
-    Real anisotropic = eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real roughness   = eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
     // Clamp roughness to avoid numerical issues.
     roughness   = std::clamp(roughness, Real(0.01), Real(1));
     Vector3 lwi = to_local(frame, dir_in);
@@ -78,7 +73,9 @@ Real pdf_sample_bsdf_op::operator()(const DisneyMetalModified& bsdf) const {
     return D_m * G_in * fabs(lwh.z) / (4.0 * fabs(dot(lwh, lwo)));
 }
 
-std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyMetalModified& bsdf) const {
+inline std::optional<BSDFSampleRecord> sample_disney_metal_modified(const Vector3& dir_in, const PathVertex& vertex,
+                                                                    Real roughness, Real anisotropic,
+                                                                    const Vector2& rnd_param_uv) {
     if (dot(vertex.geometric_normal, dir_in) < 0) {
         // No light below the surface
         return {};
@@ -88,14 +85,12 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyMetalModi
     if (dot(frame.n, dir_in) < 0) { frame = -frame; }
 
     // Homework 1: Wuqiong Zhao's implementation.
-    Real roughness   = eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real anisotropic = eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real aspect      = std::sqrt(1.0 - 0.9 * anisotropic);
-    roughness        = std::clamp(roughness, Real(0.01), Real(1));
-    Real alpha_x     = std::max(Real(0.0001), (roughness * roughness) / aspect);
-    Real alpha_y     = std::max(Real(0.0001), (roughness * roughness) * aspect);
+    Real aspect  = std::sqrt(1.0 - 0.9 * anisotropic);
+    roughness    = std::clamp(roughness, Real(0.01), Real(1));
+    Real alpha_x = std::max(Real(0.0001), (roughness * roughness) / aspect);
+    Real alpha_y = std::max(Real(0.0001), (roughness * roughness) * aspect);
 
-    auto reflect_vector = [](const Vector3& i, const Vector3& m) { return i - 2.0 * dot(i, m) * m; };
+    auto reflect_vector = [](const Vector3& i, const Vector3& m) { return i - Real(2) * dot(i, m) * m; };
 
     Vector3 v_local = to_local(frame, dir_in);
     // Vector3 h_local = sample_visible_normals(v_local, roughness * roughness, rnd_param_uv);
@@ -107,4 +102,28 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyMetalModi
     return BSDFSampleRecord{ to_world(frame, lwo), Real(0.0), roughness };
 }
 
+Spectrum eval_op::operator()(const DisneyMetalModified& bsdf) const {
+    return eval_disney_metal_modified(dir_in, dir_out, vertex,
+                                      eval(bsdf.base_color, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                      eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                      eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                      eval(bsdf.specular, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                      eval(bsdf.metallic, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                      eval(bsdf.specular_tint, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                      bsdf.eta);
+}
+
+Real pdf_sample_bsdf_op::operator()(const DisneyMetalModified& bsdf) const {
+    return pdf_disney_metal_modified(dir_in, dir_out, vertex,
+                                     eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                     eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool));
+}
+
+std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyMetalModified& bsdf) const {
+    return sample_disney_metal_modified(dir_in, vertex,
+                                        eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                        eval(bsdf.anisotropic, vertex.uv, vertex.uv_screen_size, texture_pool),
+                                        rnd_param_uv);
+}
+
 TextureSpectrum get_texture_op::operator()(const DisneyMetalModified& bsdf) const { return bsdf.base_color; }
@@ -1,6 +1,8 @@
 #include "../microfacet.h"
 
-Spectrum eval_op::operator()(const DisneySheen& bsdf) const {
+/// The sheen lobe, on its evaluated textures.
+inline Spectrum eval_disney_sheen(const Vector3& dir_in, const Vector3& dir_out, const PathVertex& vertex,
+                                  const Spectrum& base_color, Real sheen_tint) {
     if (dot(vertex.geometric_normal, dir_in) < 0 || dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
         return make_zero_spectrum();
@@ -21,23 +23,26 @@ Spectrum eval_op::operator()(const DisneySheen& bsdf) const {
     Real len    = length(lwh);
     lwh /= len;
 
-    Spectrum base_color = eval(bsdf.base_color, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real sheen_tint     = eval(bsdf.sheen_tint, vertex.uv, vertex.uv_screen_size, texture_pool);
-
     Real lum        = luminance(base_color);
-    Spectrum c_tint = make_const_spectrum(1.0);
-    if (lum > 0.0) {
-        c_tint = base_color * (1.0 / lum); // hue of base_color
+    Spectrum c_tint = make_const_spectrum(Real(1));
+    if (lum > 0) {
+        c_tint = base_color * (Real(1) / lum); // hue of base_color
     }
-    Spectrum c_sheen = (1.0 - sheen_tint) * make_const_spectrum(1.0) + sheen_tint * c_tint;
+    Spectrum c_sheen = (Real(1) - sheen_tint) * make_const_spectrum(Real(1)) + sheen_tint * c_tint;
 
     Real h_dot_out  = dot(lwh, lwo);
-    Real sheen_term = std::pow(1.0 - std::fabs(h_dot_out), 5.0);
+    Real sheen_term = std::pow(Real(1) - std::fabs(h_dot_out), Real(5));
     Real n_dot_out  = lwo.z;
 
     return c_sheen * (sheen_term * n_dot_out);
 }
 
+Spectrum eval_op::operator()(const DisneySheen& bsdf) const {
+    return eval_disney_sheen(dir_in, dir_out, vertex,
+                             eval(bsdf.base_color, vertex.uv, vertex.uv_screen_size, texture_pool),
+                             eval(bsdf.sheen_tint, vertex.uv, vertex.uv_screen_size, texture_pool));
+}
+
 Real pdf_sample_bsdf_op::operator()(const DisneySheen& bsdf) const {
     if (dot(vertex.geometric_normal, dir_in) < 0 || dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
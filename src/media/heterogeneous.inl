@@ -19,3 +19,11 @@ Spectrum get_sigma_a_op::operator()(const HeterogeneousMedium& m) {
     Spectrum albedo  = lookup(m.albedo, p);
     return density * (Real(1) - albedo);
 }
+
+MajorantIterator make_majorant_iterator_op::operator()(const HeterogeneousMedium& m) {
+    if (m.majorant_grid.data.empty()) {
+        // Constant density (which is sigma_t)
+        return make_single_segment_iterator(get_max_value(m.density), 0, t_max, true);
+    }
+    return make_dda_iterator(m.majorant_grid, ray, t_max);
+}
@@ -3,3 +3,7 @@ Spectrum get_majorant_op::operator()(const HomogeneousMedium& m) { return m.sigm
 Spectrum get_sigma_s_op::operator()(const HomogeneousMedium& m) { return m.sigma_s; }
 
 Spectrum get_sigma_a_op::operator()(const HomogeneousMedium& m) { return m.sigma_a; }
+
+MajorantIterator make_majorant_iterator_op::operator()(const HomogeneousMedium& m) {
+    return make_single_segment_iterator(m.sigma_a + m.sigma_s, 0, t_max, true);
+}
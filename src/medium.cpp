@@ -21,11 +21,106 @@ struct get_sigma_a_op {
     const Vector3& p;
 };
 
+struct make_majorant_iterator_op {
+    MajorantIterator operator()(const HomogeneousMedium& m);
+    MajorantIterator operator()(const HeterogeneousMedium& m);
+
+    const Ray& ray;
+    Real t_max;
+};
+
+/// An iterator producing the single segment [t_min, t_max] with majorant sigma_maj.
+static MajorantIterator make_single_segment_iterator(const Spectrum& sigma_maj, Real t_min, Real t_max,
+                                                     bool homogeneous) {
+    MajorantIterator iter;
+    iter.sigma_maj   = sigma_maj;
+    iter.homogeneous = homogeneous;
+    iter.t_min       = t_min;
+    iter.t_max       = t_max;
+    return iter;
+}
+
+static MajorantIterator make_dda_iterator(const MajorantGrid<Spectrum>& grid, const Ray& ray, Real t_max) {
+    MajorantIterator iter;
+    iter.grid = &grid;
+    // Work in the grid space [0, 1]^3. The distances along the ray stay the same.
+    Vector3 extent = grid.p_max - grid.p_min;
+    Vector3 o      = (ray.org - grid.p_min) / extent;
+    Vector3 d      = ray.dir / extent;
+
+    // Clip the ray to the grid
+    Real t0 = 0, t1 = t_max;
+    for (int i = 0; i < 3; i++) {
+        Real tnear = (0 - o[i]) / d[i];
+        Real tfar  = (1 - o[i]) / d[i];
+        if (tnear > tfar) { std::swap(tnear, tfar); }
+        t0 = tnear > t0 ? tnear : t0;
+        t1 = tfar < t1 ? tfar : t1;
+    }
+    iter.t_min = t0;
+    iter.t_max = t1;
+    if (!(t0 < t1)) {
+        // Missed the grid (this also catches the NaNs of rays parallel to and on a slab boundary)
+        iter.t_max = iter.t_min;
+        return iter;
+    }
+
+    Vector3 p_start = o + d * t0;
+    for (int i = 0; i < 3; i++) {
+        int res         = grid.resolution[i];
+        iter.voxel[i]   = std::clamp(int(p_start[i] * res), 0, res - 1);
+        iter.delta_t[i] = d[i] != 0 ? 1 / (fabs(d[i]) * res) : infinity<Real>();
+        if (d[i] > 0) {
+            iter.next_crossing_t[i] = t0 + (Real(iter.voxel[i] + 1) / res - p_start[i]) / d[i];
+            iter.step[i]            = 1;
+            iter.voxel_limit[i]     = res;
+        } else if (d[i] < 0) {
+            iter.next_crossing_t[i] = t0 + (Real(iter.voxel[i]) / res - p_start[i]) / d[i];
+            iter.step[i]            = -1;
+            iter.voxel_limit[i]     = -1;
+        } else {
+            iter.next_crossing_t[i] = infinity<Real>();
+            iter.step[i]            = 0;
+            iter.voxel_limit[i]     = -1;
+        }
+    }
+    return iter;
+}
+
 #include "media/heterogeneous.inl"
 #include "media/homogeneous.inl"
 
 Spectrum get_majorant(const Medium& medium, const Ray& ray) { return std::visit(get_majorant_op{ ray }, medium); }
 
+MajorantIterator make_majorant_iterator(const Medium& medium, const Ray& ray, Real t_max) {
+    return std::visit(make_majorant_iterator_op{ ray, t_max }, medium);
+}
+
+std::optional<MajorantSegment> next_majorant_segment(MajorantIterator& iter) {
+    if (iter.t_min >= iter.t_max) { return {}; }
+    if (iter.grid == nullptr) {
+        MajorantSegment segment{ iter.t_min, iter.t_max, iter.sigma_maj, iter.homogeneous };
+        iter.t_min = iter.t_max;
+        return segment;
+    }
+
+    // The axis we cross first
+    int axis = 0;
+    if (iter.next_crossing_t[1] < iter.next_crossing_t[axis]) { axis = 1; }
+    if (iter.next_crossing_t[2] < iter.next_crossing_t[axis]) { axis = 2; }
+
+    const MajorantGrid<Spectrum>& grid = *iter.grid;
+    Real t_exit                        = min(iter.t_max, iter.next_crossing_t[axis]);
+    int index = (iter.voxel.z * grid.resolution.y + iter.voxel.y) * grid.resolution.x + iter.voxel.x;
+    MajorantSegment segment{ iter.t_min, t_exit, grid.data[index], false };
+
+    iter.t_min = t_exit;
+    iter.voxel[axis] += iter.step[axis];
+    if (iter.voxel[axis] == iter.voxel_limit[axis]) { iter.t_min = iter.t_max; }
+    iter.next_crossing_t[axis] += iter.delta_t[axis];
+    return segment;
+}
+
 Spectrum get_sigma_s(const Medium& medium, const Vector3& p) { return std::visit(get_sigma_s_op{ p }, medium); }
 
 Spectrum get_sigma_a(const Medium& medium, const Vector3& p) { return std::visit(get_sigma_a_op{ p }, medium); }
@@ -3,6 +3,7 @@
 #include "phase_function.h"
 #include "spectrum.h"
 #include "volume.h"
+#include <optional>
 #include <variant>
 
 struct Scene;
@@ -17,6 +18,8 @@ struct HomogeneousMedium : public MediumBase {
 
 struct HeterogeneousMedium : public MediumBase {
     VolumeSpectrum albedo, density;
+    /// Local maxima of density (which is sigma_t), built at load time with make_majorant_grid
+    MajorantGrid<Spectrum> majorant_grid;
 };
 
 using Medium = std::variant<HomogeneousMedium, HeterogeneousMedium>;
@@ -26,6 +29,34 @@ Spectrum get_majorant(const Medium& medium, const Ray& ray);
 Spectrum get_sigma_s(const Medium& medium, const Vector3& p);
 Spectrum get_sigma_a(const Medium& medium, const Vector3& p);
 
+/// A piece [t_min, t_max] of a ray over which sigma_t is bounded by sigma_maj.
+struct MajorantSegment {
+    Real t_min, t_max;
+    Spectrum sigma_maj;
+    /// sigma_t is sigma_maj all over the segment, so its transmittance is exp(-sigma_maj * (t_max - t_min)).
+    bool homogeneous;
+};
+
+/// Steps a ray through the majorant grid of a medium with a 3D DDA
+/// (see pbrt-v4's DDAMajorantIterator), producing the segments front to back.
+/// Media without a grid produce a single segment with their global majorant.
+struct MajorantIterator {
+    /// nullptr for the single segment case
+    const MajorantGrid<Spectrum>* grid = nullptr;
+    Spectrum sigma_maj;
+    bool homogeneous = false;
+    /// The part of the ray that is still left
+    Real t_min, t_max;
+    /// Ray distance at which we cross into the next cell along each axis,
+    /// and the distance between two crossings
+    Vector3 next_crossing_t, delta_t;
+    Vector3i step, voxel_limit, voxel;
+};
+
+/// The majorant segments of ray (with a normalized direction) between distance 0 and t_max from its origin.
+MajorantIterator make_majorant_iterator(const Medium& medium, const Ray& ray, Real t_max);
+std::optional<MajorantSegment> next_majorant_segment(MajorantIterator& iter);
+
 inline PhaseFunction get_phase_function(const Medium& medium) {
     return std::visit([&](const auto& m) { return m.phase_function; }, medium);
 }
@@ -0,0 +1,156 @@
+#include "mesh_cache.h"
+#include "mapped_file.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+/// Bump whenever the layout below (or TriangleMesh) changes.
+constexpr uint32_t c_mesh_cache_version = 2;
+constexpr size_t c_mesh_cache_alignment = 64;
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_size;
+    uint64_t num_positions, num_indices, num_normals, num_uvs;
+};
+
+static size_t align_up(size_t offset) {
+    return (offset + c_mesh_cache_alignment - 1) / c_mesh_cache_alignment * c_mesh_cache_alignment;
+}
+
+/// Serialize the key, including the current state of the source file.
+/// Returns an empty string if the source file cannot be accessed.
+static std::string serialize_key(const MeshCacheKey& key) {
+    std::error_code ec;
+    fs::path filename = fs::absolute(key.filename, ec);
+    if (ec) { return ""; }
+    uintmax_t file_size = fs::file_size(filename, ec);
+    if (ec) { return ""; }
+    auto mtime = fs::last_write_time(filename, ec);
+    if (ec) { return ""; }
+
+    std::ostringstream ss;
+    ss << filename.string() << '\0' << file_size << ' ' << mtime.time_since_epoch().count() << ' '
+       << key.shape_index << ' ' << key.face_normals << ' ' << sizeof(Real);
+    // The exact bits of the transform
+    ss.write((const char*)key.to_world.data, sizeof(key.to_world.data));
+    return ss.str();
+}
+
+/// FNV-1a
+static uint64_t hash_key(const std::string& key) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : key) {
+        h ^= uint8_t(c);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static fs::path cache_filename(const fs::path& cache_dir, const std::string& key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.mesh", (unsigned long long)hash_key(key));
+    return cache_dir / name;
+}
+
+/// Offsets of the four arrays in the file, and the total size.
+struct MeshCacheLayout {
+    size_t positions, indices, normals, uvs, size;
+};
+
+static MeshCacheLayout get_layout(const MeshCacheHeader& header) {
+    MeshCacheLayout layout;
+    layout.positions = align_up(sizeof(MeshCacheHeader) + header.key_size);
+    layout.indices   = align_up(layout.positions + header.num_positions * sizeof(MeshPosition));
+    layout.normals   = align_up(layout.indices + header.num_indices * sizeof(Vector3i));
+    layout.uvs       = align_up(layout.normals + header.num_normals * sizeof(Vector3));
+    layout.size      = layout.uvs + header.num_uvs * sizeof(Vector2);
+    return layout;
+}
+
+template <typename T>
+static void copy_array(const char* data, size_t offset, uint64_t count, std::vector<T>& v) {
+    v.resize(count);
+    if (count > 0) { memcpy((void*)v.data(), data + offset, count * sizeof(T)); }
+}
+
+template <typename T>
+static void write_array(const std::vector<T>& v, size_t offset, std::vector<char>& data) {
+    if (!v.empty()) { memcpy(data.data() + offset, (const void*)v.data(), v.size() * sizeof(T)); }
+}
+
+std::optional<TriangleMesh> load_cached_mesh(const fs::path& cache_dir, const MeshCacheKey& key) {
+    std::string serialized_key = serialize_key(key);
+    if (serialized_key.empty()) { return {}; }
+    fs::path filename = cache_filename(cache_dir, serialized_key);
+    std::error_code ec;
+    if (!fs::exists(filename, ec)) { return {}; }
+
+    MappedFile file(filename);
+    MeshCacheHeader header;
+    if (file.size < sizeof(MeshCacheHeader)) { return {}; }
+    memcpy(&header, file.data, sizeof(MeshCacheHeader));
+    if (memcmp(header.magic, "LJMESH", 6) != 0 || header.version != c_mesh_cache_version ||
+        header.key_size != serialized_key.size() || sizeof(MeshCacheHeader) + header.key_size > file.size ||
+        memcmp(file.data + sizeof(MeshCacheHeader), serialized_key.data(), header.key_size) != 0) {
+        // A stale entry (the source file changed) or a hash collision
+        return {};
+    }
+    MeshCacheLayout layout = get_layout(header);
+    if (layout.size != file.size) { return {}; }
+
+    TriangleMesh mesh;
+    copy_array(file.data, layout.positions, header.num_positions, mesh.positions);
+    copy_array(file.data, layout.indices, header.num_indices, mesh.indices);
+    copy_array(file.data, layout.normals, header.num_normals, mesh.normals);
+    copy_array(file.data, layout.uvs, header.num_uvs, mesh.uvs);
+    return mesh;
+}
+
+void store_cached_mesh(const fs::path& cache_dir, const MeshCacheKey& key, const TriangleMesh& mesh) {
+    std::string serialized_key = serialize_key(key);
+    if (serialized_key.empty()) { return; }
+    std::error_code ec;
+    fs::create_directories(cache_dir, ec);
+
+    MeshCacheHeader header;
+    memcpy(header.magic, "LJMESH\0\0", 8);
+    header.version         = c_mesh_cache_version;
+    header.key_size        = (uint32_t)serialized_key.size();
+    header.num_positions   = mesh.positions.size();
+    header.num_indices     = mesh.indices.size();
+    header.num_normals     = mesh.normals.size();
+    header.num_uvs         = mesh.uvs.size();
+    MeshCacheLayout layout = get_layout(header);
+
+    std::vector<char> data(layout.size, 0);
+    memcpy(data.data(), &header, sizeof(MeshCacheHeader));
+    memcpy(data.data() + sizeof(MeshCacheHeader), serialized_key.data(), serialized_key.size());
+    write_array(mesh.positions, layout.positions, data);
+    write_array(mesh.indices, layout.indices, data);
+    write_array(mesh.normals, layout.normals, data);
+    write_array(mesh.uvs, layout.uvs, data);
+
+    // Write to a temporary file first and rename it, so that concurrent renders never see a partial entry.
+    fs::path filename     = cache_filename(cache_dir, serialized_key);
+    fs::path tmp_filename = filename;
+    tmp_filename += ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream ofs(tmp_filename, std::ios::binary);
+        ofs.write(data.data(), data.size());
+        if (!ofs) {
+            std::cout << "[Warning] failed to write the mesh cache entry " << tmp_filename << std::endl;
+            ofs.close();
+            fs::remove(tmp_filename, ec);
+            return;
+        }
+    }
+    fs::rename(tmp_filename, filename, ec);
+    if (ec) {
+        std::cout << "[Warning] failed to write the mesh cache entry " << filename << std::endl;
+        fs::remove(tmp_filename, ec);
+    }
+}
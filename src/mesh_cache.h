@@ -0,0 +1,28 @@
+#pragma once
+
+#include "lajolla.h"
+#include "matrix.h"
+#include "shape.h"
+#include <optional>
+
+/// An on-disk cache of the triangle meshes loaded from files (obj, ply, serialized),
+/// so that the second time a scene is parsed we skip both the parsing and the normal computation.
+///
+/// Each mesh is one file in the cache directory, named after a hash of its key. The key is the absolute path,
+/// size and modification time of the source file, plus everything else the final mesh depends on:
+/// the shape index, the to_world transform, whether face normals are used, and the size of Real.
+/// The file holds a small header, the key (compared in full, so hash collisions are harmless),
+/// then the positions, indices, normals, and uvs as flat arrays in the layout of TriangleMesh,
+/// each 64-byte aligned. Loading maps the file and copies each array with a single memcpy.
+struct MeshCacheKey {
+    fs::path filename;
+    int shape_index;
+    Matrix4x4 to_world;
+    bool face_normals;
+};
+
+/// The cached mesh for key, if the cache has an up-to-date one.
+std::optional<TriangleMesh> load_cached_mesh(const fs::path& cache_dir, const MeshCacheKey& key);
+
+/// Store mesh in the cache. Failures only print a warning: the cache is an optimization.
+void store_cached_mesh(const fs::path& cache_dir, const MeshCacheKey& key, const TriangleMesh& mesh);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "vector.h"
+
+/// A vertex position of a triangle mesh, stored the way Embree reads its vertices:
+/// three floats padded to 16 bytes. Embree shares the position array of the mesh instead of copying it,
+/// so the vertices live in memory only once. (Embree intersects in single precision anyway,
+/// so the shading code sees the very same triangles as the ray tracer.)
+/// Converts implicitly from and to Vector3, so most code can treat it as one.
+struct alignas(16) MeshPosition {
+    MeshPosition() {}
+    MeshPosition(const Vector3& p) : x(float(p.x)), y(float(p.y)), z(float(p.z)) {}
+
+    operator Vector3() const { return Vector3{ x, y, z }; }
+
+    float x, y, z;
+    float padding = 0;
+};
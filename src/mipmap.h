@@ -1,46 +1,115 @@
 #pragma once
 
 #include "lajolla.h"
+#include "stats.h"
+#include "texel_format.h"
+#include "texture_cache.h"
+#include <memory>
 
 constexpr int c_max_mipmap_levels = 8;
 
+/// One level of a mipmap. The texels are stored row by row in the format of the mipmap.
+struct TexelImage {
+    int width;
+    int height;
+    std::vector<uint8_t> data;
+};
+
 template <typename T>
 struct Mipmap {
-    std::vector<Image<T>> images;
+    TexelFormat format = TexelFormat::Real;
+    std::vector<TexelImage> images;
+
+    /// Out-of-core textures leave images empty and fetch their texels
+    /// from the texture cache instead (see texture_cache.h).
+    std::shared_ptr<TextureCache> cache;
+    int cache_id = -1;
 };
 
 template <typename T>
-inline int get_width(const Mipmap<T>& mipmap) {
+constexpr int c_num_channels = sizeof(T) / sizeof(Real);
+
+template <typename T>
+inline int get_num_levels(const Mipmap<T>& mipmap) {
+    if (mipmap.cache) { return (int)get_tiled_texture(*mipmap.cache, mipmap.cache_id).level_sizes.size(); }
     assert(mipmap.images.size() > 0);
-    return mipmap.images[0].width;
+    return (int)mipmap.images.size();
 }
 
 template <typename T>
-inline int get_height(const Mipmap<T>& mipmap) {
+inline int get_width(const Mipmap<T>& mipmap, int level = 0) {
+    if (mipmap.cache) { return get_tiled_texture(*mipmap.cache, mipmap.cache_id).level_sizes[level].x; }
     assert(mipmap.images.size() > 0);
-    return mipmap.images[0].height;
+    return mipmap.images[level].width;
+}
+
+template <typename T>
+inline int get_height(const Mipmap<T>& mipmap, int level = 0) {
+    if (mipmap.cache) { return get_tiled_texture(*mipmap.cache, mipmap.cache_id).level_sizes[level].y; }
+    assert(mipmap.images.size() > 0);
+    return mipmap.images[level].height;
+}
+
+/// A mipmap whose texels are paged in from the cache on demand.
+template <typename T>
+inline Mipmap<T> make_cached_mipmap(const std::shared_ptr<TextureCache>& cache, const fs::path& filename) {
+    Mipmap<T> mipmap;
+    mipmap.cache    = cache;
+    mipmap.cache_id = add_texture(*cache, filename, sizeof(T) / sizeof(Real));
+    return mipmap;
+}
+
+/// Texel (x, y) of the given level. cached is the texture of an out-of-core mipmap
+/// (from get_tiled_texture), or nullptr.
+template <typename T>
+inline T get_texel(const Mipmap<T>& mipmap, const CachedTexture* cached, int level, int x, int y) {
+    if (cached) { return decode_texel<T>(cached->format, fetch_texel(*mipmap.cache, *cached, level, x, y)); }
+    const TexelImage& img = mipmap.images[level];
+    int texel_bytes       = c_num_channels<T> * texel_channel_bytes(mipmap.format);
+    return decode_texel<T>(mipmap.format, img.data.data() + (size_t(y) * img.width + x) * texel_bytes);
+}
+
+/// Encode img in format.
+template <typename T>
+inline TexelImage encode_image(const Image<T>& img, TexelFormat format) {
+    int channel_bytes = texel_channel_bytes(format);
+    TexelImage encoded{ img.width, img.height, {} };
+    encoded.data.resize(img.data.size() * c_num_channels<T> * channel_bytes);
+    uint8_t* dst = encoded.data.data();
+    for (const T& texel : img.data) {
+        const Real* p = (const Real*)&texel;
+        for (int c = 0; c < c_num_channels<T>; c++) {
+            encode_channel(format, p[c], dst);
+            dst += channel_bytes;
+        }
+    }
+    return encoded;
 }
 
+/// Build the mipmap of img, with the texels of all levels stored in format.
+/// The levels are filtered at full precision before they are encoded.
 template <typename T>
-inline Mipmap<T> make_mipmap(const Image<T>& img) {
+inline Mipmap<T> make_mipmap(const Image<T>& img, TexelFormat format = TexelFormat::Real) {
     Mipmap<T> mipmap;
+    mipmap.format  = format;
     int size       = max(img.width, img.height);
     int num_levels = std::min((int)ceil(log2(Real(size)) + 1), c_max_mipmap_levels);
-    mipmap.images.push_back(img);
+    mipmap.images.push_back(encode_image(img, format));
+    Image<T> prev_img = img;
     for (int i = 1; i < num_levels; i++) {
-        const Image<T>& prev_img = mipmap.images.back();
-        int next_w               = max(prev_img.width / 2, 1);
-        int next_h               = max(prev_img.height / 2, 1);
+        int next_w = max(prev_img.width / 2, 1);
+        int next_h = max(prev_img.height / 2, 1);
         Image<T> next_img(next_w, next_h);
         for (int y = 0; y < next_img.height; y++) {
             for (int x = 0; x < next_img.width; x++) {
-                // 2x2 box filter
-                next_img(x, y) = (prev_img(2 * x, 2 * y) + prev_img(2 * x + 1, 2 * y) + prev_img(2 * x, 2 * y + 1) +
-                                  prev_img(2 * x + 1, 2 * y + 1)) /
-                                 Real(4);
+                int x0 = 2 * x, y0 = 2 * y;
+                int x1 = min(x0 + 1, prev_img.width - 1), y1 = min(y0 + 1, prev_img.height - 1);
+                // 2x2 box filter (clamped where the previous level is only one texel wide or high)
+                next_img(x, y) = (prev_img(x0, y0) + prev_img(x1, y0) + prev_img(x0, y1) + prev_img(x1, y1)) / Real(4);
             }
         }
-        mipmap.images.push_back(next_img);
+        mipmap.images.push_back(encode_image(next_img, format));
+        prev_img = std::move(next_img);
     }
     return mipmap;
 }
@@ -48,21 +117,25 @@ inline Mipmap<T> make_mipmap(const Image<T>& img) {
 /// Bilinear lookup of a mipmap at location (uv) with an integer level
 template <typename T>
 inline T lookup(const Mipmap<T>& mipmap, Real u, Real v, int level) {
-    assert(level >= 0 && level < (int)mipmap.images.size());
+    assert(level >= 0 && level < get_num_levels(mipmap));
+    add_mip_level_stat(level);
+    const CachedTexture* cached = mipmap.cache ? &get_tiled_texture(*mipmap.cache, mipmap.cache_id) : nullptr;
+    int width                   = cached ? cached->level_sizes[level].x : mipmap.images[level].width;
+    int height                  = cached ? cached->level_sizes[level].y : mipmap.images[level].height;
     // Bilinear interpolation
     // (-0.5 to match Mitsuba's coordinates)
-    u          = u * mipmap.images[level].width - Real(0.5);
-    v          = v * mipmap.images[level].height - Real(0.5);
-    int ufi    = modulo(int(u), mipmap.images[level].width);
-    int vfi    = modulo(int(v), mipmap.images[level].height);
-    int uci    = modulo(ufi + 1, mipmap.images[level].width);
-    int vci    = modulo(vfi + 1, mipmap.images[level].height);
+    u          = u * width - Real(0.5);
+    v          = v * height - Real(0.5);
+    int ufi    = modulo(int(u), width);
+    int vfi    = modulo(int(v), height);
+    int uci    = modulo(ufi + 1, width);
+    int vci    = modulo(vfi + 1, height);
     Real u_off = u - ufi;
     Real v_off = v - vfi;
-    T val_ff   = mipmap.images[level](ufi, vfi);
-    T val_fc   = mipmap.images[level](ufi, vci);
-    T val_cf   = mipmap.images[level](uci, vfi);
-    T val_cc   = mipmap.images[level](uci, vci);
+    T val_ff   = get_texel(mipmap, cached, level, ufi, vfi);
+    T val_fc   = get_texel(mipmap, cached, level, ufi, vci);
+    T val_cf   = get_texel(mipmap, cached, level, uci, vfi);
+    T val_cc   = get_texel(mipmap, cached, level, uci, vci);
     return val_ff * (1 - u_off) * (1 - v_off) + val_fc * (1 - u_off) * v_off + val_cf * u_off * (1 - v_off) +
            val_cc * u_off * v_off;
 }
@@ -70,15 +143,16 @@ inline T lookup(const Mipmap<T>& mipmap, Real u, Real v, int level) {
 /// Trilinear look of of a mipmap at (u, v, level)
 template <typename T>
 inline T lookup(const Mipmap<T>& mipmap, Real u, Real v, Real level) {
+    int num_levels = get_num_levels(mipmap);
     if (level <= 0) {
         return lookup(mipmap, u, v, 0);
-    } else if (level < Real(mipmap.images.size() - 1)) {
-        int flevel     = std::clamp((int)floor(level), 0, (int)mipmap.images.size() - 1);
-        int clevel     = std::clamp(flevel + 1, 0, (int)mipmap.images.size() - 1);
+    } else if (level < Real(num_levels - 1)) {
+        int flevel     = std::clamp((int)floor(level), 0, num_levels - 1);
+        int clevel     = std::clamp(flevel + 1, 0, num_levels - 1);
         Real level_off = level - flevel;
         return lookup(mipmap, u, v, flevel) * (1 - level_off) + lookup(mipmap, u, v, clevel) * level_off;
     } else {
-        return lookup(mipmap, u, v, int(mipmap.images.size() - 1));
+        return lookup(mipmap, u, v, num_levels - 1);
     }
 }
 
@@ -1,11 +1,14 @@
 #include "parallel.h"
 #include <cassert>
 #include <condition_variable>
-#include <list>
+#include <deque>
 #include <thread>
 #include <vector>
 
-// From https://github.com/mmp/pbrt-v3/blob/master/src/core/parallel.cpp
+// Thread setup from https://github.com/mmp/pbrt-v3/blob/master/src/core/parallel.cpp
+// The scheduler is a simple work-stealing one in the spirit of Cilk/TBB:
+// each thread owns a deque of tasks. The owner pushes and pops at the back (LIFO, cache friendly),
+// idle threads steal from the front (FIFO, which tends to be the largest chunks of work).
 
 class Barrier {
   public:
@@ -19,31 +22,22 @@ class Barrier {
     int count;
 };
 
-static std::vector<std::thread> threads;
-static bool shutdownThreads = false;
-struct ParallelForLoop;
-static ParallelForLoop* workList = nullptr;
-static std::mutex workListMutex;
-
-struct ParallelForLoop {
-    ParallelForLoop(std::function<void(int)> func1D, int64_t maxIndex, int64_t chunkSize)
-        : func1D(std::move(func1D)), maxIndex(maxIndex), chunkSize(chunkSize) {}
-    ParallelForLoop(const std::function<void(Vector2i)>& f, const Vector2i count)
-        : func2D(f), maxIndex(count[0] * count[1]), chunkSize(1) {
-        nX = count[0];
-    }
+struct TaskDeque {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+};
 
-    std::function<void(int)> func1D;
-    std::function<void(Vector2i)> func2D;
-    const int64_t maxIndex;
-    const int64_t chunkSize;
-    int64_t nextIndex     = 0;
-    int activeWorkers     = 0;
-    ParallelForLoop* next = nullptr;
-    int nX                = -1;
+static std::vector<std::thread> threads;
+// One deque per thread, indexed by ThreadIndex (the main thread is 0).
+static std::vector<std::unique_ptr<TaskDeque>> taskDeques;
+static std::atomic<bool> shutdownThreads{ false };
+// Number of tasks sitting in the deques. Sleeping workers wait for this to become nonzero.
+static std::atomic<int64_t> numPendingTasks{ 0 };
+static std::atomic<int> numSleepingThreads{ 0 };
+static std::mutex sleepMutex;
+static std::condition_variable sleepCondition;
 
-    bool Finished() const { return nextIndex >= maxIndex && activeWorkers == 0; }
-};
+thread_local int ThreadIndex;
 
 void Barrier::Wait() {
     std::unique_lock<std::mutex> lock(mutex);
@@ -59,115 +53,133 @@ void Barrier::Wait() {
     }
 }
 
-static std::condition_variable workListCondition;
+static int own_deque_index() {
+    // Threads not created by the scheduler share the deque of the main thread.
+    return ThreadIndex < (int)taskDeques.size() ? ThreadIndex : 0;
+}
+
+static bool pop_task(std::function<void()>& task) {
+    int num_deques = (int)taskDeques.size();
+    int own        = own_deque_index();
+    {
+        TaskDeque& deque = *taskDeques[own];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (!deque.tasks.empty()) {
+            task = std::move(deque.tasks.back());
+            deque.tasks.pop_back();
+            return true;
+        }
+    }
+    // Our own deque is empty: try to steal from the others, starting from our neighbor
+    // so that thieves spread out over the victims.
+    for (int i = 1; i < num_deques; i++) {
+        TaskDeque& deque = *taskDeques[(own + i) % num_deques];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (!deque.tasks.empty()) {
+            task = std::move(deque.tasks.front());
+            deque.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void enqueue_task(std::function<void()> task) {
+    if (taskDeques.empty()) {
+        // No scheduler: just run it.
+        task();
+        return;
+    }
+    {
+        TaskDeque& deque = *taskDeques[own_deque_index()];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        deque.tasks.push_back(std::move(task));
+    }
+    numPendingTasks++;
+    // A worker that goes to sleep increments numSleepingThreads before checking numPendingTasks,
+    // while we increment numPendingTasks before checking numSleepingThreads, so one of the two
+    // always sees the other and the wakeup cannot be lost.
+    if (numSleepingThreads > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        sleepCondition.notify_one();
+    }
+}
+
+bool run_pending_task() {
+    if (taskDeques.empty()) { return false; }
+    std::function<void()> task;
+    if (!pop_task(task)) { return false; }
+    numPendingTasks--;
+    task();
+    return true;
+}
+
+int num_parallel_threads() {
+    return std::max((int)taskDeques.size(), 1);
+}
 
 static void worker_thread_func(const int tIndex, std::shared_ptr<Barrier> barrier) {
     ThreadIndex = tIndex;
 
     // The main thread sets up a barrier so that it can be sure that all
-    // workers have called ProfilerWorkerThreadInit() before it continues
-    // (and actually starts the profiling system).
+    // workers have been initialized before it continues.
     barrier->Wait();
 
     // Release our reference to the Barrier so that it's freed once all of
     // the threads have cleared it.
     barrier.reset();
 
-    std::unique_lock<std::mutex> lock(workListMutex);
     while (!shutdownThreads) {
-        if (!workList) {
-            // Sleep until there are more tasks to run
-            workListCondition.wait(lock);
-        } else {
-            // Get work from _workList_ and run loop iterations
-            ParallelForLoop& loop = *workList;
-
-            // Run a chunk of loop iterations for _loop_
-
-            // Find the set of loop iterations to run next
-            int64_t indexStart = loop.nextIndex;
-            int64_t indexEnd   = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-            // Update _loop_ to reflect iterations this thread will run
-            loop.nextIndex = indexEnd;
-            if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-            loop.activeWorkers++;
-
-            // Run loop indices in _[indexStart, indexEnd)_
-            lock.unlock();
-            for (int64_t index = indexStart; index < indexEnd; ++index) {
-                if (loop.func1D) {
-                    loop.func1D((int)index);
-                }
-                // Handle other types of loops
-                else {
-                    assert(loop.func2D != nullptr);
-                    loop.func2D(Vector2i{ int(index % loop.nX), int(index / loop.nX) });
-                }
-            }
-            lock.lock();
-
-            // Update _loop_ to reflect completion of iterations
-            loop.activeWorkers--;
-            if (loop.Finished()) { workListCondition.notify_all(); }
-        }
+        if (run_pending_task()) { continue; }
+        // Sleep until there are more tasks to run
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        numSleepingThreads++;
+        sleepCondition.wait(lock, [] { return shutdownThreads || numPendingTasks > 0; });
+        numSleepingThreads--;
     }
 }
 
-void parallel_for(const std::function<void(int)>& func, int64_t count, int64_t chunkSize) {
+/// Shared state of one parallel_for call. It lives on the stack of the caller,
+/// which does not return before remaining drops to zero.
+struct ParallelForLoop {
+    const std::function<void(int64_t)>& func;
+    const int64_t chunkSize;
+    std::atomic<int64_t> remaining;
+};
+
+/// Run the iterations [begin, end) of loop. The range is split recursively:
+/// the upper half is pushed to our deque (where it can be stolen), and we keep on with the lower half
+/// until it is no bigger than the chunk size.
+static void run_range(ParallelForLoop* loop, int64_t begin, int64_t end) {
+    while (end - begin > loop->chunkSize) {
+        int64_t mid = begin + (end - begin) / 2;
+        enqueue_task([loop, mid, end]() { run_range(loop, mid, end); });
+        end = mid;
+    }
+    for (int64_t index = begin; index < end; ++index) { loop->func(index); }
+    // This has to be the last access to loop: the caller may return as soon as remaining hits zero.
+    loop->remaining -= (end - begin);
+}
+
+void parallel_for(const std::function<void(int64_t)>& func, int64_t count, int64_t chunk_size) {
+    chunk_size = std::max(chunk_size, int64_t(1));
     // Run iterations immediately if not using threads or if _count_ is small
-    if (threads.empty() || count < chunkSize) {
-        for (int i = 0; i < (int)count; i++) { func(i); }
+    if (threads.empty() || count <= chunk_size) {
+        for (int64_t i = 0; i < count; i++) { func(i); }
         return;
     }
 
-    // Create and enqueue _ParallelForLoop_ for this loop
-    ParallelForLoop loop(func, count, chunkSize);
-    workListMutex.lock();
-    loop.next = workList;
-    workList  = &loop;
-    workListMutex.unlock();
-
-    // Notify worker threads of work to be done
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd   = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) { workList = loop.next; }
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            if (loop.func1D) {
-                loop.func1D((int)index);
-            }
-            // Handle other types of loops
-            else {
-                assert(loop.func2D != nullptr);
-                loop.func2D(Vector2i{ int(index % loop.nX), int(index / loop.nX) });
-            }
-        }
-        lock.lock();
+    ParallelForLoop loop{ func, chunk_size, { count } };
+    run_range(&loop, 0, count);
 
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
+    // Help out with pending tasks (of this loop, or of any other one) until all our iterations are done.
+    // Since we never block, nested parallel_for calls from inside func are fine.
+    while (loop.remaining > 0) {
+        if (!run_pending_task()) { std::this_thread::yield(); }
     }
 }
 
-thread_local int ThreadIndex;
-
 void parallel_for(std::function<void(Vector2i)> func, const Vector2i count) {
-    // Launch worker threads if needed
     if (threads.empty() || count.x * count.y <= 1) {
         for (int y = 0; y < count.y; ++y) {
             for (int x = 0; x < count.x; ++x) { func(Vector2i{ x, y }); }
@@ -175,56 +187,23 @@ void parallel_for(std::function<void(Vector2i)> func, const Vector2i count) {
         return;
     }
 
-    ParallelForLoop loop(std::move(func), count);
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        loop.next = workList;
-        workList  = &loop;
-    }
-
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd   = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) { workList = loop.next; }
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            if (loop.func1D) {
-                loop.func1D((int)index);
-            }
-            // Handle other types of loops
-            else {
-                assert(loop.func2D != nullptr);
-                loop.func2D(Vector2i{ int(index % loop.nX), int(index / loop.nX) });
-            }
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
-    }
+    int nX = count.x;
+    parallel_for([&](int64_t index) { func(Vector2i{ int(index % nX), int(index / nX) }); },
+                 int64_t(count.x) * int64_t(count.y));
 }
 
 void parallel_init(int num_threads) {
     assert(threads.size() == 0);
     ThreadIndex = 0;
+    num_threads = std::max(num_threads, 1);
+
+    taskDeques.clear();
+    for (int i = 0; i < num_threads; ++i) { taskDeques.push_back(std::make_unique<TaskDeque>()); }
+    numPendingTasks    = 0;
+    numSleepingThreads = 0;
 
-    // Create a barrier so that we can be sure all worker threads get past
-    // their call to ProfilerWorkerThreadInit() before we return from this
-    // function.  In turn, we can be sure that the profiling system isn't
-    // started until after all worker threads have done that.
+    // Create a barrier so that we can be sure all worker threads are initialized
+    // before we return from this function.
     std::shared_ptr<Barrier> barrier = std::make_shared<Barrier>(num_threads);
 
     // Launch one fewer worker thread than the total number we want doing
@@ -235,15 +214,17 @@ void parallel_init(int num_threads) {
 }
 
 void parallel_cleanup() {
-    if (threads.empty()) { return; }
+    if (!threads.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            shutdownThreads = true;
+            sleepCondition.notify_all();
+        }
 
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        shutdownThreads = true;
-        workListCondition.notify_all();
+        for (std::thread& thread : threads) { thread.join(); }
+        threads.erase(threads.begin(), threads.end());
+        shutdownThreads = false;
     }
-
-    for (std::thread& thread : threads) { thread.join(); }
-    threads.erase(threads.begin(), threads.end());
-    shutdownThreads = false;
+    taskDeques.clear();
+    numPendingTasks = 0;
 }
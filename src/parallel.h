@@ -3,10 +3,17 @@
 #include "vector.h"
 
 #include <atomic>
+#include <chrono>
 #include <functional>
+#include <future>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <type_traits>
 
-// From https://github.com/mmp/pbrt-v3/blob/master/src/core/parallel.h
+// Interface from https://github.com/mmp/pbrt-v3/blob/master/src/core/parallel.h
+// The scheduler underneath is a work-stealing one: every thread owns a task deque,
+// pushes/pops at the back of its own deque, and steals from the front of the others'.
 extern thread_local int ThreadIndex;
 
 void parallel_for(const std::function<void(int64_t)>& func, int64_t count, int64_t chunk_size = 1);
@@ -14,3 +21,55 @@ void parallel_for(std::function<void(Vector2i)> func, const Vector2i count);
 
 void parallel_init(int num_threads);
 void parallel_cleanup();
+
+/// Number of threads (including the main thread) the scheduler runs on.
+int num_parallel_threads();
+
+/// Push a task to the deque of the calling thread. Idle threads will steal it.
+void enqueue_task(std::function<void()> task);
+
+/// Run one pending task (from our own deque first, otherwise stolen from another thread).
+/// Returns false if there was nothing to run.
+/// Threads that block on other tasks should call this in a loop so that nested
+/// parallelism cannot deadlock.
+bool run_pending_task();
+
+/// The result of run_async(). get() helps executing other tasks while waiting,
+/// so it is safe to wait on a Future from inside a task.
+template <typename T>
+class Future {
+  public:
+    Future() {}
+    Future(std::future<T>&& future) : future(std::move(future)) {}
+
+    bool is_ready() const { return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+
+    void wait() {
+        while (!is_ready()) {
+            if (!run_pending_task()) { std::this_thread::yield(); }
+        }
+    }
+
+    T get() {
+        wait();
+        return future.get();
+    }
+
+  private:
+    std::future<T> future;
+};
+
+/// Run func asynchronously on the scheduler and return a Future of its result.
+/// If the scheduler has no worker threads, func is run immediately.
+template <typename F>
+auto run_async(F&& func) -> Future<std::invoke_result_t<std::decay_t<F>>> {
+    using T   = std::invoke_result_t<std::decay_t<F>>;
+    auto task = std::make_shared<std::packaged_task<T()>>(std::forward<F>(func));
+    Future<T> future(task->get_future());
+    if (num_parallel_threads() <= 1) {
+        (*task)();
+    } else {
+        enqueue_task([task]() { (*task)(); });
+    }
+    return future;
+}
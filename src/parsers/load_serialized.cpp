@@ -193,12 +193,15 @@ TriangleMesh load_serialized(const fs::path& filename, int shape_index, const Ma
     // bool face_normals = flags & EFaceNormals;
 
     TriangleMesh mesh;
+    std::vector<Vector3> positions;
     if (file_double_precision) {
-        mesh.positions = load_position<double>(zs, vertex_count);
+        positions = load_position<double>(zs, vertex_count);
     } else {
-        mesh.positions = load_position<float>(zs, vertex_count);
+        positions = load_position<float>(zs, vertex_count);
     }
-    for (auto& p : mesh.positions) { p = xform_point(to_world, p); }
+    // Transform before rounding to the single precision mesh positions
+    mesh.positions.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) { mesh.positions[i] = xform_point(to_world, positions[i]); }
 
     if (flags & EHasNormals) {
         if (file_double_precision) {
@@ -1,127 +1,300 @@
 #include "parse_obj.h"
 #include "flexception.h"
+#include "mapped_file.h"
+#include "parallel.h"
 #include "transform.h"
 
-#include <fstream>
-#include <functional>
-#include <map>
-#include <regex>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <string>
 
-// https://stackoverflow.com/questions/216823/how-to-trim-a-stdstring
-// trim from start
-static inline std::string& ltrim(std::string& s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) { return !std::isspace(ch); }));
-    return s;
+// The parser works directly on a memory mapping of the file and never allocates per line or per token.
+// Large files are cut into chunks at line boundaries, which are tokenized in parallel.
+// The chunks are then stitched together and the vertices deduplicated with a flat hash map.
+
+/// Face corner: indices (0-based, -1 if absent) into the position, uv, and normal pools.
+struct ObjVertex {
+    int v, vt, vn;
+
+    bool operator==(const ObjVertex& vertex) const { return v == vertex.v && vt == vertex.vt && vn == vertex.vn; }
+};
+
+/// What a chunk of the file parses to. The corners (three per triangle) index the pools of the whole file,
+/// except for relative (negative) indices: those depend on the number of elements in the previous chunks,
+/// so we store them relative to this chunk, and remember which corners they are to fix them up later.
+struct ObjChunk {
+    std::vector<Vector3> positions;
+    std::vector<Vector2> uvs;
+    std::vector<Vector3> normals;
+    std::vector<ObjVertex> corners;
+    std::vector<int> relative_v, relative_vt, relative_vn;
+    /// Set instead of throwing, since the chunks are parsed on worker threads.
+    std::string error;
+};
+
+static inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static inline void skip_blanks(const char*& p, const char* end) {
+    while (p < end && is_blank(*p)) { p++; }
 }
-// trim from end
-static inline std::string& rtrim(std::string& s) {
-    s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) { return !std::isspace(ch); }).base(), s.end());
-    return s;
+
+/// Parse a number starting at p (after blanks) and advance p past it. Returns false if there is none.
+template <typename T>
+static inline bool parse_number(const char*& p, const char* end, T& value) {
+    skip_blanks(p, end);
+    // from_chars does not accept a leading plus sign
+    if (p < end && *p == '+') { p++; }
+    auto [ptr, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc()) { return false; }
+    p = ptr;
+    return true;
 }
-// trim from both ends
-static inline std::string& trim(std::string& s) { return ltrim(rtrim(s)); }
-
-static std::vector<int> split_face_str(const std::string& s) {
-    std::regex rgx("/");
-    std::sregex_token_iterator first{ begin(s), end(s), rgx, -1 }, last;
-    std::vector<std::string> list{ first, last };
-    std::vector<int> result;
-    for (auto& i : list) {
-        if (i != "") result.push_back(std::stoi(i));
-        else result.push_back(0);
+
+/// Resolve an index as written in the file (1-based, negative for relative, 0 for absent).
+/// Relative indices are resolved against the elements of this chunk and flagged with relative = true.
+static inline int resolve_index(int index, int num_in_chunk, bool& relative) {
+    relative = index < 0;
+    if (index > 0) { return index - 1; }
+    if (index < 0) { return num_in_chunk + index; }
+    return -1;
+}
+
+/// A face corner as written in the file, before it is added to the triangles of the chunk.
+struct ObjCorner {
+    ObjVertex vertex;
+    bool relative_v, relative_vt, relative_vn;
+};
+
+/// Parse a face corner "v", "v/vt", "v//vn", or "v/vt/vn" starting at p.
+static bool parse_corner(const char*& p, const char* end, const ObjChunk& chunk, ObjCorner& corner) {
+    int ids[3] = { 0, 0, 0 };
+    if (!parse_number(p, end, ids[0])) { return false; }
+    for (int i = 1; i < 3 && p < end && *p == '/'; i++) {
+        p++;
+        if (p < end && *p != '/' && !is_blank(*p)) {
+            if (!parse_number(p, end, ids[i])) { return false; }
+        }
     }
-    while (result.size() < 3) result.push_back(0);
+    corner.vertex = ObjVertex{ resolve_index(ids[0], (int)chunk.positions.size(), corner.relative_v),
+                               resolve_index(ids[1], (int)chunk.uvs.size(), corner.relative_vt),
+                               resolve_index(ids[2], (int)chunk.normals.size(), corner.relative_vn) };
+    return true;
+}
 
-    return result;
+static void add_corner(ObjChunk& chunk, const ObjCorner& corner) {
+    int id = (int)chunk.corners.size();
+    if (corner.relative_v) { chunk.relative_v.push_back(id); }
+    if (corner.relative_vt) { chunk.relative_vt.push_back(id); }
+    if (corner.relative_vn) { chunk.relative_vn.push_back(id); }
+    chunk.corners.push_back(corner.vertex);
 }
 
-struct ObjVertex {
-    ObjVertex(const std::vector<int>& id) : v(id[0] - 1), vt(id[1] - 1), vn(id[2] - 1) {}
+/// Tokenize the lines in [begin, end). begin is at the start of a line and end is after a newline (or at EOF).
+static void parse_chunk(const char* begin, const char* end, ObjChunk& chunk) {
+    const char* p = begin;
+    while (p < end) {
+        const char* line_end = (const char*)memchr(p, '\n', end - p);
+        if (line_end == nullptr) { line_end = end; }
+        const char* line = p;
+        skip_blanks(p, line_end);
+        if (p + 1 < line_end && p[0] == 'v' && is_blank(p[1])) { // vertices
+            p += 1;
+            // x y z, then either w or (as some exporters do) a vertex color
+            Real values[7];
+            int num_values = 0;
+            while (num_values < 7 && parse_number(p, line_end, values[num_values])) { num_values++; }
+            if (num_values < 3) {
+                chunk.error = "Invalid vertex: " + std::string(line, std::min(line_end, line + 64));
+                return;
+            }
+            Real w = num_values == 4 ? values[3] : Real(1);
+            chunk.positions.push_back(Vector3{ values[0], values[1], values[2] } / w);
+        } else if (p + 2 < line_end && p[0] == 'v' && p[1] == 't' && is_blank(p[2])) {
+            p += 2;
+            Real s = 0, t = 0;
+            parse_number(p, line_end, s);
+            parse_number(p, line_end, t);
+            chunk.uvs.push_back(Vector2{ s, 1 - t });
+        } else if (p + 2 < line_end && p[0] == 'v' && p[1] == 'n' && is_blank(p[2])) {
+            p += 2;
+            Real x = 0, y = 0, z = 0;
+            parse_number(p, line_end, x);
+            parse_number(p, line_end, y);
+            parse_number(p, line_end, z);
+            chunk.normals.push_back(normalize(Vector3{ x, y, z }));
+        } else if (p + 1 < line_end && p[0] == 'f' && is_blank(p[1])) {
+            p += 1;
+            ObjCorner face[4];
+            int num_corners = 0;
+            while (true) {
+                skip_blanks(p, line_end);
+                if (p >= line_end) { break; }
+                if (num_corners == 4) {
+                    chunk.error = "The object file contains n-gon (n>4) that we do not support.";
+                    return;
+                }
+                if (!parse_corner(p, line_end, chunk, face[num_corners])) {
+                    chunk.error = "Invalid face: " + std::string(line, std::min(line_end, line + 64));
+                    return;
+                }
+                num_corners++;
+            }
+            if (num_corners < 3) {
+                chunk.error = "Invalid face: " + std::string(line, std::min(line_end, line + 64));
+                return;
+            }
+            add_corner(chunk, face[0]);
+            add_corner(chunk, face[1]);
+            add_corner(chunk, face[2]);
+            if (num_corners == 4) {
+                // Split the quad (0, 1, 2, 3) into (0, 1, 2) and (0, 2, 3)
+                add_corner(chunk, face[0]);
+                add_corner(chunk, face[2]);
+                add_corner(chunk, face[3]);
+            }
+        } // Currently ignore other tokens and comments
+        p = line_end + 1;
+    }
+}
 
-    bool operator<(const ObjVertex& vertex) const {
-        if (v != vertex.v) { return v < vertex.v; }
-        if (vt != vertex.vt) { return vt < vertex.vt; }
-        if (vn != vertex.vn) { return vn < vertex.vn; }
-        return false;
+/// Open addressing hash map from corners to vertex ids of the mesh.
+/// It starts from an estimate of the number of unique vertices, and doubles when it gets half full,
+/// so that it stays in proportion to the vertices of the mesh rather than to its corners.
+struct ObjVertexMap {
+    ObjVertexMap(size_t expected_size) {
+        size_t capacity = 16;
+        while (capacity < 2 * expected_size) { capacity *= 2; }
+        keys.resize(capacity);
+        values.resize(capacity, -1);
+        mask = capacity - 1;
     }
 
-    int v, vt, vn;
+    /// The id of vertex if we have seen it, otherwise insert it with id new_id. Returns whether it was inserted.
+    bool find_or_insert(const ObjVertex& vertex, int new_id, int& id) {
+        size_t slot = find_slot(vertex);
+        if (values[slot] >= 0) {
+            id = values[slot];
+            return false;
+        }
+        keys[slot]   = vertex;
+        values[slot] = new_id;
+        id           = new_id;
+        if (++size * 2 > keys.size()) { grow(); }
+        return true;
+    }
+
+    static uint64_t hash(const ObjVertex& vertex) {
+        uint64_t h = uint64_t(uint32_t(vertex.v)) * 0x9E3779B97F4A7C15ull;
+        h ^= uint64_t(uint32_t(vertex.vt)) * 0xC2B2AE3D27D4EB4Full;
+        h ^= uint64_t(uint32_t(vertex.vn)) * 0x165667B19E3779F9ull;
+        return h ^ (h >> 32);
+    }
+
+    /// The slot of vertex, or the empty slot where it goes.
+    size_t find_slot(const ObjVertex& vertex) const {
+        for (size_t slot = hash(vertex) & mask;; slot = (slot + 1) & mask) {
+            if (values[slot] < 0 || keys[slot] == vertex) { return slot; }
+        }
+    }
+
+    void grow() {
+        std::vector<ObjVertex> old_keys = std::move(keys);
+        std::vector<int> old_values     = std::move(values);
+        keys.assign(old_keys.size() * 2, ObjVertex{});
+        values.assign(old_values.size() * 2, -1);
+        mask = keys.size() - 1;
+        for (size_t i = 0; i < old_keys.size(); i++) {
+            if (old_values[i] < 0) { continue; }
+            size_t slot  = find_slot(old_keys[i]);
+            keys[slot]   = old_keys[i];
+            values[slot] = old_values[i];
+        }
+    }
+
+    std::vector<ObjVertex> keys;
+    std::vector<int> values;
+    size_t mask;
+    size_t size = 0;
 };
 
-size_t get_vertex_id(const ObjVertex& vertex, const std::vector<Vector3>& pos_pool, const std::vector<Vector2>& st_pool,
-                     const std::vector<Vector3>& nor_pool, const Matrix4x4& to_world, std::vector<Vector3>& pos,
-                     std::vector<Vector2>& st, std::vector<Vector3>& nor, std::map<ObjVertex, size_t>& vertex_map) {
-    auto it = vertex_map.find(vertex);
-    if (it != vertex_map.end()) { return it->second; }
-    size_t id = pos.size();
-    pos.push_back(xform_point(to_world, pos_pool[vertex.v]));
-    if (vertex.vt != -1) st.push_back(st_pool[vertex.vt]);
-    if (vertex.vn != -1) { nor.push_back(xform_normal(inverse(to_world), nor_pool[vertex.vn])); }
-    vertex_map[vertex] = id;
-    return id;
-}
+/// Files below this size are parsed in one chunk.
+constexpr size_t c_obj_chunk_size = size_t(1) << 20;
 
 TriangleMesh parse_obj(const fs::path& filename, const Matrix4x4& to_world) {
+    MappedFile file(filename);
+    const char* data = file.data;
+    size_t size      = file.size;
+
+    // Cut the file into chunks at line boundaries
+    std::vector<const char*> boundaries = { data };
+    for (size_t offset = c_obj_chunk_size; offset < size; offset += c_obj_chunk_size) {
+        const char* b = std::max(boundaries.back(), data + offset);
+        b             = (const char*)memchr(b, '\n', data + size - b);
+        if (b == nullptr) { break; }
+        boundaries.push_back(b + 1);
+    }
+    boundaries.push_back(data + size);
+    int num_chunks = (int)boundaries.size() - 1;
+
+    std::vector<ObjChunk> chunks(num_chunks);
+    parallel_for([&](int64_t i) { parse_chunk(boundaries[i], boundaries[i + 1], chunks[i]); }, num_chunks);
+    for (const ObjChunk& chunk : chunks) {
+        if (!chunk.error.empty()) { Error(chunk.error + " (" + filename.string() + ")"); }
+    }
+
+    // Stitch the chunks together
     std::vector<Vector3> pos_pool;
-    std::vector<Vector3> nor_pool;
     std::vector<Vector2> st_pool;
-    std::map<ObjVertex, size_t> vertex_map;
-    TriangleMesh mesh;
+    std::vector<Vector3> nor_pool;
+    std::vector<ObjVertex> corners;
+    size_t num_positions = 0, num_uvs = 0, num_normals = 0, num_corners = 0;
+    for (const ObjChunk& chunk : chunks) {
+        num_positions += chunk.positions.size();
+        num_uvs += chunk.uvs.size();
+        num_normals += chunk.normals.size();
+        num_corners += chunk.corners.size();
+    }
+    pos_pool.reserve(num_positions);
+    st_pool.reserve(num_uvs);
+    nor_pool.reserve(num_normals);
+    corners.reserve(num_corners);
+    for (ObjChunk& chunk : chunks) {
+        for (int c : chunk.relative_v) { chunk.corners[c].v += (int)pos_pool.size(); }
+        for (int c : chunk.relative_vt) { chunk.corners[c].vt += (int)st_pool.size(); }
+        for (int c : chunk.relative_vn) { chunk.corners[c].vn += (int)nor_pool.size(); }
+        pos_pool.insert(pos_pool.end(), chunk.positions.begin(), chunk.positions.end());
+        st_pool.insert(st_pool.end(), chunk.uvs.begin(), chunk.uvs.end());
+        nor_pool.insert(nor_pool.end(), chunk.normals.begin(), chunk.normals.end());
+        corners.insert(corners.end(), chunk.corners.begin(), chunk.corners.end());
+        chunk = ObjChunk{};
+    }
 
-    std::ifstream ifs(filename.c_str(), std::ifstream::in);
-    if (!ifs.is_open()) { Error("Unable to open the obj file"); }
-    while (ifs.good()) {
-        std::string line;
-        std::getline(ifs, line);
-        line = trim(line);
-        if (line.size() == 0 || line[0] == '#') { // comment
-            continue;
-        }
+    // Transform to world space, before the positions are rounded to single precision
+    Matrix4x4 normal_to_world = inverse(to_world);
+    parallel_for([&](int64_t i) { pos_pool[i] = xform_point(to_world, pos_pool[i]); }, pos_pool.size(), 4096);
+    parallel_for([&](int64_t i) { nor_pool[i] = xform_normal(normal_to_world, nor_pool[i]); }, nor_pool.size(), 4096);
 
-        std::stringstream ss(line);
-        std::string token;
-        ss >> token;
-        if (token == "v") { // vertices
-            Real x, y, z, w = 1;
-            ss >> x >> y >> z >> w;
-            pos_pool.push_back(Vector3{ x, y, z } / w);
-        } else if (token == "vt") {
-            Real s, t, w;
-            ss >> s >> t >> w;
-            st_pool.push_back(Vector2{ s, 1 - t });
-        } else if (token == "vn") {
-            Real x, y, z;
-            ss >> x >> y >> z;
-            nor_pool.push_back(normalize(Vector3{ x, y, z }));
-        } else if (token == "f") {
-            std::string i0, i1, i2;
-            ss >> i0 >> i1 >> i2;
-            std::vector<int> i0f = split_face_str(i0);
-            std::vector<int> i1f = split_face_str(i1);
-            std::vector<int> i2f = split_face_str(i2);
-
-            ObjVertex v0(i0f), v1(i1f), v2(i2f);
-            size_t v0id = get_vertex_id(v0, pos_pool, st_pool, nor_pool, to_world, mesh.positions, mesh.uvs,
-                                        mesh.normals, vertex_map);
-            size_t v1id = get_vertex_id(v1, pos_pool, st_pool, nor_pool, to_world, mesh.positions, mesh.uvs,
-                                        mesh.normals, vertex_map);
-            size_t v2id = get_vertex_id(v2, pos_pool, st_pool, nor_pool, to_world, mesh.positions, mesh.uvs,
-                                        mesh.normals, vertex_map);
-            mesh.indices.push_back(Vector3i{ v0id, v1id, v2id });
-
-            std::string i3;
-            if (ss >> i3) {
-                std::vector<int> i3f = split_face_str(i3);
-                ObjVertex v3(i3f);
-                size_t v3id = get_vertex_id(v3, pos_pool, st_pool, nor_pool, to_world, mesh.positions, mesh.uvs,
-                                            mesh.normals, vertex_map);
-                mesh.indices.push_back(Vector3i{ v0id, v2id, v3id });
-            }
-            std::string i4;
-            if (ss >> i4) { Error("The object file contains n-gon (n>4) that we do not support."); }
-        } // Currently ignore other tokens
+    // Deduplicate the vertices, in the order they are first used
+    TriangleMesh mesh;
+    // Most meshes have about as many vertices as positions (or as normals or uvs, if those are split more).
+    ObjVertexMap vertex_map(std::max({ pos_pool.size(), st_pool.size(), nor_pool.size() }));
+    std::vector<int> vertex_ids(corners.size());
+    for (size_t i = 0; i < corners.size(); i++) {
+        const ObjVertex& vertex = corners[i];
+        if (vertex.v < 0 || vertex.v >= (int)pos_pool.size() || vertex.vt < -1 || vertex.vt >= (int)st_pool.size() ||
+            vertex.vn < -1 || vertex.vn >= (int)nor_pool.size()) {
+            Error(std::string("Face index out of range in ") + filename.string());
+        }
+        if (vertex_map.find_or_insert(vertex, (int)mesh.positions.size(), vertex_ids[i])) {
+            mesh.positions.push_back(pos_pool[vertex.v]);
+            if (vertex.vt != -1) { mesh.uvs.push_back(st_pool[vertex.vt]); }
+            if (vertex.vn != -1) { mesh.normals.push_back(nor_pool[vertex.vn]); }
+        }
+    }
+    mesh.indices.resize(corners.size() / 3);
+    for (size_t i = 0; i < mesh.indices.size(); i++) {
+        mesh.indices[i] = Vector3i{ vertex_ids[3 * i], vertex_ids[3 * i + 1], vertex_ids[3 * i + 2] };
     }
-
     return mesh;
 }
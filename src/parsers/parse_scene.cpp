@@ -2,11 +2,14 @@
 #include "3rdparty/pugixml.hpp"
 #include "flexception.h"
 #include "load_serialized.h"
+#include "mesh_cache.h"
 #include "parse_obj.h"
 #include "parse_ply.h"
 #include "shape_utils.h"
+#include "stats.h"
 #include "transform.h"
 #include <cctype>
+#include <functional>
 #include <map>
 #include <regex>
 
@@ -17,7 +20,9 @@ const Filter c_default_filter        = Box{ Real(1) };
 ;
 
 struct ParsedSampler {
+    SamplerType type = SamplerType::Independent;
     int sample_count = 4;
+    int seed         = 0;
 };
 
 enum class TextureType { BITMAP, CHECKERBOARD };
@@ -443,17 +448,35 @@ void parse_default_map(pugi::xml_node node, std::map<std::string, std::string>&
     }
 }
 
+LightSampler parse_light_sampler(const std::string& value, const std::map<std::string, std::string>& default_map) {
+    std::string type = parse_string(value, default_map);
+    if (type == "power") {
+        return LightSampler::Power;
+    } else if (type == "bvh") {
+        return LightSampler::BVH;
+    } else {
+        Error(std::string("Unsupported light sampler: ") + type);
+        return LightSampler::BVH;
+    }
+}
+
 RenderOptions parse_integrator(pugi::xml_node node, const std::map<std::string, std::string>& default_map) {
     RenderOptions options;
     std::string type = node.attribute("type").value();
-    if (type == "path") {
-        options.integrator = Integrator::Path;
+    if (type == "path" || type == "wavefrontPath" || type == "wavefront_path") {
+        options.integrator = type == "path" ? Integrator::Path : Integrator::WavefrontPath;
         for (auto child : node.children()) {
             std::string name = child.attribute("name").value();
             if (name == "maxDepth") {
                 options.max_depth = parse_integer(child.attribute("value").value(), default_map);
             } else if (name == "rrDepth") {
                 options.rr_depth = parse_integer(child.attribute("value").value(), default_map);
+            } else if (name == "adaptiveThreshold" || name == "adaptive_threshold") {
+                options.adaptive_threshold = parse_float(child.attribute("value").value(), default_map);
+            } else if (name == "adaptiveMinSamples" || name == "adaptive_min_samples") {
+                options.adaptive_min_samples = parse_integer(child.attribute("value").value(), default_map);
+            } else if (name == "lightSampler" || name == "light_sampler") {
+                options.light_sampler = parse_light_sampler(child.attribute("value").value(), default_map);
             }
         }
     } else if (type == "volpath") {
@@ -468,6 +491,12 @@ RenderOptions parse_integrator(pugi::xml_node node, const std::map<std::string,
                 options.vol_path_version = parse_integer(child.attribute("value").value(), default_map);
             } else if (name == "maxNullCollisions" || name == "max_null_collisions") {
                 options.max_null_collisions = parse_integer(child.attribute("value").value(), default_map);
+            } else if (name == "adaptiveThreshold" || name == "adaptive_threshold") {
+                options.adaptive_threshold = parse_float(child.attribute("value").value(), default_map);
+            } else if (name == "adaptiveMinSamples" || name == "adaptive_min_samples") {
+                options.adaptive_min_samples = parse_integer(child.attribute("value").value(), default_map);
+            } else if (name == "lightSampler" || name == "light_sampler") {
+                options.light_sampler = parse_light_sampler(child.attribute("value").value(), default_map);
             }
         }
     } else if (type == "direct") {
@@ -619,7 +648,8 @@ std::tuple<std::string /* ID */, Medium> parse_medium(pugi::xml_node node,
         }
         // scale only applies to density!!
         set_scale(density, scale);
-        return std::make_tuple(id, HeterogeneousMedium{ { phase_func }, albedo, density });
+        return std::make_tuple(id,
+                               HeterogeneousMedium{ { phase_func }, albedo, density, make_majorant_grid(density) });
     } else {
         Error(std::string("Unknown medium type:") + type);
     }
@@ -672,13 +702,24 @@ parse_sensor(pugi::xml_node node, std::vector<Medium>& media,
             std::tie(width, height, filename, filter) = parse_film(child, default_map);
         } else if (std::string(child.name()) == "sampler") {
             std::string name = child.attribute("type").value();
-            if (name != "independent") {
-                std::cerr << "Warning: the renderer currently only supports independent samplers." << std::endl;
+            if (name == "independent") {
+                sampler.type = SamplerType::Independent;
+            } else if (name == "sobol" || name == "ldsampler") {
+                sampler.type = SamplerType::Sobol;
+            } else if (name == "pmj02" || name == "pmj02bn") {
+                sampler.type = SamplerType::PMJ02;
+            } else if (name == "zsobol") {
+                sampler.type = SamplerType::ZSobol;
+            } else {
+                std::cerr << "Warning: unsupported sampler " << name << ", using the independent sampler instead."
+                          << std::endl;
             }
             for (auto grand_child : child.children()) {
                 std::string name = grand_child.attribute("name").value();
                 if (name == "sampleCount" || name == "sample_count") {
                     sampler.sample_count = parse_integer(grand_child.attribute("value").value(), default_map);
+                } else if (name == "seed") {
+                    sampler.seed = parse_integer(grand_child.attribute("value").value(), default_map);
                 }
             }
         } else if (std::string(child.name()) == "ref") {
@@ -976,11 +1017,31 @@ parse_bsdf(pugi::xml_node node, const std::map<std::string /* name id */, Parsed
     return std::make_tuple("", Material{});
 }
 
+/// Load a triangle mesh from filename with load, and set up its normals: none with face_normals,
+/// otherwise the ones from the file, or smooth ones computed from the triangles if the file has none.
+/// With a mesh cache directory, the result is looked up in (or added to) the cache, see mesh_cache.h.
+TriangleMesh load_triangle_mesh(const fs::path& filename, int shape_index, const Matrix4x4& to_world,
+                                bool face_normals, const fs::path& mesh_cache_dir,
+                                const std::function<TriangleMesh()>& load) {
+    MeshCacheKey key{ filename, shape_index, to_world, face_normals };
+    if (!mesh_cache_dir.empty()) {
+        if (std::optional<TriangleMesh> mesh = load_cached_mesh(mesh_cache_dir, key)) { return std::move(*mesh); }
+    }
+    TriangleMesh mesh = load();
+    if (face_normals) {
+        mesh.normals = std::vector<Vector3>{};
+    } else {
+        if (mesh.normals.size() == 0) { mesh.normals = compute_normal(mesh.positions, mesh.indices); }
+    }
+    if (!mesh_cache_dir.empty()) { store_cached_mesh(mesh_cache_dir, key, mesh); }
+    return mesh;
+}
+
 Shape parse_shape(pugi::xml_node node, std::vector<Material>& materials,
                   std::map<std::string /* name id */, int /* index id */>& material_map,
                   const std::map<std::string /* name id */, ParsedTexture>& texture_map, TexturePool& texture_pool,
                   std::vector<Medium>& media, std::map<std::string /* name id */, int /* index id */>& medium_map,
-                  std::vector<Light>& lights, const std::vector<Shape>& shapes,
+                  std::vector<Light>& lights, const std::vector<Shape>& shapes, const fs::path& mesh_cache_dir,
                   const std::map<std::string, std::string>& default_map) {
     int material_id        = -1;
     int interior_medium_id = -1;
@@ -1050,13 +1111,8 @@ Shape parse_shape(pugi::xml_node node, std::vector<Material>& materials,
                 face_normals = parse_boolean(child.attribute("value").value(), default_map);
             }
         }
-        shape              = parse_obj(filename, to_world);
-        TriangleMesh& mesh = std::get<TriangleMesh>(shape);
-        if (face_normals) {
-            mesh.normals = std::vector<Vector3>{};
-        } else {
-            if (mesh.normals.size() == 0) { mesh.normals = compute_normal(mesh.positions, mesh.indices); }
-        }
+        shape = load_triangle_mesh(filename, 0, to_world, face_normals, mesh_cache_dir,
+                                   [&]() { return parse_obj(filename, to_world); });
     } else if (type == "serialized") {
         std::string filename;
         int shape_index    = 0;
@@ -1074,13 +1130,8 @@ Shape parse_shape(pugi::xml_node node, std::vector<Material>& materials,
                 face_normals = parse_boolean(child.attribute("value").value(), default_map);
             }
         }
-        shape              = load_serialized(filename, shape_index, to_world);
-        TriangleMesh& mesh = std::get<TriangleMesh>(shape);
-        if (face_normals) {
-            mesh.normals = std::vector<Vector3>{};
-        } else {
-            if (mesh.normals.size() == 0) { mesh.normals = compute_normal(mesh.positions, mesh.indices); }
-        }
+        shape = load_triangle_mesh(filename, shape_index, to_world, face_normals, mesh_cache_dir,
+                                   [&]() { return load_serialized(filename, shape_index, to_world); });
     } else if (type == "ply") {
         std::string filename;
         int shape_index    = 0;
@@ -1098,13 +1149,8 @@ Shape parse_shape(pugi::xml_node node, std::vector<Material>& materials,
                 face_normals = parse_boolean(child.attribute("value").value(), default_map);
             }
         }
-        shape              = parse_ply(filename, to_world);
-        TriangleMesh& mesh = std::get<TriangleMesh>(shape);
-        if (face_normals) {
-            mesh.normals = std::vector<Vector3>{};
-        } else {
-            if (mesh.normals.size() == 0) { mesh.normals = compute_normal(mesh.positions, mesh.indices); }
-        }
+        shape = load_triangle_mesh(filename, shape_index, to_world, face_normals, mesh_cache_dir,
+                                   [&]() { return parse_ply(filename, to_world); });
     } else if (type == "sphere") {
         Vector3 center{ 0, 0, 0 };
         Real radius = 1;
@@ -1164,18 +1210,45 @@ Shape parse_shape(pugi::xml_node node, std::vector<Material>& materials,
     return shape;
 }
 
-std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice& embree_device) {
+ShapeInstance parse_instance(pugi::xml_node node,
+                             const std::map<std::string /* name id */, int /* index id */>& shape_group_map,
+                             const std::map<std::string, std::string>& default_map) {
+    int group_id       = -1;
+    Matrix4x4 to_world = Matrix4x4::identity();
+    for (auto child : node.children()) {
+        std::string name = child.name();
+        if (name == "ref") {
+            std::string id = child.attribute("id").value();
+            auto it        = shape_group_map.find(id);
+            if (it == shape_group_map.end()) { Error(std::string("Shape group reference ") + id + " not found."); }
+            group_id = it->second;
+        } else if (name == "transform") {
+            std::string transform_name = child.attribute("name").value();
+            if (transform_name == "toWorld" || transform_name == "to_world") {
+                to_world = parse_transform(child, default_map);
+            }
+        }
+    }
+    if (group_id == -1) { Error("Shape group reference not specified for the instance."); }
+    return ShapeInstance{ group_id, to_world, inverse(to_world) };
+}
+
+std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice& embree_device, size_t texture_cache_budget,
+                                   const fs::path& mesh_cache_dir) {
     RenderOptions options;
     Camera camera(Matrix4x4::identity(), c_default_fov, c_default_res, c_default_res, c_default_filter,
                   -1 /*medium_id*/);
     std::string filename = c_default_filename;
     std::vector<Material> materials;
     std::map<std::string /* name id */, int /* index id */> material_map;
-    TexturePool texture_pool;
+    TexturePool texture_pool(texture_cache_budget);
     std::map<std::string /* name id */, ParsedTexture> texture_map;
     std::vector<Medium> media;
     std::map<std::string /* name id */, int /* index id */> medium_map;
     std::vector<Shape> shapes;
+    std::vector<ShapeGroup> shape_groups;
+    std::map<std::string /* name id */, int /* index id */> shape_group_map;
+    std::vector<ShapeInstance> instances;
     std::vector<Light> lights;
     // For <default> tags
     // e.g., <default name="spp" value="4096"/> will map "spp" to "4096"
@@ -1192,6 +1265,8 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice& embree_
             ParsedSampler sampler;
             std::tie(camera, filename, sampler) = parse_sensor(child, media, medium_map, default_map);
             options.samples_per_pixel           = sampler.sample_count;
+            options.sampler                     = sampler.type;
+            options.sampler_seed                = sampler.seed;
         } else if (name == "bsdf") {
             std::string material_name;
             Material m;
@@ -1201,9 +1276,30 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice& embree_
                 materials.push_back(m);
             }
         } else if (name == "shape") {
-            Shape s = parse_shape(child, materials, material_map, texture_map, texture_pool, media, medium_map, lights,
-                                  shapes, default_map);
-            shapes.push_back(s);
+            if (std::string(child.attribute("type").value()) == "instance") {
+                instances.push_back(parse_instance(child, shape_group_map, default_map));
+            } else {
+                Shape s = parse_shape(child, materials, material_map, texture_map, texture_pool, media, medium_map,
+                                      lights, shapes, mesh_cache_dir, default_map);
+                shapes.push_back(s);
+            }
+        } else if (name == "shapegroup") {
+            std::string id = child.attribute("id").value();
+            if (shape_group_map.find(id) != shape_group_map.end()) {
+                Error(std::string("Duplicated shape group ID:") + id);
+            }
+            ShapeGroup group;
+            for (auto grand_child : child.children()) {
+                if (std::string(grand_child.name()) != "shape") { continue; }
+                Shape s = parse_shape(grand_child, materials, material_map, texture_map, texture_pool, media,
+                                      medium_map, lights, shapes, mesh_cache_dir, default_map);
+                // An emitter would need a light per instance.
+                if (is_light(s)) { Error(std::string("Emitters in shape groups are not supported:") + id); }
+                group.shape_ids.push_back((int)shapes.size());
+                shapes.push_back(s);
+            }
+            shape_group_map[id] = (int)shape_groups.size();
+            shape_groups.push_back(group);
         } else if (name == "texture") {
             std::string id = child.attribute("id").value();
             if (texture_map.find(id) != texture_map.end()) { Error(std::string("Duplicated texture ID:") + id); }
@@ -1289,15 +1385,20 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice& embree_
                 Vector3 tangent, bitangent;
                 std::tie(tangent, bitangent) = coordinate_system(-direction);
                 TriangleMesh mesh;
-                Real length    = Real(1e-3);
+                Real quad_size = Real(1e-3);
                 Real dist      = Real(1e3);
-                mesh.positions = { Real(0.5) * length * (-tangent - bitangent) - dist * direction,
-                                   Real(0.5) * length * (tangent - bitangent) - dist * direction,
-                                   Real(0.5) * length * (tangent + bitangent) - dist * direction,
-                                   Real(0.5) * length * (-tangent + bitangent) - dist * direction };
+                mesh.positions = { Real(0.5) * quad_size * (-tangent - bitangent) - dist * direction,
+                                   Real(0.5) * quad_size * (tangent - bitangent) - dist * direction,
+                                   Real(0.5) * quad_size * (tangent + bitangent) - dist * direction,
+                                   Real(0.5) * quad_size * (-tangent + bitangent) - dist * direction };
                 mesh.indices   = { Vector3i{ 0, 1, 2 }, Vector3i{ 0, 2, 3 } };
                 mesh.normals   = { direction, direction, direction, direction };
-                intensity *= ((dist * dist) / (length * length));
+                // The corners are rounded to single precision, which noticeably changes the area of such
+                // a tiny and distant quad, so we normalize by the area of the quad we actually store.
+                Vector3 p0 = mesh.positions[0], p1 = mesh.positions[1], p2 = mesh.positions[2],
+                        p3 = mesh.positions[3];
+                Real area = (length(cross(p1 - p0, p2 - p0)) + length(cross(p2 - p0, p3 - p0))) / 2;
+                intensity *= ((dist * dist) / area);
                 Shape s         = mesh;
                 Material m      = Lambertian{ make_constant_spectrum_texture(make_zero_spectrum()) };
                 int material_id = materials.size();
@@ -1320,10 +1421,13 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice& embree_
         }
     }
     return std::make_unique<Scene>(embree_device, camera, materials, shapes, lights, media, envmap_light_id,
-                                   texture_pool, options, filename);
+                                   texture_pool, options, filename, shape_groups, instances);
 }
 
-std::unique_ptr<Scene> parse_scene(const fs::path& filename, const RTCDevice& embree_device) {
+std::unique_ptr<Scene> parse_scene(const fs::path& filename, const RTCDevice& embree_device,
+                                   size_t texture_cache_budget, const fs::path& mesh_cache_dir) {
+    // (the construction of the Scene at the end times its own phases)
+    StatPhaseTimer phase_timer(StatPhase::Parse);
     pugi::xml_document doc;
     pugi::xml_parse_result result = doc.load_file(filename.c_str());
     if (!result) {
@@ -1331,10 +1435,12 @@ std::unique_ptr<Scene> parse_scene(const fs::path& filename, const RTCDevice& em
         std::cerr << "Error offset: " << result.offset << std::endl;
         Error("Parse error");
     }
+    // the mesh cache directory is relative to the current working directory, not to the scene
+    fs::path cache_dir = mesh_cache_dir.empty() ? fs::path() : fs::absolute(mesh_cache_dir);
     // back up the current working directory and switch to the parent folder of the file
     fs::path old_path = fs::current_path();
     fs::current_path(filename.parent_path());
-    std::unique_ptr<Scene> scene = parse_scene(doc.child("scene"), embree_device);
+    std::unique_ptr<Scene> scene = parse_scene(doc.child("scene"), embree_device, texture_cache_budget, cache_dir);
     // switch back to the old current working directory
     fs::current_path(old_path);
     return scene;
@@ -6,4 +6,9 @@
 #include <string>
 
 /// Parse Mitsuba's XML scene format.
-std::unique_ptr<Scene> parse_scene(const fs::path& filename, const RTCDevice& embree_device);
+/// With a nonzero texture_cache_budget (in bytes), image textures are loaded lazily
+/// and paged through a texture cache of that size instead of being kept in memory.
+/// With a mesh_cache_dir, the meshes loaded from files are cached there in a binary format
+/// (see mesh_cache.h), so that parsing the same scene again skips the mesh parsing.
+std::unique_ptr<Scene> parse_scene(const fs::path& filename, const RTCDevice& embree_device,
+                                   size_t texture_cache_budget = 0, const fs::path& mesh_cache_dir = fs::path());
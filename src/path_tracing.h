@@ -1,13 +1,17 @@
 #pragma once
 
-#include "pcg.h"
+#include "sampler.h"
 #include "scene.h"
 
 /// Unidirectional path tracing
+/// If shadow_queue is given, the shadow rays of next event estimation are not traced right away:
+/// they are pushed to the queue together with their contribution, so that the caller can
+/// test them in batches (see trace_shadow_rays()). The returned radiance then excludes them.
 Spectrum path_tracing(const Scene& scene, int x, int y, /* pixel coordinates */
-                      pcg32_state& rng) {
+                      Sampler& sampler, ShadowRayQueue* shadow_queue = nullptr) {
     int w = scene.camera.width, h = scene.camera.height;
-    Vector2 screen_pos((x + next_pcg32_real<Real>(rng)) / w, (y + next_pcg32_real<Real>(rng)) / h);
+    Vector2 pixel_offset = next_2d(sampler);
+    Vector2 screen_pos{ (x + pixel_offset.x) / w, (y + pixel_offset.y) / h };
     Ray ray                  = sample_primary(scene.camera, screen_pos);
     RayDifferential ray_diff = init_ray_differential(w, h);
 
@@ -87,23 +91,29 @@ Spectrum path_tracing(const Scene& scene, int x, int y, /* pixel coordinates */
         // our hemisphere sampling.
 
         // Let's implement this!
-        const Material& mat = scene.materials[vertex.material_id];
+        // The textures of the material are evaluated once for all the BSDF queries at the vertex.
+        Material mat = prepare_material(scene.materials[vertex.material_id], vertex, scene.texture_pool);
 
         // First, we sample a point on the light source.
         // We do this by first picking a light source, then pick a point on it.
-        Vector2 light_uv{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) };
-        Real light_w                  = next_pcg32_real<Real>(rng);
-        Real shape_w                  = next_pcg32_real<Real>(rng);
-        int light_id                  = sample_light(scene, light_w);
-        const Light& light            = scene.lights[light_id];
-        PointAndNormal point_on_light = sample_point_on_light(light, vertex.position, light_uv, shape_w, scene);
+        // The light BVH picks the lights by their estimated contribution to the point,
+        // so it needs the position and the normal of the point.
+        Vector2 light_uv = next_2d(sampler);
+        Real light_w     = next_1d(sampler);
+        Real shape_w     = next_1d(sampler);
+        int light_id     = sample_light(scene, vertex.position, vertex.geometric_normal, light_w);
 
         // Next, we compute w1*C1/p1. We store C1/p1 in C1.
         Spectrum C1 = make_zero_spectrum();
         Real w1     = 0;
+        Ray shadow_ray;
         // Remember "current_path_throughput" already stores all the path contribution on and before v_i.
         // So we only need to compute G(v_{i}, v_{i+1}) * f(v_{i-1}, v_{i}, v_{i+1}) * L(v_{i}, v_{i+1})
-        {
+        // (if no light can contribute to the point, light_id is -1 and C1 is zero)
+        if (light_id >= 0) {
+            const Light& light            = scene.lights[light_id];
+            PointAndNormal point_on_light = sample_point_on_light(light, vertex.position, light_uv, shape_w, scene);
+
             // Let's first deal with C1 = G * f * L.
             // Let's first compute G.
             Real G = 0;
@@ -116,16 +126,15 @@ Spectrum path_tracing(const Scene& scene, int x, int y, /* pixel coordinates */
                 // To avoid self intersection, we need to set the tnear of the ray
                 // to a small "epsilon". We set the epsilon to be a small constant times the
                 // scale of the scene, which we can obtain through the get_shadow_epsilon() function.
-                Ray shadow_ray{ vertex.position, dir_light, get_shadow_epsilon(scene),
-                                (1 - get_shadow_epsilon(scene)) * distance(point_on_light.position, vertex.position) };
-                if (!occluded(scene, shadow_ray)) {
-                    // geometry term is cosine at v_{i+1} divided by distance squared
-                    // this can be derived by the infinitesimal area of a surface projected on
-                    // a unit sphere -- it's the Jacobian between the area measure and the solid angle
-                    // measure.
-                    G = max(-dot(dir_light, point_on_light.normal), Real(0)) /
-                        distance_squared(point_on_light.position, vertex.position);
-                }
+                shadow_ray = Ray{ vertex.position, dir_light, get_shadow_epsilon(scene),
+                                  (1 - get_shadow_epsilon(scene)) *
+                                      distance(point_on_light.position, vertex.position) };
+                // geometry term is cosine at v_{i+1} divided by distance squared
+                // this can be derived by the infinitesimal area of a surface projected on
+                // a unit sphere -- it's the Jacobian between the area measure and the solid angle
+                // measure.
+                G = max(-dot(dir_light, point_on_light.normal), Real(0)) /
+                    distance_squared(point_on_light.position, vertex.position);
             } else {
                 // The direction from envmap towards the point is stored in
                 // point_on_light.normal.
@@ -133,19 +142,20 @@ Spectrum path_tracing(const Scene& scene, int x, int y, /* pixel coordinates */
                 // If the point on light is occluded, G is 0. So we need to test for occlusion.
                 // To avoid self intersection, we need to set the tnear of the ray
                 // to a small "epsilon" which we define as c_shadow_epsilon as a global constant.
-                Ray shadow_ray{ vertex.position, dir_light, get_shadow_epsilon(scene),
-                                infinity<Real>() /* envmaps are infinitely far away */ };
-                if (!occluded(scene, shadow_ray)) {
-                    // We integrate envmaps using the solid angle measure,
-                    // so the geometry term is 1.
-                    G = 1;
-                }
+                shadow_ray = Ray{ vertex.position, dir_light, get_shadow_epsilon(scene),
+                                  infinity<Real>() /* envmaps are infinitely far away */ };
+                // We integrate envmaps using the solid angle measure,
+                // so the geometry term is 1.
+                G = 1;
             }
+            // Unless the shadow ray is deferred to the queue, test for occlusion now.
+            if (shadow_queue == nullptr && G > 0 && occluded(scene, shadow_ray)) { G = 0; }
 
             // Before we proceed, we first compute the probability density p1(v1)
             // The probability density for light sampling to sample our point is
             // just the probability of sampling a light times the probability of sampling a point
-            Real p1 = light_pmf(scene, light_id) * pdf_point_on_light(light, point_on_light, vertex.position, scene);
+            Real p1 = light_pmf(scene, vertex.position, vertex.geometric_normal, light_id) *
+                      pdf_point_on_light(light, point_on_light, vertex.position, scene);
 
             // We don't need to continue the computation if G is 0.
             // Also sometimes there can be some numerical issue such that we generate
@@ -194,12 +204,17 @@ Spectrum path_tracing(const Scene& scene, int x, int y, /* pixel coordinates */
                 C1 /= p1;
             }
         }
-        radiance += current_path_throughput * C1 * w1;
+        if (shadow_queue == nullptr) {
+            radiance += current_path_throughput * C1 * w1;
+        } else if (w1 > 0) {
+            // Only counts if the shadow ray turns out to be unoccluded.
+            push_shadow_ray(*shadow_queue, shadow_ray, current_path_throughput * C1 * w1);
+        }
 
         // Let's do the hemispherical sampling next.
         Vector3 dir_view = -ray.dir;
-        Vector2 bsdf_rnd_param_uv{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) };
-        Real bsdf_rnd_param_w = next_pcg32_real<Real>(rng);
+        Vector2 bsdf_rnd_param_uv = next_2d(sampler);
+        Real bsdf_rnd_param_w     = next_1d(sampler);
         std::optional<BSDFSampleRecord> bsdf_sample_ =
             sample_bsdf(mat, dir_view, vertex, scene.texture_pool, bsdf_rnd_param_uv, bsdf_rnd_param_w);
         if (!bsdf_sample_) {
@@ -260,7 +275,8 @@ Spectrum path_tracing(const Scene& scene, int x, int y, /* pixel coordinates */
             assert(light_id >= 0);
             const Light& light = scene.lights[light_id];
             PointAndNormal light_point{ bsdf_vertex->position, bsdf_vertex->geometric_normal };
-            Real p1 = light_pmf(scene, light_id) * pdf_point_on_light(light, light_point, vertex.position, scene);
+            Real p1 = light_pmf(scene, vertex.position, vertex.geometric_normal, light_id) *
+                      pdf_point_on_light(light, light_point, vertex.position, scene);
             Real w2 = (p2 * p2) / (p1 * p1 + p2 * p2);
 
             C2 /= p2;
@@ -276,7 +292,7 @@ Spectrum path_tracing(const Scene& scene, int x, int y, /* pixel coordinates */
             // Next let's compute p1(v2): the probability of the light source sampling
             // directly drawing the direction bsdf_dir.
             PointAndNormal light_point{ Vector3{ 0, 0, 0 }, -dir_bsdf }; // pointing outwards from light
-            Real p1 = light_pmf(scene, scene.envmap_light_id) *
+            Real p1 = light_pmf(scene, vertex.position, vertex.geometric_normal, scene.envmap_light_id) *
                       pdf_point_on_light(light, light_point, vertex.position, scene);
             Real w2 = (p2 * p2) / (p1 * p1 + p2 * p2);
 
@@ -294,7 +310,7 @@ Spectrum path_tracing(const Scene& scene, int x, int y, /* pixel coordinates */
         Real rr_prob = 1;
         if (num_vertices - 1 >= scene.options.rr_depth) {
             rr_prob = min(max((1 / eta_scale) * current_path_throughput), Real(0.95));
-            if (next_pcg32_real<Real>(rng) > rr_prob) {
+            if (next_1d(sampler) > rr_prob) {
                 // Terminate the path
                 break;
             }
@@ -1,4 +1,5 @@
 #include "phase_function.h"
+#include "stats.h"
 
 struct eval_op {
     Spectrum operator()(const IsotropicPhase& p) const;
@@ -33,6 +34,7 @@ Spectrum eval(const PhaseFunction& phase_function, const Vector3& dir_in, const
 
 std::optional<Vector3> sample_phase_function(const PhaseFunction& phase_function, const Vector3& dir_in,
                                              const Vector2& rnd_param) {
+    add_stat(StatCounter::PhaseSamples);
     return std::visit(sample_phase_function_op{ dir_in, rnd_param }, phase_function);
 }
 
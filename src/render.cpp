@@ -1,28 +1,34 @@
 #include "render.h"
+#include "checkpoint.h"
+#include "film.h"
 #include "intersection.h"
 #include "material.h"
 #include "parallel.h"
 #include "path_tracing.h"
-#include "pcg.h"
 #include "progress_reporter.h"
+#include "sampler.h"
 #include "scene.h"
+#include "stats.h"
+#include "timer.h"
 #include "vol_path_tracing.h"
+#include "wavefront_path_tracing.h"
 
 /// Render auxiliary buffers e.g., depth.
 Image3 aux_render(const Scene& scene) {
     int w = scene.camera.width, h = scene.camera.height;
     Image3 img(w, h);
 
-    constexpr int tile_size = 16;
-    int num_tiles_x         = (w + tile_size - 1) / tile_size;
-    int num_tiles_y         = (h + tile_size - 1) / tile_size;
+    int tile_size               = max(scene.options.tile_size, 1);
+    std::vector<Vector2i> tiles = order_tiles(
+        Vector2i{ (w + tile_size - 1) / tile_size, (h + tile_size - 1) / tile_size }, scene.options.tile_order);
 
     parallel_for(
-        [&](const Vector2i& tile) {
-            int x0 = tile[0] * tile_size;
-            int x1 = min(x0 + tile_size, w);
-            int y0 = tile[1] * tile_size;
-            int y1 = min(y0 + tile_size, h);
+        [&](int64_t tile_index) {
+            const Vector2i& tile = tiles[tile_index];
+            int x0               = tile[0] * tile_size;
+            int x1               = min(x0 + tile_size, w);
+            int y0               = tile[1] * tile_size;
+            int y1               = min(y0 + tile_size, h);
             for (int y = y0; y < y1; y++) {
                 for (int x = x0; x < x1; x++) {
                     Ray ray = sample_primary(scene.camera, Vector2((x + Real(0.5)) / w, (y + Real(0.5)) / h));
@@ -65,51 +71,219 @@ Image3 aux_render(const Scene& scene) {
                 }
             }
         },
-        Vector2i(num_tiles_x, num_tiles_y));
+        (int64_t)tiles.size());
 
     return img;
 }
 
-Image3 path_render(const Scene& scene) {
+/// Render the image in passes over all the tiles, accumulating the samples into a Film.
+/// Normally there is a single pass taking all the samples per pixel.
+/// The tiles have tile_size^2 pixels and are handed to parallel_for in tile_order (see tile_order.h).
+/// In progressive mode, every pass takes one sample per pixel, and we stop once
+/// samples_per_pixel is reached or the next pass would exceed the time budget.
+/// Every checkpoint_interval seconds the current estimate is written to the output file,
+/// and the state of the render to its checkpoint file (see checkpoint.h), once more at the end.
+/// With resume, we start from the checkpoint file (if there is one) instead of an empty film:
+/// the pixels only take the samples they are still missing, and the time budget counts the time spent before.
+/// With adaptive sampling (adaptive_threshold > 0), every pass takes adaptive_min_samples
+/// samples per pixel, but only at the pixels whose relative error is still above the threshold,
+/// so the samples concentrate where the image has not converged yet.
+/// samples_per_pixel is then the maximum number of samples of a pixel.
+///
+/// The samples are handed to render_batch(pixels, sample_indices, sampler, radiance) in batches of about
+/// batch_size samples (from the same tile), which writes the sample sample_indices[i] of pixels[i] to radiance[i].
+/// The sample index of a pixel keeps on counting over the passes, so that every pass gets new samples.
+///
+/// A shard (num_shards > 1) only takes the samples [shard_index * spp / num_shards, (shard_index + 1) * spp /
+/// num_shards) of every pixel, and writes its film to its checkpoint file at the end,
+/// so that "lajolla merge" can add the films of all the shards up (see checkpoint.h).
+template <typename BatchFunc>
+Image3 progressive_render(const Scene& scene, const BatchFunc& render_batch, int batch_size) {
     int w = scene.camera.width, h = scene.camera.height;
-    Image3 img(w, h);
+    Film film(w, h);
+    Real elapsed = 0;
+    if (scene.options.resume) {
+        RenderCheckpoint checkpoint;
+        if (read_checkpoint(checkpoint_filename(scene), scene, checkpoint)) {
+            film    = std::move(checkpoint.film);
+            elapsed = checkpoint.elapsed;
+            fprintf(stdout, " resuming from %s (%.2f seconds)\n", checkpoint_filename(scene).string().c_str(),
+                    elapsed);
+        }
+    }
 
-    constexpr int tile_size = 16;
-    int num_tiles_x         = (w + tile_size - 1) / tile_size;
-    int num_tiles_y         = (h + tile_size - 1) / tile_size;
+    int tile_size               = max(scene.options.tile_size, 1);
+    std::vector<Vector2i> tiles = order_tiles(
+        Vector2i{ (w + tile_size - 1) / tile_size, (h + tile_size - 1) / tile_size }, scene.options.tile_order);
 
-    ProgressReporter reporter(num_tiles_x * num_tiles_y);
-    parallel_for(
-        [&](const Vector2i& tile) {
-            // Use a different rng stream for each thread.
-            pcg32_state rng = init_pcg32(tile[1] * num_tiles_x + tile[0]);
-            int x0          = tile[0] * tile_size;
-            int x1          = min(x0 + tile_size, w);
-            int y0          = tile[1] * tile_size;
-            int y1          = min(y0 + tile_size, h);
-            for (int y = y0; y < y1; y++) {
-                for (int x = x0; x < x1; x++) {
-                    Spectrum radiance = make_zero_spectrum();
-                    int spp           = scene.options.samples_per_pixel;
-                    for (int s = 0; s < spp; s++) { radiance += path_tracing(scene, x, y, rng); }
-                    img(x, y) = radiance / Real(spp);
+    Sampler sampler_prototype = make_sampler(scene.options.sampler, scene.options.samples_per_pixel,
+                                             Vector2i{ w, h }, scene.options.sampler_seed);
+
+    // The samples of this shard (all of them without sharding). The film counts from 0 to spp.
+    int num_shards   = scene.options.num_shards;
+    int sample_begin = int(int64_t(scene.options.samples_per_pixel) * scene.options.shard_index / num_shards);
+    int sample_end   = int(int64_t(scene.options.samples_per_pixel) * (scene.options.shard_index + 1) / num_shards);
+    int spp          = sample_end - sample_begin;
+
+    bool adaptive      = scene.options.adaptive_threshold > 0;
+    auto needs_samples = [&](int x, int y) {
+        if (film.counts(x, y) >= spp) { return false; }
+        return !adaptive || pixel_error(film, x, y, spp) >= scene.options.adaptive_threshold;
+    };
+    // Returns the number of pixels that still need samples after the pass.
+    auto render_pass = [&](int pass_spp, ProgressReporter* reporter) {
+        std::atomic<int64_t> num_active{ 0 };
+        parallel_for(
+            [&](int64_t tile_index) {
+                const Vector2i& tile = tiles[tile_index];
+                Sampler sampler      = sampler_prototype;
+                int x0               = tile[0] * tile_size;
+                int x1               = min(x0 + tile_size, w);
+                int y0               = tile[1] * tile_size;
+                int y1               = min(y0 + tile_size, h);
+                // Gather the samples of a few pixels, render them as a batch, and only then add them to the film.
+                std::vector<Vector2i> sample_pixels;
+                std::vector<int> sample_indices;
+                std::vector<Spectrum> sample_radiance;
+                auto flush = [&]() {
+                    sample_radiance.resize(sample_pixels.size());
+                    render_batch(sample_pixels, sample_indices, sampler, sample_radiance);
+                    for (int i = 0; i < (int)sample_pixels.size(); i++) {
+                        add_sample(film, sample_pixels[i].x, sample_pixels[i].y, sample_radiance[i]);
+                    }
+                    sample_radiance.clear();
+                    sample_indices.clear();
+                    sample_pixels.clear();
+                };
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        if (!needs_samples(x, y)) { continue; }
+                        int n = min(pass_spp, spp - film.counts(x, y));
+                        for (int s = 0; s < n; s++) {
+                            sample_pixels.push_back(Vector2i{ x, y });
+                            sample_indices.push_back(sample_begin + film.counts(x, y) + s);
+                        }
+                        if ((int)sample_pixels.size() >= batch_size) { flush(); }
+                    }
                 }
-            }
-            reporter.update(1);
-        },
-        Vector2i(num_tiles_x, num_tiles_y));
-    reporter.done();
-    return img;
+                flush();
+                int64_t active = 0;
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        if (needs_samples(x, y)) { active++; }
+                    }
+                }
+                num_active += active;
+                if (reporter != nullptr) { reporter->update(1); }
+            },
+            (int64_t)tiles.size());
+        return int64_t(num_active);
+    };
+
+    if (!scene.options.progressive && !adaptive) {
+        ProgressReporter reporter(tiles.size());
+        Timer timer;
+        tick(timer);
+        render_pass(spp, &reporter);
+        reporter.done();
+        if (num_shards > 1) {
+            StatPhaseTimer phase_timer(StatPhase::Write);
+            write_checkpoint(checkpoint_filename(scene), scene, film, elapsed + tick(timer));
+        }
+        return resolve(film);
+    }
+
+    int pass_spp = adaptive ? max(min(scene.options.adaptive_min_samples, spp), 2) : 1;
+    Timer timer, pass_timer;
+    tick(timer);
+    tick(pass_timer);
+    Real last_checkpoint = elapsed, pass_time = 0;
+    int num_passes       = 0;
+    int64_t num_active   = int64_t(w) * int64_t(h);
+    // The intermediate image, and the state to resume from
+    auto write_checkpoints = [&]() {
+        StatPhaseTimer phase_timer(StatPhase::Write);
+        imwrite(scene.output_filename, resolve(film));
+        write_checkpoint(checkpoint_filename(scene), scene, film, elapsed);
+        last_checkpoint = elapsed;
+    };
+    while (num_active > 0) {
+        // Always finish at least one pass.
+        if (scene.options.time_budget > 0 && num_passes > 0 && elapsed + pass_time > scene.options.time_budget) {
+            break;
+        }
+        tick(pass_timer);
+        num_active = render_pass(pass_spp, nullptr);
+        num_passes++;
+        pass_time = tick(pass_timer);
+        elapsed += tick(timer);
+        fprintf(stdout, "\r pass %d, %lld pixels left (%.2f seconds)", num_passes, (long long)num_active, elapsed);
+        fflush(stdout);
+        if (scene.options.checkpoint_interval > 0 && num_active > 0 &&
+            elapsed - last_checkpoint >= scene.options.checkpoint_interval) {
+            write_checkpoints();
+        }
+    }
+    // Also at the end (the caller writes the image), to resume when we stopped for the time budget,
+    // to continue later with more samples per pixel, or to merge the shards.
+    if (scene.options.checkpoint_interval > 0 || num_shards > 1) {
+        StatPhaseTimer phase_timer(StatPhase::Write);
+        write_checkpoint(checkpoint_filename(scene), scene, film, elapsed);
+    }
+    int64_t total_samples = 0;
+    for (int c : film.counts.data) { total_samples += c; }
+    fprintf(stdout, "\n %.2f samples per pixel on average\n", Real(total_samples) / (Real(w) * Real(h)));
+    return resolve(film);
 }
 
-Image3 vol_path_render(const Scene& scene) {
-    int w = scene.camera.width, h = scene.camera.height;
-    Image3 img(w, h);
+/// Render a batch with an integrator that computes one sample at a time, path_func(x, y, sampler, shadow_queue).
+/// The shadow rays the integrator defers to the queue are traced together in packets at the end.
+template <typename PathFunc>
+void render_batch_megakernel(const Scene& scene, const PathFunc& path_func, const std::vector<Vector2i>& pixels,
+                             const std::vector<int>& sample_indices, Sampler& sampler,
+                             std::vector<Spectrum>& radiance) {
+    ShadowRayQueue shadow_queue;
+    // The length of a path is the number of scattering events the integrator sampled for it.
+    auto num_scatterings = []() {
+        return get_thread_stat(StatCounter::BsdfSamples) + get_thread_stat(StatCounter::PhaseSamples);
+    };
+    uint64_t scatterings = num_scatterings();
+    for (int i = 0; i < (int)pixels.size(); i++) {
+        start_pixel_sample(sampler, pixels[i], sample_indices[i]);
+        shadow_queue.sample_id = i;
+        radiance[i]            = path_func(pixels[i].x, pixels[i].y, sampler, &shadow_queue);
+        uint64_t next          = num_scatterings();
+        add_path_length_stat(int(next - scatterings));
+        scatterings = next;
+    }
+    trace_shadow_rays(scene, shadow_queue, radiance.data());
+}
 
-    constexpr int tile_size = 16;
-    int num_tiles_x         = (w + tile_size - 1) / tile_size;
-    int num_tiles_y         = (h + tile_size - 1) / tile_size;
+Image3 path_render(const Scene& scene) {
+    auto path_func = [&](int x, int y, Sampler& sampler, ShadowRayQueue* shadow_queue) {
+        return path_tracing(scene, x, y, sampler, shadow_queue);
+    };
+    return progressive_render(
+        scene,
+        [&](const std::vector<Vector2i>& pixels, const std::vector<int>& sample_indices, Sampler& sampler,
+            std::vector<Spectrum>& radiance) {
+            render_batch_megakernel(scene, path_func, pixels, sample_indices, sampler, radiance);
+        },
+        64);
+}
+
+Image3 wavefront_path_render(const Scene& scene) {
+    // Large batches keep the path pool full. A tile with one pass has at most tile_size^2 * spp samples.
+    return progressive_render(
+        scene,
+        [&](const std::vector<Vector2i>& pixels, const std::vector<int>& sample_indices, Sampler& sampler,
+            std::vector<Spectrum>& radiance) {
+            wavefront_path_tracing(scene, pixels, sample_indices, sampler, radiance);
+        },
+        4096);
+}
 
+Image3 vol_path_render(const Scene& scene) {
     auto f = vol_path_tracing;
     if (scene.options.vol_path_version == 1) {
         f = vol_path_tracing_1;
@@ -125,37 +299,24 @@ Image3 vol_path_render(const Scene& scene) {
         f = vol_path_tracing;
     }
 
-    ProgressReporter reporter(num_tiles_x * num_tiles_y);
-    parallel_for(
-        [&](const Vector2i& tile) {
-            // Use a different rng stream for each thread.
-            pcg32_state rng = init_pcg32(tile[1] * num_tiles_x + tile[0]);
-            int x0          = tile[0] * tile_size;
-            int x1          = min(x0 + tile_size, w);
-            int y0          = tile[1] * tile_size;
-            int y1          = min(y0 + tile_size, h);
-            for (int y = y0; y < y1; y++) {
-                for (int x = x0; x < x1; x++) {
-                    Spectrum radiance = make_zero_spectrum();
-                    int spp           = scene.options.samples_per_pixel;
-                    for (int s = 0; s < spp; s++) {
-                        Spectrum L = f(scene, x, y, rng);
-                        if (isfinite(L)) {
-                            // Hacky: exclude NaNs in the rendering.
-                            radiance += L;
-                        }
-                    }
-                    img(x, y) = radiance / Real(spp);
-                }
-            }
-            reporter.update(1);
+    // The volumetric next event estimation accumulates transmittance through index-matched
+    // surfaces segment by segment, so it is not a plain occlusion test and is not deferred.
+    auto path_func = [&](int x, int y, Sampler& sampler, ShadowRayQueue*) {
+        Spectrum L = f(scene, x, y, sampler);
+        // Hacky: exclude NaNs in the rendering.
+        return isfinite(L) ? L : make_zero_spectrum();
+    };
+    return progressive_render(
+        scene,
+        [&](const std::vector<Vector2i>& pixels, const std::vector<int>& sample_indices, Sampler& sampler,
+            std::vector<Spectrum>& radiance) {
+            render_batch_megakernel(scene, path_func, pixels, sample_indices, sampler, radiance);
         },
-        Vector2i(num_tiles_x, num_tiles_y));
-    reporter.done();
-    return img;
+        64);
 }
 
 Image3 render(const Scene& scene) {
+    StatPhaseTimer phase_timer(StatPhase::Render);
     if (scene.options.integrator == Integrator::Depth || scene.options.integrator == Integrator::ShadingNormal ||
         scene.options.integrator == Integrator::MeanCurvature ||
         scene.options.integrator == Integrator::RayDifferential ||
@@ -163,6 +324,8 @@ Image3 render(const Scene& scene) {
         return aux_render(scene);
     } else if (scene.options.integrator == Integrator::Path) {
         return path_render(scene);
+    } else if (scene.options.integrator == Integrator::WavefrontPath) {
+        return wavefront_path_render(scene);
     } else if (scene.options.integrator == Integrator::VolPath) {
         return vol_path_render(scene);
     } else {
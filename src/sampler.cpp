@@ -0,0 +1,24 @@
+#include "sampler.h"
+
+static int log2_ceil(uint64_t v) {
+    int ret = 0;
+    while ((uint64_t(1) << ret) < v) { ret++; }
+    return ret;
+}
+
+Sampler make_sampler(SamplerType type, int samples_per_pixel, const Vector2i& resolution, uint64_t seed) {
+    samples_per_pixel = max(samples_per_pixel, 1);
+    if (type == SamplerType::Sobol) {
+        return SobolSampler{ seed, Vector2i{ 0, 0 }, 0, 0 };
+    } else if (type == SamplerType::PMJ02) {
+        return PMJ02Sampler{ seed, uint32_t(samples_per_pixel), Vector2i{ 0, 0 }, 0, 0 };
+    } else if (type == SamplerType::ZSobol) {
+        int log2_spp = log2_ceil(samples_per_pixel);
+        int log2_res = log2_ceil(max(resolution.x, resolution.y));
+        // The base-4 digits of the Morton index of the pixel, followed by those of the sample index
+        int num_base4_digits = log2_res + (log2_spp + 1) / 2;
+        return ZSobolSampler{ seed, log2_spp, num_base4_digits, 0, 0 };
+    } else {
+        return IndependentSampler{ seed, init_pcg32() };
+    }
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "lajolla.h"
+#include "low_discrepancy.h"
+#include "pcg.h"
+#include "vector.h"
+
+#include <variant>
+
+/// The integrators draw all their random numbers from a Sampler.
+/// Before computing a sample, the renderer calls start_pixel_sample(sampler, pixel, sample_index);
+/// the integrator then draws the dimensions of the sample one after another with next_1d() and next_2d().
+/// For the low-discrepancy samplers, a dimension of all the samples of a pixel (or of the whole image,
+/// for z-sobol) forms a well stratified point set. So the integrators draw the dimensions in the same
+/// order for every sample, and draw the 2D quantities (e.g., a point on a light) with next_2d().
+/// All the samplers only depend on (pixel, sample index, dimension, seed), so the images do not depend
+/// on the order in which the samples are computed.
+
+enum class SamplerType {
+    Independent, // uniform random numbers from PCG
+    Sobol,       // Owen-scrambled Sobol (0,2)-sequences, padded per pair of dimensions
+    PMJ02,       // progressive multi-jittered (0,2) sample sets
+    ZSobol       // Sobol with the samples of the pixels interleaved in Morton order (blue noise over the image)
+};
+
+/// Uniform random numbers, from a PCG stream chosen by the pixel sample.
+struct IndependentSampler {
+    uint64_t seed;
+    pcg32_state rng;
+};
+
+/// Owen-scrambled Sobol, from Brent Burley, "Practical Hash-based Owen Scrambling", JCGT 2020.
+/// Every pair of dimensions is an independently shuffled and scrambled copy of the (0,2)-sequence
+/// of the first two Sobol dimensions. The scrambling is different for every pixel.
+struct SobolSampler {
+    uint64_t seed;
+    Vector2i pixel;
+    uint32_t sample_index;
+    int dimension;
+};
+
+/// Progressive multi-jittered (0,2) sample sets, similar to pbrt-v4's PMJ02BN sampler:
+/// every pair of dimensions is an Owen-scrambled (0,2)-sequence (which is a stochastic pmj02
+/// sequence, see Helmer et al., "Stochastic Generation of (t,s) Sample Sequences", EGSR 2021),
+/// shared by all the pixels. Each pixel shuffles the samples and applies a random digital shift.
+/// The 1D dimensions are jittered samples in a random order per pixel, stratified over samples_per_pixel.
+struct PMJ02Sampler {
+    uint64_t seed;
+    uint32_t samples_per_pixel;
+    Vector2i pixel;
+    uint32_t sample_index;
+    int dimension;
+};
+
+/// From Abdalla G. M. Ahmed and Peter Wonka, "Screen-Space Blue-Noise Diffusion of Monte Carlo Sampling Error
+/// via Hierarchical Ordering of Pixels", 2020, following pbrt-v4's ZSobolSampler.
+/// The samples of all the pixels are consecutive indices of one Owen-scrambled Sobol sequence,
+/// assigned to the pixels in Morton order with random permutations of the base-4 digits,
+/// so that neighboring pixels get complementary samples and the error becomes blue noise.
+/// samples_per_pixel is rounded up to a power of two.
+struct ZSobolSampler {
+    uint64_t seed;
+    int log2_samples_per_pixel;
+    int num_base4_digits;
+    uint64_t morton_index;
+    int dimension;
+};
+
+using Sampler = std::variant<IndependentSampler, SobolSampler, PMJ02Sampler, ZSobolSampler>;
+
+/// Create a sampler for an image of the given size with (at most) samples_per_pixel samples per pixel.
+Sampler make_sampler(SamplerType type, int samples_per_pixel, const Vector2i& resolution, uint64_t seed = 0);
+
+/// Hash of the pixel sample (pixel, sample_index) at "dimension".
+inline uint64_t hash_pixel_sample(uint64_t seed, const Vector2i& pixel, uint64_t dimension) {
+    return hash_combine(hash_combine(seed, (uint64_t(uint32_t(pixel.x)) << 32) | uint32_t(pixel.y)), dimension);
+}
+
+/// The index in the Sobol sequence of the current sample and dimension.
+inline uint64_t zsobol_sample_index(const ZSobolSampler& sampler) {
+    // The 24 permutations of the base-4 digits
+    static const uint8_t permutations[24][4] = {
+        { 0, 1, 2, 3 }, { 0, 1, 3, 2 }, { 0, 2, 1, 3 }, { 0, 2, 3, 1 }, { 0, 3, 2, 1 }, { 0, 3, 1, 2 },
+        { 1, 0, 2, 3 }, { 1, 0, 3, 2 }, { 1, 2, 0, 3 }, { 1, 2, 3, 0 }, { 1, 3, 2, 0 }, { 1, 3, 0, 2 },
+        { 2, 1, 0, 3 }, { 2, 1, 3, 0 }, { 2, 0, 1, 3 }, { 2, 0, 3, 1 }, { 2, 3, 0, 1 }, { 2, 3, 1, 0 },
+        { 3, 1, 2, 0 }, { 3, 1, 0, 2 }, { 3, 2, 1, 0 }, { 3, 2, 0, 1 }, { 3, 0, 2, 1 }, { 3, 0, 1, 2 }
+    };
+    uint64_t dimension_hash = (0x55555555u * uint64_t(sampler.dimension)) ^ sampler.seed;
+    uint64_t sample_index   = 0;
+    // With an odd power of two samples per pixel, the last digit is in base 2.
+    bool base2_last_digit = sampler.log2_samples_per_pixel & 1;
+    int last_digit        = base2_last_digit ? 1 : 0;
+    for (int i = sampler.num_base4_digits - 1; i >= last_digit; i--) {
+        // Permute each digit randomly, depending on the digits above it.
+        int digit_shift        = 2 * i - (base2_last_digit ? 1 : 0);
+        int digit              = (sampler.morton_index >> digit_shift) & 3;
+        uint64_t higher_digits = sampler.morton_index >> (digit_shift + 2);
+        int p                  = (mix_bits(higher_digits ^ dimension_hash) >> 24) % 24;
+        sample_index |= uint64_t(permutations[p][digit]) << digit_shift;
+    }
+    if (base2_last_digit) {
+        uint64_t digit = sampler.morton_index & 1;
+        sample_index |= digit ^ (mix_bits((sampler.morton_index >> 1) ^ dimension_hash) & 1);
+    }
+    return sample_index;
+}
+
+struct start_pixel_sample_op {
+    void operator()(IndependentSampler& s) const { s.rng = init_pcg32(hash_pixel_sample(s.seed, pixel, sample_index)); }
+    void operator()(SobolSampler& s) const {
+        s.pixel        = pixel;
+        s.sample_index = uint32_t(sample_index);
+        s.dimension    = 0;
+    }
+    void operator()(PMJ02Sampler& s) const {
+        s.pixel        = pixel;
+        s.sample_index = uint32_t(sample_index);
+        s.dimension    = 0;
+    }
+    void operator()(ZSobolSampler& s) const {
+        s.morton_index = (encode_morton_2(pixel.x, pixel.y) << s.log2_samples_per_pixel) | sample_index;
+        s.dimension    = 0;
+    }
+
+    const Vector2i& pixel;
+    uint64_t sample_index;
+};
+
+struct next_1d_op {
+    Real operator()(IndependentSampler& s) const { return next_pcg32_real<Real>(s.rng); }
+    Real operator()(SobolSampler& s) const {
+        uint64_t hash  = hash_pixel_sample(s.seed, s.pixel, s.dimension++);
+        uint32_t index = owen_scramble(s.sample_index, uint32_t(hash));
+        return bits_to_real(owen_scramble(sobol_sample_0(index), uint32_t(hash >> 32)));
+    }
+    Real operator()(PMJ02Sampler& s) const {
+        uint64_t hash  = hash_pixel_sample(s.seed, s.pixel, s.dimension++);
+        uint32_t index = permutation_element(s.sample_index % s.samples_per_pixel, s.samples_per_pixel,
+                                             uint32_t(hash));
+        Real jitter    = bits_to_real(uint32_t(hash >> 32));
+        return min((index + jitter) / s.samples_per_pixel, c_one_minus_epsilon);
+    }
+    Real operator()(ZSobolSampler& s) const {
+        uint64_t index = zsobol_sample_index(s);
+        uint64_t hash  = hash_combine(s.seed, ++s.dimension);
+        return bits_to_real(owen_scramble(sobol_sample_0(index), uint32_t(hash)));
+    }
+};
+
+struct next_2d_op {
+    Vector2 operator()(IndependentSampler& s) const {
+        return Vector2{ next_pcg32_real<Real>(s.rng), next_pcg32_real<Real>(s.rng) };
+    }
+    Vector2 operator()(SobolSampler& s) const {
+        uint64_t hash = hash_pixel_sample(s.seed, s.pixel, s.dimension);
+        s.dimension += 2;
+        uint32_t index    = owen_scramble(s.sample_index, uint32_t(hash));
+        uint64_t scramble = mix_bits(hash);
+        return Vector2{ bits_to_real(owen_scramble(sobol_sample_0(index), uint32_t(scramble))),
+                        bits_to_real(owen_scramble(sobol_sample_1(index), uint32_t(scramble >> 32))) };
+    }
+    Vector2 operator()(PMJ02Sampler& s) const {
+        uint64_t hash = hash_pixel_sample(s.seed, s.pixel, s.dimension);
+        // The sample set of the pair of dimensions is the same for all the pixels.
+        uint64_t scramble = hash_combine(s.seed, s.dimension);
+        s.dimension += 2;
+        uint32_t index = owen_scramble(s.sample_index, uint32_t(hash));
+        // A random digital shift (XOR) per pixel maps the elementary intervals onto each other,
+        // so unlike a toroidal shift it keeps the samples of the pixel stratified.
+        uint64_t shift = mix_bits(hash);
+        return Vector2{
+            bits_to_real(owen_scramble(sobol_sample_0(index), uint32_t(scramble)) ^ uint32_t(shift)),
+            bits_to_real(owen_scramble(sobol_sample_1(index), uint32_t(scramble >> 32)) ^ uint32_t(shift >> 32)) };
+    }
+    Vector2 operator()(ZSobolSampler& s) const {
+        uint64_t index = zsobol_sample_index(s);
+        s.dimension += 2;
+        uint64_t hash = hash_combine(s.seed, s.dimension);
+        return Vector2{ bits_to_real(owen_scramble(sobol_sample_0(index), uint32_t(hash))),
+                        bits_to_real(owen_scramble(sobol_sample_1(index), uint32_t(hash >> 32))) };
+    }
+};
+
+/// Start computing sample "sample_index" of pixel "pixel" (from dimension 0).
+inline void start_pixel_sample(Sampler& sampler, const Vector2i& pixel, uint64_t sample_index) {
+    std::visit(start_pixel_sample_op{ pixel, sample_index }, sampler);
+}
+
+/// The next dimension of the current sample, in [0, 1).
+inline Real next_1d(Sampler& sampler) { return std::visit(next_1d_op{}, sampler); }
+
+/// The next two dimensions of the current sample, in [0, 1)^2.
+inline Vector2 next_2d(Sampler& sampler) { return std::visit(next_2d_op{}, sampler); }
@@ -1,38 +1,99 @@
 #include "scene.h"
+#include "flexception.h"
+#include "parallel.h"
+#include "stats.h"
 #include "table_dist.h"
+#include "transform.h"
 
-Scene::Scene(const RTCDevice& embree_device, const Camera& camera, const std::vector<Material>& materials,
-             const std::vector<Shape>& shapes, const std::vector<Light>& lights, const std::vector<Medium>& media,
-             int envmap_light_id, const TexturePool& texture_pool, const RenderOptions& options,
-             const std::string& output_filename)
-    : embree_device(embree_device), camera(camera), materials(materials), shapes(shapes), lights(lights), media(media),
-      envmap_light_id(envmap_light_id), texture_pool(texture_pool), options(options), output_filename(output_filename) {
-    // Register the geometry to Embree
-    embree_scene = rtcNewScene(embree_device);
+#include <algorithm>
+
+static RTCScene new_embree_scene(const RTCDevice& embree_device) {
+    RTCScene embree_scene = rtcNewScene(embree_device);
     // We don't care about build time.
     rtcSetSceneBuildQuality(embree_scene, RTC_BUILD_QUALITY_HIGH);
     rtcSetSceneFlags(embree_scene, RTC_SCENE_FLAG_ROBUST);
-    for (const Shape& shape : this->shapes) { register_embree(shape, embree_device, embree_scene); }
-    rtcCommitScene(embree_scene);
+    return embree_scene;
+}
 
+static void update_bounds(Scene& scene) {
     // Get scene bounding box from Embree
     RTCBounds embree_bounds;
-    rtcGetSceneBounds(embree_scene, &embree_bounds);
+    rtcGetSceneBounds(scene.embree_scene, &embree_bounds);
     Vector3 lb{ embree_bounds.lower_x, embree_bounds.lower_y, embree_bounds.lower_z };
     Vector3 ub{ embree_bounds.upper_x, embree_bounds.upper_y, embree_bounds.upper_z };
-    bounds = BSphere{ distance(ub, lb) / 2, (lb + ub) / Real(2) };
-
-    // build shape & light sampling distributions if necessary
-    // TODO: const_cast is a bit ugly...
-    std::vector<Shape>& mod_shapes = const_cast<std::vector<Shape>&>(this->shapes);
-    for (Shape& shape : mod_shapes) { init_sampling_dist(shape); }
-    std::vector<Light>& mod_lights = const_cast<std::vector<Light>&>(this->lights);
-    for (Light& light : mod_lights) { init_sampling_dist(light, *this); }
+    scene.bounds = BSphere{ distance(ub, lb) / 2, (lb + ub) / Real(2) };
+}
 
+static void build_light_sampling(Scene& scene) {
     // build a sampling distributino for all the lights
-    std::vector<Real> power(this->lights.size());
-    for (int i = 0; i < (int)this->lights.size(); i++) { power[i] = light_power(this->lights[i], *this); }
-    light_dist = make_table_dist_1d(power);
+    std::vector<Real> power(scene.lights.size());
+    parallel_for([&](int64_t i) { power[i] = light_power(scene.lights[i], scene); }, scene.lights.size(), 64);
+    scene.light_dist = make_table_dist_1d(power);
+    if (scene.options.light_sampler == LightSampler::BVH) { scene.light_bvh = make_light_bvh(scene.lights, scene); }
+}
+
+Scene::Scene(const RTCDevice& embree_device, const Camera& camera, const std::vector<Material>& materials,
+             const std::vector<Shape>& shapes, const std::vector<Light>& lights, const std::vector<Medium>& media,
+             int envmap_light_id, const TexturePool& texture_pool, const RenderOptions& options,
+             const std::string& output_filename, const std::vector<ShapeGroup>& shape_groups,
+             const std::vector<ShapeInstance>& instances)
+    : embree_device(embree_device), camera(camera), materials(materials), shapes(shapes), lights(lights), media(media),
+      shape_groups(shape_groups), instances(instances), envmap_light_id(envmap_light_id), texture_pool(texture_pool),
+      options(options), output_filename(output_filename) {
+    std::optional<StatPhaseTimer> phase_timer;
+    phase_timer.emplace(StatPhase::BvhBuild);
+    // Register the geometry to Embree
+    embree_scene = new_embree_scene(embree_device);
+    std::vector<bool> in_group(this->shapes.size(), false);
+    for (const ShapeGroup& group : this->shape_groups) {
+        for (int shape_id : group.shape_ids) { in_group[shape_id] = true; }
+    }
+    for (int i = 0; i < (int)this->shapes.size(); i++) {
+        if (!in_group[i]) { register_embree(this->shapes[i], embree_device, embree_scene, i); }
+    }
+    // One Embree scene per group, with the same geomIDs as in the top level
+    // (so that a hit gives us the shape ID directly), shared by all its instances.
+    std::vector<RTCScene> group_scenes;
+    for (const ShapeGroup& group : this->shape_groups) {
+        RTCScene group_scene = new_embree_scene(embree_device);
+        for (int shape_id : group.shape_ids) {
+            register_embree(this->shapes[shape_id], embree_device, group_scene, shape_id);
+        }
+        rtcCommitScene(group_scene);
+        group_scenes.push_back(group_scene);
+    }
+    for (int i = 0; i < (int)this->instances.size(); i++) {
+        const ShapeInstance& instance = this->instances[i];
+        RTCGeometry rtc_geom          = rtcNewGeometry(embree_device, RTC_GEOMETRY_TYPE_INSTANCE);
+        rtcSetGeometryInstancedScene(rtc_geom, group_scenes[instance.group_id]);
+        float xform[16];
+        for (int column = 0; column < 4; column++) {
+            for (int row = 0; row < 4; row++) { xform[4 * column + row] = (float)instance.to_world(row, column); }
+        }
+        rtcSetGeometryTransform(rtc_geom, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, xform);
+        rtcCommitGeometry(rtc_geom);
+        rtcAttachGeometryByID(embree_scene, rtc_geom, (unsigned int)(this->shapes.size() + i));
+        rtcReleaseGeometry(rtc_geom);
+    }
+    // The instances hold on to the group scenes
+    for (RTCScene group_scene : group_scenes) { rtcReleaseScene(group_scene); }
+    rtcCommitScene(embree_scene);
+
+    update_bounds(*this);
+
+    phase_timer.reset();
+    phase_timer.emplace(StatPhase::DistributionBuild);
+    // build shape & light sampling distributions if necessary
+    // (each distribution is independent, so they can be built in parallel)
+    // Only the emitters are ever sampled, so the other shapes (e.g., large meshes) skip their distributions.
+    // An edit that makes a shape an emitter builds its distribution then (see replace_light).
+    parallel_for(
+        [&](int64_t i) {
+            if (is_light(this->shapes[i])) { init_sampling_dist(this->shapes[i]); }
+        },
+        this->shapes.size());
+    parallel_for([&](int64_t i) { init_sampling_dist(this->lights[i], *this); }, this->lights.size());
+    build_light_sampling(*this);
 }
 
 Scene::~Scene() {
@@ -41,6 +102,163 @@ Scene::~Scene() {
     rtcReleaseScene(embree_scene);
 }
 
-int sample_light(const Scene& scene, Real u) { return sample(scene.light_dist, u); }
+int sample_light(const Scene& scene, const Vector3& ref_point, const Vector3& ref_normal, Real u) {
+    if (scene.options.light_sampler == LightSampler::BVH) { return sample(scene.light_bvh, ref_point, ref_normal, u); }
+    return sample(scene.light_dist, u);
+}
+
+Real light_pmf(const Scene& scene, const Vector3& ref_point, const Vector3& ref_normal, int light_id) {
+    if (scene.options.light_sampler == LightSampler::BVH) {
+        return pmf(scene.light_bvh, ref_point, ref_normal, light_id);
+    }
+    return pmf(scene.light_dist, light_id);
+}
+
+/// Check that the shape can be edited, and switch the scene to a two-level BVH at the first edit.
+static void begin_shape_edit(Scene& scene, int shape_id) {
+    if (shape_id < 0 || shape_id >= (int)scene.shapes.size()) {
+        Error(std::string("Invalid shape ID: ") + std::to_string(shape_id));
+    }
+    for (const ShapeGroup& group : scene.shape_groups) {
+        if (std::find(group.shape_ids.begin(), group.shape_ids.end(), shape_id) != group.shape_ids.end()) {
+            Error("Cannot edit the shapes of a shape group.");
+        }
+    }
+    if (!scene.dynamic) {
+        // Each geometry gets its own BVH, and a commit only rebuilds the BVHs that changed.
+        // (The first commit after this still builds everything.)
+        rtcSetSceneFlags(scene.embree_scene, RTCSceneFlags(RTC_SCENE_FLAG_ROBUST | RTC_SCENE_FLAG_DYNAMIC));
+        rtcSetSceneBuildQuality(scene.embree_scene, RTC_BUILD_QUALITY_LOW);
+        scene.dynamic = true;
+    }
+}
+
+void transform_shape(Scene& scene, int shape_id, const Matrix4x4& xform) {
+    begin_shape_edit(scene, shape_id);
+    Shape& shape         = scene.shapes[shape_id];
+    RTCGeometry rtc_geom = rtcGetGeometry(scene.embree_scene, shape_id);
+    if (auto* sphere = std::get_if<Sphere>(&shape)) {
+        // Embree asks the sphere for its bounds again at the commit.
+        sphere->position = xform_point(xform, sphere->position);
+        sphere->radius *= length(xform_vector(xform, Vector3{ 1, 0, 0 }));
+    } else if (auto* mesh = std::get_if<TriangleMesh>(&shape)) {
+        for (MeshPosition& p : mesh->positions) { p = xform_point(xform, p); }
+        Matrix4x4 inv_xform = inverse(xform);
+        for (Vector3& n : mesh->normals) { n = xform_normal(inv_xform, n); }
+        // Embree shares the vertex buffer, so it only needs to know that the vertices moved.
+        // The topology is the same, so the BVH of the mesh is refit instead of built again.
+        rtcUpdateGeometryBuffer(rtc_geom, RTC_BUFFER_TYPE_VERTEX, 0);
+        rtcSetGeometryBuildQuality(rtc_geom, RTC_BUILD_QUALITY_REFIT);
+    }
+    rtcCommitGeometry(rtc_geom);
+    if (is_light(shape)) {
+        init_sampling_dist(shape);
+        scene.lights_changed = true;
+    }
+    scene.geometry_changed = true;
+}
 
-Real light_pmf(const Scene& scene, int light_id) { return pmf(scene.light_dist, light_id); }
+void replace_shape(Scene& scene, int shape_id, const Shape& shape) {
+    begin_shape_edit(scene, shape_id);
+    // (-1 is no material, i.e., an index-matching interface)
+    int material_id = get_material_id(shape);
+    if (material_id < -1 || material_id >= (int)scene.materials.size()) {
+        Error(std::string("Invalid material ID: ") + std::to_string(material_id));
+    }
+    for (int medium_id : { get_interior_medium_id(shape), get_exterior_medium_id(shape) }) {
+        if (medium_id < -1 || medium_id >= (int)scene.media.size()) {
+            Error(std::string("Invalid medium ID: ") + std::to_string(medium_id));
+        }
+    }
+    // The area light of a shape points back to it (see replace_light), so the new shape can only
+    // emit for the light of this shape, and the emitter of a light cannot stop emitting here.
+    int area_light_id = get_area_light_id(shape);
+    if (area_light_id >= 0) {
+        const DiffuseAreaLight* area_light = nullptr;
+        if (area_light_id < (int)scene.lights.size()) {
+            area_light = std::get_if<DiffuseAreaLight>(&scene.lights[area_light_id]);
+        }
+        if (area_light == nullptr || area_light->shape_id != shape_id) {
+            Error(std::string("Invalid area light ID: ") + std::to_string(area_light_id) +
+                  " is not the area light of shape " + std::to_string(shape_id));
+        }
+    } else if (int old_light_id = get_area_light_id(scene.shapes[shape_id]); old_light_id >= 0) {
+        Error(std::string("Shape ") + std::to_string(shape_id) + " is the emitter of light " +
+              std::to_string(old_light_id) + ", replace the light first.");
+    } else if (area_light_id != -1) {
+        Error(std::string("Invalid area light ID: ") + std::to_string(area_light_id));
+    }
+    if (is_light(scene.shapes[shape_id])) { scene.lights_changed = true; }
+    rtcDetachGeometry(scene.embree_scene, shape_id);
+    scene.shapes[shape_id] = shape;
+    register_embree(scene.shapes[shape_id], scene.embree_device, scene.embree_scene, shape_id);
+    if (is_light(scene.shapes[shape_id])) {
+        init_sampling_dist(scene.shapes[shape_id]);
+        scene.lights_changed = true;
+    }
+    scene.geometry_changed = true;
+}
+
+void set_shape_material(Scene& scene, int shape_id, int material_id) {
+    if (shape_id < 0 || shape_id >= (int)scene.shapes.size()) {
+        Error(std::string("Invalid shape ID: ") + std::to_string(shape_id));
+    }
+    if (material_id < 0 || material_id >= (int)scene.materials.size()) {
+        Error(std::string("Invalid material ID: ") + std::to_string(material_id));
+    }
+    // The materials are looked up at the hit points, Embree does not know about them.
+    set_material_id(scene.shapes[shape_id], material_id);
+}
+
+void replace_material(Scene& scene, int material_id, const Material& material) {
+    if (material_id < 0 || material_id >= (int)scene.materials.size()) {
+        Error(std::string("Invalid material ID: ") + std::to_string(material_id));
+    }
+    scene.materials[material_id] = material;
+}
+
+void replace_light(Scene& scene, int light_id, const Light& light) {
+    if (light_id < 0 || light_id >= (int)scene.lights.size()) {
+        Error(std::string("Invalid light ID: ") + std::to_string(light_id));
+    }
+    // The shapes point back to their area lights (the area_light_id of the shape we hit tells the emission),
+    // so an area light can only move to a shape that does not emit yet.
+    const auto* area_light = std::get_if<DiffuseAreaLight>(&light);
+    if (area_light != nullptr) {
+        if (area_light->shape_id < 0 || area_light->shape_id >= (int)scene.shapes.size()) {
+            Error(std::string("Invalid shape ID: ") + std::to_string(area_light->shape_id));
+        }
+        int emitter_light_id = get_area_light_id(scene.shapes[area_light->shape_id]);
+        if (emitter_light_id >= 0 && emitter_light_id != light_id) {
+            Error(std::string("Shape ") + std::to_string(area_light->shape_id) + " is already the emitter of light " +
+                  std::to_string(emitter_light_id));
+        }
+    }
+    if (const auto* old_area_light = std::get_if<DiffuseAreaLight>(&scene.lights[light_id])) {
+        set_area_light_id(scene.shapes[old_area_light->shape_id], -1);
+    }
+    scene.lights[light_id] = light;
+    if (area_light != nullptr) {
+        Shape& shape = scene.shapes[area_light->shape_id];
+        set_area_light_id(shape, light_id);
+        init_sampling_dist(shape);
+    }
+    init_sampling_dist(scene.lights[light_id], scene);
+    scene.lights_changed = true;
+}
+
+void commit_edits(Scene& scene) {
+    if (scene.geometry_changed) {
+        StatPhaseTimer phase_timer(StatPhase::BvhBuild);
+        rtcCommitScene(scene.embree_scene);
+        update_bounds(scene);
+        // The power of an envmap depends on the size of the scene.
+        if (has_envmap(scene)) { scene.lights_changed = true; }
+        scene.geometry_changed = false;
+    }
+    if (scene.lights_changed) {
+        StatPhaseTimer phase_timer(StatPhase::DistributionBuild);
+        build_light_sampling(scene);
+        scene.lights_changed = false;
+    }
+}
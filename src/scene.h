@@ -3,9 +3,12 @@
 #include "camera.h"
 #include "lajolla.h"
 #include "light.h"
+#include "light_bvh.h"
 #include "material.h"
 #include "medium.h"
+#include "sampler.h"
 #include "shape.h"
+#include "tile_order.h"
 #include "volume.h"
 
 #include <memory>
@@ -18,9 +21,16 @@ enum class Integrator {
     RayDifferential, // visualize radius & spread
     MipmapLevel,
     Path,
+    WavefrontPath, // same as Path, but traces many paths at once stage by stage
     VolPath
 };
 
+/// How we choose a light for next event estimation.
+enum class LightSampler {
+    Power, // proportionally to the power of the lights
+    BVH    // with the light BVH, by the estimated contribution to the shading point (see light_bvh.h)
+};
+
 struct RenderOptions {
     Integrator integrator   = Integrator::Path;
     int samples_per_pixel   = 4;
@@ -28,6 +38,29 @@ struct RenderOptions {
     int rr_depth            = 5;
     int vol_path_version    = 0;
     int max_null_collisions = 1000;
+    // Progressive rendering: render passes over the whole image until
+    // samples_per_pixel is reached or the time budget runs out.
+    bool progressive         = false;
+    Real time_budget         = 0; // in seconds, <= 0 means no limit
+    Real checkpoint_interval = 0; // write the intermediate image and the checkpoint every N seconds, <= 0 means never
+    // Continue from the checkpoint of the render (see checkpoint.h) if there is one.
+    bool resume = false;
+    // Render only the shard shard_index of num_shards, a range of the samples of every pixel (see render.cpp).
+    int shard_index = 0;
+    int num_shards  = 1;
+    // Adaptive sampling: keep on sampling a pixel (in batches of adaptive_min_samples) until
+    // its relative standard error drops below adaptive_threshold. <= 0 means off.
+    // A pixel with no light yet takes at least a quarter of samples_per_pixel (see pixel_error).
+    Real adaptive_threshold  = 0;
+    int adaptive_min_samples = 16;
+    // The sampler that generates the random numbers of the integrators (see sampler.h).
+    SamplerType sampler   = SamplerType::Independent;
+    uint64_t sampler_seed = 0;
+    // How we choose the lights for next event estimation
+    LightSampler light_sampler = LightSampler::BVH;
+    // The image is rendered in tiles of tile_size^2 pixels, handed to the threads in tile_order (see tile_order.h).
+    int tile_size        = 16;
+    TileOrder tile_order = TileOrder::Hilbert;
 };
 
 /// Bounding sphere
@@ -44,7 +77,8 @@ struct Scene {
     Scene(const RTCDevice& embree_device, const Camera& camera, const std::vector<Material>& materials,
           const std::vector<Shape>& shapes, const std::vector<Light>& lights, const std::vector<Medium>& media,
           int envmap_light_id, /* -1 if the scene has no envmap */
-          const TexturePool& texture_pool, const RenderOptions& options, const std::string& output_filename);
+          const TexturePool& texture_pool, const RenderOptions& options, const std::string& output_filename,
+          const std::vector<ShapeGroup>& shape_groups = {}, const std::vector<ShapeInstance>& instances = {});
     ~Scene();
     Scene(const Scene& t)            = delete;
     Scene& operator=(const Scene& t) = delete;
@@ -58,10 +92,15 @@ struct Scene {
     // For now we use stl vectors to store scene content.
     // This wouldn't work if we want to extend this to run on GPUs.
     // If we want to port this to GPUs later, we need to maintain a thrust vector or something similar.
-    const std::vector<Material> materials;
-    const std::vector<Shape> shapes;
-    const std::vector<Light> lights;
+    // The materials, shapes, and lights can be edited in place with the functions below (see commit_edits).
+    std::vector<Material> materials;
+    std::vector<Shape> shapes;
+    std::vector<Light> lights;
     const std::vector<Medium> media;
+    // The shapes of a group are rendered only through the instances of the group.
+    // In Embree, the instances come after the shapes: instance i has the geomID shapes.size() + i.
+    const std::vector<ShapeGroup> shape_groups;
+    const std::vector<ShapeInstance> instances;
     int envmap_light_id;
     const TexturePool texture_pool;
 
@@ -73,13 +112,53 @@ struct Scene {
 
     // For sampling lights
     TableDist1D light_dist;
+    LightBVH light_bvh;
+
+    // The state of the incremental edits: whether the geometry or the lights changed since the last commit,
+    // and whether the Embree scene has been switched to a two-level BVH for cheap updates.
+    bool geometry_changed = false;
+    bool lights_changed   = false;
+    bool dynamic          = false;
 };
 
-/// Sample a light source from the scene given a random number u \in [0, 1]
-int sample_light(const Scene& scene, Real u);
+/// Incremental edits of a loaded scene, e.g., for look-dev in the render server (server.h).
+/// Instead of building the whole scene again, an edit only updates what it touches:
+/// a moved mesh keeps its Embree geometry, whose BVH is refit to the new vertices, and a replaced shape
+/// is registered to Embree alone. The first edit switches the Embree scene to a two-level BVH
+/// (RTC_SCENE_FLAG_DYNAMIC), so that a commit rebuilds only the changed geometries and the top level.
+/// The light distributions are rebuilt only if an emitter changed.
+/// The edits take effect in commit_edits(), which must be called before rendering the scene again.
+/// The shapes of a shape group cannot be edited.
+
+/// Transform the positions (and normals) of a shape in place. A sphere is assumed to be transformed
+/// without shearing or non-uniform scaling.
+void transform_shape(Scene& scene, int shape_id, const Matrix4x4& xform);
+
+/// Replace a shape by another one. The new shape carries its own material, area light, and media IDs.
+/// The area light ID has to stay the same: -1 if the old shape does not emit, the ID of its light otherwise
+/// (use replace_light to move or remove an area light).
+void replace_shape(Scene& scene, int shape_id, const Shape& shape);
+
+/// Assign another material to a shape.
+void set_shape_material(Scene& scene, int shape_id, int material_id);
+
+/// Replace the parameters of a material.
+void replace_material(Scene& scene, int material_id, const Material& material);
+
+/// Replace a light, e.g., to change its intensity. An area light can move to another shape that does not emit
+/// light yet, which becomes its emitter (and the old one stops emitting).
+void replace_light(Scene& scene, int light_id, const Light& light);
+
+/// Apply the pending edits: commit the Embree scene and rebuild the light distributions if necessary.
+void commit_edits(Scene& scene);
+
+/// Sample a light source from the scene for the shading point ref_point with the (geometric) normal
+/// ref_normal, given a random number u \in [0, 1]. ref_normal is zero for points in a medium.
+/// Returns -1 if no light can contribute to the point.
+int sample_light(const Scene& scene, const Vector3& ref_point, const Vector3& ref_normal, Real u);
 
 /// The probability mass function of the sampling procedure above.
-Real light_pmf(const Scene& scene, int light_id);
+Real light_pmf(const Scene& scene, const Vector3& ref_point, const Vector3& ref_normal, int light_id);
 
 inline bool has_envmap(const Scene& scene) { return scene.envmap_light_id != -1; }
 
@@ -88,6 +167,14 @@ inline const Light& get_envmap(const Scene& scene) {
     return scene.lights[scene.envmap_light_id];
 }
 
-inline Real get_shadow_epsilon(const Scene& scene) { return min(scene.bounds.radius * Real(1e-5), Real(0.01)); }
+/// Ray offsets relative to the scene radius. A float only has about 7 significant digits,
+/// so 1e-5 of the radius is within a few dozen ulps of a hit point; we back off further there.
+constexpr Real c_ray_epsilon_scale = sizeof(Real) == sizeof(float) ? Real(1e-4) : Real(1e-5);
 
-inline Real get_intersection_epsilon(const Scene& scene) { return min(scene.bounds.radius * Real(1e-5), Real(0.01)); }
+inline Real get_shadow_epsilon(const Scene& scene) {
+    return min(scene.bounds.radius * c_ray_epsilon_scale, Real(0.01));
+}
+
+inline Real get_intersection_epsilon(const Scene& scene) {
+    return min(scene.bounds.radius * c_ray_epsilon_scale, Real(0.01));
+}
@@ -0,0 +1,417 @@
+#include "server.h"
+#include "flexception.h"
+#include "image.h"
+#include "json.h"
+#include "parsers/parse_scene.h"
+#include "render.h"
+#include "timer.h"
+#include "transform.h"
+
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// A scene in memory, and the file it was loaded from (absolute, so that we can tell files apart).
+struct LoadedScene {
+    fs::path file;
+    std::unique_ptr<Scene> scene;
+};
+
+struct ServerState {
+    RTCDevice embree_device;
+    size_t texture_cache_budget;
+    fs::path mesh_cache_dir;
+    std::map<std::string, LoadedScene> scenes;
+    std::string current_scene;
+    bool quit = false;
+};
+
+/// Reads the lines of a file descriptor.
+struct LineReader {
+    int fd;
+    std::string buffer;
+
+    bool next_line(std::string& line) {
+        while (true) {
+            size_t end = buffer.find('\n');
+            if (end != std::string::npos) {
+                line = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                return true;
+            }
+            char chunk[4096];
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) {
+                // End of the input: the last line may have no newline.
+                line = buffer;
+                buffer.clear();
+                return line.find_first_not_of(" \t\r") != std::string::npos;
+            }
+            buffer.append(chunk, n);
+        }
+    }
+};
+
+static bool write_all(int fd, const std::string& str) {
+    size_t written = 0;
+    while (written < str.size()) {
+        ssize_t n = write(fd, str.data() + written, str.size() - written);
+        if (n <= 0) { return false; }
+        written += n;
+    }
+    return true;
+}
+
+static const JsonValue* get_member(const JsonValue& cmd, const std::string& key, JsonValue::Type type) {
+    const JsonValue* value = find_member(cmd, key);
+    if (value != nullptr && value->type != type) { Error(std::string("Wrong type of the member \"") + key + "\"."); }
+    return value;
+}
+
+/// The member "key" as an array of count numbers.
+static std::vector<Real> get_numbers(const JsonValue& cmd, const std::string& key, size_t count) {
+    const JsonValue* value = get_member(cmd, key, JsonValue::Type::Array);
+    if (value == nullptr) { Error(std::string("Missing member \"") + key + "\"."); }
+    std::vector<Real> numbers;
+    for (const JsonValue& element : value->array) {
+        if (element.type != JsonValue::Type::Number) { break; }
+        numbers.push_back(Real(element.number));
+    }
+    if (numbers.size() != value->array.size() || numbers.size() != count) {
+        Error(std::string("The member \"") + key + "\" is not an array of " + std::to_string(count) + " numbers.");
+    }
+    return numbers;
+}
+
+static Vector3 get_vector3(const JsonValue& cmd, const std::string& key) {
+    std::vector<Real> numbers = get_numbers(cmd, key, 3);
+    return Vector3{ numbers[0], numbers[1], numbers[2] };
+}
+
+static Scene& get_scene(ServerState& state, const JsonValue& cmd) {
+    std::string name = state.current_scene;
+    if (const JsonValue* value = get_member(cmd, "scene", JsonValue::Type::String)) { name = value->string; }
+    auto it = state.scenes.find(name);
+    if (it == state.scenes.end()) {
+        if (name == "") { Error("No scene is loaded."); }
+        Error(std::string("Unknown scene: ") + name);
+    }
+    return *it->second.scene;
+}
+
+static Integrator parse_integrator_name(const std::string& name) {
+    if (name == "path") {
+        return Integrator::Path;
+    } else if (name == "wavefrontPath" || name == "wavefront_path") {
+        return Integrator::WavefrontPath;
+    } else if (name == "volpath") {
+        return Integrator::VolPath;
+    } else if (name == "depth") {
+        return Integrator::Depth;
+    } else if (name == "shadingNormal" || name == "shading_normal") {
+        return Integrator::ShadingNormal;
+    } else if (name == "meanCurvature" || name == "mean_curvature") {
+        return Integrator::MeanCurvature;
+    } else if (name == "rayDifferential" || name == "ray_differential") {
+        return Integrator::RayDifferential;
+    } else if (name == "mipmapLevel" || name == "mipmap_level") {
+        return Integrator::MipmapLevel;
+    } else {
+        Error(std::string("Unsupported integrator: ") + name);
+        return Integrator::Path;
+    }
+}
+
+static SamplerType parse_sampler_name(const std::string& name) {
+    if (name == "independent") {
+        return SamplerType::Independent;
+    } else if (name == "sobol" || name == "ldsampler") {
+        return SamplerType::Sobol;
+    } else if (name == "pmj02" || name == "pmj02bn") {
+        return SamplerType::PMJ02;
+    } else if (name == "zsobol") {
+        return SamplerType::ZSobol;
+    } else {
+        Error(std::string("Unsupported sampler: ") + name);
+        return SamplerType::Independent;
+    }
+}
+
+static void load_scene(ServerState& state, const JsonValue& cmd, std::ostream& response) {
+    const JsonValue* file = get_member(cmd, "file", JsonValue::Type::String);
+    if (file == nullptr) { Error("Missing member \"file\"."); }
+    std::string name = file->string;
+    if (const JsonValue* value = get_member(cmd, "name", JsonValue::Type::String)) { name = value->string; }
+    const JsonValue* reload = get_member(cmd, "reload", JsonValue::Type::Boolean);
+
+    // A name loaded from another file is loaded again from the new one.
+    fs::path path = fs::absolute(file->string).lexically_normal();
+    auto it       = state.scenes.find(name);
+    bool cached   = it != state.scenes.end() && it->second.file == path && (reload == nullptr || !reload->boolean);
+    Real seconds  = 0;
+    if (!cached) {
+        Timer timer;
+        tick(timer);
+        std::cout << "Parsing and constructing scene " << file->string << "." << std::endl;
+        std::unique_ptr<Scene> scene =
+            parse_scene(file->string, state.embree_device, state.texture_cache_budget, state.mesh_cache_dir);
+        seconds = tick(timer);
+        std::cout << "Done. Took " << seconds << " seconds." << std::endl;
+        state.scenes[name] = LoadedScene{ path, std::move(scene) };
+    }
+    state.current_scene = name;
+    response << ", \"scene\": " << json_string(name) << ", \"cached\": " << (cached ? "true" : "false")
+             << ", \"seconds\": " << seconds;
+}
+
+static void unload_scene(ServerState& state, const JsonValue& cmd) {
+    Scene& scene = get_scene(state, cmd);
+    for (auto it = state.scenes.begin(); it != state.scenes.end(); it++) {
+        if (it->second.scene.get() == &scene) {
+            if (it->first == state.current_scene) { state.current_scene = ""; }
+            state.scenes.erase(it);
+            break;
+        }
+    }
+}
+
+static void list_scenes(ServerState& state, std::ostream& response) {
+    response << ", \"scenes\": [";
+    bool first = true;
+    for (const auto& [name, scene] : state.scenes) {
+        response << (first ? "" : ", ") << json_string(name);
+        first = false;
+    }
+    response << "], \"current\": " << json_string(state.current_scene);
+}
+
+static void set_camera(ServerState& state, const JsonValue& cmd) {
+    Scene& scene           = get_scene(state, cmd);
+    Camera& camera         = scene.camera;
+    Matrix4x4 cam_to_world = camera.cam_to_world;
+    Real fov               = camera.fov;
+    int width              = camera.width;
+    int height             = camera.height;
+    if (find_member(cmd, "origin") != nullptr || find_member(cmd, "target") != nullptr) {
+        Vector3 up   = find_member(cmd, "up") != nullptr ? get_vector3(cmd, "up") : Vector3{ 0, 1, 0 };
+        cam_to_world = look_at(get_vector3(cmd, "origin"), get_vector3(cmd, "target"), up);
+    }
+    if (const JsonValue* value = get_member(cmd, "fov", JsonValue::Type::Number)) { fov = Real(value->number); }
+    if (const JsonValue* value = get_member(cmd, "width", JsonValue::Type::Number)) { width = int(value->number); }
+    if (const JsonValue* value = get_member(cmd, "height", JsonValue::Type::Number)) { height = int(value->number); }
+    if (width <= 0 || height <= 0) { Error("The image size must be positive."); }
+    camera = Camera(cam_to_world, fov, width, height, camera.filter, camera.medium_id);
+}
+
+static void set_options(ServerState& state, const JsonValue& cmd) {
+    Scene& scene           = get_scene(state, cmd);
+    RenderOptions& options = scene.options;
+    if (const JsonValue* value = get_member(cmd, "spp", JsonValue::Type::Number)) {
+        options.samples_per_pixel = int(value->number);
+    }
+    if (const JsonValue* value = get_member(cmd, "max_depth", JsonValue::Type::Number)) {
+        options.max_depth = int(value->number);
+    }
+    if (const JsonValue* value = get_member(cmd, "rr_depth", JsonValue::Type::Number)) {
+        options.rr_depth = int(value->number);
+    }
+    if (const JsonValue* value = get_member(cmd, "vol_path_version", JsonValue::Type::Number)) {
+        options.vol_path_version = int(value->number);
+    }
+    if (const JsonValue* value = get_member(cmd, "integrator", JsonValue::Type::String)) {
+        options.integrator = parse_integrator_name(value->string);
+    }
+    if (const JsonValue* value = get_member(cmd, "sampler", JsonValue::Type::String)) {
+        options.sampler = parse_sampler_name(value->string);
+    }
+    if (const JsonValue* value = get_member(cmd, "seed", JsonValue::Type::Number)) {
+        options.sampler_seed = uint64_t(value->number);
+    }
+    if (const JsonValue* value = get_member(cmd, "adaptive_threshold", JsonValue::Type::Number)) {
+        options.adaptive_threshold = Real(value->number);
+    }
+    if (const JsonValue* value = get_member(cmd, "progressive", JsonValue::Type::Boolean)) {
+        options.progressive = value->boolean;
+    }
+    if (const JsonValue* value = get_member(cmd, "time_budget", JsonValue::Type::Number)) {
+        options.time_budget = Real(value->number);
+    }
+    if (const JsonValue* value = get_member(cmd, "tile_size", JsonValue::Type::Number)) {
+        options.tile_size = max(int(value->number), 1);
+    }
+    if (const JsonValue* value = get_member(cmd, "tile_order", JsonValue::Type::String)) {
+        options.tile_order = parse_tile_order(value->string);
+    }
+    if (const JsonValue* value = get_member(cmd, "light_sampler", JsonValue::Type::String)) {
+        if (value->string == "power") {
+            options.light_sampler = LightSampler::Power;
+        } else if (value->string == "bvh") {
+            // The light BVH is only built for the scenes that use it.
+            if (options.light_sampler != LightSampler::BVH) {
+                options.light_sampler = LightSampler::BVH;
+                scene.light_bvh       = make_light_bvh(scene.lights, scene);
+            }
+        } else {
+            Error(std::string("Unsupported light sampler: ") + value->string);
+        }
+    }
+}
+
+static void edit_scene(ServerState& state, const JsonValue& cmd, std::ostream& response) {
+    Scene& scene = get_scene(state, cmd);
+    Timer timer;
+    tick(timer);
+    if (const JsonValue* shape = get_member(cmd, "shape", JsonValue::Type::Number)) {
+        int shape_id = int(shape->number);
+        if (const JsonValue* value = get_member(cmd, "material", JsonValue::Type::Number)) {
+            set_shape_material(scene, shape_id, int(value->number));
+        }
+        // Scale, then rotate, then translate.
+        Matrix4x4 xform = Matrix4x4::identity();
+        bool moved      = false;
+        if (find_member(cmd, "scale") != nullptr) {
+            xform = scale(get_vector3(cmd, "scale")) * xform;
+            moved = true;
+        }
+        if (find_member(cmd, "rotate") != nullptr) {
+            // [angle in degree, axis x, axis y, axis z]
+            std::vector<Real> rotation = get_numbers(cmd, "rotate", 4);
+            xform                      = rotate(rotation[0], Vector3{ rotation[1], rotation[2], rotation[3] }) * xform;
+            moved                      = true;
+        }
+        if (find_member(cmd, "translate") != nullptr) {
+            xform = translate(get_vector3(cmd, "translate")) * xform;
+            moved = true;
+        }
+        if (moved) { transform_shape(scene, shape_id, xform); }
+    }
+    if (const JsonValue* light = get_member(cmd, "light", JsonValue::Type::Number)) {
+        int light_id = int(light->number);
+        if (light_id < 0 || light_id >= (int)scene.lights.size()) {
+            Error(std::string("Invalid light ID: ") + std::to_string(light_id));
+        }
+        Light new_light = scene.lights[light_id];
+        if (auto* area_light = std::get_if<DiffuseAreaLight>(&new_light)) {
+            if (find_member(cmd, "intensity") != nullptr) { area_light->intensity = get_vector3(cmd, "intensity"); }
+        } else if (auto* envmap = std::get_if<Envmap>(&new_light)) {
+            if (const JsonValue* value = get_member(cmd, "intensity", JsonValue::Type::Number)) {
+                envmap->scale = Real(value->number);
+            }
+        }
+        replace_light(scene, light_id, new_light);
+    }
+    commit_edits(scene);
+    response << ", \"seconds\": " << tick(timer);
+}
+
+static void render_scene(ServerState& state, const JsonValue& cmd, std::ostream& response) {
+    Scene& scene       = get_scene(state, cmd);
+    std::string output = scene.output_filename;
+    if (const JsonValue* value = get_member(cmd, "output", JsonValue::Type::String)) { output = value->string; }
+    Timer timer;
+    tick(timer);
+    std::cout << "Rendering..." << std::endl;
+    Image3 img   = render(scene);
+    Real seconds = tick(timer);
+    std::cout << "Done. Took " << seconds << " seconds." << std::endl;
+    imwrite(output, img);
+    std::cout << "Image written to " << output << std::endl;
+    response << ", \"output\": " << json_string(output) << ", \"seconds\": " << seconds;
+}
+
+/// Execute one command line and return the response line.
+static std::string execute(ServerState& state, const std::string& line) {
+    std::ostringstream response;
+    std::string id;
+    try {
+        JsonValue cmd = parse_json(line);
+        if (const JsonValue* value = find_member(cmd, "id")) {
+            if (value->type == JsonValue::Type::String) {
+                id = json_string(value->string);
+            } else if (value->type == JsonValue::Type::Number) {
+                id = json_number(value->number);
+            }
+        }
+        const JsonValue* name = get_member(cmd, "cmd", JsonValue::Type::String);
+        if (name == nullptr) { Error("Missing member \"cmd\"."); }
+        std::ostringstream result;
+        if (name->string == "load") {
+            load_scene(state, cmd, result);
+        } else if (name->string == "unload") {
+            unload_scene(state, cmd);
+        } else if (name->string == "list") {
+            list_scenes(state, result);
+        } else if (name->string == "camera") {
+            set_camera(state, cmd);
+        } else if (name->string == "options") {
+            set_options(state, cmd);
+        } else if (name->string == "edit") {
+            edit_scene(state, cmd, result);
+        } else if (name->string == "render") {
+            render_scene(state, cmd, result);
+        } else if (name->string == "quit") {
+            state.quit = true;
+        } else {
+            Error(std::string("Unknown command: ") + name->string);
+        }
+        response << "{\"ok\": true" << result.str();
+    } catch (const std::exception& e) {
+        response << "{\"ok\": false, \"error\": " << json_string(e.what());
+    }
+    if (id != "") { response << ", \"id\": " << id; }
+    response << "}\n";
+    return response.str();
+}
+
+/// Serve the commands from in_fd until the input ends or a quit command.
+static void serve(ServerState& state, int in_fd, int out_fd) {
+    LineReader reader{ in_fd };
+    std::string line;
+    while (!state.quit && reader.next_line(line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) { continue; }
+        if (!write_all(out_fd, execute(state, line))) { break; }
+    }
+}
+
+void run_server(const RTCDevice& embree_device, const std::string& socket_path, size_t texture_cache_budget,
+                const fs::path& mesh_cache_dir) {
+    ServerState state{ embree_device, texture_cache_budget, mesh_cache_dir };
+    if (socket_path == "") {
+        // The responses take stdout over, so the log goes to stderr.
+        std::cout.flush();
+        int out_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        serve(state, STDIN_FILENO, out_fd);
+        close(out_fd);
+        return;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) { Error(std::string("Socket path too long: ") + socket_path); }
+    strcpy(address.sun_path, socket_path.c_str());
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0) { Error("Cannot create the server socket."); }
+    unlink(socket_path.c_str());
+    if (bind(server_fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(server_fd, 4) != 0) {
+        close(server_fd);
+        Error(std::string("Cannot listen on ") + socket_path);
+    }
+    // A client that goes away should not take the server down with it.
+    signal(SIGPIPE, SIG_IGN);
+    std::cout << "Listening on " << socket_path << std::endl;
+    while (!state.quit) {
+        int client_fd = accept(server_fd, nullptr, nullptr);
+        if (client_fd < 0) { continue; }
+        serve(state, client_fd, client_fd);
+        close(client_fd);
+    }
+    close(server_fd);
+    unlink(socket_path.c_str());
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "lajolla.h"
+#include <embree4/rtcore.h>
+#include <string>
+
+/// Run lajolla as a render server that keeps the parsed scenes (and their Embree BVHs) in memory
+/// between jobs, so that we can re-render a scene with another camera or other options without
+/// parsing it again. The server reads one JSON command per line and answers each with one line of JSON,
+/// {"ok": true, ...} or {"ok": false, "error": "..."}. A command is an object with a "cmd" member:
+///   {"cmd": "load", "file": "scene.xml", "name": "cbox", "reload": false}
+///   {"cmd": "unload", "scene": "cbox"}
+///   {"cmd": "list"}
+///   {"cmd": "camera", "origin": [0, 1, 5], "target": [0, 1, 0], "up": [0, 1, 0], "fov": 40,
+///    "width": 640, "height": 480}
+///   {"cmd": "options", "spp": 64, "max_depth": 6, "rr_depth": 5, "integrator": "path", "sampler": "sobol",
+///    "seed": 0, "light_sampler": "bvh", "adaptive_threshold": 0, "progressive": false, "time_budget": 0,
+///    "vol_path_version": 6, "tile_size": 16, "tile_order": "hilbert"}
+///   {"cmd": "edit", "shape": 3, "scale": [1, 1, 1], "rotate": [30, 0, 1, 0], "translate": [0, 0.5, 0],
+///    "material": 2}
+///   {"cmd": "edit", "light": 0, "intensity": [10, 10, 10]}
+///   {"cmd": "render", "output": "image.exr"}
+///   {"cmd": "quit"}
+/// "edit" updates the scene incrementally (see commit_edits in scene.h): it moves a shape and/or assigns it
+/// another material, or changes the intensity of a light (a number, the scale, for an envmap).
+/// All members but "cmd" are optional. "scene" selects the scene a command applies to and defaults to
+/// the last loaded one; the name of a scene defaults to its file name. "load" reuses the scene in memory
+/// unless "reload" is true or the name was loaded from another file. A member "id" is echoed in the response.
+/// Without a socket_path, the commands come from stdin and the responses go to stdout (the log goes to stderr).
+/// Otherwise the server listens on the Unix domain socket socket_path and serves the connections one by one.
+void run_server(const RTCDevice& embree_device, const std::string& socket_path, size_t texture_cache_budget,
+                const fs::path& mesh_cache_dir);
@@ -10,6 +10,7 @@ struct register_embree_op {
 
     const RTCDevice& device;
     const RTCScene& scene;
+    uint32_t geomID;
 };
 
 struct sample_point_on_shape_op {
@@ -49,8 +50,8 @@ struct compute_shading_info_op {
 #include "shapes/sphere.inl"
 #include "shapes/triangle_mesh.inl"
 
-uint32_t register_embree(const Shape& shape, const RTCDevice& device, const RTCScene& scene) {
-    return std::visit(register_embree_op{ device, scene }, shape);
+uint32_t register_embree(const Shape& shape, const RTCDevice& device, const RTCScene& scene, uint32_t geomID) {
+    return std::visit(register_embree_op{ device, scene, geomID }, shape);
 }
 
 PointAndNormal sample_point_on_shape(const Shape& shape, const Vector3& ref_point, const Vector2& uv, Real w) {
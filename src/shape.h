@@ -2,6 +2,8 @@
 
 #include "frame.h"
 #include "lajolla.h"
+#include "matrix.h"
+#include "mesh_position.h"
 #include "table_dist.h"
 #include "vector.h"
 #include <embree4/rtcore.h>
@@ -38,12 +40,14 @@ struct Sphere : public ShapeBase {
 
 struct TriangleMesh : public ShapeBase {
     /// TODO: make these portable to GPUs
-    std::vector<Vector3> positions;
+    /// positions and indices are shared with Embree (see register_embree),
+    /// so they must not be reallocated once the mesh is in a scene.
+    std::vector<MeshPosition> positions;
     std::vector<Vector3i> indices;
     std::vector<Vector3> normals;
     std::vector<Vector2> uvs;
     /// Below are used only when the mesh is associated with an area light
-    Real total_area;
+    Real total_area = 0;
     /// For sampling a triangle based on its area
     TableDist1D triangle_sampler;
 };
@@ -52,8 +56,21 @@ struct TriangleMesh : public ShapeBase {
 // then implement all the relevant functions below.
 using Shape = std::variant<Sphere, TriangleMesh>;
 
-/// Add the shape to an Embree scene.
-uint32_t register_embree(const Shape& shape, const RTCDevice& device, const RTCScene& scene);
+/// A group of shapes that is only rendered through its instances (Mitsuba's "shapegroup").
+/// The shapes live once in Scene::shapes, in the local space of the group,
+/// and all the instances share a single Embree scene built from them.
+struct ShapeGroup {
+    std::vector<int> shape_ids;
+};
+
+/// A copy of a shape group placed in the world (Mitsuba's "instance").
+struct ShapeInstance {
+    int group_id;
+    Matrix4x4 to_world, to_local;
+};
+
+/// Add the shape to an Embree scene, with geomID as its Embree geometry ID.
+uint32_t register_embree(const Shape& shape, const RTCDevice& device, const RTCScene& scene, uint32_t geomID);
 
 /// Sample a point on the surface given a reference point.
 /// uv & w are uniform random numbers.
@@ -62,10 +79,11 @@ PointAndNormal sample_point_on_shape(const Shape& shape, const Vector3& ref_poin
 /// Probability density of the operation above
 Real pdf_point_on_shape(const Shape& shape, const PointAndNormal& point_on_shape, const Vector3& ref_point);
 
-/// Useful for sampling.
+/// Useful for sampling. The area of a mesh is computed by init_sampling_dist.
 Real surface_area(const Shape& shape);
 
 /// Some shapes require storing sampling data structures inside. This function initialize them.
+/// A Scene only initializes the shapes that are area lights.
 void init_sampling_dist(Shape& shape);
 
 /// Embree doesn't calculate some shading information for us. We have to do it ourselves.
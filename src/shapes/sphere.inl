@@ -33,18 +33,8 @@ bool solve_quadratic(Real a, Real b, Real c, Real* t0, Real* t1) {
     return true;
 }
 
-void sphere_intersect_func(const RTCIntersectFunctionNArguments* args) {
-    assert(args->N == 1);
-    int* valid = args->valid;
-    if (!valid[0]) { return; }
-    void* ptr            = args->geometryUserPtr;
-    const Sphere* sphere = (const Sphere*)ptr;
-    RTCRayHitN* rayhit   = args->rayhit;
-    RTCRay* rtc_ray      = (RTCRay*)RTCRayHitN_RayN(rayhit, 1);
-    RTCHit* rtc_hit      = (RTCHit*)RTCRayHitN_HitN(rayhit, 1);
-
-    Ray ray{ Vector3{ rtc_ray->org_x, rtc_ray->org_y, rtc_ray->org_z },
-             Vector3{ rtc_ray->dir_x, rtc_ray->dir_y, rtc_ray->dir_z }, rtc_ray->tnear, rtc_ray->tfar };
+/// Intersect the sphere with a ray, returns the hit distance or -1 if there is no hit.
+Real intersect_sphere(const Sphere& sphere, const Ray& ray) {
     // Our sphere is ||p - x||^2 = r^2
     // substitute x = o + d * t, we want to solve for t
     // ||p - (o + d * t)||^2 = r^2
@@ -52,14 +42,14 @@ void sphere_intersect_func(const RTCIntersectFunctionNArguments* args) {
     // (d.x^2 + d.y^2 + d.z^2) t^2 + 2 * (d.x * (o.x - p.x) + d.y * (o.y - p.y) + d.z * (o.z - p.z)) t +
     // ((p.x-o.x)^2 + (p.y-o.y)^2 + (p.z-o.z)^2  - r^2) = 0
     // A t^2 + B t + C
-    Vector3 v = ray.org - sphere->position;
+    Vector3 v = ray.org - sphere.position;
     Real A    = dot(ray.dir, ray.dir);
     Real B    = 2 * dot(ray.dir, v);
-    Real C    = dot(v, v) - sphere->radius * sphere->radius;
+    Real C    = dot(v, v) - sphere.radius * sphere.radius;
     Real t0, t1;
     if (!solve_quadratic(A, B, C, &t0, &t1)) {
         // No intersection
-        return;
+        return -1;
     }
     // This can happen due to numerical inaccuracies
     if (t0 > t1) { std::swap(t0, t1); }
@@ -67,65 +57,65 @@ void sphere_intersect_func(const RTCIntersectFunctionNArguments* args) {
     Real t = -1;
     if (t0 >= ray.tnear && t0 < ray.tfar) { t = t0; }
     if (t1 >= ray.tnear && t1 < ray.tfar && t < 0) { t = t1; }
+    if (t >= ray.tnear && t < ray.tfar) { return t; }
+    return -1;
+}
+
+// Embree calls these with N > 1 when we trace ray packets (e.g., rtcOccluded16),
+// so we loop over the valid lanes.
+void sphere_intersect_func(const RTCIntersectFunctionNArguments* args) {
+    const int* valid     = args->valid;
+    unsigned int N       = args->N;
+    const Sphere* sphere = (const Sphere*)args->geometryUserPtr;
+    RTCRayN* rtc_ray     = RTCRayHitN_RayN(args->rayhit, N);
+    RTCHitN* rtc_hit     = RTCRayHitN_HitN(args->rayhit, N);
+    for (unsigned int i = 0; i < N; i++) {
+        if (!valid[i]) { continue; }
+        Ray ray{ Vector3{ RTCRayN_org_x(rtc_ray, N, i), RTCRayN_org_y(rtc_ray, N, i), RTCRayN_org_z(rtc_ray, N, i) },
+                 Vector3{ RTCRayN_dir_x(rtc_ray, N, i), RTCRayN_dir_y(rtc_ray, N, i), RTCRayN_dir_z(rtc_ray, N, i) },
+                 RTCRayN_tnear(rtc_ray, N, i), RTCRayN_tfar(rtc_ray, N, i) };
+        Real t = intersect_sphere(*sphere, ray);
+        if (t < 0) { continue; }
 
-    if (t >= ray.tnear && t < ray.tfar) {
         // Record the intersection
         Vector3 p                = ray.org + t * ray.dir;
         Vector3 geometric_normal = p - sphere->position;
         // rtc_hit->Ng doesn't need to be normalized
-        rtc_hit->Ng_x = geometric_normal.x;
-        rtc_hit->Ng_y = geometric_normal.y;
-        rtc_hit->Ng_z = geometric_normal.z;
+        RTCHitN_Ng_x(rtc_hit, N, i) = geometric_normal.x;
+        RTCHitN_Ng_y(rtc_hit, N, i) = geometric_normal.y;
+        RTCHitN_Ng_z(rtc_hit, N, i) = geometric_normal.z;
         // We use the spherical coordinates as uv
         Vector3 cartesian = geometric_normal / sphere->radius;
         // https://en.wikipedia.org/wiki/Spherical_coordinate_system#Cartesian_coordinates
         // We use the convention that y is up axis.
-        Real elevation     = acos(std::clamp(cartesian.y, Real(-1), Real(1)));
-        Real azimuth       = atan2(cartesian.z, cartesian.x);
-        rtc_hit->u         = azimuth / c_TWOPI;
-        rtc_hit->v         = elevation / c_PI;
-        rtc_hit->primID    = args->primID;
-        rtc_hit->geomID    = args->geomID;
-        rtc_hit->instID[0] = args->context->instID[0];
-        rtc_ray->tfar      = t;
+        Real elevation                   = acos(std::clamp(cartesian.y, Real(-1), Real(1)));
+        Real azimuth                     = atan2(cartesian.z, cartesian.x);
+        RTCHitN_u(rtc_hit, N, i)         = azimuth / c_TWOPI;
+        RTCHitN_v(rtc_hit, N, i)         = elevation / c_PI;
+        RTCHitN_primID(rtc_hit, N, i)    = args->primID;
+        RTCHitN_geomID(rtc_hit, N, i)    = args->geomID;
+        RTCHitN_instID(rtc_hit, N, i, 0) = args->context->instID[0];
+        RTCRayN_tfar(rtc_ray, N, i)      = t;
     }
 }
 
 void sphere_occluded_func(const RTCOccludedFunctionNArguments* args) {
-    assert(args->N == 1);
-    int* valid = args->valid;
-    if (!valid[0]) { return; }
-
-    void* ptr            = args->geometryUserPtr;
-    const Sphere* sphere = (const Sphere*)ptr;
-    RTCRay* rtc_ray      = (RTCRay*)args->ray;
-
-    Ray ray{ Vector3{ rtc_ray->org_x, rtc_ray->org_y, rtc_ray->org_z },
-             Vector3{ rtc_ray->dir_x, rtc_ray->dir_y, rtc_ray->dir_z }, rtc_ray->tnear, rtc_ray->tfar };
-
-    // See sphere_intersect_func for explanation.
-    Vector3 v = ray.org - sphere->position;
-    Real A    = dot(ray.dir, ray.dir);
-    Real B    = 2 * dot(ray.dir, v);
-    Real C    = dot(v, v) - sphere->radius * sphere->radius;
-    Real t0, t1;
-    if (!solve_quadratic(A, B, C, &t0, &t1)) {
-        // No intersection
-        return;
+    const int* valid     = args->valid;
+    unsigned int N       = args->N;
+    const Sphere* sphere = (const Sphere*)args->geometryUserPtr;
+    RTCRayN* rtc_ray     = args->ray;
+    for (unsigned int i = 0; i < N; i++) {
+        if (!valid[i]) { continue; }
+        Ray ray{ Vector3{ RTCRayN_org_x(rtc_ray, N, i), RTCRayN_org_y(rtc_ray, N, i), RTCRayN_org_z(rtc_ray, N, i) },
+                 Vector3{ RTCRayN_dir_x(rtc_ray, N, i), RTCRayN_dir_y(rtc_ray, N, i), RTCRayN_dir_z(rtc_ray, N, i) },
+                 RTCRayN_tnear(rtc_ray, N, i), RTCRayN_tfar(rtc_ray, N, i) };
+        if (intersect_sphere(*sphere, ray) >= 0) { RTCRayN_tfar(rtc_ray, N, i) = -infinity<float>(); }
     }
-
-    // This can happen due to numerical inaccuracies
-    if (t0 > t1) { std::swap(t0, t1); }
-    Real t = -1;
-    if (t0 >= ray.tnear && t0 < ray.tfar) { t = t0; }
-    if (t1 >= ray.tnear && t1 < ray.tfar && t < 0) { t = t1; }
-
-    if (t >= ray.tnear && t < ray.tfar) { rtc_ray->tfar = -infinity<float>(); }
 }
 
 uint32_t register_embree_op::operator()(const Sphere& sphere) const {
     RTCGeometry rtc_geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
-    uint32_t geomID      = rtcAttachGeometry(scene, rtc_geom);
+    rtcAttachGeometryByID(scene, rtc_geom, geomID);
     rtcSetGeometryUserPrimitiveCount(rtc_geom, 1);
     rtcSetGeometryUserData(rtc_geom, (void*)&sphere);
     rtcSetGeometryBoundsFunction(rtc_geom, sphere_bounds_func, nullptr);
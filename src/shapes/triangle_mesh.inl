@@ -1,16 +1,13 @@
 uint32_t register_embree_op::operator()(const TriangleMesh& mesh) const {
     RTCGeometry rtc_geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
     // A geomID is the ID associated with the shape inside Embree.
-    uint32_t geomID     = rtcAttachGeometry(scene, rtc_geom);
-    Vector4f* positions = (Vector4f*)rtcSetNewGeometryBuffer(rtc_geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
-                                                             sizeof(Vector4f), mesh.positions.size());
-    Vector3i* triangles = (Vector3i*)rtcSetNewGeometryBuffer(rtc_geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
-                                                             sizeof(Vector3i), mesh.indices.size());
-    for (int i = 0; i < (int)mesh.positions.size(); i++) {
-        Vector3 position = mesh.positions[i];
-        positions[i]     = Vector4f{ (float)position[0], (float)position[1], (float)position[2], 0.f };
-    }
-    for (int i = 0; i < (int)mesh.indices.size(); i++) { triangles[i] = mesh.indices[i]; }
+    rtcAttachGeometryByID(scene, rtc_geom, geomID);
+    // Embree reads the vertices and triangles in place instead of keeping its own copy.
+    static_assert(sizeof(MeshPosition) == 4 * sizeof(float) && sizeof(Vector3i) == 3 * sizeof(uint32_t));
+    rtcSetSharedGeometryBuffer(rtc_geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, mesh.positions.data(), 0,
+                               sizeof(MeshPosition), mesh.positions.size());
+    rtcSetSharedGeometryBuffer(rtc_geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, mesh.indices.data(), 0,
+                               sizeof(Vector3i), mesh.indices.size());
     rtcSetGeometryVertexAttributeCount(rtc_geom, 1);
     rtcCommitGeometry(rtc_geom);
     rtcReleaseGeometry(rtc_geom);
@@ -0,0 +1,214 @@
+#include "stats.h"
+#include "json.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// The ThreadStats of the running threads register themselves here, so that collect_stats() can sum them up.
+// When a thread exits, its counts move to "retired".
+struct StatsRegistry {
+    std::mutex mutex;
+    std::vector<ThreadStats*> threads;
+    StatsReport retired;
+};
+
+static StatsRegistry& stats_registry() {
+    static StatsRegistry registry;
+    return registry;
+}
+
+thread_local ThreadStats thread_stats;
+// The innermost running phase of the thread.
+static thread_local StatPhaseTimer* current_phase = nullptr;
+
+template <size_t N>
+static void accumulate(std::array<uint64_t, N>& sums, const std::atomic<uint64_t> (&counts)[N]) {
+    for (size_t i = 0; i < N; i++) { sums[i] += counts[i].load(std::memory_order_relaxed); }
+}
+
+static void accumulate(StatsReport& report, const ThreadStats& stats) {
+    accumulate(report.counters, stats.counters);
+    accumulate(report.mip_level_lookups, stats.mip_level_lookups);
+    accumulate(report.path_lengths, stats.path_lengths);
+}
+
+ThreadStats::ThreadStats() {
+    StatsRegistry& registry = stats_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.push_back(this);
+}
+
+ThreadStats::~ThreadStats() {
+    StatsRegistry& registry = stats_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    accumulate(registry.retired, *this);
+    registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+}
+
+// The perf event file descriptors of the hardware counters (-1 if not opened).
+static int hardware_counter_fds[int(StatHardwareCounter::Count)] = { -1, -1, -1 };
+
+bool open_hardware_counters() {
+#if defined(__linux__)
+    if (has_hardware_counters()) { return true; }
+    const uint64_t configs[] = { PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_CACHE_REFERENCES,
+                                 PERF_COUNT_HW_INSTRUCTIONS };
+    static_assert(sizeof(configs) / sizeof(configs[0]) == int(StatHardwareCounter::Count));
+    for (int i = 0; i < int(StatHardwareCounter::Count); i++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.config         = configs[i];
+        attr.inherit        = 1; // count the threads created later too
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        int fd              = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fd < 0) {
+            for (int j = 0; j < i; j++) {
+                close(hardware_counter_fds[j]);
+                hardware_counter_fds[j] = -1;
+            }
+            return false;
+        }
+        hardware_counter_fds[i] = fd;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool has_hardware_counters() { return hardware_counter_fds[0] >= 0; }
+
+StatsReport collect_stats() {
+    StatsRegistry& registry = stats_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    StatsReport report = registry.retired;
+    // The other threads may be counting while we read, so the counts of a running rendering are a snapshot
+    // that misses the latest increments.
+    for (const ThreadStats* stats : registry.threads) { accumulate(report, *stats); }
+#if defined(__linux__)
+    // The counts since open_hardware_counters(), including the running and the exited threads.
+    for (int i = 0; i < int(StatHardwareCounter::Count) && has_hardware_counters(); i++) {
+        uint64_t count = 0;
+        if (read(hardware_counter_fds[i], &count, sizeof(count)) == sizeof(count)) {
+            report.hardware_counters[i] = count;
+        }
+    }
+#endif
+    return report;
+}
+
+StatsReport operator-(const StatsReport& end, const StatsReport& begin) {
+    StatsReport report;
+    for (int i = 0; i < int(StatCounter::Count); i++) { report.counters[i] = end.counters[i] - begin.counters[i]; }
+    for (int i = 0; i < num_stat_mip_levels; i++) {
+        report.mip_level_lookups[i] = end.mip_level_lookups[i] - begin.mip_level_lookups[i];
+    }
+    for (int i = 0; i < num_stat_path_lengths; i++) {
+        report.path_lengths[i] = end.path_lengths[i] - begin.path_lengths[i];
+    }
+    for (int i = 0; i < int(StatPhase::Count); i++) {
+        report.phase_seconds[i] = end.phase_seconds[i] - begin.phase_seconds[i];
+    }
+    for (int i = 0; i < int(StatHardwareCounter::Count); i++) {
+        report.hardware_counters[i] = end.hardware_counters[i] - begin.hardware_counters[i];
+    }
+    return report;
+}
+
+StatPhaseTimer::StatPhaseTimer(StatPhase phase) : phase(phase), parent(current_phase) {
+    start = std::chrono::steady_clock::now();
+    if (parent != nullptr) {
+        // Pause the outer phase.
+        std::chrono::duration<double> elapsed = start - parent->start;
+        StatsRegistry& registry               = stats_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.retired.phase_seconds[int(parent->phase)] += elapsed.count();
+    }
+    current_phase = this;
+}
+
+StatPhaseTimer::~StatPhaseTimer() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed     = now - start;
+    {
+        StatsRegistry& registry = stats_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.retired.phase_seconds[int(phase)] += elapsed.count();
+    }
+    // Resume the outer phase.
+    if (parent != nullptr) { parent->start = now; }
+    current_phase = parent;
+}
+
+template <typename T, size_t N>
+static void write_json_array(std::ostream& os, const std::array<T, N>& values) {
+    os << "[";
+    for (size_t i = 0; i < N; i++) { os << (i > 0 ? ", " : "") << values[i]; }
+    os << "]";
+}
+
+void write_stats_json(std::ostream& os, const std::string& name, const StatsReport& report, int indent) {
+    static const char* phase_names[]   = { "parse", "bvh_build", "distribution_build", "render", "write" };
+    static const char* counter_names[] = { "primary_rays",  "intersect_rays", "shadow_rays",
+                                           "bsdf_samples",  "phase_samples",  "null_collisions" };
+    static_assert(sizeof(phase_names) / sizeof(phase_names[0]) == int(StatPhase::Count));
+    static_assert(sizeof(counter_names) / sizeof(counter_names[0]) == int(StatCounter::Count));
+
+    auto counter             = [&](StatCounter c) { return report.counters[int(c)]; };
+    uint64_t primary_rays    = counter(StatCounter::PrimaryRays);
+    uint64_t intersect_rays  = counter(StatCounter::IntersectRays);
+    uint64_t total_rays      = intersect_rays + counter(StatCounter::ShadowRays);
+    uint64_t texture_lookups = 0;
+    for (uint64_t n : report.mip_level_lookups) { texture_lookups += n; }
+    double total_seconds = 0;
+    for (double s : report.phase_seconds) { total_seconds += s; }
+    double render_seconds = report.phase_seconds[int(StatPhase::Render)];
+
+    std::string pad(indent, ' ');
+    os << pad << "{\n";
+    os << pad << "  \"name\": " << json_string(name) << ",\n";
+    os << pad << "  \"threads\": " << num_parallel_threads() << ",\n";
+    os << pad << "  \"seconds\": {";
+    for (int i = 0; i < int(StatPhase::Count); i++) {
+        os << "\"" << phase_names[i] << "\": " << report.phase_seconds[i] << ", ";
+    }
+    os << "\"total\": " << total_seconds << "},\n";
+    os << pad << "  \"counters\": {";
+    for (int i = 0; i < int(StatCounter::Count); i++) {
+        os << "\"" << counter_names[i] << "\": " << report.counters[i] << ", ";
+    }
+    // The closest-hit queries that are not camera rays: the bounces (and the transmittance rays of volpath).
+    os << "\"indirect_rays\": " << intersect_rays - primary_rays << ", ";
+    os << "\"total_rays\": " << total_rays << ", ";
+    os << "\"texture_lookups\": " << texture_lookups << "},\n";
+    os << pad << "  \"rays_per_second\": " << (render_seconds > 0 ? double(total_rays) / render_seconds : 0.0)
+       << ",\n";
+    os << pad << "  \"texture_lookups_per_mip_level\": ";
+    write_json_array(os, report.mip_level_lookups);
+    os << ",\n";
+    os << pad << "  \"path_lengths\": ";
+    write_json_array(os, report.path_lengths);
+    if (has_hardware_counters()) {
+        uint64_t misses     = report.hardware_counters[int(StatHardwareCounter::CacheMisses)];
+        uint64_t references = report.hardware_counters[int(StatHardwareCounter::CacheReferences)];
+        os << ",\n";
+        os << pad << "  \"hardware_counters\": {\"cache_misses\": " << misses
+           << ", \"cache_references\": " << references << ", \"cache_miss_rate\": "
+           << (references > 0 ? double(misses) / double(references) : 0.0) << ", \"instructions\": "
+           << report.hardware_counters[int(StatHardwareCounter::Instructions)] << "}";
+    }
+    os << "\n";
+    os << pad << "}";
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "lajolla.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/// Low-overhead statistics of a rendering, in the spirit of pbrt's STAT_COUNTER and profiler.
+/// Every thread counts into its own thread_local ThreadStats without any synchronization,
+/// and the counts of all the threads are only summed up when we collect them (collect_stats()).
+/// The counters are atomics that only their thread writes, with relaxed loads and stores
+/// (plain moves on x86, no locked instructions), so that collect_stats() can read them while the threads count.
+/// The time spent in the phases of a rendering (parsing, BVH build, ...) is measured with StatPhaseTimer.
+
+enum class StatCounter {
+    PrimaryRays,    // camera rays (sample_primary)
+    IntersectRays,  // closest-hit queries, including the primary rays
+    ShadowRays,     // occlusion queries
+    BsdfSamples,    // sample_bsdf calls
+    PhaseSamples,   // sample_phase_function calls
+    NullCollisions, // fake particles of delta/ratio tracking
+    Count
+};
+
+enum class StatPhase { Parse, BvhBuild, DistributionBuild, Render, Write, Count };
+
+/// Hardware counters of the whole process, like the ones of "perf stat" (see open_hardware_counters()).
+enum class StatHardwareCounter { CacheMisses, CacheReferences, Instructions, Count };
+
+/// Texture lookups of the levels beyond the last bin, and paths longer than it, go to the last bin.
+constexpr int num_stat_mip_levels   = 16;
+constexpr int num_stat_path_lengths = 64;
+
+struct ThreadStats {
+    ThreadStats();
+    ~ThreadStats();
+
+    std::atomic<uint64_t> counters[int(StatCounter::Count)]      = {};
+    std::atomic<uint64_t> mip_level_lookups[num_stat_mip_levels] = {};
+    std::atomic<uint64_t> path_lengths[num_stat_path_lengths]    = {};
+};
+
+extern thread_local ThreadStats thread_stats;
+
+/// Add to a counter of the current thread (its only writer, so no read-modify-write is needed).
+inline void add_thread_count(std::atomic<uint64_t>& count, uint64_t n) {
+    count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void add_stat(StatCounter counter, uint64_t n = 1) { add_thread_count(thread_stats.counters[int(counter)], n); }
+
+inline uint64_t get_thread_stat(StatCounter counter) {
+    return thread_stats.counters[int(counter)].load(std::memory_order_relaxed);
+}
+
+/// Count a texel fetch (a bilinear lookup) of mipmap level "level".
+inline void add_mip_level_stat(int level) {
+    add_thread_count(thread_stats.mip_level_lookups[min(level, num_stat_mip_levels - 1)], 1);
+}
+
+/// Record a finished path. The length of a path is its number of scattering events
+/// (BSDF or phase function samples): a camera ray that escapes or stops at a light has length 0.
+inline void add_path_length_stat(int length) {
+    add_thread_count(thread_stats.path_lengths[min(length, num_stat_path_lengths - 1)], 1);
+}
+
+/// The sum of the statistics of all the threads since the start of the program.
+struct StatsReport {
+    std::array<uint64_t, int(StatCounter::Count)> counters{};
+    std::array<uint64_t, num_stat_mip_levels> mip_level_lookups{};
+    std::array<uint64_t, num_stat_path_lengths> path_lengths{};
+    std::array<double, int(StatPhase::Count)> phase_seconds{};
+    std::array<uint64_t, int(StatHardwareCounter::Count)> hardware_counters{};
+};
+
+StatsReport collect_stats();
+
+/// Start counting the cache misses, cache references, and instructions of the process with perf events,
+/// for the reports of collect_stats(). A counter only follows the threads created after it is opened,
+/// so call this before parallel_init(). Returns false (and the counters stay 0) if perf events are
+/// not permitted, e.g., with kernel.perf_event_paranoid > 2, in containers, or on other systems than Linux.
+bool open_hardware_counters();
+
+/// Whether open_hardware_counters() succeeded.
+bool has_hardware_counters();
+
+/// The statistics recorded between two collect_stats() calls.
+StatsReport operator-(const StatsReport& end, const StatsReport& begin);
+
+/// Write the report as a JSON object, with the derived quantities (e.g., rays per second)
+/// and the number of threads of the scheduler.
+void write_stats_json(std::ostream& os, const std::string& name, const StatsReport& report, int indent = 0);
+
+/// Measures the time the current thread spends in a phase while the timer is in scope.
+/// The phases are exclusive: when a phase starts inside another one (e.g., the BVH build in
+/// the parsing), the outer phase pauses until the inner one ends.
+class StatPhaseTimer {
+  public:
+    StatPhaseTimer(StatPhase phase);
+    ~StatPhaseTimer();
+    StatPhaseTimer(const StatPhaseTimer&)            = delete;
+    StatPhaseTimer& operator=(const StatPhaseTimer&) = delete;
+
+  private:
+    StatPhase phase;
+    StatPhaseTimer* parent;
+    std::chrono::steady_clock::time_point start;
+};
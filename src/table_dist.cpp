@@ -1,5 +1,40 @@
 #include "table_dist.h"
 
+/// Vose's construction of the alias table of a normalized pmf.
+static std::vector<AliasBin> make_alias_table(const std::vector<Real>& pmf) {
+    int n = (int)pmf.size();
+    std::vector<AliasBin> bins(n);
+    // Probability of each bin scaled by n, so that the average bin holds 1.
+    // Accumulate in double: with many entries the float rounding errors add up.
+    std::vector<double> scaled(n);
+    std::vector<int> small, large;
+    for (int i = 0; i < n; i++) {
+        scaled[i] = double(pmf[i]) * n;
+        if (scaled[i] < 1) {
+            small.push_back(i);
+        } else {
+            large.push_back(i);
+        }
+    }
+    // Fill up each underfull bin with a piece of an overfull one.
+    while (!small.empty() && !large.empty()) {
+        int s = small.back(), l = large.back();
+        small.pop_back();
+        large.pop_back();
+        bins[s]   = AliasBin{ Real(scaled[s]), l };
+        scaled[l] = (scaled[l] + scaled[s]) - 1;
+        if (scaled[l] < 1) {
+            small.push_back(l);
+        } else {
+            large.push_back(l);
+        }
+    }
+    // What is left is full, up to rounding errors.
+    for (int i : large) { bins[i] = AliasBin{ Real(1), i }; }
+    for (int i : small) { bins[i] = AliasBin{ Real(1), i }; }
+    return bins;
+}
+
 TableDist1D make_table_dist_1d(const std::vector<Real>& f) {
     std::vector<Real> pmf = f;
     std::vector<Real> cdf(f.size() + 1);
@@ -21,10 +56,23 @@ TableDist1D make_table_dist_1d(const std::vector<Real>& f) {
         }
         cdf.back() = 1;
     }
-    return TableDist1D{ pmf, cdf };
+    std::vector<AliasBin> alias_table = make_alias_table(pmf);
+    return TableDist1D{ pmf, cdf, alias_table };
 }
 
 int sample(const TableDist1D& table, Real rnd_param) {
+    int size = table.alias_table.size();
+    assert(size > 0);
+    // The integer part of rnd_param * size picks a bin, and the fractional part decides
+    // between the bin and its alias. Scale in double so that large tables still get a fraction
+    // in single-precision builds.
+    double scaled     = double(rnd_param) * size;
+    int bin           = std::clamp(int(scaled), 0, size - 1);
+    const AliasBin& b = table.alias_table[bin];
+    return Real(scaled - bin) < b.prob ? bin : b.alias;
+}
+
+int sample_cdf(const TableDist1D& table, Real rnd_param) {
     int size = table.pmf.size();
     assert(size > 0);
     const Real* ptr = std::upper_bound(table.cdf.data(), table.cdf.data() + size + 1, rnd_param);
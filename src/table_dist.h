@@ -4,12 +4,23 @@
 #include "vector.h"
 #include <vector>
 
+/// One bin of an alias table: the bin keeps its own entry with probability prob,
+/// and otherwise hands over to the entry alias.
+struct AliasBin {
+    Real prob;
+    int alias;
+};
+
 /// TableDist1D stores a tabular discrete distribution
 /// that we can sample from using the functions below.
 /// Useful for light source sampling.
+///
+/// Sampling uses the alias method (Walker; Vose's construction), which takes constant time
+/// regardless of the number of entries. The CDF is kept for sample_cdf.
 struct TableDist1D {
     std::vector<Real> pmf;
     std::vector<Real> cdf;
+    std::vector<AliasBin> alias_table;
 };
 
 /// Construct the tabular discrete distribution given a vector of positive numbers.
@@ -18,6 +29,11 @@ TableDist1D make_table_dist_1d(const std::vector<Real>& f);
 /// Sample an entry from the discrete table given a random number in [0, 1]
 int sample(const TableDist1D& table, Real rnd_param);
 
+/// Same distribution as sample, by inverting the CDF with a binary search, O(log n).
+/// Unlike the alias method, this maps rnd_param monotonically to the entries,
+/// so it preserves the stratification of rnd_param.
+int sample_cdf(const TableDist1D& table, Real rnd_param);
+
 /// The probability mass function of the sampling procedure above.
 Real pmf(const TableDist1D& table, int id);
 
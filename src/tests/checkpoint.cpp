@@ -0,0 +1,116 @@
+#include "../checkpoint.h"
+#include "../parallel.h"
+#include "../render.h"
+#include "../scene.h"
+#include "../transform.h"
+#include <cstdio>
+#include <cstring>
+
+TriangleMesh make_quad(Real z, Real size) {
+    TriangleMesh mesh;
+    mesh.positions = { Vector3{ -size, -size, z }, Vector3{ size, -size, z }, Vector3{ size, size, z },
+                       Vector3{ -size, size, z } };
+    mesh.indices   = { Vector3i{ 0, 1, 2 }, Vector3i{ 0, 2, 3 } };
+    return mesh;
+}
+
+bool same_image(const Image3& a, const Image3& b) {
+    return a.data.size() == b.data.size() && memcmp(a.data.data(), b.data.data(), a.data.size() * sizeof(Vector3)) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    parallel_init(4);
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+
+    // A floor lit by a small area light, seen from above.
+    std::vector<Material> materials;
+    materials.push_back(Lambertian{ ConstantTexture<Spectrum>{ Vector3{ Real(0.5), Real(0.5), Real(0.5) } } });
+    std::vector<Shape> shapes;
+    TriangleMesh floor  = make_quad(0, 10);
+    floor.material_id   = 0;
+    TriangleMesh light  = make_quad(Real(3), Real(0.5));
+    light.material_id   = 0;
+    light.area_light_id = 0;
+    shapes.push_back(floor);
+    shapes.push_back(light);
+    std::vector<Light> lights{ DiffuseAreaLight{ 1, Vector3{ 10, 10, 10 } } };
+    Camera camera(look_at(Vector3{ 1, 2, 8 }, Vector3{ 0, 0, 0 }, Vector3{ 0, 1, 0 }), 45, 40, 30, Box{ Real(1) }, -1);
+    RenderOptions options;
+    options.samples_per_pixel   = 8;
+    options.progressive         = true;
+    options.checkpoint_interval = Real(1e-9);
+    fs::path output             = fs::temp_directory_path() / "lajolla_test_checkpoint.pfm";
+    Scene scene(embree_device, camera, materials, shapes, lights, {}, -1, TexturePool{}, options, output.string());
+    fs::path checkpoint_file = checkpoint_filename(scene);
+    fs::remove(checkpoint_file);
+
+    // The reference: all the samples in one go.
+    Image3 reference = render(scene);
+
+    // Stop after the first pass, as if the render was killed...
+    scene.options.time_budget = Real(1e-9);
+    Image3 partial            = render(scene);
+    RenderCheckpoint checkpoint;
+    bool success = read_checkpoint(checkpoint_file, scene, checkpoint) && checkpoint.film.counts(0, 0) == 1 &&
+                   !same_image(partial, reference);
+
+    // ...and resume: the same samples, added up in the same order.
+    scene.options.time_budget = 0;
+    scene.options.resume      = true;
+    Image3 resumed            = render(scene);
+    if (!same_image(resumed, reference)) { success = false; }
+
+    // Three shards with 2, 3, and 3 samples per pixel add up to the same samples
+    // (only the order of the sums differs).
+    scene.options.resume      = false;
+    scene.options.progressive = false;
+    scene.options.num_shards  = 3;
+    std::vector<fs::path> shard_files;
+    for (int i = 0; i < 3; i++) {
+        scene.options.shard_index = i;
+        render(scene);
+        shard_files.push_back(checkpoint_filename(scene));
+    }
+    Film merged  = merge_checkpoints(shard_files);
+    Image3 image = resolve(merged);
+    for (int i = 0; i < (int)image.data.size(); i++) {
+        if (merged.counts(i) != 8 || distance(image(i), reference(i)) > Real(1e-4) * length(reference(i))) {
+            success = false;
+        }
+    }
+    try {
+        merge_checkpoints({ shard_files[0], shard_files[1], shard_files[1] });
+        success = false;
+    } catch (const std::exception&) {}
+    // A shard with other samples per pixel would take an overlapping range of samples.
+    scene.options.samples_per_pixel = 16;
+    render(scene);
+    try {
+        merge_checkpoints({ shard_files[0], shard_files[1], checkpoint_filename(scene) });
+        success = false;
+    } catch (const std::exception&) {}
+    scene.options.samples_per_pixel = 8;
+    for (const fs::path& shard_file : shard_files) { fs::remove(shard_file); }
+    scene.options.shard_index = 0;
+    scene.options.num_shards  = 1;
+
+    // A checkpoint of another render is refused.
+    scene.options.sampler_seed = 1;
+    try {
+        read_checkpoint(checkpoint_file, scene, checkpoint);
+        success = false;
+    } catch (const std::exception&) {}
+    scene.options.sampler_seed = 0;
+    fs::remove(checkpoint_file);
+    fs::remove(output);
+    if (read_checkpoint(checkpoint_file, scene, checkpoint)) { success = false; }
+
+    parallel_cleanup();
+    rtcReleaseDevice(embree_device);
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
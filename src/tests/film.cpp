@@ -0,0 +1,40 @@
+#include "../film.h"
+#include <cstdio>
+
+int main(int argc, char* argv[]) {
+    Film film(3, 1);
+    // Pixel 0: constant samples, zero variance
+    for (int i = 0; i < 8; i++) { add_sample(film, 0, 0, Vector3{ 1, 1, 1 }); }
+    // Pixel 1: alternating 0 and 2, mean 1, variance 8/7
+    for (int i = 0; i < 8; i++) { add_sample(film, 1, 0, make_const_spectrum(Real(2 * (i % 2)))); }
+    // Pixel 2: no light yet
+    for (int i = 0; i < 8; i++) { add_sample(film, 2, 0, make_zero_spectrum()); }
+
+    if (film.counts(0, 0) != 8 || film.counts(1, 0) != 8) {
+        printf("FAIL\n");
+        return 1;
+    }
+    if (fabs(pixel_mean(film, 0, 0) - 1) > Real(1e-6) || fabs(pixel_variance(film, 0, 0)) > Real(1e-6) ||
+        fabs(pixel_error(film, 0, 0, 64)) > Real(1e-6)) {
+        printf("FAIL\n");
+        return 1;
+    }
+    if (fabs(pixel_mean(film, 1, 0) - 1) > Real(1e-6) || fabs(pixel_variance(film, 1, 0) - Real(8) / 7) > Real(1e-6) ||
+        fabs(pixel_error(film, 1, 0, 64) - sqrt(Real(1) / 7)) > Real(1e-6)) {
+        printf("FAIL\n");
+        return 1;
+    }
+    // A pixel without light keeps on sampling until it has a quarter of the samples.
+    if (pixel_error(film, 2, 0, 64) < 1 || pixel_error(film, 2, 0, 32) != 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    Image3 img = resolve(film);
+    if (fabs(img(1, 0).x - 1) > Real(1e-6)) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
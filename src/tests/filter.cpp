@@ -2,7 +2,8 @@
 #include <cstdio>
 
 Real compute_determinant(const Filter& f, const Vector2& rnd_param) {
-    Real eps     = Real(1e-6);
+    // Finite differences need a larger step in single precision.
+    Real eps     = sizeof(Real) == sizeof(float) ? Real(1e-3) : Real(1e-6);
     Vector2 s    = sample(f, rnd_param);
     Vector2 s_u  = sample(f, rnd_param + Vector2{ eps, Real(0) });
     Vector2 s_v  = sample(f, rnd_param + Vector2{ Real(0), eps });
@@ -12,6 +13,13 @@ Real compute_determinant(const Filter& f, const Vector2& rnd_param) {
     return det;
 }
 
+/// Double precision gets within 1e-3 of the answer. In single precision, forward differences
+/// have a relative error around 1e-3, so we compare relatively there.
+bool close_enough(Real det, Real expected) {
+    if (sizeof(Real) == sizeof(float)) { return fabs(det - expected) <= Real(1e-2) * max(fabs(expected), Real(1)); }
+    return fabs(det - expected) <= Real(1e-3);
+}
+
 int main(int argc, char* argv[]) {
     Real width        = 2;
     Vector2 rnd_param = Vector2{ 0.3, 0.4 };
@@ -22,7 +30,7 @@ int main(int argc, char* argv[]) {
         // The determinant of this Jacobian should be
         // a constant width * width (the inverse value of the normalized box filter kernel)
         Real det = compute_determinant(f, rnd_param);
-        if (fabs(det - width * width) > Real(1e-3)) {
+        if (!close_enough(det, width * width)) {
             printf("FAIL\n");
             return 1;
         }
@@ -40,7 +48,7 @@ int main(int argc, char* argv[]) {
         Real norm       = half_width;
         Real kernel     = ((1 - fabs(s.x) / half_width) / norm) * ((1 - fabs(s.y) / half_width) / norm);
         Real inv_kernel = 1 / kernel;
-        if (fabs(det - inv_kernel) > Real(1e-3)) {
+        if (!close_enough(det, inv_kernel)) {
             printf("FAIL\n");
             return 1;
         }
@@ -55,7 +63,7 @@ int main(int argc, char* argv[]) {
         // kernel is a gaussian
         Real kernel     = exp(-((s.x * s.x + s.y * s.y) / (stddev * stddev)) / 2) / (stddev * stddev * 2 * c_PI);
         Real inv_kernel = 1 / kernel;
-        if (fabs(det - inv_kernel) > Real(1e-3)) {
+        if (!close_enough(det, inv_kernel)) {
             printf("FAIL\n");
             return 1;
         }
@@ -0,0 +1,87 @@
+#include "../intersection.h"
+#include "../pcg.h"
+#include "../scene.h"
+#include "../transform.h"
+#include <cstdio>
+
+bool close(const Vector3& a, const Vector3& b) { return distance(a, b) < Real(1e-3); }
+
+bool close(const Vector2& a, const Vector2& b) { return fabs(a.x - b.x) + fabs(a.y - b.y) < Real(1e-3); }
+
+int main(int argc, char* argv[]) {
+    // A group of a triangle and a sphere, instanced twice.
+    TriangleMesh mesh;
+    mesh.positions = { Vector3{ -1.0, -1.0, 0.0 }, Vector3{ 1.0, -1.0, 0.5 }, Vector3{ 0.0, 1.0, 0.0 } };
+    mesh.indices   = { Vector3i{ 0, 1, 2 } };
+    mesh.normals   = { normalize(Vector3{ -0.2, 0.0, 1.0 }), normalize(Vector3{ 0.2, 0.1, 1.0 }),
+                       normalize(Vector3{ 0.0, -0.3, 1.0 }) };
+    mesh.uvs       = { Vector2{ 0, 0 }, Vector2{ 1, 0 }, Vector2{ 0.5, 1.0 } };
+    Sphere sphere{ {}, Vector3{ 0.0, 0.0, -2.0 }, Real(0.75) };
+    std::vector<Matrix4x4> to_worlds = {
+        translate(Vector3{ 2.0, 0.0, 0.0 }) * rotate(Real(30), Vector3{ 0.0, 1.0, 1.0 }) *
+            scale(Vector3{ 2.0, 2.0, 2.0 }),
+        translate(Vector3{ -2.0, 1.0, 0.5 }) * rotate(Real(-70), Vector3{ 1.0, 0.0, 0.0 }) *
+            scale(Vector3{ 0.5, 0.5, 0.5 })
+    };
+
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+    std::vector<ShapeInstance> instances;
+    for (const Matrix4x4& to_world : to_worlds) {
+        instances.push_back(ShapeInstance{ 0, to_world, inverse(to_world) });
+    }
+    Scene instanced(embree_device, Camera(), {}, { mesh, sphere }, {}, {}, -1, TexturePool{}, RenderOptions{}, "",
+                    { ShapeGroup{ { 0, 1 } } }, instances);
+
+    // The same scene with the copies transformed explicitly: instance i, shape j is shape 2 * i + j.
+    std::vector<Shape> flattened_shapes;
+    for (const Matrix4x4& to_world : to_worlds) {
+        TriangleMesh world_mesh = mesh;
+        for (auto& p : world_mesh.positions) { p = xform_point(to_world, p); }
+        for (auto& n : world_mesh.normals) { n = xform_normal(inverse(to_world), n); }
+        flattened_shapes.push_back(world_mesh);
+        Real scale = length(xform_vector(to_world, Vector3{ 1.0, 0.0, 0.0 }));
+        flattened_shapes.push_back(Sphere{ {}, xform_point(to_world, sphere.position), sphere.radius * scale });
+    }
+    Scene flattened(embree_device, Camera(), {}, flattened_shapes, {}, {}, -1, TexturePool{}, RenderOptions{}, "");
+
+    bool success    = instanced.instances.size() == 2;
+    int num_hits    = 0;
+    pcg32_state rng = init_pcg32();
+    for (int i = 0; i < 4096; i++) {
+        // From a sphere around the scene towards a point close to the copies
+        Vector3 org    = Real(10) * normalize(Vector3{ next_pcg32_real<Real>(rng) - Real(0.5),
+                                                 next_pcg32_real<Real>(rng) - Real(0.5),
+                                                 next_pcg32_real<Real>(rng) - Real(0.5) });
+        Vector3 target = Vector3{ 6 * next_pcg32_real<Real>(rng) - 3, 4 * next_pcg32_real<Real>(rng) - 2,
+                                  6 * next_pcg32_real<Real>(rng) - 3 };
+        Ray ray{ org, normalize(target - org), Real(0), infinity<Real>() };
+        std::optional<PathVertex> a = intersect(instanced, ray);
+        std::optional<PathVertex> b = intersect(flattened, ray);
+        if (bool(a) != bool(b) || occluded(instanced, ray) != occluded(flattened, ray)) {
+            success = false;
+            break;
+        }
+        if (!a) { continue; }
+        num_hits++;
+        if (a->instance_id < 0 || 2 * a->instance_id + a->shape_id != b->shape_id || b->instance_id != -1 ||
+            !close(a->position, b->position) || !close(a->geometric_normal, b->geometric_normal) ||
+            !close(a->shading_frame.n, b->shading_frame.n) ||
+            fabs(a->mean_curvature - b->mean_curvature) > Real(1e-3)) {
+            success = false;
+            break;
+        }
+        // The sphere picks its uvs and tangent from the world axes, so only those of the mesh are comparable.
+        if (a->shape_id == 0 && (!close(a->uv, b->uv) || !close(a->shading_frame.x, b->shading_frame.x))) {
+            success = false;
+            break;
+        }
+    }
+    rtcReleaseDevice(embree_device);
+
+    if (!success || num_hits < 100) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -13,6 +13,7 @@ int main(int argc, char* argv[]) {
                                    {},                                                             // uvs
                                    Real(0),                                                        // total area
                                    TableDist1D{} });
+    shapes.push_back(Sphere{ {}, Vector3{ 0, 5, 0 }, Real(1) });
     Scene scene(embree_device, Camera(), {}, /* materials */
                 shapes, {},                  /* lights */
                 {},                          /* media */
@@ -31,6 +32,28 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    // Batched occlusion: even rays point at the triangle, odd rays at the sphere or nothing.
+    std::vector<Ray> rays;
+    for (int i = 0; i < 37; i++) {
+        if (i % 2 == 0) {
+            rays.push_back(Ray{ Vector3{ 0, 0, 0 }, Vector3{ 0, 0, -1 }, Real(0), infinity<Real>() });
+        } else if (i % 4 == 1) {
+            rays.push_back(Ray{ Vector3{ 0, 0, 0 }, Vector3{ 0, 1, 0 }, Real(0), infinity<Real>() });
+        } else {
+            rays.push_back(Ray{ Vector3{ 0, 0, 0 }, Vector3{ 0, 0, 1 }, Real(0), infinity<Real>() });
+        }
+    }
+    for (int count = 1; count <= (int)rays.size(); count++) {
+        uint64_t mask = occluded(scene, rays.data(), count);
+        for (int i = 0; i < count; i++) {
+            bool expected = i % 4 != 3;
+            if (bool(mask & (uint64_t(1) << i)) != expected || occluded(scene, rays[i]) != expected) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
     printf("SUCCESS\n");
     return 0;
 }
@@ -0,0 +1,81 @@
+#include "../flexception.h"
+#include "../json.h"
+#include <cstdio>
+#include <limits>
+
+bool fails_to_parse(const std::string& str) {
+    try {
+        parse_json(str);
+    } catch (const std::exception&) { return true; }
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    bool success = true;
+
+    JsonValue cmd = parse_json(R"( {"cmd": "camera", "origin": [0, 1.5, -2e1], "fov": 45,
+                                   "progressive": true, "seed": null, "name": "a \"b\"\né", "empty": {}} )");
+    if (cmd.type != JsonValue::Type::Object || cmd.object.size() != 7) { success = false; }
+    const JsonValue* name = find_member(cmd, "cmd");
+    if (name == nullptr || name->type != JsonValue::Type::String || name->string != "camera") { success = false; }
+    const JsonValue* origin = find_member(cmd, "origin");
+    if (origin == nullptr || origin->type != JsonValue::Type::Array || origin->array.size() != 3 ||
+        origin->array[1].number != 1.5 || origin->array[2].number != -20) {
+        success = false;
+    }
+    const JsonValue* progressive = find_member(cmd, "progressive");
+    if (progressive == nullptr || progressive->type != JsonValue::Type::Boolean || !progressive->boolean) {
+        success = false;
+    }
+    const JsonValue* seed = find_member(cmd, "seed");
+    if (seed == nullptr || seed->type != JsonValue::Type::Null) { success = false; }
+    const JsonValue* escaped = find_member(cmd, "name");
+    if (escaped == nullptr || escaped->string != "a \"b\"\n\xc3\xa9") { success = false; }
+    const JsonValue* empty = find_member(cmd, "empty");
+    if (empty == nullptr || empty->type != JsonValue::Type::Object || !empty->object.empty()) { success = false; }
+    if (find_member(cmd, "missing") != nullptr || find_member(*origin, "cmd") != nullptr) { success = false; }
+
+    // A quoted string parses back to itself.
+    std::string str = "path\\to \"scene\"\t.xml";
+    if (parse_json(json_string(str)).string != str) { success = false; }
+
+    // Numbers are written back exactly, integers without an exponent.
+    if (json_number(1234567) != "1234567" || json_number(-3) != "-3" || parse_json(json_number(0.1)).number != 0.1 ||
+        parse_json(json_number(1e300)).number != 1e300) {
+        success = false;
+    }
+    // A \u escape takes exactly four hex digits.
+    if (parse_json(R"("\u00e9\u0041")").string != "\xc3\xa9" "A" || !fails_to_parse(R"("\u12")") ||
+        !fails_to_parse(R"("\u12g4")") || !fails_to_parse(R"("\u+123")")) {
+        success = false;
+    }
+
+    // Only the escapes of JSON.
+    if (parse_json(R"("\/\b\f")").string != "/\b\f" || !fails_to_parse(R"("\x41")") || !fails_to_parse(R"("\a")")) {
+        success = false;
+    }
+    // Only the number grammar of JSON, and only the numbers that a double can hold, so that they can be written back.
+    if (parse_json("-0.5e+2").number != -50 || parse_json("0").number != 0 || parse_json("1E3").number != 1000) {
+        success = false;
+    }
+    for (const char* number :
+         { "nan", "inf", "-inf", "infinity", "0x10", "+1", "01", "1.", ".5", "1e", "-", "1e999" }) {
+        if (!fails_to_parse(number) || !fails_to_parse(std::string("{\"id\": ") + number + "}")) { success = false; }
+    }
+    if (json_number(std::numeric_limits<double>::quiet_NaN()) != "null" ||
+        json_number(std::numeric_limits<double>::infinity()) != "null") {
+        success = false;
+    }
+
+    if (!fails_to_parse("") || !fails_to_parse("{\"cmd\": }") || !fails_to_parse("[1, 2") ||
+        !fails_to_parse("{\"cmd\": \"load\"} x") || !fails_to_parse("\"unterminated") || !fails_to_parse("nul")) {
+        success = false;
+    }
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "../pcg.h"
+#include "../scene.h"
+#include <cstdio>
+
+Vector3 random_direction(pcg32_state& rng) {
+    Real z   = 2 * next_pcg32_real<Real>(rng) - 1;
+    Real phi = c_TWOPI * next_pcg32_real<Real>(rng);
+    Real r   = sqrt(max(1 - z * z, Real(0)));
+    return Vector3{ r * cos(phi), r * sin(phi), z };
+}
+
+int main(int argc, char* argv[]) {
+    // Many small one-sided quads facing random directions, and a few spheres, as area lights.
+    pcg32_state rng = init_pcg32();
+    std::vector<Shape> shapes;
+    std::vector<Light> lights;
+    for (int i = 0; i < 200; i++) {
+        Vector3 center{ 10 * next_pcg32_real<Real>(rng) - 5, 10 * next_pcg32_real<Real>(rng) - 5,
+                        10 * next_pcg32_real<Real>(rng) - 5 };
+        Vector3 n = random_direction(rng);
+        Vector3 t = normalize(cross(n, fabs(n.x) > Real(0.5) ? Vector3{ 0, 1, 0 } : Vector3{ 1, 0, 0 }));
+        Vector3 b = cross(n, t);
+        Real size = Real(0.05) + Real(0.2) * next_pcg32_real<Real>(rng);
+        TriangleMesh mesh;
+        mesh.positions     = { center - size * t - size * b, center + size * t - size * b,
+                               center + size * t + size * b, center - size * t + size * b };
+        mesh.indices       = { Vector3i{ 0, 1, 2 }, Vector3i{ 0, 2, 3 } };
+        mesh.area_light_id = (int)lights.size();
+        lights.push_back(DiffuseAreaLight{ (int)shapes.size(), Vector3{ 1, 1, 1 } * next_pcg32_real<Real>(rng) });
+        shapes.push_back(mesh);
+    }
+    for (int i = 0; i < 5; i++) {
+        Sphere sphere;
+        sphere.position      = Vector3{ 10 * next_pcg32_real<Real>(rng) - 5, 10 * next_pcg32_real<Real>(rng) - 5,
+                                        10 * next_pcg32_real<Real>(rng) - 5 };
+        sphere.radius        = Real(0.3);
+        sphere.area_light_id = (int)lights.size();
+        lights.push_back(DiffuseAreaLight{ (int)shapes.size(), Vector3{ 2, 2, 2 } });
+        shapes.push_back(sphere);
+    }
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+    Scene scene(embree_device, Camera(), {}, shapes, lights, {}, -1, TexturePool{}, RenderOptions{}, "");
+
+    bool success = scene.light_bvh.nodes.size() == 2 * lights.size() - 1;
+    for (int q = 0; q < 20 && success; q++) {
+        Vector3 p{ 12 * next_pcg32_real<Real>(rng) - 6, 12 * next_pcg32_real<Real>(rng) - 6,
+                   12 * next_pcg32_real<Real>(rng) - 6 };
+        // Half of the points are on a surface, the others in a medium.
+        Vector3 n = q % 2 == 0 ? random_direction(rng) : Vector3{ 0, 0, 0 };
+
+        // The pmf sums up to at most one: the sampling fails when it reaches a node
+        // where neither child can contribute (although the node could).
+        std::vector<Real> pmfs(lights.size());
+        Real sum = 0;
+        for (int i = 0; i < (int)lights.size(); i++) {
+            pmfs[i] = light_pmf(scene, p, n, i);
+            sum += pmfs[i];
+        }
+        if (sum > 1 + Real(1e-3) || sum < Real(0.5)) { success = false; }
+
+        // The lights are sampled with that pmf.
+        int num_samples = 100000;
+        std::vector<int> counts(lights.size(), 0);
+        int num_failures = 0;
+        for (int s = 0; s < num_samples; s++) {
+            int light_id = sample_light(scene, p, n, next_pcg32_real<Real>(rng));
+            if (light_id < 0) {
+                num_failures++;
+            } else {
+                counts[light_id]++;
+            }
+        }
+        if (fabs(Real(num_failures) / num_samples - (1 - sum)) > Real(0.01)) { success = false; }
+        for (int i = 0; i < (int)lights.size(); i++) {
+            // Five standard deviations of the binomial estimate
+            Real tolerance = 5 * sqrt(pmfs[i] * (1 - pmfs[i]) / num_samples) + Real(1e-4);
+            if (fabs(Real(counts[i]) / num_samples - pmfs[i]) > tolerance) { success = false; }
+        }
+
+        // The importance is conservative: a light that can illuminate p is never skipped.
+        for (int i = 0; i < (int)lights.size(); i++) {
+            for (int s = 0; s < 16; s++) {
+                Vector2 uv{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) };
+                PointAndNormal x = sample_point_on_light(lights[i], p, uv, next_pcg32_real<Real>(rng), scene);
+                Vector3 dir      = x.position - p;
+                bool emits       = dot(x.normal, -dir) > 0;
+                bool received    = length_squared(n) == 0 || fabs(dot(n, dir)) > 0;
+                if (emits && received && pmfs[i] <= 0) { success = false; }
+            }
+        }
+    }
+    rtcReleaseDevice(embree_device);
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "../medium.h"
+#include "../pcg.h"
+#include <cstdio>
+
+int main(int argc, char* argv[]) {
+    // A grid volume finer than the majorant grid along x and coarser along y and z,
+    // with a non-cubic bounding box.
+    GridVolume<Spectrum> grid;
+    grid.resolution = Vector3i{ 40, 7, 3 };
+    grid.p_min      = Vector3{ -1.0, 0.0, 2.0 };
+    grid.p_max      = Vector3{ 3.0, 1.0, 2.5 };
+    pcg32_state rng = init_pcg32();
+    grid.data.resize(grid.resolution.x * grid.resolution.y * grid.resolution.z);
+    for (Spectrum& v : grid.data) {
+        v = Spectrum{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) };
+    }
+    grid.scale = 3;
+    HeterogeneousMedium medium{ { IsotropicPhase{} },
+                                ConstantVolume<Spectrum>{ make_const_spectrum(Real(0.5)) }, grid,
+                                make_majorant_grid(VolumeSpectrum{ grid }) };
+
+    bool success = true;
+    for (int i = 0; i < 1000 && success; i++) {
+        Vector3 org = Vector3{ -2 + 6 * next_pcg32_real<Real>(rng), -1 + 3 * next_pcg32_real<Real>(rng),
+                               Real(1.5) + Real(1.5) * next_pcg32_real<Real>(rng) };
+        Vector3 dir = normalize(Vector3{ next_pcg32_real<Real>(rng) - Real(0.5), next_pcg32_real<Real>(rng) - Real(0.5),
+                                         next_pcg32_real<Real>(rng) - Real(0.5) });
+        Real t_max  = 5 * next_pcg32_real<Real>(rng);
+        Ray ray{ org, dir, Real(0), t_max };
+
+        // The segments should be ordered, contiguous, and each should bound the density inside it.
+        MajorantIterator iter = make_majorant_iterator(medium, ray, t_max);
+        Real prev_t_max       = -1;
+        while (std::optional<MajorantSegment> segment = next_majorant_segment(iter)) {
+            if (segment->t_min < 0 || segment->t_max > t_max * (1 + Real(1e-4)) || segment->t_min > segment->t_max ||
+                (prev_t_max >= 0 && fabs(segment->t_min - prev_t_max) > Real(1e-4)) || segment->homogeneous) {
+                success = false;
+                break;
+            }
+            prev_t_max = segment->t_max;
+            for (int j = 0; j < 8; j++) {
+                Real t     = segment->t_min + (segment->t_max - segment->t_min) * (j + Real(0.5)) / 8;
+                Spectrum d = lookup(medium.density, org + t * dir);
+                if (d.x > segment->sigma_maj.x + Real(1e-3) || d.y > segment->sigma_maj.y + Real(1e-3) ||
+                    d.z > segment->sigma_maj.z + Real(1e-3)) {
+                    success = false;
+                }
+            }
+        }
+    }
+
+    // A homogeneous medium gives a single segment covering the whole ray, whose majorant is exactly sigma_t.
+    HomogeneousMedium homogeneous{ { IsotropicPhase{} }, make_const_spectrum(1), make_const_spectrum(2) };
+    Ray ray{ Vector3{ 0, 0, 0 }, Vector3{ 1, 0, 0 }, Real(0), Real(1) };
+    MajorantIterator iter = make_majorant_iterator(homogeneous, ray, 1);
+
+    std::optional<MajorantSegment> segment = next_majorant_segment(iter);
+    if (!segment || segment->t_min != 0 || segment->t_max != 1 || segment->sigma_maj.x != 3 ||
+        !segment->homogeneous || next_majorant_segment(iter)) {
+        success = false;
+    }
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "../mesh_cache.h"
+#include "../transform.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+template <typename T>
+bool same_bytes(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+int main(int argc, char* argv[]) {
+    fs::path cache_dir = fs::temp_directory_path() / "lajolla_test_mesh_cache";
+    fs::path filename  = fs::temp_directory_path() / "lajolla_test_mesh_cache.obj";
+    fs::remove_all(cache_dir);
+    {
+        // Only the size and modification time of the source file matter, not its contents.
+        std::ofstream ofs(filename);
+        ofs << "# mesh\n";
+    }
+
+    TriangleMesh mesh;
+    mesh.positions = { Vector3{ 0, 0, 0 }, Vector3{ 1, 0, 0 }, Vector3{ 0, 1, 0 }, Vector3{ 1, 1, 0 } };
+    mesh.indices   = { Vector3i{ 0, 1, 2 }, Vector3i{ 1, 3, 2 } };
+    mesh.normals   = { Vector3{ 0, 0, 1 }, Vector3{ 0, 0, 1 }, Vector3{ 0, 0, 1 }, Vector3{ 0, 0, 1 } };
+    MeshCacheKey key{ filename, 0, translate(Vector3{ 0, 0, 1 }), false };
+    bool success = !load_cached_mesh(cache_dir, key).has_value();
+
+    store_cached_mesh(cache_dir, key, mesh);
+    std::optional<TriangleMesh> cached = load_cached_mesh(cache_dir, key);
+    if (!cached || !same_bytes(cached->positions, mesh.positions) || !same_bytes(cached->indices, mesh.indices) ||
+        !same_bytes(cached->normals, mesh.normals) || !cached->uvs.empty()) {
+        success = false;
+    }
+
+    // A different transform or shape is a different entry
+    MeshCacheKey moved = key;
+    moved.to_world     = translate(Vector3{ 0, 0, 2 });
+    MeshCacheKey other = key;
+    other.shape_index  = 1;
+    success            = success && !load_cached_mesh(cache_dir, moved).has_value() &&
+                         !load_cached_mesh(cache_dir, other).has_value();
+
+    // Editing the source file invalidates the entry
+    {
+        std::ofstream ofs(filename, std::ios::app);
+        ofs << "# edited\n";
+    }
+    success = success && !load_cached_mesh(cache_dir, key).has_value();
+
+    fs::remove_all(cache_dir);
+    fs::remove(filename);
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -18,6 +18,42 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // The compact formats should decode close to the full precision texels.
+    Image3 ramp(37, 23);
+    for (int y = 0; y < ramp.height; y++) {
+        for (int x = 0; x < ramp.width; x++) { ramp(x, y) = Vector3{ Real(x) / 36, Real(y) / 22, Real(x + y) / 58 }; }
+    }
+    Mipmap3 full = make_mipmap(ramp);
+    for (TexelFormat format : { TexelFormat::Float, TexelFormat::Half, TexelFormat::SRGB8 }) {
+        Mipmap3 compact = make_mipmap(ramp, format);
+        // 8-bit gamma codes are at most ~0.0087 apart (the steepest step is at the top)
+        Real tolerance = format == TexelFormat::SRGB8 ? Real(5e-3) : Real(1e-3);
+        for (int l = 0; l < (int)full.images.size(); l++) {
+            for (int i = 0; i < 100; i++) {
+                Real u    = (i % 10 + Real(0.5)) / 10, v = (i / 10 + Real(0.5)) / 10;
+                Vector3 a = lookup(full, u, v, l);
+                Vector3 b = lookup(compact, u, v, l);
+                if (fabs(a.x - b.x) > tolerance || fabs(a.y - b.y) > tolerance || fabs(a.z - b.z) > tolerance) {
+                    printf("FAIL\n");
+                    return 1;
+                }
+            }
+        }
+    }
+    // 8-bit codes and halves survive a round trip
+    for (int i = 0; i < 256; i++) {
+        if (encode_srgb8(get_srgb8_table().values[i]) != i) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+    for (float f : { 0.f, 1.f, -2.5f, 65504.f, 6.1035156e-05f, 5.9604645e-08f }) {
+        if (half_to_float(float_to_half(f)) != f) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
     printf("SUCCESS\n");
     return 0;
 }
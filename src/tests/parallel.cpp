@@ -0,0 +1,68 @@
+#include "../parallel.h"
+#include <cstdio>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+    parallel_init(4);
+
+    // 1D loop: every index is visited exactly once
+    {
+        std::vector<std::atomic<int>> visited(10007);
+        for (auto& v : visited) { v = 0; }
+        parallel_for([&](int64_t i) { visited[i]++; }, visited.size(), 16);
+        for (auto& v : visited) {
+            if (v != 1) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    // 2D loop: every pixel is visited exactly once
+    {
+        Vector2i count{ 37, 23 };
+        std::vector<std::atomic<int>> visited(count.x * count.y);
+        for (auto& v : visited) { v = 0; }
+        parallel_for([&](Vector2i p) { visited[p.y * count.x + p.x]++; }, count);
+        for (auto& v : visited) {
+            if (v != 1) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    // Nested loops
+    {
+        std::atomic<int64_t> sum{ 0 };
+        parallel_for(
+            [&](int64_t i) { parallel_for([&](int64_t j) { sum += i * 100 + j; }, 100); }, 100);
+        // sum_{i,j} (100 i + j) = 100 * 100 * 4950 + 100 * 4950
+        if (sum != int64_t(100) * 100 * 4950 + 100 * 4950) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // Futures, including waiting on a future from inside a task
+    {
+        std::vector<Future<int64_t>> futures;
+        for (int64_t i = 0; i < 64; i++) {
+            futures.push_back(run_async([i]() {
+                Future<int64_t> inner = run_async([i]() { return i * i; });
+                return inner.get() + 1;
+            }));
+        }
+        for (int64_t i = 0; i < 64; i++) {
+            if (futures[i].get() != i * i + 1) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    parallel_cleanup();
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "../parallel.h"
+#include "../parsers/parse_obj.h"
+#include "../transform.h"
+#include <cstdio>
+#include <fstream>
+
+bool close(const Vector3& a, const Vector3& b) { return distance(a, b) < Real(1e-5); }
+
+bool same(const Vector3i& a, const Vector3i& b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+
+int main(int argc, char* argv[]) {
+    fs::path filename = fs::temp_directory_path() / "lajolla_test_parse_obj.obj";
+    bool success      = true;
+    {
+        // A triangle and a quad sharing an edge, with CRLF line endings, comments, a homogeneous coordinate,
+        // and relative indices.
+        std::ofstream ofs(filename, std::ios::binary);
+        ofs << "# comment\r\n"
+            << "v 0 0 0\r\n"
+            << "v 1 0 0\r\n"
+            << "v 2 2 0 2\r\n"
+            << "  v 0 1 0\r\n"
+            << "v 2 0 0\r\n"
+            << "vt 0 0\r\nvt 1 0\r\nvt 1 1\r\n"
+            << "vn 0 0 2\r\n"
+            << "o object\r\n"
+            << "f 1/1/1 2/2/1 3/3/1\r\n"
+            << "f -4//-1 -1//1 3//1 4//1\r\n";
+    }
+    TriangleMesh mesh = parse_obj(filename, translate(Vector3{ 0, 0, 1 }));
+    // Corners 1/1/1, 2/2/1, 3/3/1 for the triangle, then 2//1, 5//1, 3//1, 4//1 for the quad
+    success = success && mesh.positions.size() == 7 && mesh.uvs.size() == 3 && mesh.normals.size() == 7 &&
+              mesh.indices.size() == 3;
+    if (success) {
+        success = close(mesh.positions[2], Vector3{ 1, 1, 1 }) && close(mesh.positions[4], Vector3{ 2, 0, 1 }) &&
+                  close(mesh.normals[0], Vector3{ 0, 0, 1 }) && mesh.uvs[2].y == 0 &&
+                  same(mesh.indices[1], Vector3i{ 3, 4, 5 }) && same(mesh.indices[2], Vector3i{ 3, 5, 6 });
+    }
+
+    // More than one chunk: the relative indices and the vertex order must not depend on where the chunks are cut,
+    // nor on the number of threads.
+    {
+        std::ofstream ofs(filename, std::ios::binary);
+        for (int i = 0; i < 50000; i++) {
+            ofs << "v " << i << " 0.5 -1.25e-1\n"
+                << "v " << i << " 1 0\n"
+                << "v " << i << " 1 1\n"
+                << "f -3 -2 -1\n"
+                << "f " << 3 * i + 1 << " " << 3 * i + 3 << " -2\n";
+        }
+    }
+    parallel_init(4);
+    TriangleMesh big = parse_obj(filename, Matrix4x4::identity());
+    parallel_cleanup();
+    success = success && big.positions.size() == 150000 && big.indices.size() == 100000;
+    for (int i = 0; i < 50000 && success; i++) {
+        success = same(big.indices[2 * i], Vector3i{ 3 * i, 3 * i + 1, 3 * i + 2 }) &&
+                  same(big.indices[2 * i + 1], Vector3i{ 3 * i, 3 * i + 2, 3 * i + 1 }) &&
+                  close(big.positions[3 * i], Vector3{ Real(i), Real(0.5), Real(-0.125) });
+    }
+
+    // More vertices than positions and uvs (every position with every uv), twice each:
+    // the vertex map grows past its estimate, and still finds the vertices it has seen.
+    {
+        std::ofstream ofs(filename, std::ios::binary);
+        for (int i = 0; i < 20; i++) { ofs << "v " << i << " 0 0\nvt " << i << " 0\n"; }
+        for (int round = 0; round < 2; round++) {
+            for (int i = 1; i <= 20; i++) {
+                for (int j = 1; j <= 20; j += 4) {
+                    ofs << "f " << i << "/" << j << " " << i << "/" << j + 1 << " " << i << "/" << j + 2 << " " << i
+                        << "/" << j + 3 << "\n";
+                }
+            }
+        }
+    }
+    TriangleMesh combos = parse_obj(filename, Matrix4x4::identity());
+    success = success && combos.positions.size() == 400 && combos.indices.size() == 400;
+    for (int i = 0; i < 200 && success; i++) {
+        success = same(combos.indices[i], combos.indices[i + 200]) && combos.indices[i].x == 4 * (i / 2);
+    }
+    fs::remove(filename);
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "../sampler.h"
+#include <cstdio>
+#include <vector>
+
+// Checks that every 4x4 stratum of [0, 1)^2 has exactly one of the 16 points.
+static bool stratified_4x4(const std::vector<Vector2>& points) {
+    std::vector<int> counts(16, 0);
+    for (const Vector2& p : points) {
+        if (p.x < 0 || p.x >= 1 || p.y < 0 || p.y >= 1) { return false; }
+        counts[int(p.y * 4) * 4 + int(p.x * 4)]++;
+    }
+    for (int c : counts) {
+        if (c != 1) { return false; }
+    }
+    return true;
+}
+
+// Mean squared error of estimating the integral of a smooth function over [0, 1)^2 (= 1/4)
+// with the spp samples of each of the pixels of a small image.
+static Real integration_error(SamplerType type, int spp) {
+    Vector2i resolution{ 16, 16 };
+    Sampler sampler = make_sampler(type, spp, resolution);
+    Real error      = 0;
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x < resolution.x; x++) {
+            Real sum = 0;
+            for (int s = 0; s < spp; s++) {
+                start_pixel_sample(sampler, Vector2i{ x, y }, s);
+                next_1d(sampler);
+                Vector2 u = next_2d(sampler);
+                sum += u.x * u.y;
+            }
+            Real diff = sum / spp - Real(0.25);
+            error += diff * diff;
+        }
+    }
+    return error / (resolution.x * resolution.y);
+}
+
+int main(int argc, char* argv[]) {
+    bool success = true;
+
+    // permutation_element is a permutation for every length and seed.
+    for (uint32_t l : { 1u, 2u, 7u, 16u, 100u }) {
+        for (uint32_t p : { 0u, 1u, 0xdeadbeefu }) {
+            std::vector<int> hits(l, 0);
+            for (uint32_t i = 0; i < l; i++) { hits[permutation_element(i, l, p)]++; }
+            for (int h : hits) {
+                if (h != 1) { success = false; }
+            }
+        }
+    }
+
+    // The 16 samples of a pixel are stratified in every pair of dimensions.
+    for (SamplerType type : { SamplerType::Sobol, SamplerType::PMJ02, SamplerType::ZSobol }) {
+        Sampler sampler = make_sampler(type, 16, Vector2i{ 8, 8 });
+        for (Vector2i pixel : { Vector2i{ 0, 0 }, Vector2i{ 5, 3 } }) {
+            std::vector<std::vector<Vector2>> dims(3);
+            std::vector<int> strata_1d(16, 0);
+            for (int s = 0; s < 16; s++) {
+                start_pixel_sample(sampler, pixel, s);
+                Real u = next_1d(sampler);
+                if (u < 0 || u >= 1) {
+                    success = false;
+                } else {
+                    strata_1d[int(u * 16)]++;
+                }
+                for (auto& d : dims) { d.push_back(next_2d(sampler)); }
+            }
+            for (const auto& d : dims) {
+                if (!stratified_4x4(d)) { success = false; }
+            }
+            for (int c : strata_1d) {
+                if (c != 1) { success = false; }
+            }
+        }
+    }
+
+    // The samples only depend on the pixel sample and the dimension.
+    Sampler a = make_sampler(SamplerType::Independent, 4, Vector2i{ 8, 8 });
+    Sampler b = a;
+    start_pixel_sample(a, Vector2i{ 2, 3 }, 1);
+    start_pixel_sample(b, Vector2i{ 7, 7 }, 0);
+    next_2d(b);
+    start_pixel_sample(b, Vector2i{ 2, 3 }, 1);
+    if (next_1d(a) != next_1d(b)) { success = false; }
+
+    // The low-discrepancy samplers converge faster than the independent one.
+    Real independent_error = integration_error(SamplerType::Independent, 16);
+    for (SamplerType type : { SamplerType::Sobol, SamplerType::PMJ02, SamplerType::ZSobol }) {
+        if (integration_error(type, 16) > independent_error / 4) { success = false; }
+    }
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
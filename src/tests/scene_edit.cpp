@@ -0,0 +1,127 @@
+#include "../intersection.h"
+#include "../scene.h"
+#include "../transform.h"
+#include <cstdio>
+
+TriangleMesh make_quad(Real z, Real size) {
+    TriangleMesh mesh;
+    mesh.positions = { Vector3{ -size, -size, z }, Vector3{ size, -size, z }, Vector3{ size, size, z },
+                       Vector3{ -size, size, z } };
+    mesh.indices   = { Vector3i{ 0, 1, 2 }, Vector3i{ 0, 2, 3 } };
+    return mesh;
+}
+
+int main(int argc, char* argv[]) {
+    // A floor, and two area lights above it.
+    std::vector<Material> materials;
+    materials.push_back(Lambertian{ ConstantTexture<Spectrum>{ Vector3{ Real(0.5), Real(0.5), Real(0.5) } } });
+    materials.push_back(Lambertian{ ConstantTexture<Spectrum>{ Vector3{ Real(0.8), Real(0.2), Real(0.2) } } });
+    std::vector<Shape> shapes;
+    std::vector<Light> lights;
+    TriangleMesh floor = make_quad(0, 10);
+    floor.material_id  = 0;
+    shapes.push_back(floor);
+    for (int i = 0; i < 2; i++) {
+        TriangleMesh light  = make_quad(Real(5), Real(0.5));
+        light.material_id   = 0;
+        light.area_light_id = i;
+        lights.push_back(DiffuseAreaLight{ (int)shapes.size(), Vector3{ 1, 1, 1 } });
+        shapes.push_back(light);
+    }
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+    RenderOptions options;
+    options.light_sampler = LightSampler::Power;
+    Scene scene(embree_device, Camera(), materials, shapes, lights, {}, -1, TexturePool{}, options, "");
+
+    bool success = true;
+    auto hit_z   = [&](const Vector3& org) {
+        std::optional<PathVertex> vertex =
+            intersect(scene, Ray{ org, Vector3{ 0, 0, -1 }, Real(0), infinity<Real>() });
+        return vertex ? vertex->position.z : -infinity<Real>();
+    };
+    if (fabs(hit_z(Vector3{ 8, 8, 10 })) > Real(1e-4)) { success = false; }
+    // Only the emitters have sampling distributions.
+    const auto& floor_mesh = std::get<TriangleMesh>(scene.shapes[0]);
+    if (floor_mesh.total_area != 0 || floor_mesh.triangle_sampler.pmf.size() != 0 ||
+        fabs(surface_area(scene.shapes[1]) - 1) > Real(1e-4) || fabs(surface_area(scene.shapes[2]) - 1) > Real(1e-4)) {
+        success = false;
+    }
+
+    // Move the floor up: the mesh is refit.
+    transform_shape(scene, 0, translate(Vector3{ 0, 0, 1 }));
+    commit_edits(scene);
+    if (fabs(hit_z(Vector3{ 8, 8, 10 }) - 1) > Real(1e-4)) { success = false; }
+    if (!scene.dynamic || scene.geometry_changed || scene.lights_changed) { success = false; }
+
+    // Replace the floor with a sphere.
+    Sphere sphere;
+    sphere.position    = Vector3{ 8, 8, 0 };
+    sphere.radius      = 2;
+    sphere.material_id = 0;
+    replace_shape(scene, 0, sphere);
+    commit_edits(scene);
+    if (fabs(hit_z(Vector3{ 8, 8, 10 }) - 2) > Real(1e-3)) { success = false; }
+
+    // Swap the material.
+    set_shape_material(scene, 0, 1);
+    std::optional<PathVertex> vertex =
+        intersect(scene, Ray{ Vector3{ 8, 8, 10 }, Vector3{ 0, 0, -1 }, Real(0), infinity<Real>() });
+    if (!vertex || vertex->material_id != 1) { success = false; }
+
+    // Brighten a light: the light distribution follows.
+    Vector3 p{ 0, 0, 0 }, n{ 0, 0, 1 };
+    if (fabs(light_pmf(scene, p, n, 0) - Real(0.5)) > Real(1e-4)) { success = false; }
+    replace_light(scene, 1, DiffuseAreaLight{ 2, Vector3{ 3, 3, 3 } });
+    commit_edits(scene);
+    if (fabs(light_pmf(scene, p, n, 0) - Real(0.25)) > Real(1e-4)) { success = false; }
+
+    // Scale up an emitter: its area, and so its power, grows.
+    transform_shape(scene, 1, scale(Vector3{ 3, 3, 1 }));
+    commit_edits(scene);
+    if (fabs(light_pmf(scene, p, n, 0) - Real(0.75)) > Real(1e-4)) { success = false; }
+    if (fabs(surface_area(scene.shapes[1]) - 9) > Real(1e-3)) { success = false; }
+
+    // Move a light to the sphere: the sphere emits, and the old emitter stops.
+    // A light cannot go to a missing shape, or to the emitter of another light.
+    for (int shape_id : { 3, 2 }) {
+        try {
+            replace_light(scene, 0, DiffuseAreaLight{ shape_id, Vector3{ 1, 1, 1 } });
+            success = false;
+        } catch (const std::exception&) {}
+    }
+    replace_light(scene, 1, DiffuseAreaLight{ 0, Vector3{ 2, 2, 2 } });
+    commit_edits(scene);
+    if (get_area_light_id(scene.shapes[0]) != 1 || is_light(scene.shapes[2])) { success = false; }
+
+    // A replaced shape keeps its area light: the emitter of a light cannot be replaced by a shape that does
+    // not emit, and a shape cannot take the light of another one. Nor can it have a missing material.
+    TriangleMesh no_emitter = make_quad(Real(5), Real(0.5));
+    no_emitter.material_id  = 0;
+    TriangleMesh stolen     = no_emitter;
+    stolen.area_light_id    = 0;
+    TriangleMesh bad        = no_emitter;
+    bad.material_id         = 2;
+    for (auto [shape_id, shape] : { std::pair{ 1, no_emitter }, std::pair{ 2, stolen }, std::pair{ 2, bad } }) {
+        try {
+            replace_shape(scene, shape_id, shape);
+            success = false;
+        } catch (const std::exception&) {}
+    }
+    replace_shape(scene, 1, stolen);
+    commit_edits(scene);
+    // (light 1 is on the sphere, twice as bright)
+    Real power0 = surface_area(scene.shapes[1]), power1 = 2 * surface_area(scene.shapes[0]);
+    if (get_area_light_id(scene.shapes[1]) != 0 || is_light(scene.shapes[2]) ||
+        fabs(surface_area(scene.shapes[1]) - 1) > Real(1e-4) ||
+        fabs(light_pmf(scene, p, n, 0) - power0 / (power0 + power1)) > Real(1e-4)) {
+        success = false;
+    }
+    rtcReleaseDevice(embree_device);
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "../spectrum.h"
+#include <cstdio>
+
+/// The distance between a and b in units in the last place of b.
+Real ulps(Real a, Real b) {
+    if (a == b) { return 0; }
+    return fabs(a - b) / (std::nextafter(b, infinity<Real>()) - b);
+}
+
+int main(int argc, char* argv[]) {
+    bool success = true;
+
+    // The lane-wise operators match the Vector3 ones.
+    Vector3 a{ Real(0.25), Real(-1.5), Real(3) }, b{ Real(2), Real(0.5), Real(-0.75) };
+    Spectrum sa        = a, sb = b;
+    Vector3 results[]  = { sa + sb, sa - sb, sa * sb, sa / sb, sa * Real(3), sa / Real(3), Real(2) - sa, -sa };
+    Vector3 expected[] = { a + b, a - b, a * b, a / b, a * Real(3), a / Real(3), Real(2) - a, -a };
+    for (int i = 0; i < 8; i++) {
+        if (distance(results[i], expected[i]) != 0) { success = false; }
+    }
+    Real lum = a.x * Real(0.212671) + a.y * Real(0.715160) + a.z * Real(0.072169);
+    if (luminance(sa) != lum || max(sa) != 3 || avg(sb) != Real(1.75) / 3) { success = false; }
+    Spectrum m = max(sa, sb), r = sqrt(sa);
+    if (m[0] != 2 || m[1] != Real(0.5) || m[2] != 3) { success = false; }
+    if (r[0] != Real(0.5) || r[1] != 0 || r[2] != sqrt(Real(3))) { success = false; }
+
+    // exp, on every lane of a chunk, is within a few ulps of std::exp (down to the denormals, flushed to zero)
+    Real max_ulps = 0;
+    for (Real x = -87; x < 88; x += Real(0.0137)) {
+        SpectrumChunk chunk = {};
+        chunk[0]            = x;
+        chunk[1]            = -x / 3;
+        SpectrumChunk e     = exp_chunk(chunk);
+        max_ulps            = max(max_ulps, max(ulps(e[0], exp(x)), ulps(e[1], exp(-x / 3))));
+        if (ulps(exp(make_const_spectrum(x))[2], exp(x)) > 4) { success = false; }
+    }
+    if (max_ulps > 4) { success = false; }
+    Spectrum special = exp(Spectrum{ -infinity<Real>(), infinity<Real>(), Real(-1000) });
+    if (special[0] != 0 || special[1] != infinity<Real>() || special[2] != 0) { success = false; }
+    if (!isnan(exp(make_const_spectrum(std::numeric_limits<Real>::quiet_NaN())))) { success = false; }
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "../parallel.h"
+#include "../stats.h"
+#include <cstdio>
+#include <sstream>
+#include <thread>
+
+int main(int argc, char* argv[]) {
+    // (perf events are often not permitted, e.g., in containers: then the hardware counters stay 0)
+    bool hardware = open_hardware_counters();
+    parallel_init(4);
+    StatsReport begin = collect_stats();
+
+    // Counts of all the threads add up
+    parallel_for(
+        [&](int64_t i) {
+            add_stat(StatCounter::ShadowRays);
+            add_stat(StatCounter::IntersectRays, 2);
+            add_mip_level_stat(int(i % 20));
+            add_path_length_stat(int(i % 100));
+        },
+        10000, 16);
+    // (including the threads that exited in the meantime)
+    std::thread([]() { add_stat(StatCounter::ShadowRays, 5); }).join();
+
+    // Exclusive phases: the nested phase does not count towards the outer one
+    {
+        StatPhaseTimer parse(StatPhase::Parse);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        {
+            StatPhaseTimer bvh(StatPhase::BvhBuild);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    StatsReport report = collect_stats() - begin;
+    bool success       = report.counters[int(StatCounter::ShadowRays)] == 10005;
+    success            = success && report.counters[int(StatCounter::IntersectRays)] == 20000;
+    success            = success && report.counters[int(StatCounter::PrimaryRays)] == 0;
+    // i % 20 = 15..19 go to the last bin
+    success = success && report.mip_level_lookups[0] == 500;
+    success = success && report.mip_level_lookups[num_stat_mip_levels - 1] == 2500;
+    // i % 100 = 63..99 go to the last bin
+    success = success && report.path_lengths[1] == 100;
+    success = success && report.path_lengths[num_stat_path_lengths - 1] == 3700;
+
+    double parse_seconds = report.phase_seconds[int(StatPhase::Parse)];
+    double bvh_seconds   = report.phase_seconds[int(StatPhase::BvhBuild)];
+    success              = success && parse_seconds >= 0.02 && parse_seconds < 0.09 && bvh_seconds >= 0.1;
+
+    std::stringstream ss;
+    write_stats_json(ss, "test", report);
+    success = success && ss.str().find("\"shadow_rays\": 10005") != std::string::npos &&
+              ss.str().find("\"total_rays\": 30005") != std::string::npos;
+    uint64_t instructions = report.hardware_counters[int(StatHardwareCounter::Instructions)];
+    success = success && hardware == has_hardware_counters() && (instructions > 0) == hardware &&
+              (ss.str().find("\"hardware_counters\"") != std::string::npos) == hardware;
+
+    parallel_cleanup();
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "../pcg.h"
+#include "../table_dist.h"
+#include <cstdio>
+
+int main(int argc, char* argv[]) {
+    // Weights spanning a few orders of magnitude, with a couple of zeros.
+    std::vector<Real> f = { 1, 0, 5, Real(0.01), 3, 0, 100, 2, Real(0.5), 7 };
+    TableDist1D table   = make_table_dist_1d(f);
+
+    bool success = table.alias_table.size() == f.size();
+    // Each entry should be sampled with probability pmf. Check both sampling routines.
+    std::vector<int> alias_counts(f.size(), 0), cdf_counts(f.size(), 0);
+    int num_samples = 1000000;
+    pcg32_state rng = init_pcg32();
+    for (int i = 0; i < num_samples; i++) {
+        Real u = next_pcg32_real<Real>(rng);
+        alias_counts[sample(table, u)]++;
+        cdf_counts[sample_cdf(table, u)]++;
+    }
+    for (int i = 0; i < (int)f.size(); i++) {
+        Real p = pmf(table, i);
+        // Five standard deviations of the binomial estimate
+        Real tolerance = 5 * sqrt(p * (1 - p) / num_samples) + Real(1e-6);
+        if (fabs(Real(alias_counts[i]) / num_samples - p) > tolerance ||
+            fabs(Real(cdf_counts[i]) / num_samples - p) > tolerance) {
+            success = false;
+        }
+        if (f[i] == 0 && (alias_counts[i] > 0 || cdf_counts[i] > 0)) { success = false; }
+    }
+    // The end points of [0, 1] must stay in range.
+    for (Real u : { Real(0), Real(1) }) {
+        int id = sample(table, u);
+        if (id < 0 || id >= (int)f.size() || f[id] == 0) { success = false; }
+    }
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include "../image.h"
+#include "../mipmap.h"
+#include "../parallel.h"
+#include "../pcg.h"
+#include <atomic>
+#include <cstdio>
+
+int main(int argc, char* argv[]) {
+    // A texture that is not a multiple of the tile size, so that we also go through the padded border tiles.
+    Image3 img(100, 70);
+    pcg32_state rng = init_pcg32();
+    for (int i = 0; i < img.width * img.height; i++) {
+        img(i) = Vector3{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) };
+    }
+    fs::path filename = fs::temp_directory_path() / "lajolla_test_texture_cache.exr";
+    imwrite(filename, img);
+
+    Image3 loaded     = imread3(filename);
+    Mipmap3 reference = make_mipmap(loaded, choose_texel_format(filename, loaded));
+    // Room for only a handful of tiles, so that we keep on evicting.
+    size_t tile_bytes = c_texture_tile_size * c_texture_tile_size * 3 * texel_channel_bytes(reference.format);
+    auto cache        = std::make_shared<TextureCache>(4 * tile_bytes);
+    Mipmap3 cached    = make_cached_mipmap<Vector3>(cache, filename);
+
+    bool success = get_num_levels(cached) == get_num_levels(reference) &&
+                   get_width(cached) == get_width(reference) && get_height(cached) == get_height(reference);
+
+    parallel_init(4);
+    std::atomic<int> num_mismatches{ 0 };
+    parallel_for(
+        [&](int64_t i) {
+            pcg32_state rng = init_pcg32(i);
+            for (int j = 0; j < 256; j++) {
+                Real u     = next_pcg32_real<Real>(rng), v = next_pcg32_real<Real>(rng);
+                Real level = next_pcg32_real<Real>(rng) * get_num_levels(reference);
+                Vector3 a  = lookup(reference, u, v, level);
+                Vector3 b  = lookup(cached, u, v, level);
+                if (a.x != b.x || a.y != b.y || a.z != b.z) { num_mismatches++; }
+            }
+        },
+        64);
+    parallel_cleanup();
+    fs::remove(filename);
+
+    // The tiles the threads hold count against the budget too; all the tiles are the same size here,
+    // so there is always room for one more.
+    if (!success || num_mismatches > 0 || *cache->live_bytes > cache->budget ||
+        cache->peak_live_bytes > cache->budget || cache->num_tile_evictions == 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "../tile_order.h"
+#include <cstdio>
+#include <set>
+
+bool is_tile(const Vector2i& tile, int x, int y) { return tile.x == x && tile.y == y; }
+
+int main(int argc, char* argv[]) {
+    bool success = true;
+
+    // Every order visits every tile exactly once, also on grids that are not powers of two.
+    const TileOrder orders[] = { TileOrder::Scanline, TileOrder::Morton, TileOrder::Hilbert, TileOrder::Spiral };
+    const Vector2i grids[]   = { Vector2i{ 1, 1 }, Vector2i{ 8, 8 }, Vector2i{ 13, 5 }, Vector2i{ 3, 17 } };
+    for (TileOrder order : orders) {
+        for (const Vector2i& grid : grids) {
+            std::vector<Vector2i> tiles = order_tiles(grid, order);
+            std::set<std::pair<int, int>> visited;
+            for (const Vector2i& tile : tiles) {
+                if (tile.x < 0 || tile.x >= grid.x || tile.y < 0 || tile.y >= grid.y) { success = false; }
+                visited.insert({ tile.x, tile.y });
+            }
+            if ((int)tiles.size() != grid.x * grid.y || (int)visited.size() != grid.x * grid.y) { success = false; }
+        }
+    }
+
+    // On a power-of-two grid, consecutive tiles of the Hilbert curve are neighbors.
+    std::vector<Vector2i> hilbert = order_tiles(Vector2i{ 16, 16 }, TileOrder::Hilbert);
+    for (int i = 1; i < (int)hilbert.size(); i++) {
+        if (abs(hilbert[i].x - hilbert[i - 1].x) + abs(hilbert[i].y - hilbert[i - 1].y) != 1) { success = false; }
+    }
+    // The Morton curve goes through the quadrants one after another.
+    std::vector<Vector2i> morton = order_tiles(Vector2i{ 4, 4 }, TileOrder::Morton);
+    if (!is_tile(morton[1], 1, 0) || !is_tile(morton[2], 0, 1) || !is_tile(morton[4], 2, 0)) { success = false; }
+    // The spiral starts at the center, and goes outwards ring by ring.
+    std::vector<Vector2i> spiral = order_tiles(Vector2i{ 9, 7 }, TileOrder::Spiral);
+    if (!is_tile(spiral[0], 4, 3)) { success = false; }
+    int ring = 0;
+    for (const Vector2i& tile : spiral) {
+        int tile_ring = max(abs(tile.x - 4), abs(tile.y - 3));
+        if (tile_ring < ring) { success = false; }
+        ring = tile_ring;
+    }
+
+    if (parse_tile_order("hilbert") != TileOrder::Hilbert || parse_tile_order("spiral") != TileOrder::Spiral) {
+        success = false;
+    }
+    try {
+        parse_tile_order("zigzag");
+        success = false;
+    } catch (const std::exception&) {}
+
+    if (!success) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "image.h"
+#include "lajolla.h"
+#include <cstring>
+
+/// How the texels of a mipmap are stored. Lookups always decode to Real.
+enum class TexelFormat {
+    Real,  // 8 bytes per channel (4 in single-precision builds), no conversion
+    Float, // 4 bytes per channel
+    Half,  // 2 bytes per channel, IEEE 754 binary16
+    SRGB8  // 1 byte per channel, gamma encoded, decoded with a table lookup
+};
+
+/// Bytes per channel of a texel stored in format.
+inline int texel_channel_bytes(TexelFormat format) {
+    switch (format) {
+    case TexelFormat::Real:
+        return sizeof(Real);
+    case TexelFormat::Float:
+        return sizeof(float);
+    case TexelFormat::Half:
+        return sizeof(uint16_t);
+    case TexelFormat::SRGB8:
+        return sizeof(uint8_t);
+    }
+    return 0;
+}
+
+/// https://gist.github.com/rygorous/2156668 (float_to_half_fast3_rtne), rounding to the nearest even.
+inline uint16_t float_to_half(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(float));
+    uint32_t sign = u & 0x80000000u;
+    u ^= sign;
+    uint16_t h;
+    if (u >= 0x47800000u) {
+        // Too large for a half (or NaN/inf): NaN stays NaN, everything else becomes inf
+        h = u > 0x7f800000u ? 0x7e00 : 0x7c00;
+    } else if (u < 0x38800000u) {
+        // Denormal half: let the FPU do the shift and the rounding
+        float denorm_magic = 0.5f;
+        float g;
+        memcpy(&g, &u, sizeof(float));
+        g += denorm_magic;
+        uint32_t v;
+        memcpy(&v, &g, sizeof(float));
+        h = uint16_t(v - 0x3f000000u);
+    } else {
+        uint32_t mant_odd = (u >> 13) & 1;
+        u += (uint32_t(15 - 127) << 23) + 0xfff;
+        u += mant_odd;
+        h = uint16_t(u >> 13);
+    }
+    return h | uint16_t(sign >> 16);
+}
+
+inline float half_to_float(uint16_t h) {
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp  = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t u;
+    if (exp == 0x1f) {
+        // inf/NaN
+        u = sign | 0x7f800000u | (mant << 13);
+    } else if (exp != 0) {
+        u = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    } else {
+        // zero or denormal: mant * 2^-24
+        float f = float(mant) * (1.0f / 16777216.0f);
+        memcpy(&u, &f, sizeof(float));
+        u |= sign;
+    }
+    float f;
+    memcpy(&f, &u, sizeof(float));
+    return f;
+}
+
+/// The decoded values of the 256 8-bit codes. stb_image converts 8-bit images to linear
+/// with a gamma of 2.2, so we use the same curve: a texel decodes to exactly what imread would return.
+struct SRGB8Table {
+    SRGB8Table() {
+        for (int i = 0; i < 256; i++) { values[i] = pow(float(i) / 255.0f, 2.2f); }
+    }
+    float values[256];
+};
+
+inline const SRGB8Table& get_srgb8_table() {
+    static const SRGB8Table table;
+    return table;
+}
+
+/// The nearest 8-bit code of a linear value.
+inline uint8_t encode_srgb8(Real v) {
+    const float* values = get_srgb8_table().values;
+    int i               = int(std::lower_bound(values, values + 256, float(v)) - values);
+    if (i == 0) { return 0; }
+    if (i == 256) { return 255; }
+    return fabs(values[i] - v) < fabs(values[i - 1] - v) ? uint8_t(i) : uint8_t(i - 1);
+}
+
+/// Encode the channel v to dst.
+inline void encode_channel(TexelFormat format, Real v, uint8_t* dst) {
+    switch (format) {
+    case TexelFormat::Real: {
+        memcpy(dst, &v, sizeof(Real));
+    } break;
+    case TexelFormat::Float: {
+        float f = float(v);
+        memcpy(dst, &f, sizeof(float));
+    } break;
+    case TexelFormat::Half: {
+        uint16_t h = float_to_half(float(v));
+        memcpy(dst, &h, sizeof(uint16_t));
+    } break;
+    case TexelFormat::SRGB8: {
+        *dst = encode_srgb8(v);
+    } break;
+    }
+}
+
+inline Real decode_channel(TexelFormat format, const uint8_t* src) {
+    switch (format) {
+    case TexelFormat::Real: {
+        Real v;
+        memcpy(&v, src, sizeof(Real));
+        return v;
+    }
+    case TexelFormat::Float: {
+        float f;
+        memcpy(&f, src, sizeof(float));
+        return Real(f);
+    }
+    case TexelFormat::Half: {
+        uint16_t h;
+        memcpy(&h, src, sizeof(uint16_t));
+        return Real(half_to_float(h));
+    }
+    case TexelFormat::SRGB8: {
+        return Real(get_srgb8_table().values[*src]);
+    }
+    }
+    return Real(0);
+}
+
+template <typename T>
+inline T decode_texel(TexelFormat format, const uint8_t* src);
+template <>
+inline Real decode_texel(TexelFormat format, const uint8_t* src) {
+    return decode_channel(format, src);
+}
+template <>
+inline Vector3 decode_texel(TexelFormat format, const uint8_t* src) {
+    int stride = texel_channel_bytes(format);
+    return Vector3{ decode_channel(format, src), decode_channel(format, src + stride),
+                    decode_channel(format, src + 2 * stride) };
+}
+
+/// The compact format for a texture loaded from filename:
+/// 8 bits for the low dynamic range formats, which are 8-bit to begin with,
+/// half for high dynamic range images that fit in its range, and float for the rest.
+template <typename T>
+inline TexelFormat choose_texel_format(const fs::path& filename, const Image<T>& img) {
+    std::string extension = to_lowercase(filename.extension().string());
+    if (extension == ".jpg" || extension == ".png" || extension == ".tga" || extension == ".bmp" ||
+        extension == ".psd" || extension == ".gif") {
+        return TexelFormat::SRGB8;
+    }
+    Real max_value = 0;
+    for (const T& texel : img.data) {
+        const Real* p = (const Real*)&texel;
+        for (int c = 0; c < int(sizeof(T) / sizeof(Real)); c++) { max_value = max(max_value, fabs(p[c])); }
+    }
+    // The largest finite half is 65504
+    return max_value < Real(65504) ? TexelFormat::Half : TexelFormat::Float;
+}
@@ -7,15 +7,24 @@
 #include <map>
 #include <variant>
 
-/// Can be replaced by a more advanced texture caching system,
-/// where we only load images from files when necessary.
-/// See OpenImageIO for example https://github.com/OpenImageIO/oiio
+/// By default, images are loaded when the scene is parsed and kept in memory.
+/// With a texture cache, images read from files are instead loaded when first used
+/// and paged in tile by tile within the memory budget of the cache (see texture_cache.h).
 struct TexturePool {
+    TexturePool() {}
+    /// A pool whose file textures go through a texture cache with the given budget in bytes
+    /// (0 keeps everything in memory).
+    TexturePool(size_t cache_budget) {
+        if (cache_budget > 0) { cache = std::make_shared<TextureCache>(cache_budget); }
+    }
+
     std::map<std::string, int> image1s_map;
     std::map<std::string, int> image3s_map;
 
     std::vector<Mipmap1> image1s;
     std::vector<Mipmap3> image3s;
+
+    std::shared_ptr<TextureCache> cache;
 };
 
 inline bool texture_id_exists(const TexturePool& pool, const std::string& texture_name) {
@@ -30,7 +39,12 @@ inline int insert_image1(TexturePool& pool, const std::string& texture_name, con
     }
     int id                         = (int)pool.image1s.size();
     pool.image1s_map[texture_name] = id;
-    pool.image1s.push_back(make_mipmap(imread1(filename)));
+    if (pool.cache) {
+        pool.image1s.push_back(make_cached_mipmap<Real>(pool.cache, filename));
+    } else {
+        Image1 img = imread1(filename);
+        pool.image1s.push_back(make_mipmap(img, choose_texel_format(filename, img)));
+    }
     return id;
 }
 
@@ -52,7 +66,12 @@ inline int insert_image3(TexturePool& pool, const std::string& texture_name, con
     }
     int id                         = (int)pool.image3s.size();
     pool.image3s_map[texture_name] = id;
-    pool.image3s.push_back(make_mipmap(imread3(filename)));
+    if (pool.cache) {
+        pool.image3s.push_back(make_cached_mipmap<Vector3>(pool.cache, filename));
+    } else {
+        Image3 img = imread3(filename);
+        pool.image3s.push_back(make_mipmap(img, choose_texel_format(filename, img)));
+    }
     return id;
 }
 
@@ -96,16 +115,11 @@ struct CheckerboardTexture {
     Real uoffset, voffset;
 };
 
-template <typename T>
-inline const Mipmap<T>& get_img(const ImageTexture<T>& t, const TexturePool& pool) {
-    return Mipmap<T>{};
-}
-template <>
-inline const Mipmap<Real>& get_img(const ImageTexture<Real>& t, const TexturePool& pool) {
+inline const Mipmap1& get_img(const ImageTexture<Real>& t, const TexturePool& pool) {
     return get_img1(pool, t.texture_id);
 }
-template <>
-inline const Mipmap<Vector3>& get_img(const ImageTexture<Vector3>& t, const TexturePool& pool) {
+/// Spectrum textures are stored as RGB images (Vector3 texels, without the padding lane).
+inline const Mipmap3& get_img(const ImageTexture<Spectrum>& t, const TexturePool& pool) {
     return get_img3(pool, t.texture_id);
 }
 
@@ -130,7 +144,7 @@ T eval_texture_op<T>::operator()(const ConstantTexture<T>& t) const {
 }
 template <typename T>
 T eval_texture_op<T>::operator()(const ImageTexture<T>& t) const {
-    const Mipmap<T>& img = get_img(t, pool);
+    const auto& img = get_img(t, pool);
     Vector2 local_uv{ modulo(uv[0] * t.uscale + t.uoffset, Real(1)), modulo(uv[1] * t.vscale + t.voffset, Real(1)) };
     Real scaled_footprint = max(get_width(img), get_height(img)) * max(t.uscale, t.vscale) * footprint;
     Real level            = log2(max(scaled_footprint, Real(1e-8f)));
@@ -0,0 +1,260 @@
+#include "texture_cache.h"
+#include "flexception.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+
+static std::atomic<uint64_t> next_cache_uid{ 1 };
+
+/// The per-thread tile cache: direct-mapped on the tile key.
+constexpr int c_thread_tile_slots = 64;
+
+TextureCache::TextureCache(size_t budget) : budget(budget), uid(next_cache_uid++) {
+    tile_file = std::tmpfile();
+    if (tile_file == nullptr) { Error("Failed to create the texture tile file."); }
+    // The threads hold at most a quarter of the budget together, counting with the largest tiles.
+    size_t max_tile_bytes = size_t(c_texture_tile_size) * c_texture_tile_size * 3 * sizeof(Real);
+    size_t num_threads    = size_t(std::max({ num_parallel_threads(), (int)std::thread::hardware_concurrency(), 1 }));
+    thread_slots          = 1;
+    while (thread_slots < c_thread_tile_slots &&
+           4 * num_threads * size_t(2 * thread_slots) * max_tile_bytes <= budget) {
+        thread_slots *= 2;
+    }
+}
+
+TextureCache::~TextureCache() { fclose(tile_file); }
+
+int add_texture(TextureCache& cache, const fs::path& filename, int num_channels) {
+    assert(num_channels == 1 || num_channels == 3);
+    auto texture = std::make_unique<CachedTexture>();
+    texture->id  = (int)cache.textures.size();
+    // The parser changes the working directory, and we read the file much later.
+    texture->filename     = fs::absolute(filename);
+    texture->num_channels = num_channels;
+    cache.textures.push_back(std::move(texture));
+    return (int)cache.textures.size() - 1;
+}
+
+/// Evict the least recently used tiles that no thread holds, until the tiles in memory
+/// and extra_bytes fit in the budget (if they can). Call with cache.mutex held.
+static void evict_tiles(TextureCache& cache, size_t extra_bytes) {
+    auto it = cache.lru.end();
+    while (it != cache.lru.begin() && *cache.live_bytes + extra_bytes > cache.budget) {
+        --it;
+        // Nobody else can get a new reference to the tile without the lock, so a tile
+        // that only the cache holds stays that way while we evict it.
+        if (it->tile.use_count() > 1) { continue; }
+        cache.resident.erase(it->key);
+        it = cache.lru.erase(it);
+        cache.num_tile_evictions++;
+    }
+}
+
+/// Builds the mipmap of a texture strip by strip, with the same filter as make_mipmap (so the texels are the same).
+/// The rows of level 0 go in at the top. Every level keeps one strip of c_texture_tile_size rows at full precision;
+/// a full strip is encoded, cut into a row of tiles, and written to the tile file, while its rows are filtered
+/// down to the next level as they come. So no level is ever in memory as a whole.
+template <typename T>
+struct MipmapStripWriter {
+    struct Level {
+        int width, height;
+        int tiles_x;
+        int first_tile;
+        /// The rows of the current strip, and the row of the level that comes next
+        std::vector<T> strip;
+        int next_row = 0;
+        /// The last even row, waiting for the odd one below it to be filtered down
+        std::vector<T> pending_row;
+        /// The row of the next level filtered from this one
+        std::vector<T> filtered_row;
+    };
+
+    MipmapStripWriter(TextureCache& cache, CachedTexture& texture, int width, int height)
+        : cache(cache), texture(texture) {
+        int size       = max(width, height);
+        int num_levels = std::min((int)ceil(log2(Real(size)) + 1), c_max_mipmap_levels);
+        int num_tiles  = 0;
+        for (int i = 0; i < num_levels; i++) {
+            Level level;
+            level.width      = i == 0 ? width : max(levels.back().width / 2, 1);
+            level.height     = i == 0 ? height : max(levels.back().height / 2, 1);
+            level.tiles_x    = (level.width + c_texture_tile_size - 1) / c_texture_tile_size;
+            level.first_tile = num_tiles;
+            level.strip.resize(size_t(level.width) * c_texture_tile_size);
+            num_tiles += level.tiles_x * ((level.height + c_texture_tile_size - 1) / c_texture_tile_size);
+            texture.level_sizes.push_back(Vector2i{ level.width, level.height });
+            texture.level_tiles_x.push_back(level.tiles_x);
+            texture.level_first_tile.push_back(level.first_tile);
+            levels.push_back(std::move(level));
+        }
+        texel_bytes         = c_num_channels<T> * texel_channel_bytes(texture.format);
+        // Tiling happens under cache.tiling_mutex, so the file is ours to append to.
+        texture.file_offset = cache.file_size;
+        cache.file_size += int64_t(num_tiles) * int64_t(texture.tile_bytes);
+    }
+
+    void add_row(int l, const T* row) {
+        Level& level = levels[l];
+        int y        = level.next_row++;
+        int strip_y  = y % c_texture_tile_size;
+        std::copy(row, row + level.width, level.strip.begin() + size_t(strip_y) * level.width);
+        if (l + 1 < (int)levels.size()) {
+            if (y % 2 == 0) {
+                level.pending_row.assign(row, row + level.width);
+                // A level one texel high is filtered with itself (clamped, as in make_mipmap)
+                if (level.height == 1) { filter_rows(l, level.pending_row.data(), row); }
+            } else {
+                filter_rows(l, level.pending_row.data(), row);
+            }
+        }
+        if (strip_y == c_texture_tile_size - 1 || y == level.height - 1) { write_strip(l, y / c_texture_tile_size); }
+    }
+
+    /// 2x2 box filter of two rows of level l into a row of level l + 1.
+    void filter_rows(int l, const T* row0, const T* row1) {
+        Level& level = levels[l];
+        level.filtered_row.resize(levels[l + 1].width);
+        for (int x = 0; x < (int)level.filtered_row.size(); x++) {
+            int x0                = 2 * x;
+            int x1                = min(x0 + 1, level.width - 1);
+            level.filtered_row[x] = (row0[x0] + row0[x1] + row1[x0] + row1[x1]) / Real(4);
+        }
+        add_row(l + 1, level.filtered_row.data());
+    }
+
+    /// Encode the strip ty of level l, cut it into tiles (padded with zeros), and write them.
+    void write_strip(int l, int ty) {
+        const Level& level = levels[l];
+        int rows           = min(c_texture_tile_size, level.height - ty * c_texture_tile_size);
+        tiles.assign(size_t(level.tiles_x) * texture.tile_bytes, 0);
+        int channel_bytes = texel_channel_bytes(texture.format);
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < level.width; x++) {
+                int tile      = x / c_texture_tile_size;
+                int texel     = y * c_texture_tile_size + x % c_texture_tile_size;
+                uint8_t* dst  = &tiles[size_t(tile) * texture.tile_bytes + size_t(texel) * texel_bytes];
+                const Real* p = (const Real*)&level.strip[size_t(y) * level.width + x];
+                for (int c = 0; c < c_num_channels<T>; c++) {
+                    encode_channel(texture.format, p[c], dst + c * channel_bytes);
+                }
+            }
+        }
+        int64_t first_tile = level.first_tile + ty * level.tiles_x;
+        int64_t offset     = texture.file_offset + first_tile * int64_t(texture.tile_bytes);
+        if (pwrite(fileno(cache.tile_file), tiles.data(), tiles.size(), offset) != (ssize_t)tiles.size()) {
+            Error(std::string("Failed to write the texture tiles of ") + texture.filename.string());
+        }
+    }
+
+    TextureCache& cache;
+    CachedTexture& texture;
+    std::vector<Level> levels;
+    int texel_bytes;
+    std::vector<uint8_t> tiles;
+};
+
+template <typename T>
+static void tile_image(TextureCache& cache, CachedTexture& texture, const Image<T>& img) {
+    texture.format     = choose_texel_format(texture.filename, img);
+    texture.tile_bytes = size_t(c_texture_tile_size) * c_texture_tile_size * c_num_channels<T> *
+                         texel_channel_bytes(texture.format);
+    MipmapStripWriter<T> writer(cache, texture, img.width, img.height);
+    for (int y = 0; y < img.height; y++) { writer.add_row(0, &img.data[size_t(y) * img.width]); }
+}
+
+/// Decode the texture, build its mipmap and spill the tiles to the tile file.
+/// The decoded image is dropped afterwards.
+static void tile_texture(TextureCache& cache, CachedTexture& texture) {
+    if (texture.num_channels == 1) {
+        Image1 img = imread1(texture.filename);
+        {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            evict_tiles(cache, img.data.size() * sizeof(Real));
+        }
+        tile_image(cache, texture, img);
+    } else {
+        Image3 img = imread3(texture.filename);
+        {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            evict_tiles(cache, img.data.size() * sizeof(Vector3));
+        }
+        tile_image(cache, texture, img);
+    }
+}
+
+const CachedTexture& get_tiled_texture(TextureCache& cache, int texture_id) {
+    assert(texture_id >= 0 && texture_id < (int)cache.textures.size());
+    CachedTexture& texture = *cache.textures[texture_id];
+    if (!texture.tiled.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(cache.tiling_mutex);
+        if (!texture.tiled.load(std::memory_order_relaxed)) {
+            tile_texture(cache, texture);
+            texture.tiled.store(true, std::memory_order_release);
+        }
+    }
+    return texture;
+}
+
+/// Get the tile from the shared cache, reading it from the tile file if it is not resident.
+static std::shared_ptr<const TextureTile> load_tile(TextureCache& cache, const CachedTexture& texture,
+                                                    uint64_t key, int tile_index) {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (auto it = cache.resident.find(key); it != cache.resident.end()) {
+        // Move to the front of the LRU list
+        cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+        return it->second->tile;
+    }
+
+    // Make room first, so that the tiles in memory stay within the budget.
+    size_t tile_bytes = texture.tile_bytes;
+    evict_tiles(cache, tile_bytes);
+
+    // The tile file is only read from here, and pread does not move the file position,
+    // so concurrent tilings (which only write) do not get in the way.
+    // The tile gives its bytes back when the last reference to it (in the cache or in a thread) goes away.
+    std::shared_ptr<std::atomic<size_t>> live_bytes = cache.live_bytes;
+    std::shared_ptr<TextureTile> tile(new TextureTile, [live_bytes](TextureTile* tile) {
+        *live_bytes -= tile->texels.size();
+        delete tile;
+    });
+    int64_t tile_offset = texture.file_offset + int64_t(tile_index) * int64_t(tile_bytes);
+    tile->texels.resize(tile_bytes);
+    if (pread(fileno(cache.tile_file), tile->texels.data(), tile_bytes, tile_offset) != (ssize_t)tile_bytes) {
+        Error(std::string("Failed to read the texture tiles of ") + texture.filename.string());
+    }
+    *cache.live_bytes += tile_bytes;
+    cache.peak_live_bytes = std::max(cache.peak_live_bytes, size_t(*cache.live_bytes));
+    cache.num_tile_loads++;
+
+    cache.lru.push_front(TextureCache::Entry{ key, tile });
+    cache.resident[key] = cache.lru.begin();
+    return tile;
+}
+
+struct ThreadTileSlot {
+    uint64_t cache_uid = 0;
+    uint64_t key       = 0;
+    std::shared_ptr<const TextureTile> tile;
+};
+static thread_local ThreadTileSlot thread_tiles[c_thread_tile_slots];
+
+const uint8_t* fetch_texel(TextureCache& cache, const CachedTexture& texture, int level, int x, int y) {
+    assert(level >= 0 && level < (int)texture.level_sizes.size());
+    int tx         = x / c_texture_tile_size, ty = y / c_texture_tile_size;
+    int tile_index = texture.level_first_tile[level] + ty * texture.level_tiles_x[level] + tx;
+    uint64_t key   = (uint64_t(texture.id) << 32) | uint64_t(tile_index);
+
+    ThreadTileSlot& slot = thread_tiles[(key ^ (key >> 29)) & uint64_t(cache.thread_slots - 1)];
+    if (slot.cache_uid != cache.uid || slot.key != key || slot.tile == nullptr) {
+        // Let go of the old tile first, so that it can be evicted to make room for the new one.
+        slot.tile      = nullptr;
+        slot.tile      = load_tile(cache, texture, key, tile_index);
+        slot.cache_uid = cache.uid;
+        slot.key       = key;
+    }
+    int offset      = (y % c_texture_tile_size) * c_texture_tile_size + (x % c_texture_tile_size);
+    int texel_bytes = texture.num_channels * texel_channel_bytes(texture.format);
+    return slot.tile->texels.data() + size_t(offset) * texel_bytes;
+}
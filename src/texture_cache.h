@@ -0,0 +1,107 @@
+#pragma once
+
+#include "image.h"
+#include "lajolla.h"
+#include "texel_format.h"
+#include <atomic>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/// Out-of-core storage for image textures, in the spirit of OpenImageIO's ImageCache and pbrt's texture cache.
+/// Textures registered here are not read at parse time. The first time a texture is touched, we decode the file
+/// and build its mipmap strip by strip: every level keeps only c_texture_tile_size rows at a time, which are cut
+/// into tiles of c_texture_tile_size^2 texels and spilled to a temporary file. The image formats we read
+/// (JPG/PNG/EXR, ...) can only be decoded whole, so the decoded image is the only thing we hold in memory whole;
+/// textures are decoded one at a time, and the resident tiles are evicted to make room for the decoded image.
+/// From then on tiles are paged in on demand and evicted in least-recently-used order.
+///
+/// The budget counts every tile in memory: the ones in the shared cache, and the ones that threads still hold.
+/// On top of the shared cache, each thread keeps a small direct-mapped cache of the tiles it used last,
+/// so that most texel fetches do not take the lock. Those tiles cannot be evicted while the thread holds them,
+/// so a thread keeps at most a quarter of the budget divided by the number of threads (and at least one tile),
+/// and the eviction leaves them alone.
+
+constexpr int c_texture_tile_size = 32;
+
+/// Texels of one tile, encoded in the format of the texture and padded to the full tile size.
+struct TextureTile {
+    std::vector<uint8_t> texels;
+};
+
+/// A texture registered in the cache. Everything except id, filename and num_channels
+/// is filled in when the texture is first touched.
+struct CachedTexture {
+    int id;
+    fs::path filename;
+    int num_channels;
+
+    /// Set (with release semantics) once the fields below are filled in.
+    std::atomic<bool> tiled{ false };
+    /// Chosen from the file type and the contents, see choose_texel_format
+    TexelFormat format;
+    /// Bytes of one tile
+    size_t tile_bytes;
+    /// Resolution of each mipmap level
+    std::vector<Vector2i> level_sizes;
+    /// Number of tiles along x of each level, and the index of the first tile of each level
+    std::vector<int> level_tiles_x;
+    std::vector<int> level_first_tile;
+    /// Where the tiles of this texture start in the tile file
+    int64_t file_offset;
+};
+
+struct TextureCache {
+    TextureCache(size_t budget);
+    ~TextureCache();
+    TextureCache(const TextureCache&)            = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    /// Maximum number of bytes taken by the tiles in memory.
+    size_t budget;
+    /// Distinguishes this cache from the previous ones in the per-thread tile caches.
+    uint64_t uid;
+    /// Number of slots (a power of two) of the per-thread tile caches.
+    int thread_slots;
+
+    std::vector<std::unique_ptr<CachedTexture>> textures;
+
+    /// The temporary file we spill the tiles to. It is deleted when closed.
+    FILE* tile_file;
+    /// Held while a texture is decoded and tiled, so that only one decoded image is in memory.
+    std::mutex tiling_mutex;
+    int64_t file_size = 0;
+
+    /// Resident tiles, the most recently used at the front of the list.
+    struct Entry {
+        uint64_t key;
+        std::shared_ptr<const TextureTile> tile;
+    };
+    std::mutex mutex;
+    std::list<Entry> lru;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> resident;
+    /// Bytes of all the tiles in memory, in the cache or held by the threads. A tile gives its bytes back
+    /// when its last reference goes away, which may be after the cache is gone.
+    std::shared_ptr<std::atomic<size_t>> live_bytes = std::make_shared<std::atomic<size_t>>(0);
+    /// The most live_bytes reached, for diagnostics.
+    size_t peak_live_bytes = 0;
+
+    /// Number of tiles read from the tile file and evicted, for diagnostics.
+    std::atomic<uint64_t> num_tile_loads{ 0 };
+    std::atomic<uint64_t> num_tile_evictions{ 0 };
+};
+
+/// Register a texture file with num_channels (1 or 3) channels and return its id in the cache.
+/// Nothing is read until the texture is first touched.
+int add_texture(TextureCache& cache, const fs::path& filename, int num_channels);
+
+/// The texture with the given id, made sure to be decoded and tiled.
+const CachedTexture& get_tiled_texture(TextureCache& cache, int texture_id);
+
+/// Pointer to the encoded channels of texel (x, y) of the given mipmap level of texture
+/// (from get_tiled_texture, which the caller looks up once for all its texels).
+/// The pointer stays valid until the next call of fetch_texel from the same thread.
+const uint8_t* fetch_texel(TextureCache& cache, const CachedTexture& texture, int level, int x, int y);
@@ -0,0 +1,75 @@
+#include "tile_order.h"
+#include "flexception.h"
+#include "low_discrepancy.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+/// The index of (x, y) along the Hilbert curve over an n x n grid (n a power of two).
+/// From https://en.wikipedia.org/wiki/Hilbert_curve
+static uint64_t hilbert_index(uint32_t n, uint32_t x, uint32_t y) {
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+        d += uint64_t(s) * uint64_t(s) * ((3 * rx) ^ ry);
+        // Rotate the quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+std::vector<Vector2i> order_tiles(const Vector2i& num_tiles, TileOrder order) {
+    std::vector<Vector2i> tiles;
+    tiles.reserve(size_t(max(num_tiles.x, 0)) * size_t(max(num_tiles.y, 0)));
+    for (int y = 0; y < num_tiles.y; y++) {
+        for (int x = 0; x < num_tiles.x; x++) { tiles.push_back(Vector2i{ x, y }); }
+    }
+    if (order == TileOrder::Scanline) { return tiles; }
+
+    // Sort by a key per tile (stable, so that the ties stay in scanline order)
+    std::vector<std::pair<uint64_t, Vector2i>> keyed;
+    keyed.reserve(tiles.size());
+    uint32_t n = 1;
+    while (n < uint32_t(max(num_tiles.x, num_tiles.y))) { n *= 2; }
+    for (const Vector2i& tile : tiles) {
+        uint64_t key = 0;
+        if (order == TileOrder::Morton) {
+            key = encode_morton_2(uint32_t(tile.x), uint32_t(tile.y));
+        } else if (order == TileOrder::Hilbert) {
+            key = hilbert_index(n, uint32_t(tile.x), uint32_t(tile.y));
+        } else {
+            // The ring (the distance to the center tile along x or y), then the angle around the center.
+            // Twice the coordinates, to keep the center of an even number of tiles on the integers.
+            int dx     = 2 * tile.x - (num_tiles.x - 1);
+            int dy     = 2 * tile.y - (num_tiles.y - 1);
+            int ring   = max(std::abs(dx), std::abs(dy)) / 2;
+            Real angle = atan2(Real(dy), Real(dx)) + c_PI; // in [0, 2pi]
+            key        = (uint64_t(ring) << 32) | uint64_t(angle / c_TWOPI * Real(1 << 30));
+        }
+        keyed.push_back({ key, tile });
+    }
+    std::stable_sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (int i = 0; i < (int)keyed.size(); i++) { tiles[i] = keyed[i].second; }
+    return tiles;
+}
+
+TileOrder parse_tile_order(const std::string& name) {
+    if (name == "scanline") {
+        return TileOrder::Scanline;
+    } else if (name == "morton") {
+        return TileOrder::Morton;
+    } else if (name == "hilbert") {
+        return TileOrder::Hilbert;
+    } else if (name == "spiral") {
+        return TileOrder::Spiral;
+    } else {
+        Error(std::string("Unsupported tile order: ") + name);
+        return TileOrder::Hilbert;
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "lajolla.h"
+#include "vector.h"
+
+#include <string>
+#include <vector>
+
+/// The order in which the renderer hands the image tiles to parallel_for.
+/// parallel_for splits its index range in halves recursively, and every thread works on
+/// (or steals) a contiguous range of indices. With a space-filling curve, a contiguous range of tiles is
+/// a compact region of the image, so a thread keeps on tracing rays into the same part of the scene
+/// (the same BVH nodes and textures stay in its caches), and the threads do not share the cache lines
+/// of the film along the tile borders as often. In scanline order, a range is a strip of whole rows instead.
+/// The order does not change the image: every pixel is rendered by one tile, with the same samples.
+enum class TileOrder {
+    Scanline, // row by row
+    Morton,   // Z-order curve
+    Hilbert,  // Hilbert curve, whose consecutive tiles are always neighbors
+    Spiral    // from the center of the image outwards, ring by ring (the center shows up first)
+};
+
+/// The tiles (x, y) of a num_tiles.x * num_tiles.y grid in the given order.
+/// The curves are those of the smallest power-of-two square grid around the tiles, skipping the tiles
+/// outside of the image.
+std::vector<Vector2i> order_tiles(const Vector2i& num_tiles, TileOrder order);
+
+/// "scanline", "morton", "hilbert", or "spiral".
+TileOrder parse_tile_order(const std::string& name);
@@ -4,11 +4,12 @@
 // single absorption only homogeneous volume
 // only handle directly visible light sources
 Spectrum vol_path_tracing_1(const Scene& scene, int x, int y, /* pixel coordinates */
-                            pcg32_state& rng) {
+                            Sampler& sampler) {
     // Homework 2: Wuqiong Zhao's implementation
     auto w = scene.camera.width;
     auto h = scene.camera.height;
-    Vector2 screen_pos{ (x + next_pcg32_real<Real>(rng)) / w, (y + next_pcg32_real<Real>(rng)) / h };
+    Vector2 pixel_offset = next_2d(sampler);
+    Vector2 screen_pos{ (x + pixel_offset.x) / w, (y + pixel_offset.y) / h };
     Ray ray = sample_primary(scene.camera, screen_pos);
 
     RayDifferential ray_diff{ Real(0), Real(0) };
@@ -32,11 +33,12 @@ Spectrum vol_path_tracing_1(const Scene& scene, int x, int y, /* pixel coordinat
 // single monochromatic homogeneous volume with single scattering,
 // no need to handle surface lighting, only directly visible light source
 Spectrum vol_path_tracing_2(const Scene& scene, int x, int y, /* pixel coordinates */
-                            pcg32_state& rng) {
+                            Sampler& sampler) {
     // Homework 2: Wuqiong Zhao's implementation
     auto w = scene.camera.width;
     auto h = scene.camera.height;
-    Vector2 screen_pos{ (x + next_pcg32_real<Real>(rng)) / w, (y + next_pcg32_real<Real>(rng)) / h };
+    Vector2 pixel_offset = next_2d(sampler);
+    Vector2 screen_pos{ (x + pixel_offset.x) / w, (y + pixel_offset.y) / h };
     Ray ray = sample_primary(scene.camera, screen_pos);
 
     RayDifferential ray_diff{ Real(0), Real(0) };
@@ -54,11 +56,13 @@ Spectrum vol_path_tracing_2(const Scene& scene, int x, int y, /* pixel coordinat
 
         // Compute L_s1 using Monte Carlo simulation
         auto L_s1 = [&](const Vector3& p, const Vector3& dir_view) -> std::pair<Spectrum, Real> {
-            // Sample light
-            int light_id       = sample_light(scene, next_pcg32_real<Real>(rng));
+            // Sample light (there is no normal in a medium)
+            int light_id     = sample_light(scene, p, Vector3{ 0, 0, 0 }, next_1d(sampler));
+            Vector2 light_uv = next_2d(sampler);
+            Real light_w     = next_1d(sampler);
+            // (no light can contribute to p)
+            if (light_id < 0) { return { make_zero_spectrum(), Real(1) }; }
             const Light& light = scene.lights[light_id];
-            Vector2 light_uv{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) };
-            Real light_w = next_pcg32_real<Real>(rng);
 
             PointAndNormal point_on_light = sample_point_on_light(light, p, light_uv, light_w, scene);
 
@@ -73,12 +77,13 @@ Spectrum vol_path_tracing_2(const Scene& scene, int x, int y, /* pixel coordinat
 
             Spectrum transmittance_to_light = exp(-sigma_t * dist_to_light);
 
-            Real light_pdf = light_pmf(scene, light_id) * pdf_point_on_light(light, point_on_light, p, scene);
+            Real light_pdf =
+                light_pmf(scene, p, Vector3{ 0, 0, 0 }, light_id) * pdf_point_on_light(light, point_on_light, p, scene);
 
             return { phase_val * transmittance_to_light * Le * G, light_pdf };
         };
 
-        if (Real sampled_t = -log(1 - next_pcg32_real<Real>(rng)) / sigma_t[0]; sampled_t < t_hit) {
+        if (Real sampled_t = -log(1 - next_1d(sampler)) / sigma_t[0]; sampled_t < t_hit) {
             Spectrum transmittance         = exp(-sigma_t * sampled_t);
             Real trans_pdf                 = sigma_t[0] * exp(-sigma_t[0] * sampled_t);
             Vector3 p                      = ray.org + sampled_t * ray.dir;
@@ -103,11 +108,12 @@ Spectrum vol_path_tracing_2(const Scene& scene, int x, int y, /* pixel coordinat
 // multiple monochromatic homogeneous volumes with multiple scattering
 // no need to handle surface lighting, only directly visible light source
 Spectrum vol_path_tracing_3(const Scene& scene, int x, int y, /* pixel coordinates */
-                            pcg32_state& rng) {
+                            Sampler& sampler) {
     // Homework 2: Wuqiong Zhao's implementation
     auto w = scene.camera.width;
     auto h = scene.camera.height;
-    Vector2 screen_pos{ (x + next_pcg32_real<Real>(rng)) / w, (y + next_pcg32_real<Real>(rng)) / h };
+    Vector2 pixel_offset = next_2d(sampler);
+    Vector2 screen_pos{ (x + pixel_offset.x) / w, (y + pixel_offset.y) / h };
     Ray ray = sample_primary(scene.camera, screen_pos);
     RayDifferential ray_diff{ Real(0), Real(0) };
 
@@ -131,7 +137,7 @@ Spectrum vol_path_tracing_3(const Scene& scene, int x, int y, /* pixel coordinat
             Spectrum sigma_t = sigma_s + sigma_a;
 
             // Sample distance based on extinction coefficient
-            if (Real sampled_t = -log(1 - next_pcg32_real<Real>(rng)) / sigma_t[0]; sampled_t < t_hit) {
+            if (Real sampled_t = -log(1 - next_1d(sampler)) / sigma_t[0]; sampled_t < t_hit) {
                 scatter       = true;
                 transmittance = exp(-sigma_t * sampled_t);
                 trans_pdf     = sigma_t[0] * exp(-sigma_t[0] * sampled_t);
@@ -170,8 +176,7 @@ Spectrum vol_path_tracing_3(const Scene& scene, int x, int y, /* pixel coordinat
         if (scatter) {
             auto&& medium       = scene.media[current_medium_id];
             PhaseFunction phase = get_phase_function(medium);
-            auto next_dir       = sample_phase_function(phase, -ray.dir,
-                                                        Vector2{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) });
+            auto next_dir       = sample_phase_function(phase, -ray.dir, next_2d(sampler));
             if (!next_dir) break;
 
             Real phase_pdf     = pdf_sample_phase(phase, -ray.dir, *next_dir);
@@ -185,7 +190,7 @@ Spectrum vol_path_tracing_3(const Scene& scene, int x, int y, /* pixel coordinat
         // Russian roulette
         if (Real rr_prob = 1; bounces >= scene.options.rr_depth) {
             rr_prob = min(max(luminance(current_path_throughput), Real(0.0)), Real(0.95));
-            if (next_pcg32_real<Real>(rng) > rr_prob) break;
+            if (next_1d(sampler) > rr_prob) break;
             current_path_throughput /= rr_prob;
         }
 
@@ -200,7 +205,7 @@ Spectrum vol_path_tracing_3(const Scene& scene, int x, int y, /* pixel coordinat
 // with MIS between next event estimation and phase function sampling
 // still no surface lighting
 Spectrum vol_path_tracing_4(const Scene& scene, int x, int y, /* pixel coordinates */
-                            pcg32_state& rng) {
+                            Sampler& sampler) {
     // Homework 2: Wuqiong Zhao's implementation
     auto update_medium = [](const std::optional<PathVertex>& isect, const Ray& ray, int medium) -> int {
         if (!isect || isect->interior_medium_id == isect->exterior_medium_id) { return medium; }
@@ -210,11 +215,14 @@ Spectrum vol_path_tracing_4(const Scene& scene, int x, int y, /* pixel coordinat
 
     auto next_event_estimation = [&](const Vector3& p, const Vector3& dir_view, int current_medium,
                                      int bounces) -> Spectrum {
-        // Sample light
-        int light_id       = sample_light(scene, next_pcg32_real<Real>(rng));
+        // Sample light. We ignore the normal of the surfaces, so that the light pmf
+        // at the vertices is the same for the surfaces and the media (see nee_p_cache).
+        int light_id     = sample_light(scene, p, Vector3{ 0, 0, 0 }, next_1d(sampler));
+        Vector2 light_uv = next_2d(sampler);
+        Real light_w     = next_1d(sampler);
+        // (no light can contribute to p)
+        if (light_id < 0) { return make_zero_spectrum(); }
         const Light& light = scene.lights[light_id];
-        Vector2 light_uv{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) };
-        Real light_w = next_pcg32_real<Real>(rng);
 
         PointAndNormal point_on_light = sample_point_on_light(light, p, light_uv, light_w, scene);
         Vector3 dir_light             = normalize(point_on_light.position - p);
@@ -266,7 +274,8 @@ Spectrum vol_path_tracing_4(const Scene& scene, int x, int y, /* pixel coordinat
             Real G      = fabs(dot(dir_light, point_on_light.normal)) / (dist * dist);
             Spectrum Le = emission(light, -dir_light, Real(0), point_on_light, scene);
 
-            Real pdf_nee   = light_pmf(scene, light_id) * pdf_point_on_light(light, point_on_light, p, scene);
+            Real pdf_nee   =
+                light_pmf(scene, p, Vector3{ 0, 0, 0 }, light_id) * pdf_point_on_light(light, point_on_light, p, scene);
             Real pdf_phase = pdf_sample_phase(phase, dir_view, dir_light) * G;
 
             // Power heuristic
@@ -280,7 +289,8 @@ Spectrum vol_path_tracing_4(const Scene& scene, int x, int y, /* pixel coordinat
     // Main path tracing loop
     auto w = scene.camera.width;
     auto h = scene.camera.height;
-    Vector2 screen_pos{ (x + next_pcg32_real<Real>(rng)) / w, (y + next_pcg32_real<Real>(rng)) / h };
+    Vector2 pixel_offset = next_2d(sampler);
+    Vector2 screen_pos{ (x + pixel_offset.x) / w, (y + pixel_offset.y) / h };
     Ray ray = sample_primary(scene.camera, screen_pos);
     RayDifferential ray_diff{ Real(0), Real(0) };
 
@@ -310,7 +320,7 @@ Spectrum vol_path_tracing_4(const Scene& scene, int x, int y, /* pixel coordinat
             Spectrum sigma_t = sigma_s + sigma_a;
 
             // Sample distance t
-            Real sampled_t = -log(1 - next_pcg32_real<Real>(rng)) / sigma_t[0];
+            Real sampled_t = -log(1 - next_1d(sampler)) / sigma_t[0];
 
             if (sampled_t < t_hit) {
                 scatter       = true;
@@ -348,7 +358,9 @@ Spectrum vol_path_tracing_4(const Scene& scene, int x, int y, /* pixel coordinat
                     radiance += current_path_throughput * emission(*isect, -ray.dir, scene);
                 } else {
                     // Apply MIS with NEE
-                    Real pdf_nee = pdf_point_on_light(scene.lights[get_area_light_id(scene.shapes[isect->shape_id])],
+                    int light_id = get_area_light_id(scene.shapes[isect->shape_id]);
+                    Real pdf_nee = light_pmf(scene, nee_p_cache, Vector3{ 0, 0, 0 }, light_id) *
+                                   pdf_point_on_light(scene.lights[light_id],
                                                       PointAndNormal{ isect->position, isect->geometric_normal },
                                                       nee_p_cache, scene);
 
@@ -377,8 +389,7 @@ Spectrum vol_path_tracing_4(const Scene& scene, int x, int y, /* pixel coordinat
         if (scatter) {
             auto&& medium       = scene.media[current_medium];
             PhaseFunction phase = get_phase_function(medium);
-            auto next_dir       = sample_phase_function(phase, -ray.dir,
-                                                        Vector2{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) });
+            auto next_dir       = sample_phase_function(phase, -ray.dir, next_2d(sampler));
             if (!next_dir) break;
 
             never_scatter      = false;
@@ -393,7 +404,7 @@ Spectrum vol_path_tracing_4(const Scene& scene, int x, int y, /* pixel coordinat
         // Russian roulette
         if (Real rr_prob = 1; bounces >= scene.options.rr_depth) {
             rr_prob = min(max(luminance(current_path_throughput), Real(0.0)), Real(0.95));
-            if (next_pcg32_real<Real>(rng) > rr_prob) break;
+            if (next_1d(sampler) > rr_prob) break;
             current_path_throughput /= rr_prob;
         }
 
@@ -408,7 +419,7 @@ Spectrum vol_path_tracing_4(const Scene& scene, int x, int y, /* pixel coordinat
 // with MIS between next event estimation and phase function sampling
 // with surface lighting
 Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinates */
-                            pcg32_state& rng) {
+                            Sampler& sampler) {
     // Homework 2: Wuqiong Zhao's implementation
     //
     // The vol_cbox and vol_cbox_teapot scenes are somehow dark.
@@ -420,11 +431,14 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
 
     auto next_event_estimation = [&](const Vector3& p, const Vector3& dir_view, int current_medium, int bounces,
                                      const std::optional<PathVertex>& vertex) -> Spectrum {
-        // Sample light
-        int light_id       = sample_light(scene, next_pcg32_real<Real>(rng));
+        // Sample light. We ignore the normal of the surfaces, so that the light pmf
+        // at the vertices is the same for the surfaces and the media (see nee_p_cache).
+        int light_id     = sample_light(scene, p, Vector3{ 0, 0, 0 }, next_1d(sampler));
+        Vector2 light_uv = next_2d(sampler);
+        Real light_w     = next_1d(sampler);
+        // (no light can contribute to p)
+        if (light_id < 0) { return make_zero_spectrum(); }
         const Light& light = scene.lights[light_id];
-        Vector2 light_uv{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) };
-        Real light_w = next_pcg32_real<Real>(rng);
 
         PointAndNormal point_on_light = sample_point_on_light(light, p, light_uv, light_w, scene);
         Vector3 dir_light             = normalize(point_on_light.position - p);
@@ -474,9 +488,9 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
 
             if (vertex && vertex->material_id >= 0) {
                 // Surface interaction
-                auto&& mat = scene.materials[vertex->material_id];
-                phase_val  = eval(mat, dir_view, dir_light, *vertex, scene.texture_pool);
-                pdf_phase  = pdf_sample_bsdf(mat, dir_view, dir_light, *vertex, scene.texture_pool) * G;
+                Material mat = prepare_material(scene.materials[vertex->material_id], *vertex, scene.texture_pool);
+                phase_val    = eval(mat, dir_view, dir_light, *vertex, scene.texture_pool);
+                pdf_phase    = pdf_sample_bsdf(mat, dir_view, dir_light, *vertex, scene.texture_pool) * G;
             } else if (current_medium >= 0) {
                 // Volume interaction
                 auto&& medium       = scene.media[current_medium];
@@ -488,7 +502,8 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
             }
 
             Spectrum Le  = emission(light, -dir_light, Real(0), point_on_light, scene);
-            Real pdf_nee = light_pmf(scene, light_id) * pdf_point_on_light(light, point_on_light, p, scene);
+            Real pdf_nee =
+                light_pmf(scene, p, Vector3{ 0, 0, 0 }, light_id) * pdf_point_on_light(light, point_on_light, p, scene);
 
             Real w = (pdf_nee * pdf_nee) / (pdf_nee * pdf_nee + pdf_phase * pdf_phase);
             return T_light * G * phase_val * Le * (w / pdf_nee);
@@ -499,7 +514,8 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
     // Main path tracing loop
     auto w = scene.camera.width;
     auto h = scene.camera.height;
-    Vector2 screen_pos{ (x + next_pcg32_real<Real>(rng)) / w, (y + next_pcg32_real<Real>(rng)) / h };
+    Vector2 pixel_offset = next_2d(sampler);
+    Vector2 screen_pos{ (x + pixel_offset.x) / w, (y + pixel_offset.y) / h };
     Ray ray = sample_primary(scene.camera, screen_pos);
     RayDifferential ray_diff{ Real(0), Real(0) };
 
@@ -529,7 +545,7 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
             Spectrum sigma_t = sigma_s + sigma_a;
 
             // Sample distance t
-            Real sampled_t = -log(1 - next_pcg32_real<Real>(rng)) / sigma_t[0];
+            Real sampled_t = -log(1 - next_1d(sampler)) / sigma_t[0];
 
             if (sampled_t < t_hit) {
                 scatter       = true;
@@ -570,7 +586,9 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
                 if (never_scatter) {
                     radiance += current_path_throughput * emission(*isect, -ray.dir, scene);
                 } else {
-                    Real pdf_nee = pdf_point_on_light(scene.lights[get_area_light_id(scene.shapes[isect->shape_id])],
+                    int light_id = get_area_light_id(scene.shapes[isect->shape_id]);
+                    Real pdf_nee = light_pmf(scene, nee_p_cache, Vector3{ 0, 0, 0 }, light_id) *
+                                   pdf_point_on_light(scene.lights[light_id],
                                                       PointAndNormal{ isect->position, isect->geometric_normal },
                                                       nee_p_cache, scene);
 
@@ -592,9 +610,10 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
                 continue;
             } else if (isect->material_id >= 0) {
                 // Sample BSDF for non-index-matched surface
-                const Material& mat = scene.materials[isect->material_id];
-                Vector2 bsdf_rnd_param_uv{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) };
-                Real bsdf_rnd_param_w = next_pcg32_real<Real>(rng);
+                Material mat = prepare_material(scene.materials[isect->material_id], *isect, scene.texture_pool);
+
+                Vector2 bsdf_rnd_param_uv = next_2d(sampler);
+                Real bsdf_rnd_param_w     = next_1d(sampler);
 
                 auto bsdf_sample =
                     sample_bsdf(mat, -ray.dir, *isect, scene.texture_pool, bsdf_rnd_param_uv, bsdf_rnd_param_w);
@@ -616,10 +635,11 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
                 Real cos_theta    = abs(dot(bsdf_sample->dir_out, isect->geometric_normal));
                 current_path_throughput *= (bsdf_val * cos_theta / dir_pdf);
 
-                ray.dir   = bsdf_sample->dir_out;
-                ray.org   = isect->position;
-                ray.tnear = get_intersection_epsilon(scene);
-                ray.tfar  = infinity<Real>();
+                ray.dir     = bsdf_sample->dir_out;
+                ray.org     = isect->position;
+                ray.tnear   = get_intersection_epsilon(scene);
+                ray.tfar    = infinity<Real>();
+                nee_p_cache = ray.org;
 
                 current_medium = update_medium(isect, ray, current_medium);
             } else {
@@ -633,8 +653,7 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
         if (scatter) {
             auto&& medium       = scene.media[current_medium];
             PhaseFunction phase = get_phase_function(medium);
-            auto next_dir       = sample_phase_function(phase, -ray.dir,
-                                                        Vector2{ next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng) });
+            auto next_dir       = sample_phase_function(phase, -ray.dir, next_2d(sampler));
             if (!next_dir) break;
 
             never_scatter      = false;
@@ -649,7 +668,7 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
         // Russian roulette
         if (Real rr_prob = 1; bounces >= scene.options.rr_depth) {
             rr_prob = min(max(luminance(current_path_throughput), Real(0.0)), Real(0.95));
-            if (next_pcg32_real<Real>(rng) > rr_prob) break;
+            if (next_1d(sampler) > rr_prob) break;
             current_path_throughput /= rr_prob;
         }
 
@@ -659,12 +678,377 @@ Spectrum vol_path_tracing_5(const Scene& scene, int x, int y, /* pixel coordinat
     return radiance;
 }
 
+/// exp(-majorant * dt) over a majorant segment. dt is infinite for the last segment of a ray escaping
+/// the scene inside a homogeneous medium, where a zero majorant channel must still give 1.
+inline Spectrum segment_transmittance(const Spectrum& majorant, Real dt) {
+    return Spectrum{ majorant[0] > 0 ? exp(-majorant[0] * dt) : Real(1),
+                     majorant[1] > 0 ? exp(-majorant[1] * dt) : Real(1),
+                     majorant[2] > 0 ? exp(-majorant[2] * dt) : Real(1) };
+}
+
 // The final volumetric renderer:
 // multiple chromatic heterogeneous volumes with multiple scattering
 // with MIS between next event estimation and phase function sampling
 // with surface lighting
+//
+// Free-flight sampling uses delta tracking and the transmittance for next event estimation uses ratio tracking.
+// Both step through the majorant grid of the medium (see make_majorant_iterator), so that each segment of the ray
+// is tracked against a tight local majorant instead of the maximum density of the whole medium.
+// Next event estimation takes the transmittance of homogeneous segments in closed form. After
+// max_null_collisions null collisions, both go on with Russian roulette instead of stopping, so neither is biased.
 Spectrum vol_path_tracing(const Scene& scene, int x, int y, /* pixel coordinates */
-                          pcg32_state& rng) {
-    // Homework 2: To be implemented.
-    return vol_path_tracing_5(scene, x, y, rng);
+                          Sampler& sampler) {
+    auto update_medium = [](const std::optional<PathVertex>& isect, const Ray& ray, int medium) -> int {
+        if (!isect || isect->interior_medium_id == isect->exterior_medium_id) return medium;
+        bool entering = dot(ray.dir, isect->geometric_normal) < 0;
+        return entering ? isect->interior_medium_id : isect->exterior_medium_id;
+    };
+
+    auto next_event_estimation = [&](const Vector3& p, const Vector3& dir_view, int current_medium, int bounces,
+                                     const std::optional<PathVertex>& vertex) -> Spectrum {
+        // Sample light. We ignore the normal of the surfaces, so that the light pmf
+        // at the vertices is the same for the surfaces and the media (see nee_p_cache).
+        int light_id     = sample_light(scene, p, Vector3{ 0, 0, 0 }, next_1d(sampler));
+        Vector2 light_uv = next_2d(sampler);
+        Real light_w     = next_1d(sampler);
+        // (no light can contribute to p)
+        if (light_id < 0) { return make_zero_spectrum(); }
+        const Light& light = scene.lights[light_id];
+
+        PointAndNormal point_on_light = sample_point_on_light(light, p, light_uv, light_w, scene);
+        Vector3 dir_light             = normalize(point_on_light.position - p);
+        Real dist                     = distance(point_on_light.position, p);
+
+        // Compute transmittance to light with ratio tracking. Skip through index-matching shapes.
+        Spectrum T_light     = make_const_spectrum(1);
+        Spectrum p_trans_nee = make_const_spectrum(1);
+        Spectrum p_trans_dir = make_const_spectrum(1); // for multiple importance sampling
+        int shadow_medium    = current_medium;
+        int shadow_bounces   = 0;
+
+        Vector3 curr_pos = p;
+        while (true) {
+            Ray shadow_ray{ curr_pos, dir_light, get_shadow_epsilon(scene),
+                            (1 - get_shadow_epsilon(scene)) * distance(point_on_light.position, curr_pos) };
+            std::optional<PathVertex> isect = intersect(scene, shadow_ray);
+            Real next_t                     = isect ? distance(isect->position, shadow_ray.org) : shadow_ray.tfar;
+
+            if (shadow_medium >= 0) {
+                const Medium& medium       = scene.media[shadow_medium];
+                int channel                = std::clamp(int(next_1d(sampler) * 3), 0, 2);
+                int iteration              = 0;
+                MajorantIterator majorants = make_majorant_iterator(medium, shadow_ray, next_t);
+                while (std::optional<MajorantSegment> segment = next_majorant_segment(majorants)) {
+                    const Spectrum& majorant = segment->sigma_maj;
+                    if (segment->homogeneous) {
+                        // The transmittance is known: no need to track, nothing is sampled here.
+                        // (Phase function sampling gets through the segment with probability T.)
+                        Spectrum T = segment_transmittance(majorant, segment->t_max - segment->t_min);
+                        T_light *= T;
+                        p_trans_dir *= T;
+                        continue;
+                    }
+                    // Ratio tracking. The exp(-majorant * t) factors are the probabilities of the free flights;
+                    // they go into T_light and p_trans_nee alike, so T_light / p_trans_nee is the product of
+                    // sigma_n / majorant at the null collisions (for the sampled channel).
+                    Real accum_t = segment->t_min;
+                    while (true) {
+                        Real dt = segment->t_max - accum_t;
+                        if (majorant[channel] <= 0) {
+                            // Nothing to collide with in this channel
+                            Spectrum T = segment_transmittance(majorant, dt);
+                            T_light *= T;
+                            p_trans_nee *= T;
+                            p_trans_dir *= T;
+                            break;
+                        }
+                        Real t  = -log(1 - next_1d(sampler)) / majorant[channel];
+                        accum_t = min(accum_t + t, segment->t_max);
+                        if (t < dt) {
+                            // A null-scattering event
+                            Vector3 p_null   = shadow_ray.org + accum_t * shadow_ray.dir;
+                            Spectrum sigma_t = get_sigma_s(medium, p_null) + get_sigma_a(medium, p_null);
+                            Spectrum sigma_n = majorant - sigma_t;
+                            Spectrum T       = exp(-majorant * t) / max(majorant);
+                            T_light *= T * sigma_n;
+                            p_trans_nee *= T * majorant;
+                            p_trans_dir *= T * sigma_n;
+                            ++iteration;
+                            add_stat(StatCounter::NullCollisions);
+                            if (max(T_light) <= 0) { break; }
+                            if (iteration >= scene.options.max_null_collisions) {
+                                // Russian roulette on the transmittance estimate, so that a long run of null
+                                // collisions ends without biasing the estimate.
+                                Real rr_prob = min(max(T_light) / avg(p_trans_nee), Real(1));
+                                if (next_1d(sampler) >= rr_prob) { return make_zero_spectrum(); }
+                                T_light /= rr_prob;
+                            }
+                        } else {
+                            // Reached the end of the segment
+                            Spectrum T = exp(-majorant * dt);
+                            T_light *= T;
+                            p_trans_nee *= T;
+                            p_trans_dir *= T;
+                            break;
+                        }
+                    }
+                    if (max(T_light) <= 0) { return make_zero_spectrum(); }
+                }
+            }
+
+            if (!isect) {
+                // Nothing is blocking, we're done
+                break;
+            } else if (isect->material_id >= 0) {
+                // Hit an opaque surface
+                return make_zero_spectrum();
+            }
+
+            // Handle index-matching surface
+            ++shadow_bounces;
+            if (scene.options.max_depth != -1 && bounces + shadow_bounces + 1 >= scene.options.max_depth) {
+                return make_zero_spectrum();
+            }
+
+            shadow_medium = update_medium(isect, shadow_ray, shadow_medium);
+            curr_pos      = isect->position;
+        }
+
+        if (max(T_light) > 0) {
+            Real G = fabs(dot(dir_light, point_on_light.normal)) / (dist * dist);
+            Spectrum f;
+            Real pdf_dir;
+            if (vertex && vertex->material_id >= 0) {
+                // Surface interaction
+                Material mat = prepare_material(scene.materials[vertex->material_id], *vertex, scene.texture_pool);
+                f            = eval(mat, dir_view, dir_light, *vertex, scene.texture_pool);
+                pdf_dir      = pdf_sample_bsdf(mat, dir_view, dir_light, *vertex, scene.texture_pool);
+            } else if (current_medium >= 0) {
+                // Volume interaction
+                PhaseFunction phase = get_phase_function(scene.media[current_medium]);
+                f                   = eval(phase, dir_view, dir_light);
+                pdf_dir             = pdf_sample_phase(phase, dir_view, dir_light);
+            } else {
+                return make_zero_spectrum();
+            }
+
+            Spectrum Le = emission(light, -dir_light, Real(0), point_on_light, scene);
+            Real pdf_nee = light_pmf(scene, p, Vector3{ 0, 0, 0 }, light_id) *
+                           pdf_point_on_light(light, point_on_light, p, scene) * avg(p_trans_nee);
+            Real pdf_phase = pdf_dir * G * avg(p_trans_dir);
+
+            Real w = (pdf_nee * pdf_nee) / (pdf_nee * pdf_nee + pdf_phase * pdf_phase);
+            return T_light * G * f * Le * (w / pdf_nee);
+        }
+        return make_zero_spectrum();
+    };
+
+    // Main path tracing loop
+    auto w = scene.camera.width;
+    auto h = scene.camera.height;
+    Vector2 pixel_offset = next_2d(sampler);
+    Vector2 screen_pos{ (x + pixel_offset.x) / w, (y + pixel_offset.y) / h };
+    Ray ray = sample_primary(scene.camera, screen_pos);
+    RayDifferential ray_diff{ Real(0), Real(0) };
+
+    Spectrum current_path_throughput = make_const_spectrum(1);
+    Spectrum radiance                = make_zero_spectrum();
+    int bounces                      = 0;
+    int current_medium               = scene.camera.medium_id;
+
+    // For MIS: the last point that issued NEE, the pdf of the direction sampled there,
+    // and the products of the free-flight and ratio tracking pdfs since then.
+    bool never_scatter = true;
+    Real dir_pdf       = 0;
+    Vector3 nee_p_cache;
+    Spectrum multi_trans_pdf = make_const_spectrum(1);
+    Spectrum multi_nee_pdf   = make_const_spectrum(1);
+
+    while (true) {
+        bool scatter                    = false;
+        std::optional<PathVertex> isect = intersect(scene, ray, ray_diff);
+        Real t_hit                      = isect ? distance(isect->position, ray.org) : infinity<Real>();
+
+        Spectrum transmittance = make_const_spectrum(1);
+        Spectrum trans_dir_pdf = make_const_spectrum(1); // pdf of free-flight sampling
+        Spectrum trans_nee_pdf = make_const_spectrum(1); // pdf of ratio tracking, for MIS
+
+        if (current_medium >= 0) {
+            // Delta tracking
+            const Medium& medium       = scene.media[current_medium];
+            int channel                = std::clamp(int(next_1d(sampler) * 3), 0, 2);
+            int iteration              = 0;
+            Real scatter_t             = 0;
+            bool terminated            = false; // by Russian roulette on the null collisions
+            MajorantIterator majorants = make_majorant_iterator(medium, ray, t_hit);
+            while (!scatter && !terminated) {
+                std::optional<MajorantSegment> segment = next_majorant_segment(majorants);
+                if (!segment) { break; }
+                const Spectrum& majorant = segment->sigma_maj;
+                Real accum_t             = segment->t_min;
+                while (true) {
+                    Real dt = segment->t_max - accum_t;
+                    if (majorant[channel] <= 0) {
+                        Spectrum T = segment_transmittance(majorant, dt);
+                        transmittance *= T;
+                        trans_dir_pdf *= T;
+                        // Next event estimation crosses homogeneous segments without sampling anything
+                        if (!segment->homogeneous) { trans_nee_pdf *= T; }
+                        break;
+                    }
+                    Real t  = -log(1 - next_1d(sampler)) / majorant[channel];
+                    accum_t = min(accum_t + t, segment->t_max);
+                    if (t < dt) {
+                        // Sample from real/fake particle events
+                        Vector3 p_event  = ray.org + accum_t * ray.dir;
+                        Spectrum sigma_t = get_sigma_s(medium, p_event) + get_sigma_a(medium, p_event);
+                        Spectrum T       = exp(-majorant * t) / max(majorant);
+                        if (next_1d(sampler) * majorant[channel] < sigma_t[channel]) {
+                            // A real particle
+                            scatter   = true;
+                            scatter_t = accum_t;
+                            transmittance *= T;
+                            trans_dir_pdf *= T * sigma_t;
+                            // trans_nee_pdf is not needed since we scatter
+                            break;
+                        }
+                        // A fake particle
+                        Spectrum sigma_n = majorant - sigma_t;
+                        transmittance *= T * sigma_n;
+                        trans_dir_pdf *= T * sigma_n;
+                        trans_nee_pdf *= T * majorant;
+                        ++iteration;
+                        add_stat(StatCounter::NullCollisions);
+                        if (iteration >= scene.options.max_null_collisions) {
+                            Real rr_prob = min(max(transmittance) / avg(trans_dir_pdf), Real(1));
+                            if (next_1d(sampler) >= rr_prob) {
+                                terminated = true;
+                                break;
+                            }
+                            transmittance /= rr_prob;
+                        }
+                    } else {
+                        // Reached the end of the segment
+                        Spectrum T = segment_transmittance(majorant, dt);
+                        transmittance *= T;
+                        trans_dir_pdf *= T;
+                        if (!segment->homogeneous) { trans_nee_pdf *= T; }
+                        break;
+                    }
+                }
+            }
+
+            if (terminated) {
+                break;
+            } else if (scatter) {
+                ray.org += scatter_t * ray.dir;
+                ray.tnear = 0;
+            } else if (isect) {
+                ray.org   = isect->position;
+                ray.tnear = get_intersection_epsilon(scene);
+            } else {
+                break; // Escaped the scene
+            }
+            multi_trans_pdf *= trans_dir_pdf;
+            multi_nee_pdf *= trans_nee_pdf;
+        } else if (isect) {
+            ray.org   = isect->position;
+            ray.tnear = get_intersection_epsilon(scene);
+        } else {
+            break;
+        }
+
+        current_path_throughput *= transmittance / avg(trans_dir_pdf);
+
+        // Next event estimation
+        if (scatter) {
+            Spectrum sigma_s = get_sigma_s(scene.media[current_medium], ray.org);
+            radiance += current_path_throughput * sigma_s *
+                        next_event_estimation(ray.org, -ray.dir, current_medium, bounces, {});
+        } else if (isect && isect->material_id >= 0) {
+            radiance += current_path_throughput * next_event_estimation(ray.org, -ray.dir, current_medium, bounces,
+                                                                          isect);
+        }
+
+        // Handle surface hit
+        if (!scatter && isect) {
+            if (is_light(scene.shapes[isect->shape_id])) {
+                if (never_scatter) {
+                    radiance += current_path_throughput * emission(*isect, -ray.dir, scene);
+                } else {
+                    int light_id = get_area_light_id(scene.shapes[isect->shape_id]);
+                    Real pdf_nee = light_pmf(scene, nee_p_cache, Vector3{ 0, 0, 0 }, light_id) *
+                                   pdf_point_on_light(scene.lights[light_id],
+                                                      PointAndNormal{ isect->position, isect->geometric_normal },
+                                                      nee_p_cache, scene) *
+                                   avg(multi_nee_pdf);
+
+                    Real G =
+                        fabs(dot(-ray.dir, isect->geometric_normal)) / distance_squared(nee_p_cache, isect->position);
+                    Real dir_pdf_area = dir_pdf * avg(multi_trans_pdf) * G;
+
+                    Real w = (dir_pdf_area * dir_pdf_area) / (dir_pdf_area * dir_pdf_area + pdf_nee * pdf_nee);
+
+                    radiance += current_path_throughput * emission(*isect, -ray.dir, scene) * w;
+                }
+            }
+
+            if (isect->material_id == -1) {
+                // Index-matching interface
+                current_medium = update_medium(isect, ray, current_medium);
+                ++bounces;
+                if (scene.options.max_depth != -1 && bounces >= scene.options.max_depth - 1) break;
+                continue;
+            }
+        }
+
+        if (scene.options.max_depth != -1 && bounces >= scene.options.max_depth - 1) break;
+
+        // Sample the next direction
+        if (scatter) {
+            const Medium& medium = scene.media[current_medium];
+            PhaseFunction phase  = get_phase_function(medium);
+            auto next_dir        = sample_phase_function(phase, -ray.dir, next_2d(sampler));
+            if (!next_dir) break;
+
+            dir_pdf            = pdf_sample_phase(phase, -ray.dir, *next_dir);
+            Spectrum phase_val = eval(phase, -ray.dir, *next_dir);
+            Spectrum sigma_s   = get_sigma_s(medium, ray.org);
+
+            current_path_throughput *= (phase_val / dir_pdf) * sigma_s;
+            ray.dir = *next_dir;
+        } else {
+            Material mat = prepare_material(scene.materials[isect->material_id], *isect, scene.texture_pool);
+
+            Vector2 bsdf_rnd_param_uv = next_2d(sampler);
+            Real bsdf_rnd_param_w     = next_1d(sampler);
+
+            auto bsdf_sample =
+                sample_bsdf(mat, -ray.dir, *isect, scene.texture_pool, bsdf_rnd_param_uv, bsdf_rnd_param_w);
+            if (!bsdf_sample) break;
+
+            dir_pdf           = pdf_sample_bsdf(mat, -ray.dir, bsdf_sample->dir_out, *isect, scene.texture_pool);
+            Spectrum bsdf_val = eval(mat, -ray.dir, bsdf_sample->dir_out, *isect, scene.texture_pool);
+            if (dir_pdf <= 0) break;
+            current_path_throughput *= bsdf_val / dir_pdf;
+
+            ray.dir        = bsdf_sample->dir_out;
+            current_medium = update_medium(isect, ray, current_medium);
+        }
+        never_scatter   = false;
+        nee_p_cache     = ray.org;
+        multi_trans_pdf = make_const_spectrum(1);
+        multi_nee_pdf   = make_const_spectrum(1);
+
+        // Russian roulette
+        if (Real rr_prob = 1; bounces >= scene.options.rr_depth) {
+            rr_prob = min(max(luminance(current_path_throughput), Real(0.0)), Real(0.95));
+            if (next_1d(sampler) > rr_prob) break;
+            current_path_throughput /= rr_prob;
+        }
+
+        ++bounces;
+    }
+
+    return radiance;
 }
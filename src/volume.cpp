@@ -3,7 +3,7 @@
 #include <fstream>
 #include <variant>
 
-std::variant<GridVolume<Real>, GridVolume<Vector3>> load_volume(const fs::path& filename, int target_channel) {
+std::variant<GridVolume<Real>, GridVolume<Spectrum>> load_volume(const fs::path& filename, int target_channel) {
     // code from https://github.com/mitsuba-renderer/mitsuba/blob/master/src/volume/gridvolume.cpp#L217
     enum EVolumeType { EFloat32 = 1, EFloat16 = 2, EUInt8 = 3, EQuantizedDirections = 4 };
 
@@ -93,6 +93,6 @@ GridVolume<Real> load_volume_from_file(const fs::path& filename) {
 }
 
 template <>
-GridVolume<Vector3> load_volume_from_file(const fs::path& filename) {
-    return std::get<GridVolume<Vector3>>(load_volume(filename, 3));
+GridVolume<Spectrum> load_volume_from_file(const fs::path& filename) {
+    return std::get<GridVolume<Spectrum>>(load_volume(filename, 3));
 }
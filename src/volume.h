@@ -152,6 +152,72 @@ bool intersect(const Volume<T>& v, const Ray& ray) {
     return std::visit(intersect_op<T>{ ray }, v);
 }
 
+/// A coarse grid over the bounding box of a grid volume, storing the maximum the volume takes in each cell.
+/// Delta tracking steps through it to get a tight majorant for each segment of a ray,
+/// instead of using the maximum of the whole volume everywhere.
+/// An empty grid means the volume is unbounded (a constant volume), and its maximum is used everywhere.
+template <typename T>
+struct MajorantGrid {
+    Vector3i resolution = Vector3i{ 0, 0, 0 };
+    Vector3 p_min, p_max;
+    std::vector<T> data;
+};
+
+/// Maximum number of majorant grid cells along each axis
+constexpr int c_majorant_grid_resolution = 16;
+
+template <typename T>
+struct make_majorant_grid_op {
+    MajorantGrid<T> operator()(const ConstantVolume<T>& v) const;
+    MajorantGrid<T> operator()(const GridVolume<T>& v) const;
+};
+template <typename T>
+MajorantGrid<T> make_majorant_grid_op<T>::operator()(const ConstantVolume<T>& v) const {
+    return MajorantGrid<T>{};
+}
+template <typename T>
+MajorantGrid<T> make_majorant_grid_op<T>::operator()(const GridVolume<T>& v) const {
+    MajorantGrid<T> grid;
+    grid.resolution = Vector3i{ std::min(v.resolution.x, c_majorant_grid_resolution),
+                                std::min(v.resolution.y, c_majorant_grid_resolution),
+                                std::min(v.resolution.z, c_majorant_grid_resolution) };
+    grid.p_min      = v.p_min;
+    grid.p_max      = v.p_max;
+    grid.data.resize(grid.resolution.x * grid.resolution.y * grid.resolution.z);
+    // The voxels that the trilinear interpolation (see eval_volume_op) reads for points in
+    // [cell / res, (cell + 1) / res] along an axis.
+    auto voxel_range = [](int cell, int res, int voxel_res) {
+        Real scale = Real(voxel_res - 1) / res;
+        int v0     = std::clamp(int(floor(cell * scale)), 0, voxel_res - 1);
+        int v1     = std::clamp(int(ceil((cell + 1) * scale)), 0, voxel_res - 1);
+        return std::make_pair(v0, v1);
+    };
+    for (int z = 0; z < grid.resolution.z; z++) {
+        auto [z0, z1] = voxel_range(z, grid.resolution.z, v.resolution.z);
+        for (int y = 0; y < grid.resolution.y; y++) {
+            auto [y0, y1] = voxel_range(y, grid.resolution.y, v.resolution.y);
+            for (int x = 0; x < grid.resolution.x; x++) {
+                auto [x0, x1] = voxel_range(x, grid.resolution.x, v.resolution.x);
+                T max_data    = v.data[(z0 * v.resolution.y + y0) * v.resolution.x + x0];
+                for (int vz = z0; vz <= z1; vz++) {
+                    for (int vy = y0; vy <= y1; vy++) {
+                        for (int vx = x0; vx <= x1; vx++) {
+                            max_data = max(max_data, v.data[(vz * v.resolution.y + vy) * v.resolution.x + vx]);
+                        }
+                    }
+                }
+                grid.data[(z * grid.resolution.y + y) * grid.resolution.x + x] = v.scale * max_data;
+            }
+        }
+    }
+    return grid;
+}
+
+template <typename T>
+MajorantGrid<T> make_majorant_grid(const Volume<T>& volume) {
+    return std::visit(make_majorant_grid_op<T>{}, volume);
+}
+
 template <typename T>
 GridVolume<T> load_volume_from_file(const fs::path& filename) {
     return GridVolume<T>{};
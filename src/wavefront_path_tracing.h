@@ -0,0 +1,264 @@
+#pragma once
+
+#include "intersection.h"
+#include "sampler.h"
+#include "scene.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <vector>
+
+/// The state of the paths traced by wavefront_path_tracing(), in structure-of-arrays layout.
+/// Path i computes the sample i of the batch. Each array is indexed by the path;
+/// the paths that are still alive are listed in "active".
+struct WavefrontPathPool {
+    std::vector<Ray> rays;
+    std::vector<RayDifferential> ray_diffs;
+    std::vector<PathVertex> vertices;            // the current vertex v_i of the path
+    std::vector<std::optional<PathVertex>> hits; // the result of tracing "rays"
+    std::vector<Spectrum> throughputs;           // see current_path_throughput in path_tracing()
+    std::vector<Real> eta_scales;                // see eta_scale in path_tracing()
+    std::vector<Spectrum> bsdf_values;           // f(v_{i-1}, v_i, v_{i+1}) of the sampled direction
+    std::vector<Real> bsdf_pdfs;                 // solid angle density of the sampled direction
+    std::vector<int> path_lengths;               // number of BSDF samples so far (for the statistics)
+    std::vector<Sampler> samplers;               // every path draws its own sample dimensions
+    std::vector<int> active, next_active;
+    ShadowRayQueue shadow_queue;
+
+    // Scratch space for tracing the rays of the active paths contiguously.
+    std::vector<Ray> active_rays;
+    std::vector<RayDifferential> active_ray_diffs;
+    std::vector<std::optional<PathVertex>> active_hits;
+};
+
+/// Intersect the rays of all the active paths, in packets. Writes pool.hits.
+inline void wavefront_intersect(const Scene& scene, WavefrontPathPool& pool, bool primary) {
+    int num_active = (int)pool.active.size();
+    pool.active_rays.resize(num_active);
+    pool.active_ray_diffs.resize(num_active);
+    pool.active_hits.resize(num_active);
+    for (int j = 0; j < num_active; j++) {
+        int i               = pool.active[j];
+        pool.active_rays[j] = pool.rays[i];
+        // Like path_tracing(), we only propagate the ray differential of the camera rays.
+        pool.active_ray_diffs[j] = primary ? pool.ray_diffs[i] : RayDifferential{};
+    }
+    intersect(scene, pool.active_rays.data(), pool.active_ray_diffs.data(), num_active, pool.active_hits.data());
+    for (int j = 0; j < num_active; j++) { pool.hits[pool.active[j]] = pool.active_hits[j]; }
+}
+
+/// Unidirectional path tracing, wavefront style: instead of tracing one path to the end
+/// like path_tracing(), we trace all the samples of the batch together, one bounce at a time,
+/// in stages (generate -> intersect -> sort by material -> shade -> shadow rays -> intersect -> ...).
+/// Each stage runs over all the paths, so Embree gets full ray packets and the shading
+/// of a material runs on many paths in a row.
+/// The estimator is the same as path_tracing() (with MIS between light and BSDF sampling).
+/// Path i computes the sample sample_indices[i] of pixels[i], with its own copy of sampler.
+inline void wavefront_path_tracing(const Scene& scene, const std::vector<Vector2i>& pixels,
+                                   const std::vector<int>& sample_indices, const Sampler& sampler,
+                                   std::vector<Spectrum>& radiance) {
+    // The pool is reused by the batches of the same thread to avoid reallocations.
+    thread_local WavefrontPathPool pool;
+    int num_paths = (int)pixels.size();
+    pool.rays.resize(num_paths);
+    pool.ray_diffs.resize(num_paths);
+    pool.vertices.resize(num_paths);
+    pool.hits.resize(num_paths);
+    pool.throughputs.resize(num_paths);
+    pool.eta_scales.resize(num_paths);
+    pool.bsdf_values.resize(num_paths);
+    pool.bsdf_pdfs.resize(num_paths);
+    pool.path_lengths.resize(num_paths);
+    pool.samplers.resize(num_paths);
+
+    // Stage: generate the camera rays.
+    int w = scene.camera.width, h = scene.camera.height;
+    pool.active.clear();
+    for (int i = 0; i < num_paths; i++) {
+        pool.samplers[i] = sampler;
+        start_pixel_sample(pool.samplers[i], pixels[i], sample_indices[i]);
+        Vector2 pixel_offset = next_2d(pool.samplers[i]);
+        Vector2 screen_pos{ (pixels[i].x + pixel_offset.x) / w, (pixels[i].y + pixel_offset.y) / h };
+        pool.rays[i]         = sample_primary(scene.camera, screen_pos);
+        pool.ray_diffs[i]    = init_ray_differential(w, h);
+        pool.throughputs[i]  = fromRGB(Vector3{ 1, 1, 1 });
+        pool.eta_scales[i]   = Real(1);
+        pool.path_lengths[i] = 0;
+        radiance[i]          = make_zero_spectrum();
+        pool.active.push_back(i);
+    }
+
+    // Stage: intersect the camera rays, and account for the emission we see directly.
+    wavefront_intersect(scene, pool, true /* primary */);
+    pool.next_active.clear();
+    for (int i : pool.active) {
+        if (!pool.hits[i]) {
+            // Hit background. Account for the environment map if needed.
+            if (has_envmap(scene)) {
+                const Light& envmap = get_envmap(scene);
+                // (the PointAndNormal is a dummy parameter for envmap)
+                radiance[i] = emission(envmap, -pool.rays[i].dir /* pointing outwards from light */,
+                                       pool.ray_diffs[i].spread, PointAndNormal{}, scene);
+            }
+            continue;
+        }
+        pool.vertices[i] = *pool.hits[i];
+        if (is_light(scene.shapes[pool.vertices[i].shape_id])) {
+            radiance[i] += pool.throughputs[i] * emission(pool.vertices[i], -pool.rays[i].dir, scene);
+        }
+        pool.next_active.push_back(i);
+    }
+    std::swap(pool.active, pool.next_active);
+
+    int max_depth = scene.options.max_depth;
+    for (int num_vertices = 3; (max_depth == -1 || num_vertices <= max_depth + 1) && !pool.active.empty();
+         num_vertices++) {
+        // Stage: sort the paths by material, so that we shade one material at a time.
+        std::stable_sort(pool.active.begin(), pool.active.end(), [&](int a, int b) {
+            return pool.vertices[a].material_id < pool.vertices[b].material_id;
+        });
+
+        // Stage: shade. Sample a point on a light (next event estimation) and queue the shadow ray,
+        // then sample the BSDF for the next ray.
+        pool.next_active.clear();
+        for (int i : pool.active) {
+            const PathVertex& vertex = pool.vertices[i];
+            Vector3 dir_view         = -pool.rays[i].dir;
+            // The textures of the material are evaluated once for all the BSDF queries at the vertex.
+            Material mat = prepare_material(scene.materials[vertex.material_id], vertex, scene.texture_pool);
+
+            Vector2 light_uv = next_2d(pool.samplers[i]);
+            Real light_w     = next_1d(pool.samplers[i]);
+            Real shape_w     = next_1d(pool.samplers[i]);
+            int light_id     = sample_light(scene, vertex.position, vertex.geometric_normal, light_w);
+            // (no light can contribute if the point faces away from all of them)
+            if (light_id >= 0) {
+                const Light& light            = scene.lights[light_id];
+                PointAndNormal point_on_light = sample_point_on_light(light, vertex.position, light_uv, shape_w, scene);
+
+                Real G = 0;
+                Vector3 dir_light;
+                Ray shadow_ray;
+                if (!is_envmap(light)) {
+                    dir_light  = normalize(point_on_light.position - vertex.position);
+                    shadow_ray = Ray{ vertex.position, dir_light, get_shadow_epsilon(scene),
+                                      (1 - get_shadow_epsilon(scene)) *
+                                          distance(point_on_light.position, vertex.position) };
+                    G          = max(-dot(dir_light, point_on_light.normal), Real(0)) /
+                        distance_squared(point_on_light.position, vertex.position);
+                } else {
+                    dir_light  = -point_on_light.normal;
+                    shadow_ray = Ray{ vertex.position, dir_light, get_shadow_epsilon(scene), infinity<Real>() };
+                    G          = 1;
+                }
+                Real p1 = light_pmf(scene, vertex.position, vertex.geometric_normal, light_id) *
+                          pdf_point_on_light(light, point_on_light, vertex.position, scene);
+                if (G > 0 && p1 > 0) {
+                    Spectrum f  = eval(mat, dir_view, dir_light, vertex, scene.texture_pool);
+                    Spectrum L  = emission(light, -dir_light, Real(0), point_on_light, scene);
+                    Real p2     = pdf_sample_bsdf(mat, dir_view, dir_light, vertex, scene.texture_pool) * G;
+                    Real w1     = (p1 * p1) / (p1 * p1 + p2 * p2);
+                    Spectrum C1 = G * f * L / p1;
+                    if (w1 > 0) {
+                        pool.shadow_queue.sample_id = i;
+                        push_shadow_ray(pool.shadow_queue, shadow_ray, pool.throughputs[i] * C1 * w1);
+                    }
+                }
+            }
+
+            Vector2 bsdf_rnd_param_uv = next_2d(pool.samplers[i]);
+            Real bsdf_rnd_param_w     = next_1d(pool.samplers[i]);
+            std::optional<BSDFSampleRecord> bsdf_sample_ =
+                sample_bsdf(mat, dir_view, vertex, scene.texture_pool, bsdf_rnd_param_uv, bsdf_rnd_param_w);
+            pool.path_lengths[i]++;
+            if (!bsdf_sample_) {
+                // BSDF sampling failed. Terminate the path.
+                continue;
+            }
+            const BSDFSampleRecord& bsdf_sample = *bsdf_sample_;
+            Vector3 dir_bsdf                    = bsdf_sample.dir_out;
+            RayDifferential& ray_diff           = pool.ray_diffs[i];
+            if (bsdf_sample.eta == 0) {
+                ray_diff.spread = reflect(ray_diff, vertex.mean_curvature, bsdf_sample.roughness);
+            } else {
+                ray_diff.spread = refract(ray_diff, vertex.mean_curvature, bsdf_sample.eta, bsdf_sample.roughness);
+                pool.eta_scales[i] /= (bsdf_sample.eta * bsdf_sample.eta);
+            }
+            pool.bsdf_values[i] = eval(mat, dir_view, dir_bsdf, vertex, scene.texture_pool);
+            pool.bsdf_pdfs[i]   = pdf_sample_bsdf(mat, dir_view, dir_bsdf, vertex, scene.texture_pool);
+            if (pool.bsdf_pdfs[i] <= 0) {
+                // Numerical issue -- we generated some invalid rays.
+                continue;
+            }
+            pool.rays[i] = Ray{ vertex.position, dir_bsdf, get_intersection_epsilon(scene), infinity<Real>() };
+            pool.next_active.push_back(i);
+        }
+        std::swap(pool.active, pool.next_active);
+
+        // Stage: trace the shadow rays of the bounce.
+        trace_shadow_rays(scene, pool.shadow_queue, radiance.data());
+
+        // Stage: intersect the BSDF rays.
+        wavefront_intersect(scene, pool, false /* primary */);
+
+        // Stage: account for the emission the BSDF rays hit (with MIS), Russian roulette,
+        // and move on to the next vertex.
+        pool.next_active.clear();
+        for (int i : pool.active) {
+            const std::optional<PathVertex>& bsdf_vertex = pool.hits[i];
+            const PathVertex& vertex                     = pool.vertices[i];
+            Vector3 dir_bsdf                             = pool.rays[i].dir;
+            Real G;
+            if (bsdf_vertex) {
+                G = fabs(dot(dir_bsdf, bsdf_vertex->geometric_normal)) /
+                    distance_squared(bsdf_vertex->position, vertex.position);
+            } else {
+                G = 1;
+            }
+            const Spectrum& f = pool.bsdf_values[i];
+            Real p2           = pool.bsdf_pdfs[i] * G;
+
+            if (bsdf_vertex && is_light(scene.shapes[bsdf_vertex->shape_id])) {
+                Spectrum L   = emission(*bsdf_vertex, -dir_bsdf, scene);
+                int light_id = get_area_light_id(scene.shapes[bsdf_vertex->shape_id]);
+                assert(light_id >= 0);
+                const Light& light = scene.lights[light_id];
+                PointAndNormal light_point{ bsdf_vertex->position, bsdf_vertex->geometric_normal };
+                Real p1 = light_pmf(scene, vertex.position, vertex.geometric_normal, light_id) *
+                          pdf_point_on_light(light, light_point, vertex.position, scene);
+                Real w2 = (p2 * p2) / (p1 * p1 + p2 * p2);
+                radiance[i] += pool.throughputs[i] * (G * f * L / p2) * w2;
+            } else if (!bsdf_vertex && has_envmap(scene)) {
+                const Light& light = get_envmap(scene);
+                // (the PointAndNormal is a dummy parameter for envmap)
+                Spectrum L = emission(light, -dir_bsdf /* pointing outwards from light */, pool.ray_diffs[i].spread,
+                                      PointAndNormal{}, scene);
+                PointAndNormal light_point{ Vector3{ 0, 0, 0 }, -dir_bsdf }; // pointing outwards from light
+                Real p1 = light_pmf(scene, vertex.position, vertex.geometric_normal, scene.envmap_light_id) *
+                          pdf_point_on_light(light, light_point, vertex.position, scene);
+                Real w2 = (p2 * p2) / (p1 * p1 + p2 * p2);
+                radiance[i] += pool.throughputs[i] * (G * f * L / p2) * w2;
+            }
+
+            if (!bsdf_vertex) {
+                // Hit nothing -- can't continue tracing.
+                continue;
+            }
+
+            // Russian roulette heuristics
+            Real rr_prob = 1;
+            if (num_vertices - 1 >= scene.options.rr_depth) {
+                rr_prob = min(max((1 / pool.eta_scales[i]) * pool.throughputs[i]), Real(0.95));
+                if (next_1d(pool.samplers[i]) > rr_prob) {
+                    // Terminate the path
+                    continue;
+                }
+            }
+            pool.throughputs[i] = pool.throughputs[i] * (G * f) / (p2 * rr_prob);
+            pool.vertices[i]    = *bsdf_vertex;
+            pool.next_active.push_back(i);
+        }
+        std::swap(pool.active, pool.next_active);
+    }
+    for (int i = 0; i < num_paths; i++) { add_path_length_stat(pool.path_lengths[i]); }
+}